@@ -0,0 +1,362 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cmath>
+#include <unistd.h>
+#include "pthread.h"
+#include <data_types/candidates.hpp>
+#include <data_types/candidatetable.hpp>
+#include <utils/exceptions.hpp>
+
+//Entries per DM/acceleration bounding box
+#define CANDIDATE_INDEX_BLOCK 16
+
+/*
+  A box in frequency, DM and acceleration. Bounds are inclusive and
+  DM and acceleration are unbounded unless set.
+*/
+struct CandidateQuery {
+  double freq_low;
+  double freq_high;
+  float dm_low;
+  float dm_high;
+  float acc_low;
+  float acc_high;
+
+  CandidateQuery(double freq_low, double freq_high)
+    :freq_low(freq_low),freq_high(freq_high),
+     dm_low(-HUGE_VALF),dm_high(HUGE_VALF),acc_low(-HUGE_VALF),acc_high(HUGE_VALF){}
+
+  CandidateQuery& dm_range(float low, float high){
+    dm_low = low;
+    dm_high = high;
+    return *this;
+  }
+
+  CandidateQuery& acc_range(float low, float high){
+    acc_low = low;
+    acc_high = high;
+    return *this;
+  }
+
+  bool bounds_dm_or_acc(void) const {
+    return dm_low>-HUGE_VALF || dm_high<HUGE_VALF || acc_low>-HUGE_VALF || acc_high<HUGE_VALF;
+  }
+};
+
+/*
+  Static index of candidates over log frequency, DM and acceleration.
+
+  Entries are sorted by frequency (ties in item order) and a directory
+  of log frequency buckets, each about a fractional tolerance wide,
+  gives the start of any frequency window without a search over all
+  entries. Every CANDIDATE_INDEX_BLOCK consecutive entries carry the
+  bounding box of their DMs and accelerations, so a query limited in
+  DM or acceleration skips whole blocks; frequency is the primary axis
+  because every search here is a frequency window first.
+
+  Items are numbered by the order they were given in: the candidates
+  of a vector, or the positions in a list of table rows. Building
+  costs a sort, O(n log n).
+*/
+class CandidateIndex {
+private:
+  struct Chunk {
+    const CandidateIndex* index;
+    const std::vector<CandidateQuery>* queries;
+    size_t start;
+    size_t end;
+    std::vector<size_t> counts;
+    std::vector<int> found;
+  };
+
+  struct by_freq {
+    const std::vector<double>& freq;
+    by_freq(const std::vector<double>& freq):freq(freq){}
+    bool operator()(int a, int b) const {
+      return freq[a]<freq[b] || (freq[a]==freq[b] && a<b);
+    }
+  };
+
+  double bucket_tolerance;
+  double log_min;
+  double bucket_width;
+  std::vector<int> items;
+  std::vector<int> positions;
+  std::vector<double> freqs;
+  std::vector<float> dms;
+  std::vector<float> accs;
+  std::vector<int> bucket_start;
+  std::vector<float> block_dm_min;
+  std::vector<float> block_dm_max;
+  std::vector<float> block_acc_min;
+  std::vector<float> block_acc_max;
+
+  //Bucket 0 holds frequencies that are not positive; clamping keeps buckets monotonic
+  int bucket(double freq) const {
+    if (!(freq>0))
+      return 0;
+    double index = floor((log(freq)-log_min)/bucket_width)+1;
+    int last = (int)bucket_start.size()-2;
+    return index<1 ? 1 : (index>last ? last : (int)index);
+  }
+
+  //First position in [from,to) with frequency >= freq (or > freq if after)
+  size_t bound(double freq, bool after) const {
+    int nbuckets = bucket_start.size()-1;
+    int b = bucket(freq);
+    //log rounding can put a frequency one bucket off
+    size_t from = bucket_start[std::max(0,b-1)];
+    size_t to = bucket_start[std::min(nbuckets,b+2)];
+    const double* first = freqs.empty() ? NULL : &freqs[0];
+    if (after)
+      return std::upper_bound(first+from,first+to,freq)-first;
+    return std::lower_bound(first+from,first+to,freq)-first;
+  }
+
+  bool in_box(size_t pos, const CandidateQuery& query) const {
+    return dms[pos]>=query.dm_low && dms[pos]<=query.dm_high &&
+      accs[pos]>=query.acc_low && accs[pos]<=query.acc_high;
+  }
+
+  bool block_in_box(size_t block, const CandidateQuery& query) const {
+    return block_dm_max[block]>=query.dm_low && block_dm_min[block]<=query.dm_high &&
+      block_acc_max[block]>=query.acc_low && block_acc_min[block]<=query.acc_high;
+  }
+
+  //Items in positions [first,last) inside the DM and acceleration box of query
+  void collect(size_t first, size_t last, const CandidateQuery& query, std::vector<int>& found) const {
+    if (!query.bounds_dm_or_acc()){
+      found.insert(found.end(),items.begin()+first,items.begin()+last);
+      return;
+    }
+    size_t pos = first;
+    while (pos<last){
+      size_t block = pos/CANDIDATE_INDEX_BLOCK;
+      size_t block_end = std::min(last,(block+1)*CANDIDATE_INDEX_BLOCK);
+      if (block_in_box(block,query)){
+	for (;pos<block_end;pos++)
+	  if (in_box(pos,query))
+	    found.push_back(items[pos]);
+      }
+      pos = block_end;
+    }
+  }
+
+  static void* query_chunk(void* arg)
+  {
+    Chunk& chunk = *(Chunk*) arg;
+    const std::vector<CandidateQuery>& queries = *chunk.queries;
+    chunk.counts.resize(chunk.end-chunk.start);
+    chunk.found.clear();
+    for (size_t ii=chunk.start;ii<chunk.end;ii++){
+      size_t before = chunk.found.size();
+      chunk.index->query(queries[ii],chunk.found);
+      chunk.counts[ii-chunk.start] = chunk.found.size()-before;
+    }
+    return NULL;
+  }
+
+public:
+  /*!
+    \param bucket_tolerance Fractional width of the frequency buckets,
+    about the tolerance of the windows to be searched. Buckets are
+    widened to keep their number below four per entry.
+  */
+  CandidateIndex(double bucket_tolerance=0.0001)
+    :bucket_tolerance(bucket_tolerance),log_min(0),bucket_width(1){}
+
+  /*!
+    \brief Index n candidates given as columns.
+
+    \param dm DM of each item, or NULL for all zero.
+    \param acc Acceleration of each item, or NULL for all zero.
+  */
+  void build(size_t n, const float* freq, const float* dm, const float* acc)
+  {
+    std::vector<double> item_freq(n);
+    for (size_t ii=0;ii<n;ii++)
+      item_freq[ii] = freq[ii];
+    items.resize(n);
+    for (size_t ii=0;ii<n;ii++)
+      items[ii] = ii;
+    std::sort(items.begin(),items.end(),by_freq(item_freq));
+    positions.resize(n);
+    freqs.resize(n);
+    dms.resize(n);
+    accs.resize(n);
+    for (size_t pos=0;pos<n;pos++){
+      int item = items[pos];
+      positions[item] = pos;
+      freqs[pos] = item_freq[item];
+      dms[pos] = dm==NULL ? 0 : dm[item];
+      accs[pos] = acc==NULL ? 0 : acc[item];
+    }
+
+    //bucket directory over the positive frequencies
+    size_t first_positive = std::upper_bound(freqs.begin(),freqs.end(),0.0)-freqs.begin();
+    bucket_width = log((1.0+bucket_tolerance)/(1.0-bucket_tolerance));
+    int nbuckets = 2;
+    if (first_positive<n){
+      log_min = log(freqs[first_positive]);
+      double span = log(freqs[n-1])-log_min;
+      bucket_width = std::max(bucket_width,span/(4.0*n));
+      nbuckets = (int)(span/bucket_width)+3;
+    }
+    bucket_start.assign(nbuckets+1,n);
+    bucket_start[0] = 0;
+    for (size_t pos=n;pos-->0;)
+      bucket_start[bucket(freqs[pos])] = pos;
+    for (int b=nbuckets-1;b>=0;b--)
+      bucket_start[b] = std::min(bucket_start[b],bucket_start[b+1]);
+    bucket_start[0] = 0;
+
+    size_t nblocks = (n+CANDIDATE_INDEX_BLOCK-1)/CANDIDATE_INDEX_BLOCK;
+    block_dm_min.assign(nblocks,HUGE_VALF);
+    block_dm_max.assign(nblocks,-HUGE_VALF);
+    block_acc_min.assign(nblocks,HUGE_VALF);
+    block_acc_max.assign(nblocks,-HUGE_VALF);
+    for (size_t pos=0;pos<n;pos++){
+      size_t block = pos/CANDIDATE_INDEX_BLOCK;
+      block_dm_min[block] = std::min(block_dm_min[block],dms[pos]);
+      block_dm_max[block] = std::max(block_dm_max[block],dms[pos]);
+      block_acc_min[block] = std::min(block_acc_min[block],accs[pos]);
+      block_acc_max[block] = std::max(block_acc_max[block],accs[pos]);
+    }
+  }
+
+  //Index rows of a table; item ii is rows[ii]
+  void build(const CandidateTable& table, const std::vector<int>& rows)
+  {
+    std::vector<float> freq(rows.size()), dm(rows.size()), acc(rows.size());
+    for (int ii=0;ii<rows.size();ii++){
+      freq[ii] = table.freq[rows[ii]];
+      dm[ii] = table.dm[rows[ii]];
+      acc[ii] = table.acc[rows[ii]];
+    }
+    build(rows.size(),freq.empty() ? NULL : &freq[0],
+	  dm.empty() ? NULL : &dm[0],acc.empty() ? NULL : &acc[0]);
+  }
+
+  //Index candidates (e.g. CandidateCollection::cands), without their associations
+  void build(const std::vector<Candidate>& cands)
+  {
+    std::vector<float> freq(cands.size()), dm(cands.size()), acc(cands.size());
+    for (int ii=0;ii<cands.size();ii++){
+      freq[ii] = cands[ii].freq;
+      dm[ii] = cands[ii].dm;
+      acc[ii] = cands[ii].acc;
+    }
+    build(cands.size(),freq.empty() ? NULL : &freq[0],
+	  dm.empty() ? NULL : &dm[0],acc.empty() ? NULL : &acc[0]);
+  }
+
+  size_t size(void) const {return items.size();}
+
+  size_t get_nbuckets(void) const {return bucket_start.size()-1;}
+
+  //Item at a position of the frequency order, and back
+  int item(size_t pos) const {return items[pos];}
+  size_t position(int item) const {return positions[item];}
+  double freq(size_t pos) const {return freqs[pos];}
+
+  //Positions [first,last) of the frequency order with frequency in [low,high]
+  void span(double low, double high, size_t& first, size_t& last) const
+  {
+    first = bound(low,false);
+    last = std::max(first,bound(high,true));
+  }
+
+  //Items inside query, appended to found in frequency order
+  void query(const CandidateQuery& query, std::vector<int>& found) const
+  {
+    size_t first,last;
+    span(query.freq_low,query.freq_high,first,last);
+    collect(first,last,query,found);
+  }
+
+  /*!
+    \brief Items in any of several frequency ranges, each found once.
+
+    \param ranges Inclusive frequency ranges, sorted in place.
+    \param box DM and acceleration limits (its frequencies are ignored).
+  */
+  void query(std::vector<std::pair<double,double> >& ranges, const CandidateQuery& box,
+	     std::vector<int>& found) const
+  {
+    std::sort(ranges.begin(),ranges.end());
+    size_t covered = 0;
+    for (int ii=0;ii<ranges.size();ii++){
+      size_t first,last;
+      span(ranges[ii].first,ranges[ii].second,first,last);
+      //skip what an overlapping range already found
+      first = std::max(first,covered);
+      if (first>=last)
+	continue;
+      collect(first,last,box,found);
+      covered = last;
+    }
+  }
+
+  void query(std::vector<std::pair<double,double> >& ranges, std::vector<int>& found) const
+  {
+    query(ranges,CandidateQuery(0,0),found);
+  }
+
+  /*!
+    \brief Items within a fractional tolerance of a harmonic of freq.
+
+    Searches freq*jj/kk and freq*kk/jj for jj up to max_harm and kk up
+    to max_denom, inside the DM and acceleration limits of box.
+  */
+  void query_harmonics(double freq, double tolerance, int max_harm, int max_denom,
+		       const CandidateQuery& box, std::vector<int>& found) const
+  {
+    std::vector<std::pair<double,double> > ranges;
+    for (int jj=1;jj<=max_harm;jj++)
+      for (int kk=1;kk<=max_denom;kk++){
+	ranges.push_back(std::make_pair(freq*jj*(1-tolerance)/kk,freq*jj*(1+tolerance)/kk));
+	ranges.push_back(std::make_pair(freq*kk*(1-tolerance)/jj,freq*kk*(1+tolerance)/jj));
+      }
+    query(ranges,box,found);
+  }
+
+  /*!
+    \brief Run many queries on several threads.
+
+    \param offsets Gets size()+1 entries: query ii found items [offsets[ii],offsets[ii+1]).
+    \param nthreads Number of threads (0 for all online cores).
+  */
+  void query_batch(const std::vector<CandidateQuery>& queries, std::vector<size_t>& offsets,
+		   std::vector<int>& found, unsigned int nthreads=1, size_t min_chunk=1024) const
+  {
+    if (nthreads==0)
+      nthreads = std::max(1L,sysconf(_SC_NPROCESSORS_ONLN));
+    size_t nchunks = std::max((size_t)1,std::min((size_t)nthreads,queries.size()/std::max((size_t)1,min_chunk)));
+    std::vector<Chunk> chunks(nchunks);
+    std::vector<pthread_t> threads(nchunks);
+    for (size_t ii=0;ii<nchunks;ii++){
+      chunks[ii].index = this;
+      chunks[ii].queries = &queries;
+      chunks[ii].start = ii*queries.size()/nchunks;
+      chunks[ii].end = (ii+1)*queries.size()/nchunks;
+    }
+    //chunk 0 runs on the calling thread
+    for (size_t ii=1;ii<nchunks;ii++)
+      if (pthread_create(&threads[ii],NULL,query_chunk,(void*)&chunks[ii]))
+	ErrorChecker::throw_error("CandidateIndex: failed to create thread");
+    query_chunk((void*)&chunks[0]);
+    for (size_t ii=1;ii<nchunks;ii++)
+      pthread_join(threads[ii],NULL);
+
+    offsets.resize(queries.size()+1);
+    offsets[0] = 0;
+    found.clear();
+    for (size_t ii=0;ii<nchunks;ii++){
+      for (size_t jj=0;jj<chunks[ii].counts.size();jj++)
+	offsets[chunks[ii].start+jj+1] = offsets[chunks[ii].start+jj]+chunks[ii].counts[jj];
+      found.insert(found.end(),chunks[ii].found.begin(),chunks[ii].found.end());
+    }
+  }
+};
@@ -6,7 +6,9 @@
 
 //Lightweight plain old data struct
 //used to combine multiple writes into
-//one big write
+//one big write (layout is fixed by the
+//binary candidate format, so no jerk
+//or segment)
 struct CandidatePOD {
   float dm;
   int dm_idx;
@@ -21,6 +23,9 @@ public:
   float dm;
   int dm_idx;
   float acc;
+  float jerk;
+  int segment_level;
+  int segment;
   int nh;
   float snr;
   float freq;
@@ -30,12 +35,14 @@ public:
   bool is_physical;
   float ddm_count_ratio;
   float ddm_snr_ratio;
+  std::vector<float> features; //CandidateScorer's extra features, in its order
+  int known_source; //KnownSourceMatcher's source, -1 if none
   std::vector<Candidate> assoc;
   std::vector<float> fold;
   int nbins;
   int nints;
   
-  void append(Candidate& other){
+  void append(const Candidate& other){
     assoc.push_back(other);
   }
 
@@ -49,22 +56,22 @@ public:
   }
   
   Candidate(float dm, int dm_idx, float acc, int nh, float snr, float freq)
-    :dm(dm),dm_idx(dm_idx),acc(acc),nh(nh),
+    :dm(dm),dm_idx(dm_idx),acc(acc),jerk(0.0),segment_level(0),segment(0),nh(nh),
      snr(snr),folded_snr(0.0),freq(freq),
      opt_period(0.0),is_adjacent(false),is_physical(false),
-     ddm_count_ratio(0.0),ddm_snr_ratio(0.0),nints(0),nbins(0){}
+     ddm_count_ratio(0.0),ddm_snr_ratio(0.0),known_source(-1),nints(0),nbins(0){}
   
   Candidate(float dm, int dm_idx, float acc, int nh, float snr, float folded_snr, float freq)
-    :dm(dm),dm_idx(dm_idx),acc(acc),nh(nh),snr(snr),
+    :dm(dm),dm_idx(dm_idx),acc(acc),jerk(0.0),segment_level(0),segment(0),nh(nh),snr(snr),
      folded_snr(folded_snr),freq(freq),opt_period(0.0),
      is_adjacent(false),is_physical(false),
-     ddm_count_ratio(0.0),ddm_snr_ratio(0.0),nints(0),nbins(0){}
+     ddm_count_ratio(0.0),ddm_snr_ratio(0.0),known_source(-1),nints(0),nbins(0){}
 
   Candidate()
-    :dm(0.0),dm_idx(0.0),acc(0.0),nh(0.0),snr(0.0),
+    :dm(0.0),dm_idx(0.0),acc(0.0),jerk(0.0),segment_level(0),segment(0),nh(0.0),snr(0.0),
      folded_snr(0.0),freq(0.0),opt_period(0.0),
      is_adjacent(false),is_physical(false),
-     ddm_count_ratio(0.0),ddm_snr_ratio(0.0),nints(0),nbins(0){}
+     ddm_count_ratio(0.0),ddm_snr_ratio(0.0),known_source(-1),nints(0),nbins(0){}
 
   void set_fold(float* ar, int nbins, int nints){
     int size = nbins*nints;
@@ -96,6 +103,17 @@ public:
 
 };
 
+//Candidates handed on by a search worker for one DM trial
+struct CandidateSet {
+  int dm_idx;
+  bool final; //the DM trial has been fully searched
+  std::vector<Candidate> cands;
+
+  CandidateSet():dm_idx(0),final(false){}
+  CandidateSet(int dm_idx, bool final, const std::vector<Candidate>& cands)
+    :dm_idx(dm_idx),final(final),cands(cands){}
+};
+
 class CandidateCollection {
 public:
   std::vector<Candidate> cands;
@@ -106,7 +124,7 @@ public:
     cands.insert(cands.end(),other.cands.begin(),other.cands.end());
   }
   
-  void append(std::vector<Candidate> other){
+  void append(const std::vector<Candidate>& other){
     cands.insert(cands.end(),other.begin(),other.end());
   }
 
@@ -154,14 +172,17 @@ public:
   float dm;
   int dm_idx;
   float acc;
+  float jerk;
 
-  SpectrumCandidates(float dm, int dm_idx, float acc)
-    :dm(dm),dm_idx(dm_idx),acc(acc){}
+  SpectrumCandidates(float dm, int dm_idx, float acc, float jerk=0.0)
+    :dm(dm),dm_idx(dm_idx),acc(acc),jerk(jerk){}
   
   void append(float* snrs, float* freqs, int nh, int size){
     cands.reserve(size+cands.size());
-    for (int ii=0;ii<size;ii++)
+    for (int ii=0;ii<size;ii++){
       cands.push_back(Candidate(dm,dm_idx,acc,nh,snrs[ii],freqs[ii]));
+      cands.back().jerk = jerk;
+    }
   }
 };
 
@@ -0,0 +1,146 @@
+#pragma once
+#include <vector>
+#include <data_types/candidates.hpp>
+
+/*
+  Struct-of-arrays store of candidates for the distilling stages.
+
+  Each candidate is a row of the column vectors. Associations are
+  edges in an arena (a linked list of children per row) rather than
+  nested copies: relating a candidate to a fundamental adds one edge,
+  and a row can be the child of several fundamentals without its own
+  associations being copied. Rows are never removed, so row indices
+  stay valid as distillers narrow down the list of surviving rows.
+
+  Candidates convert to rows with append() and back, with nested
+  assoc vectors for the writers, with to_candidates().
+*/
+class CandidateTable {
+private:
+  std::vector<int> first_edge;
+  std::vector<int> last_edge;
+  std::vector<int> edge_child;
+  std::vector<int> edge_next;
+
+public:
+  std::vector<float> dm;
+  std::vector<int> dm_idx;
+  std::vector<float> acc;
+  std::vector<float> jerk;
+  std::vector<int> segment_level;
+  std::vector<int> segment;
+  std::vector<int> nh;
+  std::vector<float> snr;
+  std::vector<float> freq;
+
+  size_t size(void) const {return freq.size();}
+
+  size_t get_nedges(void) const {return edge_child.size();}
+
+  size_t get_bytes(void) const {
+    return size()*(6*sizeof(float)+3*sizeof(int)+2*sizeof(int)) +
+      get_nedges()*2*sizeof(int);
+  }
+
+  void reserve(size_t nrows, size_t nedges=0){
+    dm.reserve(nrows); dm_idx.reserve(nrows); acc.reserve(nrows);
+    jerk.reserve(nrows); segment_level.reserve(nrows); segment.reserve(nrows);
+    nh.reserve(nrows); snr.reserve(nrows); freq.reserve(nrows);
+    first_edge.reserve(nrows); last_edge.reserve(nrows);
+    edge_child.reserve(nedges); edge_next.reserve(nedges);
+  }
+
+  //Add a row with the fields of cand, ignoring its associations
+  int add_row(const Candidate& cand)
+  {
+    dm.push_back(cand.dm);
+    dm_idx.push_back(cand.dm_idx);
+    acc.push_back(cand.acc);
+    jerk.push_back(cand.jerk);
+    segment_level.push_back(cand.segment_level);
+    segment.push_back(cand.segment);
+    nh.push_back(cand.nh);
+    snr.push_back(cand.snr);
+    freq.push_back(cand.freq);
+    first_edge.push_back(-1);
+    last_edge.push_back(-1);
+    return size()-1;
+  }
+
+  //Associate child with parent, after any existing associations
+  void add_assoc(int parent, int child)
+  {
+    int edge = edge_child.size();
+    edge_child.push_back(child);
+    edge_next.push_back(-1);
+    if (last_edge[parent]<0)
+      first_edge[parent] = edge;
+    else
+      edge_next[last_edge[parent]] = edge;
+    last_edge[parent] = edge;
+  }
+
+  //Add a candidate and, recursively, its associations
+  int add(const Candidate& cand)
+  {
+    int row = add_row(cand);
+    for (int ii=0;ii<cand.assoc.size();ii++)
+      add_assoc(row,add(cand.assoc[ii]));
+    return row;
+  }
+
+  //Add candidates, returning their rows
+  std::vector<int> append(const std::vector<Candidate>& cands)
+  {
+    std::vector<int> rows(cands.size());
+    for (int ii=0;ii<cands.size();ii++)
+      rows[ii] = add(cands[ii]);
+    return rows;
+  }
+
+  //Iterate over associations: for (e=first_assoc(r); e>=0; e=next_assoc(e)) assoc_row(e)
+  int first_assoc(int row) const {return first_edge[row];}
+  int next_assoc(int edge) const {return edge_next[edge];}
+  int assoc_row(int edge) const {return edge_child[edge];}
+
+  //Associations of a row and theirs, as Candidate::count_assoc counts them
+  int count_assoc(int row) const
+  {
+    int count = 0;
+    for (int edge=first_edge[row];edge>=0;edge=edge_next[edge])
+      count += 1+count_assoc(edge_child[edge]);
+    return count;
+  }
+
+  //The fields of a row, without associations
+  Candidate get(int row) const
+  {
+    Candidate cand(dm[row],dm_idx[row],acc[row],nh[row],snr[row],freq[row]);
+    cand.jerk = jerk[row];
+    cand.segment_level = segment_level[row];
+    cand.segment = segment[row];
+    return cand;
+  }
+
+  //A row with its associations nested as assoc vectors
+  Candidate to_candidate(int row) const
+  {
+    Candidate cand = get(row);
+    int nassoc = 0;
+    for (int edge=first_edge[row];edge>=0;edge=edge_next[edge])
+      nassoc++;
+    cand.assoc.reserve(nassoc);
+    for (int edge=first_edge[row];edge>=0;edge=edge_next[edge])
+      cand.assoc.push_back(to_candidate(edge_child[edge]));
+    return cand;
+  }
+
+  std::vector<Candidate> to_candidates(const std::vector<int>& rows) const
+  {
+    std::vector<Candidate> cands;
+    cands.reserve(rows.size());
+    for (int ii=0;ii<rows.size();ii++)
+      cands.push_back(to_candidate(rows[ii]));
+    return cands;
+  }
+};
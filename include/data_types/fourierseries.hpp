@@ -186,3 +186,80 @@ public:
       delete folds[ii];
   }
 };
+
+
+/*!
+  \brief Subclass for handling of frequency series in host memory.
+  
+  Counterpart of DeviceFrequencySeries for searches that run on 
+  the CPU. Memory is pageable (not pinned) so that these can be 
+  used on nodes without a CUDA device.
+*/
+template <class T>
+class HostFrequencySeries: public FrequencySeries<T> {
+protected:
+  HostFrequencySeries(unsigned int nbins, double bin_width)
+    :FrequencySeries<T>(nbins,bin_width)
+  {
+    this->data_ptr = new T [nbins];
+  }
+
+  ~HostFrequencySeries()
+  {
+    delete [] this->data_ptr;
+  }
+};
+
+//template class should be std::complex<float> or similar
+template <class T>
+class HostFourierSeries: public HostFrequencySeries<T> {
+public:
+  HostFourierSeries(unsigned int nbins, double bin_width)
+    :HostFrequencySeries<T>(nbins,bin_width){}
+};
+
+//template class should be real valued
+template <class T>
+class HostPowerSpectrum: public HostFrequencySeries<T> {
+private:
+  unsigned int nh;
+
+public:
+  HostPowerSpectrum(unsigned int nbins, double bin_width,unsigned int nh=0)
+    :HostFrequencySeries<T>(nbins,bin_width),nh(nh){}
+
+  template <class U>
+  HostPowerSpectrum(FrequencySeries<U>& other,unsigned int nh=0)
+    :HostFrequencySeries<T>(other.get_nbins(),other.get_bin_width()),nh(nh){}
+
+  unsigned int get_nh(void){return nh;}
+  void set_nh(unsigned int nh_){nh=nh_;}
+};
+
+template <class T>
+class HostHarmonicSums {
+private:
+  std::vector< HostPowerSpectrum<T>* > folds;
+
+public:
+  HostHarmonicSums(HostPowerSpectrum<T>& fold0, unsigned int nfolds)
+  {
+    folds.reserve(nfolds);
+    for (int ii=0;ii<nfolds;ii++)
+      folds.push_back(new HostPowerSpectrum<T>(fold0,ii+1));
+  }
+
+  size_t size(void){
+    return folds.size();
+  }
+
+  HostPowerSpectrum<T>* operator[](int ii){
+    return folds[ii];
+  }
+
+  ~HostHarmonicSums()
+  {
+    for (int ii=0;ii<folds.size();ii++)
+      delete folds[ii];
+  }
+};
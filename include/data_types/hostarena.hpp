@@ -0,0 +1,52 @@
+#pragma once
+#include <vector>
+#include <complex>
+#include "data_types/timeseries.hpp"
+#include "data_types/fourierseries.hpp"
+
+/*
+  Scratch memory of a CPU search worker.
+
+  Everything the per-DM search loop writes to is allocated once when
+  the worker starts and reused for every task: the dedispersed series
+  and its resampled copy, the Fourier series, the interbinned spectrum
+  with its harmonic sums, and the peak lists (reserved for the largest
+  number of peaks a spectrum can hold at the default minimum gap).
+*/
+class HostSearchArena {
+public:
+  HostTimeSeries<float> tim;
+  HostTimeSeries<float> tim_r;
+  HostFourierSeries< std::complex<float> > fseries;
+  HostPowerSpectrum<float> pspec;
+  HostHarmonicSums<float> sums;
+  std::vector<int> peakidxs;
+  std::vector<float> peaksnrs;
+  std::vector<float> peakfreqs;
+
+  /*!
+    \param size Transform length.
+    \param bin_width Width of a Fourier bin (Hz).
+    \param nharmonics Number of harmonic folds.
+    \param max_peaks Number of peaks to reserve space for.
+  */
+  HostSearchArena(unsigned int size, double bin_width, unsigned int nharmonics,
+		  size_t max_peaks=0)
+    :tim(size),tim_r(size),fseries(size/2+1,bin_width),
+     pspec(size/2+1,bin_width),sums(pspec,nharmonics)
+  {
+    if (max_peaks==0)
+      max_peaks = (size/2+1)/30+1;
+    peakidxs.reserve(max_peaks);
+    peaksnrs.reserve(max_peaks);
+    peakfreqs.reserve(max_peaks);
+  }
+
+  size_t get_bytes(void){
+    size_t nbins = fseries.get_nbins();
+    return 2*tim.get_nsamps()*sizeof(float) +
+      nbins*sizeof(std::complex<float>) +
+      (sums.size()+1)*nbins*sizeof(float) +
+      peakidxs.capacity()*(sizeof(int)+2*sizeof(float));
+  }
+};
@@ -25,6 +25,7 @@
 
 #pragma once
 #include <vector>
+#include <algorithm>
 #include "cuda.h"
 #include <thrust/copy.h>
 #include <thrust/device_ptr.h>
@@ -218,6 +219,66 @@ public:
 };
 
 
+/*!
+  \brief TimeSeries subclass for timeseries in host memory.
+  
+  Host counterpart of DeviceTimeSeries for searches that run on 
+  the CPU. The buffer lifetime is tied to the object.
+*/
+template <class T>
+class HostTimeSeries: public TimeSeries<T> {
+public:
+  /*!
+    \brief Construct a HostTimeSeries with N samples.
+
+    \param nsamps Number of samples.
+    \param tsamp Sampling time (seconds).
+  */
+  HostTimeSeries(unsigned int nsamps, float tsamp=0.0)
+    :TimeSeries<T>(nsamps)
+  {
+    this->data_ptr = new T [nsamps];
+    this->tsamp = tsamp;
+  }
+
+  /*!
+    \brief Copy (with type conversion) from another TimeSeries.
+    
+    Copies min(nsamps) samples from host_tim and takes its 
+    sampling time.
+
+    \param host_tim A TimeSeries instance in host memory.
+  */
+  template <class OtherType>
+  void copy_from_host(TimeSeries<OtherType>& host_tim)
+  {
+    size_t size = std::min(host_tim.get_nsamps(),this->nsamps);
+    this->tsamp = host_tim.get_tsamp();
+    OtherType* input = host_tim.get_data();
+    for (size_t ii=0;ii<size;ii++)
+      this->data_ptr[ii] = (T) input[ii];
+  }
+
+  /*!
+    \brief Fill a range of samples with a value.
+    
+    \param start Index of first sample to fill.
+    \param end Index of last sample to fill.
+    \param value Value to fill range with.
+  */
+  void fill(size_t start, size_t end, T value){
+    if (end > this->nsamps)
+      ErrorChecker::throw_error("HostTimeSeries::fill bad end value requested");
+    std::fill(this->data_ptr+start,this->data_ptr+end,value);
+  }
+
+  ~HostTimeSeries()
+  {
+    delete [] this->data_ptr;
+  }
+};
+
+
 /*!
   \brief TimeSeries subclass for encapsulating on-GPU timeseries.
   
@@ -108,6 +108,42 @@ void device_harmonic_sum(float* d_input_array,
 			 unsigned int max_blocks,
 			 unsigned int max_threads);
 
+//Largest number of harmonic folds summed by the fused peak kernel
+#define MAX_FUSED_HARMONIC_FOLDS 8
+
+//Per harmonic fold [start,end) bin ranges searched for peaks
+typedef struct {
+  int start[MAX_FUSED_HARMONIC_FOLDS+1];
+  int end[MAX_FUSED_HARMONIC_FOLDS+1];
+} peasoup_peak_window;
+
+unsigned int device_harmonic_sum_peaks(float* d_input_array,
+				       size_t size,
+				       unsigned nharms,
+				       float thresh,
+				       peasoup_peak_window window,
+				       int* d_bins,
+				       int* d_nh,
+				       float* d_powers,
+				       unsigned int* d_count,
+				       unsigned int max_peaks,
+				       unsigned int max_blocks,
+				       unsigned int max_threads);
+
+//d_ranges: nranges folds, nranges start bins, nranges+1 running totals of range lengths
+unsigned int device_harmonic_sum_peaks_ranges(float* d_input_array,
+					      unsigned nranges,
+					      const int* d_ranges,
+					      unsigned int total,
+					      float thresh,
+					      int* d_bins,
+					      int* d_nh,
+					      float* d_powers,
+					      unsigned int* d_count,
+					      unsigned int max_peaks,
+					      unsigned int max_blocks,
+					      unsigned int max_threads);
+
 void device_form_power_series(cufftComplex* d_array_in,
 			      float* d_array_out,
 			      size_t size,
@@ -131,6 +167,50 @@ void device_resampleII(float * d_idata,
                      unsigned int block_size,
                      unsigned int max_blocks);
 
+//j is the jerk in m/s/s/s
+void device_resampleIII(float * d_idata,
+			float * d_odata,
+			size_t length,
+			float a,
+			float j,
+			float timestep,
+			unsigned int block_size,
+			unsigned int max_blocks);
+
+//out_size*factor input samples are summed in runs of factor
+void device_tscrunch(float * d_idata,
+		     float * d_odata,
+		     size_t out_size,
+		     unsigned int factor,
+		     unsigned int max_threads,
+		     unsigned int max_blocks);
+
+//d_jerk_facts may be NULL for no jerk
+void device_resampleII_batch(float * d_idata,
+			     float * d_odata,
+			     size_t size,
+			     double* d_accel_facts,
+			     double* d_jerk_facts,
+			     unsigned int nbatch,
+			     unsigned int max_threads,
+			     unsigned int max_blocks);
+
+void device_form_interbinned_batch(cufftComplex* d_array_in,
+				   float* d_array_out,
+				   size_t nbins,
+				   unsigned int nbatch,
+				   unsigned int max_blocks,
+				   unsigned int max_threads);
+
+//Leaves the crossings in the device vectors and returns their count
+int device_find_peaks(int n,
+		      int start_index,
+		      float * d_dat,
+		      float thresh,
+		      thrust::device_vector<int>&,
+		      thrust::device_vector<float>&,
+		      cached_allocator&);
+
 int device_find_peaks(int n,
 		      int start_index,
 		      float * d_dat,
@@ -141,6 +221,24 @@ int device_find_peaks(int n,
 		      thrust::device_vector<float>&,
 		      cached_allocator&);
 
+//Clusters the crossings on the device as identify_unique_peaks does,
+//leaves the peaks at the front of d_peak_index and d_peak_snrs and
+//returns their count. d_work is integer work space. The peak and work
+//vectors grow as needed.
+int device_find_unique_peaks(int n,
+			     int start_index,
+			     float * d_dat,
+			     float thresh,
+			     int min_gap,
+			     thrust::device_vector<int>& d_index,
+			     thrust::device_vector<float>& d_snrs,
+			     thrust::device_vector<int>& d_peak_index,
+			     thrust::device_vector<float>& d_peak_snrs,
+			     thrust::device_vector<int>& d_work,
+			     cached_allocator&,
+			     unsigned int max_blocks,
+			     unsigned int max_threads);
+
 void device_normalise(float* d_powers,
                       float mean,
                       float sigma,
@@ -315,6 +413,36 @@ void device_cuCmulf_inplace(cufftComplex* x,
                             unsigned int max_blocks,
                             unsigned int max_threads);
 
+//-------Fourier domain acceleration search-------//
+
+void device_fdas_segment(cufftComplex* fseries,
+			 cufftComplex* segments,
+			 unsigned int nbins,
+			 unsigned int seglen,
+			 unsigned int step,
+			 unsigned int offset,
+			 unsigned int nsegs,
+			 unsigned int max_blocks,
+			 unsigned int max_threads);
+
+void device_fdas_multiply(cufftComplex* segments,
+			  cufftComplex* kernel,
+			  cufftComplex* output,
+			  unsigned int seglen,
+			  unsigned int nsegs,
+			  unsigned int max_blocks,
+			  unsigned int max_threads);
+
+void device_fdas_extract(cufftComplex* segments,
+			 float* output,
+			 unsigned int nbins,
+			 unsigned int seglen,
+			 unsigned int step,
+			 unsigned int offset,
+			 float scale,
+			 unsigned int max_blocks,
+			 unsigned int max_threads);
+
 template <class X, class Y>
 void device_conversion(X*, Y*, unsigned int,
 		       unsigned int, unsigned int);
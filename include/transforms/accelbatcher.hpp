@@ -0,0 +1,158 @@
+#pragma once
+#include "cuda.h"
+#include "cufft.h"
+#include <vector>
+#include <algorithm>
+#include "data_types/timeseries.hpp"
+#include "transforms/ffter.hpp"
+#include "utils/exceptions.hpp"
+#include "utils/utils.hpp"
+#include "utils/stats.hpp"
+#include <kernels/defaults.h>
+#include <kernels/kernels.h>
+
+//Largest batch used when the batch size is chosen automatically
+#define MAX_ACCELERATION_BATCH 64
+
+/*
+  Resample, transform and form normalised spectra for a batch of
+  acceleration trials at once.
+
+  The K resampled series are written into one [K x size] buffer in a
+  single pass over the dedispersed series, transformed with one
+  batched R2C plan, and converted to interbinned amplitude spectra and
+  normalised as a single [K x (size/2+1)] array. Harmonic summing and
+  peak finding then run on each row of the spectrum buffer.
+
+  Only two plans are ever made: one of max_batch transforms and one of
+  a single transform. A short batch (usually the last of a DM) runs
+  its trials through the single plan in turn, so no plan or cuFFT work
+  space is added for each batch size the scheduler happens to produce.
+
+  Output is identical to running resampleII, R2C, form_interpolated
+  and normalise for each trial in turn.
+*/
+class AccelerationBatcher {
+private:
+  unsigned int size;
+  unsigned int nbins;
+  unsigned int max_batch;
+  float* d_tim_r;
+  cufftComplex* d_fseries;
+  float* d_pspec;
+  double* d_accel_facts;
+  double* d_jerk_facts;
+  std::vector<double> accel_facts;
+  std::vector<double> jerk_facts;
+  CuFFTerR2C batch_fft;
+  CuFFTerR2C single_fft;
+  unsigned int max_blocks;
+  unsigned int max_threads;
+
+  AccelerationBatcher(const AccelerationBatcher&);
+  AccelerationBatcher& operator=(const AccelerationBatcher&);
+
+public:
+  /*!
+    \param size Transform length.
+    \param max_batch Largest number of trials per batch.
+  */
+  AccelerationBatcher(unsigned int size, unsigned int max_batch,
+		      unsigned int max_blocks=MAX_BLOCKS,
+		      unsigned int max_threads=MAX_THREADS)
+    :size(size),nbins(size/2+1),max_batch(std::max(1u,max_batch)),
+     batch_fft(size,this->max_batch),single_fft(size),
+     max_blocks(max_blocks),max_threads(max_threads)
+  {
+    Utils::device_malloc<float>(&d_tim_r,this->max_batch*size);
+    Utils::device_malloc<cufftComplex>(&d_fseries,this->max_batch*nbins);
+    Utils::device_malloc<float>(&d_pspec,this->max_batch*nbins);
+    Utils::device_malloc<double>(&d_accel_facts,this->max_batch);
+    Utils::device_malloc<double>(&d_jerk_facts,this->max_batch);
+    accel_facts.resize(this->max_batch);
+    jerk_facts.resize(this->max_batch);
+  }
+
+  ~AccelerationBatcher()
+  {
+    Utils::device_free(d_tim_r);
+    Utils::device_free(d_fseries);
+    Utils::device_free(d_pspec);
+    Utils::device_free(d_accel_facts);
+    Utils::device_free(d_jerk_facts);
+  }
+
+  /*!
+    \brief Choose a batch size that fits in free device memory.
+
+    Per trial the batch holds a resampled series, its Fourier series
+    and spectrum, plus roughly a Fourier series of cuFFT work space
+    for the batched plan (the single trial plan needs one more, which
+    the fraction leaves room for). At most a fraction of the currently
+    free memory is used.
+
+    \param size Transform length.
+    \param cap Upper limit on the batch size (0 for MAX_ACCELERATION_BATCH).
+    \param fraction Fraction of free device memory to use.
+  */
+  static unsigned int choose_batch(unsigned int size, unsigned int cap=0, float fraction=0.5)
+  {
+    size_t free_bytes,total_bytes;
+    cudaMemGetInfo(&free_bytes,&total_bytes);
+    ErrorChecker::check_cuda_error("Error from cudaMemGetInfo");
+    size_t nbins = size/2+1;
+    size_t per_trial = size*sizeof(float) + nbins*(2*sizeof(cufftComplex)+sizeof(float));
+    size_t nbatch = (size_t)(fraction*free_bytes)/per_trial;
+    if (cap==0)
+      cap = MAX_ACCELERATION_BATCH;
+    nbatch = std::min((size_t)cap,nbatch);
+    return std::max((size_t)1,nbatch);
+  }
+
+  unsigned int get_max_batch(void){return max_batch;}
+
+  /*!
+    \brief Form normalised interbinned spectra for a batch of accelerations.
+
+    \param tim The (inverse transformed, dereddened) time series.
+    \param accs Accelerations of the trials (m/s/s).
+    \param nbatch Number of trials, at most get_max_batch().
+    \param mean Mean used for normalisation.
+    \param std Standard deviation used for normalisation.
+    \param jerks Jerks of the trials (m/s/s/s), NULL for none.
+  */
+  void process(DeviceTimeSeries<float>& tim, float* accs, unsigned int nbatch,
+	       float mean, float std, float* jerks=NULL)
+  {
+    if (nbatch>max_batch)
+      ErrorChecker::throw_error("AccelerationBatcher: batch too large");
+    float tsamp = tim.get_tsamp();
+    //same expression as device_resampleII
+    for (int ii=0;ii<nbatch;ii++)
+      accel_facts[ii] = ((accs[ii]*tsamp) / (2 * 299792458.0));
+    Utils::h2dcpy<double>(d_accel_facts,&accel_facts[0],nbatch);
+    if (jerks!=NULL){
+      //same expression as device_resampleIII
+      for (int ii=0;ii<nbatch;ii++)
+	jerk_facts[ii] = (((double)jerks[ii]*tsamp*tsamp) / (6 * 299792458.0));
+      Utils::h2dcpy<double>(d_jerk_facts,&jerk_facts[0],nbatch);
+    }
+    device_resampleII_batch(tim.get_data(),d_tim_r,size,d_accel_facts,
+			    (jerks!=NULL)?d_jerk_facts:NULL,
+			    nbatch,max_threads,max_blocks);
+    if (nbatch==max_batch)
+      batch_fft.execute(d_tim_r,d_fseries);
+    else
+      for (int ii=0;ii<nbatch;ii++)
+	single_fft.execute(d_tim_r+(size_t)ii*size,d_fseries+(size_t)ii*nbins);
+    device_form_interbinned_batch(d_fseries,d_pspec,nbins,nbatch,
+				  max_blocks,max_threads);
+    stats::normalise(d_pspec,mean,std,nbatch*nbins,max_blocks,max_threads);
+  }
+
+  //Spectrum of trial idx of the last batch
+  float* get_spectrum(unsigned int idx)
+  {
+    return d_pspec + (size_t)idx*nbins;
+  }
+};
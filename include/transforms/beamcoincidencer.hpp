@@ -0,0 +1,328 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <cmath>
+#include <unistd.h>
+#include "pthread.h"
+#include "utils/exceptions.hpp"
+#include "data_types/candidateindex.hpp"
+
+/*
+  Candidates of many beams in one set of columns. Row ii is candidate
+  idx[ii] of beam beam[ii].
+*/
+struct BeamCandidateTable {
+  std::vector<int> beam;
+  std::vector<int> idx;
+  std::vector<float> freq;
+  std::vector<float> snr;
+  std::vector<float> dm;
+  std::vector<float> acc;
+
+  size_t size(void) const {return freq.size();}
+
+  void add(int beam_, int idx_, float freq_, float snr_, float dm_, float acc_){
+    beam.push_back(beam_);
+    idx.push_back(idx_);
+    freq.push_back(freq_);
+    snr.push_back(snr_);
+    dm.push_back(dm_);
+    acc.push_back(acc_);
+  }
+};
+
+/*
+  Cross-beam coincidencing of search candidates.
+
+  Two candidates in different beams match when one frequency is within
+  the fractional tolerance of the other times a harmonic ratio jj/kk
+  (or kk/jj), with jj up to max_harm and kk up to max_denom, the same
+  test the harmonic distiller uses within a beam. Candidates are
+  looked up in a CandidateIndex, so each harmonic of each candidate
+  costs a bucket lookup rather than a scan of every beam.
+
+  A candidate matched in beam_threshold or more beams (counting its
+  own) is flagged as multi-beam RFI. The remaining candidates that
+  match in an adjacent beam, within dm_tol of each other if dm_tol>0,
+  are joined into groups: detections of one source seen in
+  neighbouring beams. Without beam positions every pair of beams is
+  adjacent.
+
+  Rows are matched in contiguous chunks, one thread each, with the
+  first chunk on the calling thread. Group numbers follow the lowest
+  row in each group, so results do not depend on the number of threads.
+*/
+class BeamCoincidencer {
+private:
+  struct Chunk {
+    BeamCoincidencer* self;
+    size_t start;
+    size_t end;
+    std::vector<int> seen;
+    std::vector<std::pair<int,int> > links;
+  };
+
+  float tolerance;
+  int beam_threshold;
+  float dm_tol;
+  unsigned int nthreads;
+  size_t min_chunk;
+  std::vector<double> ratios;
+  int nbeams;
+  std::vector<char> adjacent;
+  const BeamCandidateTable* table;
+  CandidateIndex index;
+  std::vector<Chunk> chunks;
+  std::vector<pthread_t> threads;
+  std::vector<int> parent;
+
+  //Call visit(row,match) for every row of another beam matching row
+  template <class Visitor>
+  void for_each_match(int row, Visitor& visit)
+  {
+    const BeamCandidateTable& t = *table;
+    double freq = t.freq[row];
+    if (!(freq>0))
+      return;
+    for (int ii=0;ii<ratios.size();ii++){
+      //searched twice as wide as the test so rounding never loses a match
+      double target = freq*ratios[ii];
+      size_t first,last;
+      index.span(target*(1-2*tolerance),target*(1+2*tolerance),first,last);
+      for (size_t pos=first;pos<last;pos++){
+	int match = index.item(pos);
+	double ratio = t.freq[match]/target;
+	if (t.beam[match]!=t.beam[row] && ratio>1-tolerance && ratio<1+tolerance)
+	  visit(row,match);
+      }
+    }
+  }
+
+  //Distinct other beams a row matches in
+  struct BeamCounter {
+    const BeamCandidateTable& t;
+    std::vector<int>& seen;
+    int count;
+    BeamCounter(const BeamCandidateTable& t, std::vector<int>& seen):t(t),seen(seen),count(0){}
+    void operator()(int row, int match){
+      if (seen[t.beam[match]]!=row){
+	seen[t.beam[match]] = row;
+	count++;
+      }
+    }
+  };
+
+  //Links to matching candidates of adjacent beams that are not RFI
+  struct Linker {
+    BeamCoincidencer& self;
+    std::vector<std::pair<int,int> >& links;
+    Linker(BeamCoincidencer& self, std::vector<std::pair<int,int> >& links):self(self),links(links){}
+    void operator()(int row, int match){
+      const BeamCandidateTable& t = *self.table;
+      if (!self.is_rfi[match] &&
+	  self.adjacent[t.beam[row]*self.nbeams+t.beam[match]] &&
+	  (self.dm_tol<=0 || fabs(t.dm[row]-t.dm[match])<=self.dm_tol))
+	links.push_back(std::make_pair(row,match));
+    }
+  };
+
+  static void* count_chunk(void* arg)
+  {
+    Chunk& chunk = *(Chunk*) arg;
+    BeamCoincidencer& self = *chunk.self;
+    chunk.seen.assign(self.nbeams,-1);
+    for (size_t ii=chunk.start;ii<chunk.end;ii++){
+      BeamCounter counter(*self.table,chunk.seen);
+      self.for_each_match(ii,counter);
+      self.nbeams_matched[ii] = 1+counter.count;
+    }
+    return NULL;
+  }
+
+  static void* link_chunk(void* arg)
+  {
+    Chunk& chunk = *(Chunk*) arg;
+    BeamCoincidencer& self = *chunk.self;
+    chunk.links.clear();
+    Linker linker(self,chunk.links);
+    for (size_t ii=chunk.start;ii<chunk.end;ii++)
+      if (!self.is_rfi[ii])
+	self.for_each_match(ii,linker);
+    return NULL;
+  }
+
+  void run(void* (*func)(void*))
+  {
+    //chunk 0 runs on the calling thread
+    for (int ii=1;ii<chunks.size();ii++)
+      if (pthread_create(&threads[ii],NULL,func,(void*)&chunks[ii]))
+	ErrorChecker::throw_error("BeamCoincidencer: failed to create thread");
+    func((void*)&chunks[0]);
+    for (int ii=1;ii<chunks.size();ii++)
+      pthread_join(threads[ii],NULL);
+  }
+
+  int find(int row){
+    while (parent[row]!=row){
+      parent[row] = parent[parent[row]];
+      row = parent[row];
+    }
+    return row;
+  }
+
+  void join(int a, int b){
+    a = find(a);
+    b = find(b);
+    if (a<b)
+      parent[b] = a;
+    else if (b<a)
+      parent[a] = b;
+  }
+
+public:
+  //Number of beams each row matches in, counting its own
+  std::vector<int> nbeams_matched;
+  //Multi-beam RFI flag of each row
+  std::vector<char> is_rfi;
+  //Group of each row, or -1 if it matches nothing in an adjacent beam
+  std::vector<int> group;
+  //Number of beams with a detection in each group
+  std::vector<int> group_nbeams;
+
+  /*!
+    \param tolerance Fractional frequency tolerance (0.0001 = 0.01%).
+    \param max_harm Highest harmonic numerator to match at.
+    \param max_denom Highest harmonic denominator (1 for integer harmonics only).
+    \param beam_threshold Beams a candidate must match in to be RFI.
+    \param dm_tol Largest DM difference for grouping (0 for any).
+    \param nthreads Number of threads to match with (0 for all online cores).
+    \param min_chunk Fewest rows worth giving to a thread.
+  */
+  BeamCoincidencer(float tolerance, int max_harm, int max_denom, int beam_threshold,
+		   float dm_tol=0, unsigned int nthreads=0, size_t min_chunk=1024)
+    :tolerance(tolerance),beam_threshold(beam_threshold),dm_tol(dm_tol),
+     nthreads(nthreads),min_chunk(std::max((size_t)1,min_chunk)),nbeams(0),
+     table(NULL),index(tolerance)
+  {
+    for (int jj=1;jj<=std::max(1,max_harm);jj++)
+      for (int kk=1;kk<=std::max(1,max_denom);kk++){
+	ratios.push_back(jj/(double)kk);
+	ratios.push_back(kk/(double)jj);
+      }
+    std::sort(ratios.begin(),ratios.end());
+    ratios.erase(std::unique(ratios.begin(),ratios.end()),ratios.end());
+    if (this->nthreads==0){
+      long ncores = sysconf(_SC_NPROCESSORS_ONLN);
+      this->nthreads = std::max(1L,ncores);
+    }
+  }
+
+  unsigned int get_nthreads(void){return nthreads;}
+
+  size_t get_nratios(void){return ratios.size();}
+
+  /*!
+    \brief Only group beams no more than max_sep apart.
+
+    \param ra Right ascension of each beam in degrees.
+    \param dec Declination of each beam in degrees.
+    \param max_sep Largest separation of adjacent beams in degrees.
+  */
+  void set_positions(const std::vector<double>& ra, const std::vector<double>& dec, double max_sep)
+  {
+    if (ra.size()!=dec.size())
+      ErrorChecker::throw_error("BeamCoincidencer: need one RA and Dec per beam");
+    nbeams = ra.size();
+    adjacent.assign(nbeams*nbeams,0);
+    double deg = M_PI/180.0;
+    for (int ii=0;ii<nbeams;ii++)
+      for (int jj=0;jj<nbeams;jj++){
+	double sin_ddec = sin((dec[jj]-dec[ii])*deg/2);
+	double sin_dra = sin((ra[jj]-ra[ii])*deg/2);
+	double hav = sin_ddec*sin_ddec + cos(dec[ii]*deg)*cos(dec[jj]*deg)*sin_dra*sin_dra;
+	double sep = 2*asin(sqrt(std::min(1.0,hav)))/deg;
+	adjacent[ii*nbeams+jj] = sep<=max_sep;
+      }
+  }
+
+  /*!
+    \brief Match the candidates of all beams against each other.
+
+    \param nbeams_ Number of beams; table.beam holds 0 to nbeams_-1.
+  */
+  void match(const BeamCandidateTable& candidates, int nbeams_)
+  {
+    if (adjacent.empty() || nbeams!=nbeams_){
+      if (!adjacent.empty())
+	ErrorChecker::throw_error("BeamCoincidencer: beam positions do not match the number of beams");
+      nbeams = nbeams_;
+      adjacent.assign(nbeams*nbeams,1);
+    }
+    table = &candidates;
+    size_t size = candidates.size();
+    index.build(size,size ? &candidates.freq[0] : NULL,
+		size ? &candidates.dm[0] : NULL,size ? &candidates.acc[0] : NULL);
+    nbeams_matched.assign(size,1);
+    is_rfi.assign(size,0);
+    group.assign(size,-1);
+    group_nbeams.clear();
+    if (size==0)
+      return;
+
+    unsigned int nchunks = std::max((size_t)1,std::min((size_t)nthreads,size/min_chunk));
+    chunks.resize(nchunks);
+    threads.resize(nchunks);
+    for (int ii=0;ii<nchunks;ii++){
+      chunks[ii].self = this;
+      chunks[ii].start = ii*size/nchunks;
+      chunks[ii].end = (ii+1)*size/nchunks;
+    }
+    run(count_chunk);
+    for (size_t ii=0;ii<size;ii++)
+      is_rfi[ii] = nbeams_matched[ii]>=beam_threshold;
+    run(link_chunk);
+
+    parent.resize(size);
+    for (size_t ii=0;ii<size;ii++)
+      parent[ii] = ii;
+    for (int ii=0;ii<nchunks;ii++)
+      for (int jj=0;jj<chunks[ii].links.size();jj++)
+	join(chunks[ii].links[jj].first,chunks[ii].links[jj].second);
+    std::vector<int> linked(size,0);
+    for (int ii=0;ii<nchunks;ii++){
+      for (int jj=0;jj<chunks[ii].links.size();jj++){
+	linked[chunks[ii].links[jj].first] = 1;
+	linked[chunks[ii].links[jj].second] = 1;
+      }
+      std::vector<std::pair<int,int> >().swap(chunks[ii].links);
+    }
+    //roots are the lowest row of their group, so numbering in row order is deterministic
+    std::vector<std::pair<int,int> > group_beams;
+    for (size_t ii=0;ii<size;ii++){
+      if (!linked[ii])
+	continue;
+      int root = find(ii);
+      if (root==ii){
+	group[ii] = group_nbeams.size();
+	group_nbeams.push_back(0);
+      } else {
+	group[ii] = group[root];
+      }
+      group_beams.push_back(std::make_pair(group[ii],candidates.beam[ii]));
+    }
+    std::sort(group_beams.begin(),group_beams.end());
+    group_beams.erase(std::unique(group_beams.begin(),group_beams.end()),group_beams.end());
+    for (int ii=0;ii<group_beams.size();ii++)
+      group_nbeams[group_beams[ii].first]++;
+  }
+
+  size_t get_ngroups(void){return group_nbeams.size();}
+
+  size_t get_nrfi(void){
+    size_t count = 0;
+    for (size_t ii=0;ii<is_rfi.size();ii++)
+      count += is_rfi[ii];
+    return count;
+  }
+};
@@ -7,10 +7,13 @@
 #include <string>
 #include <vector>
 #include <iterator>
+#include <complex>
+#include <cmath>
 
 class Zapper {
 private:
   bool d_mem_allocated;
+  bool d_mem_current;
   std::vector<float> birdies;
   std::vector<float> widths;
   float* d_birdies; //device memory
@@ -29,6 +32,7 @@ public:
   Zapper(std::string zaplist)
   {
     d_mem_allocated = false;
+    d_mem_current = false;
     append_from_file(zaplist);
   }
   
@@ -44,18 +48,23 @@ public:
       }
     }
     infile.close();
+    d_mem_current = false;
+  }
 
+  //Device copies are made on first use so host-only searches need no GPU
+  void copy_to_device(void){
+    if (d_mem_current)
+      return;
     if (d_mem_allocated){
       Utils::device_free(d_birdies);
       Utils::device_free(d_widths);
-    } else {
-      Utils::device_malloc<float>(&d_birdies,birdies.size());
-      Utils::device_malloc<float>(&d_widths,birdies.size());
-      d_mem_allocated=true;
     }
+    Utils::device_malloc<float>(&d_birdies,birdies.size());
+    Utils::device_malloc<float>(&d_widths,birdies.size());
+    d_mem_allocated=true;
     Utils::h2dcpy(d_birdies,&birdies[0],birdies.size());
     Utils::h2dcpy(d_widths,&widths[0],widths.size());
-
+    d_mem_current = true;
   }
 
   void zap(DeviceFourierSeries<cufftComplex>& fseries){
@@ -65,9 +74,30 @@ public:
   }
   
   void zap(cufftComplex* fseries, float bin_width, unsigned int nbins){
+    copy_to_device();
     device_zap_birdies(fseries, d_birdies, d_widths,
                        bin_width, birdies.size(), nbins,
                        MAX_BLOCKS, MAX_THREADS);
   }
+
+  //Same bin ranges as device_zap_birdies
+  void zap(std::complex<float>* fseries, float bin_width, unsigned int nbins){
+    for (int ii=0;ii<birdies.size();ii++){
+      int low_bin = (int) floorf((birdies[ii]-widths[ii])/bin_width);
+      int high_bin = (int) ceilf((birdies[ii]+widths[ii])/bin_width);
+      if (low_bin<0)
+	low_bin = 0;
+      if (low_bin>=(int)nbins)
+	continue;
+      if (high_bin>=(int)nbins)
+	high_bin = nbins-1;
+      for (int jj=low_bin;jj<high_bin;jj++)
+	fseries[jj] = std::complex<float>(1.0,0.0);
+    }
+  }
+
+  void zap(HostFourierSeries< std::complex<float> >& fseries){
+    zap(fseries.get_data(),fseries.get_bin_width(),fseries.get_nbins());
+  }
     
 };
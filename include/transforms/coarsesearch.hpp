@@ -0,0 +1,318 @@
+#pragma once
+#include "cuda.h"
+#include "cufft.h"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include "data_types/timeseries.hpp"
+#include "data_types/fourierseries.hpp"
+#include "data_types/candidates.hpp"
+#include "transforms/resampler.hpp"
+#include "transforms/ffter.hpp"
+#include "transforms/spectrumformer.hpp"
+#include "transforms/harmonicfolder.hpp"
+#include "transforms/peakfinder.hpp"
+#include "transforms/distiller.hpp"
+#include "utils/exceptions.hpp"
+#include "utils/utils.hpp"
+#include "utils/stats.hpp"
+#include <climits>
+#include <kernels/defaults.h>
+#include <kernels/kernels.h>
+
+/*
+  First pass of a coarse-to-fine acceleration search.
+
+  The dereddened time series is summed down by an integer factor and
+  searched over the (proportionally coarser) trial grid of a second
+  AccelerationPlan at a lowered threshold. Every coarse trial with a
+  detection marks a box of fine accelerations and jerks, between the
+  coarse trials either side of it, and each detection in it the
+  frequencies its signal can drift to over that box. The full
+  resolution pass only searches fine trials inside some box, and
+  within a trial only the bins of its boxes' frequencies (or their
+  harmonics), so it never sums or thresholds the whole spectrum.
+
+  The coarse threshold is set per DM from the number of coarse trials
+  (bins x folds x accelerations x jerks), treating each as Gaussian as
+  min_snr does. It is the lower of the threshold expected to give
+  false_alarms noise detections and the threshold a min_snr signal
+  clears with probability 1-miss_prob. The signal's coarse S/N is
+  taken as min_snr times the response of the summing boxcar at the
+  highest coarse frequency, the worst case. Harmonics above the coarse
+  Nyquist frequency are lost, so fast pulsars with power in high
+  harmonics can still be missed.
+*/
+class CoarseAccelerationSearch {
+private:
+  //Fine trials between two coarse trials and the hits [first,last) found in them
+  struct Box {
+    float acc_lo;
+    float acc_hi;
+    float jerk_lo;
+    float jerk_hi;
+    size_t first;
+    size_t last;
+    bool operator<(const Box& other) const {return acc_lo<other.acc_lo;}
+  };
+
+  unsigned int factor;
+  unsigned int size;
+  AccelerationPlan& plan;
+  float min_snr;
+  float miss_prob;
+  float false_alarms;
+  float min_freq;
+  float max_freq;
+  unsigned int nharmonics;
+  float freq_tol;
+  unsigned int max_ratio;
+  double tobs;
+  float threshold;
+  double expected_false_alarms;
+  CuFFTerR2C r2cfft;
+  DeviceTimeSeries<float> d_tim;
+  DeviceTimeSeries<float> d_tim_r;
+  DeviceFourierSeries<cufftComplex> d_fseries;
+  DevicePowerSpectrum<float> pspec;
+  HarmonicSums<float> sums;
+  HarmonicFolder harm_folder;
+  PeakFinder cand_finder;
+  HarmonicDistiller harm_finder;
+  TimeDomainResampler resampler;
+  SpectrumFormer former;
+  float mean,std,rms;
+  std::vector<float> acc_list;
+  std::vector<float> jerk_list;
+  std::vector<Box> boxes;
+  std::vector<float> box_acc_lo;
+  float max_box_width;
+  std::vector<double> hit_freqs;
+  std::vector<double> hit_tols;
+  std::vector<int> found;
+
+  //Trials either side of value in a sorted trial list
+  static void bracket(std::vector<float>& sorted, float value, float& lo, float& hi)
+  {
+    std::vector<float>::iterator it = std::lower_bound(sorted.begin(),sorted.end(),value);
+    lo = (it==sorted.begin()) ? value : *(it-1);
+    if (it!=sorted.end() && *it==value)
+      it++;
+    hi = (it==sorted.end()) ? value : *it;
+  }
+
+  //Boxes containing a fine trial: those with acc_lo in [acc-max_box_width,acc]
+  void containing(float acc, float jerk, std::vector<int>& result)
+  {
+    result.clear();
+    std::vector<float>::iterator first = std::lower_bound(box_acc_lo.begin(),box_acc_lo.end(),
+							  acc-max_box_width);
+    std::vector<float>::iterator last = std::upper_bound(first,box_acc_lo.end(),acc);
+    for (size_t ii=first-box_acc_lo.begin();ii<last-box_acc_lo.begin();ii++){
+      Box& box = boxes[ii];
+      if (acc<=box.acc_hi && jerk>=box.jerk_lo && jerk<=box.jerk_hi)
+	result.push_back(ii);
+    }
+  }
+
+  //Boxcar response of summing factor samples at the highest coarse frequency
+  double coarse_efficiency(void)
+  {
+    double tsamp = tobs/(size*(double)factor);
+    double freq = std::min((double)max_freq,0.5/(factor*tsamp));
+    double x = M_PI*freq*tsamp;
+    if (x<=0)
+      return 1.0;
+    return fabs(sin(factor*x)/(factor*sin(x)));
+  }
+
+  //Coarse threshold for the current trial lists
+  void set_threshold(void)
+  {
+    double fmax = std::min((double)max_freq,0.5*size/tobs);
+    double nbins = std::max(1.0,(fmax-min_freq)*tobs);
+    double ntrials = nbins*(nharmonics+1)*acc_list.size()*jerk_list.size();
+    float false_alarm_threshold = stats::gaussian_isf(false_alarms/ntrials);
+    float miss_threshold = min_snr*coarse_efficiency()-stats::gaussian_isf(miss_prob);
+    threshold = std::min(false_alarm_threshold,miss_threshold);
+    expected_false_alarms = ntrials*0.5*erfc(threshold/sqrt(2.0));
+    cand_finder.set_threshold(threshold);
+  }
+
+public:
+  /*!
+    \param size Full resolution transform length.
+    \param factor Number of samples summed into each coarse sample.
+    \param plan Acceleration plan for the coarse series.
+    \param min_snr Full resolution S/N threshold.
+    \param miss_prob Allowed probability of missing a min_snr signal.
+    \param false_alarms Allowed number of noise detections per DM.
+    \param min_freq Lowest frequency to search.
+    \param max_freq Highest frequency to search.
+    \param nharmonics Number of harmonic folds.
+    \param freq_tol Fractional frequency tolerance.
+    \param max_harm Highest harmonic removed by the harmonic distiller.
+    \param tsamp Full resolution sampling time (s).
+  */
+  CoarseAccelerationSearch(unsigned int size, unsigned int factor,
+			   AccelerationPlan& plan, float min_snr,
+			   float miss_prob, float false_alarms,
+			   float min_freq, float max_freq,
+			   unsigned int nharmonics, float freq_tol,
+			   float max_harm, float tsamp)
+    :factor(factor),size((size/factor)&~1u),plan(plan),min_snr(min_snr),
+     miss_prob(miss_prob),false_alarms(false_alarms),min_freq(min_freq),
+     max_freq(max_freq),nharmonics(nharmonics),freq_tol(freq_tol),
+     max_ratio(1<<nharmonics),tobs(this->size*factor*(double)tsamp),
+     threshold(min_snr),expected_false_alarms(0),
+     r2cfft(this->size),d_tim(this->size),d_tim_r(this->size),
+     d_fseries(this->size/2+1,1.0/tobs),pspec(d_fseries),
+     sums(pspec,nharmonics),harm_folder(sums),
+     cand_finder(min_snr,min_freq,max_freq,this->size),
+     harm_finder(freq_tol,max_harm,false),max_box_width(0)
+  {
+    if (factor<2)
+      ErrorChecker::throw_error("CoarseAccelerationSearch: factor must be at least 2");
+    if (miss_prob<=0 || miss_prob>=1 || false_alarms<=0)
+      ErrorChecker::throw_error("CoarseAccelerationSearch: need 0<miss_prob<1 and false_alarms>0");
+    d_tim.set_tsamp(factor*tsamp);
+  }
+
+  unsigned int get_size(void){return size;}
+
+  //Threshold of the last coarse search and its expected noise detections
+  float get_threshold(void){return threshold;}
+  double get_expected_false_alarms(void){return expected_false_alarms;}
+
+  /*!
+    \brief Search the coarse trial grid and record the neighbourhoods of its detections.
+
+    \param tim Dereddened full resolution time series.
+    \param dm DM of the series.
+    \param dm_idx Index of the DM trial.
+  */
+  void search(DeviceTimeSeries<float>& tim, float dm, int dm_idx)
+  {
+    boxes.clear();
+    hit_freqs.clear();
+    hit_tols.clear();
+    device_tscrunch(tim.get_data(),d_tim.get_data(),size,factor,
+		    MAX_THREADS,MAX_BLOCKS);
+    //the summed series is normalised against its own spectrum
+    r2cfft.execute(d_tim.get_data(),d_fseries.get_data());
+    former.form_interpolated(d_fseries,pspec);
+    stats::stats<float>(pspec.get_data(),size/2+1,&mean,&rms,&std);
+
+    plan.generate_accel_list(dm,acc_list);
+    plan.generate_jerk_list(dm,jerk_list);
+    set_threshold();
+    std::vector<float> sorted_accs(acc_list);
+    std::vector<float> sorted_jerks(jerk_list);
+    std::sort(sorted_accs.begin(),sorted_accs.end());
+    std::sort(sorted_jerks.begin(),sorted_jerks.end());
+    double tobs_over_c = tobs/SPEED_OF_LIGHT;
+
+    for (int jj=0;jj<jerk_list.size();jj++){
+      for (int kk=0;kk<acc_list.size();kk++){
+	float acc = acc_list[kk];
+	float jerk = jerk_list[jj];
+	if (jerk!=0)
+	  resampler.resampleIII(d_tim,d_tim_r,size,acc,jerk);
+	else
+	  resampler.resampleII(d_tim,d_tim_r,size,acc);
+	r2cfft.execute(d_tim_r.get_data(),d_fseries.get_data());
+	former.form_interpolated(d_fseries,pspec);
+	stats::normalise(pspec.get_data(),mean,std,size/2+1);
+	SpectrumCandidates trial_cands(dm,dm_idx,acc,jerk);
+	harm_folder.fold(pspec);
+	cand_finder.find_candidates(pspec,trial_cands);
+	cand_finder.find_candidates(sums,trial_cands);
+	std::vector<Candidate> cands = harm_finder.distill(trial_cands.cands);
+	if (cands.empty())
+	  continue;
+
+	Box box;
+	bracket(sorted_accs,acc,box.acc_lo,box.acc_hi);
+	bracket(sorted_jerks,jerk,box.jerk_lo,box.jerk_hi);
+	double dacc = std::max(acc-box.acc_lo,box.acc_hi-acc);
+	double djerk = std::max(jerk-box.jerk_lo,box.jerk_hi-jerk);
+	//same drift as AccelerationDistiller plus two coarse bins
+	double drift = freq_tol + dacc*tobs_over_c + djerk*tobs_over_c*tobs/8.0;
+	box.first = hit_freqs.size();
+	for (int ii=0;ii<cands.size();ii++){
+	  hit_freqs.push_back(cands[ii].freq);
+	  hit_tols.push_back(cands[ii].freq*drift + 2.0/tobs);
+	}
+	box.last = hit_freqs.size();
+	boxes.push_back(box);
+      }
+    }
+
+    //sorted by lower acceleration edge, so a trial's boxes are one binary search away
+    std::sort(boxes.begin(),boxes.end());
+    box_acc_lo.resize(boxes.size());
+    max_box_width = 0;
+    for (int ii=0;ii<boxes.size();ii++){
+      box_acc_lo[ii] = boxes[ii].acc_lo;
+      max_box_width = std::max(max_box_width,boxes[ii].acc_hi-boxes[ii].acc_lo);
+    }
+  }
+
+  size_t get_nhits(void){return hit_freqs.size();}
+
+  /*!
+    \brief Drop fine trials that lie outside every coarse neighbourhood.
+
+    \param accs Accelerations of the fine trials.
+    \param jerks Jerks of the fine trials (same length as accs).
+  */
+  void select_trials(std::vector<float>& accs, std::vector<float>& jerks)
+  {
+    size_t nkept = 0;
+    for (size_t ii=0;ii<accs.size();ii++){
+      containing(accs[ii],jerks[ii],found);
+      if (found.empty())
+	continue;
+      accs[nkept] = accs[ii];
+      jerks[nkept] = jerks[ii];
+      nkept++;
+    }
+    accs.resize(nkept);
+    jerks.resize(nkept);
+  }
+
+  /*!
+    \brief Bins a fine trial must search: the frequencies of the hits of
+    its boxes and their harmonics and subharmonics up to 2^nharmonics.
+
+    \param acc Acceleration of the fine trial.
+    \param jerk Jerk of the fine trial.
+    \param bin_width Full resolution bin width (Hz).
+    \param ranges [start,end) bins of each fold, for HarmonicPeakFinder.
+  */
+  void neighbourhood_bins(float acc, float jerk, double bin_width,
+			  std::vector< std::vector< std::pair<int,int> > >& ranges)
+  {
+    ranges.resize(nharmonics+1);
+    for (int nh=0;nh<=nharmonics;nh++)
+      ranges[nh].clear();
+    containing(acc,jerk,found);
+    for (int ii=0;ii<found.size();ii++){
+      Box& box = boxes[found[ii]];
+      for (size_t jj=box.first;jj<box.last;jj++)
+	for (unsigned int hh=1;hh<=max_ratio;hh++)
+	  for (int sub=0;sub<(hh>1?2:1);sub++){
+	    double freq = sub ? hit_freqs[jj]/hh : hit_freqs[jj]*hh;
+	    double tol = sub ? hit_tols[jj]/hh : hit_tols[jj]*hh;
+	    //fold nh reports bin b at frequency b*bin_width/2^nh
+	    for (int nh=0;nh<=nharmonics;nh++){
+	      double scale = (1<<nh)/bin_width;
+	      double lo = std::max(0.0,floor((freq-tol)*scale));
+	      double hi = ceil((freq+tol)*scale)+1;
+	      if (hi>lo && lo<INT_MAX)
+		ranges[nh].push_back(std::make_pair((int)lo,(int)std::min(hi,(double)INT_MAX)));
+	    }
+	  }
+    }
+  }
+};
@@ -51,6 +51,11 @@ public:
     return dm_list;
   }
 
+  //Largest dispersion delay of the current DM list (samples)
+  size_t get_max_delay(void){
+    return dedisp_get_max_delay(plan);
+  }
+
   void generate_dm_list(float dm_start, float dm_end,
 			float width, float tolerance)
   {
@@ -6,6 +6,9 @@
 #include "utils/utils.hpp"
 #include "utils/exceptions.hpp"
 #include <iostream>
+#include <vector>
+#include <complex>
+#include <algorithm>
 
 class Dereddener {
 private:
@@ -66,3 +69,100 @@ public:
   }
   
 };
+
+/*
+  CPU counterpart of Dereddener. The running median is built from the
+  same three levels of median-of-5 scrunching and linear stretching as
+  the device version.
+*/
+class HostDereddener {
+private:
+  unsigned int size;
+  std::vector<float> median_5;
+  std::vector<float> median_25;
+  std::vector<float> median_125;
+  std::vector<float> median;
+  std::vector<float> intermediate;
+
+  static void median_scrunch5(const float* in, size_t count, float* out)
+  {
+    float vals[5];
+    if (count<5){
+      if (count==0)
+	return;
+      std::copy(in,in+count,vals);
+      std::sort(vals,vals+count);
+      if (count%2)
+	*out = vals[count/2];
+      else
+	*out = 0.5f*(vals[count/2-1]+vals[count/2]);
+      return;
+    }
+    size_t out_count = count/5;
+    for (size_t ii=0;ii<out_count;ii++){
+      std::copy(in+5*ii,in+5*ii+5,vals);
+      std::nth_element(vals,vals+2,vals+5);
+      out[ii] = vals[2];
+    }
+  }
+
+  static void linear_stretch(const float* in, size_t in_count,
+			     float* out, size_t out_count)
+  {
+    float step = float(in_count-1)/(out_count-1);
+    for (size_t ii=0;ii<out_count;ii++){
+      float x = ii * step;
+      unsigned int jj = x;
+      out[ii] = in[jj] + ((x-jj > 1e-5f) ? (x-jj)*(in[jj+1]-in[jj]) : 0.f);
+    }
+  }
+
+public:
+  HostDereddener(unsigned int size)
+    :size(size),median_5(size/5),median_25(size/5/5),median_125(size/5/5/5),
+     median(size),intermediate(size){}
+
+  void calculate_median(const float* powers, double bin_width,
+			float boundary_5_freq=0.05,
+			float boundary_25_freq=0.5)
+  {
+    int pos5  = (int) (boundary_5_freq/bin_width);
+    int pos25 = (int) (boundary_25_freq/bin_width);
+    median_scrunch5(powers,size,&median_5[0]);
+    median_scrunch5(&median_5[0],size/5,&median_25[0]);
+    median_scrunch5(&median_25[0],size/5/5,&median_125[0]);
+
+    linear_stretch(&median_5[0],size/5,&intermediate[0],size);
+    std::copy(&intermediate[0],&intermediate[0]+pos5,&median[0]);
+
+    linear_stretch(&median_25[0],size/5/5,&intermediate[0],size);
+    std::copy(&intermediate[0]+pos5,&intermediate[0]+pos5+pos25,&median[0]+pos5);
+
+    linear_stretch(&median_125[0],size/5/5/5,&intermediate[0],size);
+    std::copy(&intermediate[0]+pos25,&intermediate[0]+size,&median[0]+pos25);
+  }
+
+  void calculate_median(HostPowerSpectrum<float>& powers,
+			float boundary_5_freq=0.05,
+			float boundary_25_freq=0.5)
+  {
+    if (powers.get_nbins()!=size)
+      ErrorChecker::throw_error("Bad data length given to running_median()");
+    calculate_median(powers.get_data(),powers.get_bin_width(),
+		     boundary_5_freq,boundary_25_freq);
+  }
+
+  void deredden(std::complex<float>* spectrum)
+  {
+    for (unsigned int ii=0;ii<size;ii++){
+      if (ii<5)
+	spectrum[ii] = std::complex<float>(0.0,0.0);
+      else
+	spectrum[ii] /= median[ii];
+    }
+  }
+
+  void deredden(HostFourierSeries< std::complex<float> >& spectrum){
+    deredden(spectrum.get_data());
+  }
+};
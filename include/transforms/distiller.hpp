@@ -1,9 +1,16 @@
 #pragma once
 #include "stdio.h"
 #include "data_types/candidates.hpp"
+#include "data_types/candidatetable.hpp"
+#include "data_types/candidateindex.hpp"
+#include "unistd.h"
+#include <pthread.h>
 #include <vector>
+#include <set>
+#include <map>
 #include <cmath>
 #include <algorithm>
+#include <utils/exceptions.hpp>
 
 #define SPEED_OF_LIGHT 299792458.0
 
@@ -13,49 +20,162 @@ struct snr_less_than {
   }
 };
 
+//Relative widening of search windows, covering rounding in the exact tests
+#define DISTILL_WINDOW_MARGIN 1e-6
+
+struct row_snr_greater_than {
+  const std::vector<float>* snr;
+  row_snr_greater_than(const std::vector<float>& snr):snr(&snr){}
+  bool operator()(int x, int y){
+    return ((*snr)[x]>(*snr)[y]);
+  }
+};
+
+/*
+  Candidates are taken in order of decreasing S/N; each one still
+  unique removes the lower S/N candidates related to it. Rather than
+  testing every later candidate, each distiller names the frequency
+  windows that can hold related candidates, these are looked up in a
+  CandidateIndex of the rows, and only the candidates found there get
+  the exact relation test. The result is the same as testing all pairs.
+
+  Distilling works on the rows of a CandidateTable, where relating a
+  candidate adds an association edge instead of copying it into the
+  fundamental; the Candidate vector interface converts at either end.
+*/
 class BaseDistiller {
+  template <class Distiller> friend class ParallelDistiller;
 protected:
   std::vector<bool> unique;
+  std::vector<int> order;
   int size;
   bool keep_related;
-  virtual void condition(std::vector<Candidate>& cands, int idx){}
-  BaseDistiller(bool keep_related)
-    :keep_related(keep_related){}
-
-public:      
-  std::vector<Candidate> distill(std::vector<Candidate>& cands)
-  {
-    size = cands.size();
-    unique.resize(size);
-    std::fill(unique.begin(),unique.end(),true);
-    std::sort(cands.begin(),cands.end(),snr_less_than()); //Sort by snr !IMPORTANT       
-    int ii;
-    int idx;
-    int start=0;
-    int count=0;
-    while (true) {
-      idx = -1; //Sentinel value                                                    
-      for(ii=start;ii<size;ii++){
-        if (unique[ii]){
-          start = ii+1;
-          idx = ii;
-          break;
-        }
+  CandidateIndex index;
+  std::vector<std::pair<double,double> > ranges;
+  std::vector<int> found;
+  std::vector<std::pair<int,int> > relations;
+
+  //Called with the rows in S/N order before distilling
+  virtual void prepare(const CandidateTable& table, const std::vector<int>& rows){}
+
+  //Frequency ranges that can hold candidates related to row fundi
+  virtual void windows(const CandidateTable& table, int fundi,
+		       std::vector<std::pair<double,double> >& ranges)=0;
+
+  //Number of times row other relates to row fundi (it is associated that many times)
+  virtual int related(const CandidateTable& table, int fundi, int other)=0;
+
+  //tolerance sizes the index buckets, about the width of the windows
+  BaseDistiller(bool keep_related, double tolerance)
+    :keep_related(keep_related),index(tolerance){}
+
+  static double window_low(const std::pair<double,double>& range){
+    return range.first-fabs(range.first)*DISTILL_WINDOW_MARGIN;
+  }
+
+  static double window_high(const std::pair<double,double>& range){
+    return range.second+fabs(range.second)*DISTILL_WINDOW_MARGIN;
+  }
+
+  //Sort rows by S/N into order, prepare, and index them; items of the index are S/N positions
+  void index_rows(const CandidateTable& table, const std::vector<int>& rows)
+  {
+    size = rows.size();
+    unique.assign(size,true);
+    order = rows;
+    std::stable_sort(order.begin(),order.end(),row_snr_greater_than(table.snr)); //Sort by snr !IMPORTANT
+    prepare(table,order);
+    index.build(table,order);
+  }
+
+  //Positions after idx in the S/N order related to it, with how many times they are
+  void find_related(const CandidateTable& table, int idx,
+		    std::vector<std::pair<double,double> >& ranges, std::vector<int>& found,
+		    std::vector<std::pair<int,int> >& relations)
+  {
+    ranges.clear();
+    windows(table,order[idx],ranges);
+    for (int ii=0;ii<ranges.size();ii++)
+      ranges[ii] = std::make_pair(window_low(ranges[ii]),window_high(ranges[ii]));
+    found.clear();
+    index.query(ranges,found);
+    //only weaker candidates can be related
+    int nfound = 0;
+    for (int ii=0;ii<found.size();ii++)
+      if (found[ii]>idx)
+	found[nfound++] = found[ii];
+    found.resize(nfound);
+    std::sort(found.begin(),found.end());
+    for (int ii=0;ii<found.size();ii++){
+      int nrelated = related(table,order[idx],order[found[ii]]);
+      if (nrelated>0)
+	relations.push_back(std::make_pair(found[ii],nrelated));
+    }
+  }
+
+  void condition(const CandidateTable& table, int idx,
+		 std::vector<std::pair<int,int> >& links)
+  {
+    relations.clear();
+    find_related(table,idx,ranges,found,relations);
+    for (int ii=0;ii<relations.size();ii++){
+      for (int jj=0;jj<relations[ii].second;jj++){
+	if (keep_related)
+	  links.push_back(std::make_pair(order[idx],order[relations[ii].first]));
+	unique[relations[ii].first]=false;
       }
-      if (idx==-1)
-        break;
-      else{
+    }
+  }
+
+  /*
+    Distill without touching the table: the surviving rows in order of
+    decreasing S/N, and the (fundamental, related) association edges in
+    the order they are to be added.
+  */
+  void distill_rows(const CandidateTable& table, const std::vector<int>& rows,
+		    std::vector<int>& survivors, std::vector<std::pair<int,int> >& links)
+  {
+    index_rows(table,rows);
+    int count=0;
+    for (int ii=0;ii<size;ii++){
+      if (unique[ii]){
 	count++;
-	condition(cands,idx);
+	condition(table,ii,links);
       }
     }
-    std::vector<Candidate> new_cands;
-    new_cands.reserve(count);
-    for (ii=0;ii<size;ii++){
+    survivors.clear();
+    survivors.reserve(count);
+    for (int ii=0;ii<size;ii++){
       if (unique[ii])
-        new_cands.push_back(cands[ii]);
+        survivors.push_back(order[ii]);
     }
-    return new_cands;
+  }
+
+public:
+  virtual ~BaseDistiller(){}
+
+  /*!
+    \brief Distill rows of a candidate table.
+
+    \param table Candidates, gains the association edges.
+    \param rows Rows to distill.
+    \return Surviving rows in order of decreasing S/N.
+  */
+  std::vector<int> distill(CandidateTable& table, const std::vector<int>& rows)
+  {
+    std::vector<int> new_rows;
+    std::vector<std::pair<int,int> > links;
+    distill_rows(table,rows,new_rows,links);
+    for (int ii=0;ii<links.size();ii++)
+      table.add_assoc(links[ii].first,links[ii].second);
+    return new_rows;
+  }
+
+  std::vector<Candidate> distill(const std::vector<Candidate>& cands)
+  {
+    CandidateTable table;
+    std::vector<int> rows = table.append(cands);
+    return table.to_candidates(distill(table,rows));
   }
 };
 
@@ -65,100 +185,120 @@ private:
   float tolerance;
   float max_harm;
   bool fractional_harms;
+  float max_denominator;
 
-  void condition(std::vector<Candidate>& cands, int idx)
+  void prepare(const CandidateTable& table, const std::vector<int>& rows)
   {
-    int ii,jj,kk;
-    double ratio,freq;
-    int nh;
+    max_denominator = 1;
+    if (fractional_harms)
+      for (int ii=0;ii<rows.size();ii++)
+	max_denominator = std::max(max_denominator,(float)pow(2.0,table.nh[rows[ii]]));
+  }
+
+  //kk*freq/(jj*fundi_freq) within tolerance of 1 for some jj, kk
+  void windows(const CandidateTable& table, int fundi,
+	       std::vector<std::pair<double,double> >& ranges)
+  {
+    double fundi_freq = table.freq[fundi];
+    for (int jj=1;jj<=this->max_harm;jj++)
+      for (int kk=1;kk<=max_denominator;kk++)
+	ranges.push_back(std::make_pair(jj*fundi_freq*(1-tolerance)/kk,
+					jj*fundi_freq*(1+tolerance)/kk));
+  }
+
+  int related(const CandidateTable& table, int fundi, int other)
+  {
+    int jj,kk;
+    double ratio;
     double upper_tol = 1+tolerance;
     double lower_tol = 1-tolerance;
-    double fundi_freq = cands[idx].freq;
-    float max_denominator;
-    for (ii=idx+1;ii<size;ii++){
-      freq = cands[ii].freq;
-      nh = cands[ii].nh;
-      
-      /*
-      if (cands[ii].nh > cands[idx].nh){
-        continue;
-	}
-      */
-
-      if (fractional_harms)
-	max_denominator = pow(2.0,nh);
-      else
-	max_denominator = 1;
-      for (jj=1;jj<=this->max_harm;jj++){
-        for (kk=1;kk<=max_denominator;kk++){
-          ratio = kk*freq/(jj*fundi_freq);
-          if (ratio>(lower_tol)&&ratio<(upper_tol)){
-	    if (keep_related)
-	      cands[idx].append(cands[ii]);
-            unique[ii]=false;
-          }
-	}
+    double fundi_freq = table.freq[fundi];
+    double freq = table.freq[other];
+    float denominator;
+    int nrelated = 0;
+    if (fractional_harms)
+      denominator = pow(2.0,table.nh[other]);
+    else
+      denominator = 1;
+    for (jj=1;jj<=this->max_harm;jj++){
+      for (kk=1;kk<=denominator;kk++){
+	ratio = kk*freq/(jj*fundi_freq);
+	if (ratio>(lower_tol)&&ratio<(upper_tol))
+	  nrelated++;
       }
     }
+    return nrelated;
   }
   
 public:
   HarmonicDistiller(float tol, float max_harm, bool keep_related, bool fractional_harms=true)
-    :BaseDistiller(keep_related),tolerance(tol),max_harm(max_harm),fractional_harms(fractional_harms){}
+    :BaseDistiller(keep_related,tol),tolerance(tol),max_harm(max_harm),
+     fractional_harms(fractional_harms),max_denominator(1){}
 };
 
 
 //Remove other candidates with lower S/N and equal or lower harmonic number
 //Use a user defined period tolerance, but calculate the delta f for the 
 //delta acc between fundamental and test signal.
+//A delta jerk sweeps the frequency through freq*delta_jerk*tobs^2/(8c).
 
 class AccelerationDistiller: public BaseDistiller {
 private:
   float tobs;
   double tobs_over_c;
   float tolerance;
+  float min_acc, max_acc;
+  float min_jerk, max_jerk;
   
-  float correct_for_acceleration(double freq, double delta_acc){
-    return freq+delta_acc*freq*tobs_over_c;
+  float correct_for_acceleration(double freq, double delta_acc, double delta_jerk=0.0){
+    return freq+delta_acc*freq*tobs_over_c+delta_jerk*freq*tobs_over_c*tobs/8.0;
   }
 
-  void condition(std::vector<Candidate>& cands,int idx)
+  void prepare(const CandidateTable& table, const std::vector<int>& rows)
   {
-    int ii,jj,kk;
-    double ratio,freq;
-    double fundi_freq = cands[idx].freq;
-    double fundi_acc = cands[idx].acc;
-    double acc_freq;
-    double delta_acc;
-    double edge = fundi_freq*tolerance;
-    for (ii=idx+1;ii<size;ii++){
-      /*
-      if (cands[ii].nh > cands[idx].nh){
-	continue;
-	}*/
+    min_acc = max_acc = min_jerk = max_jerk = 0;
+    for (int ii=0;ii<rows.size();ii++){
+      float acc = table.acc[rows[ii]];
+      float jerk = table.jerk[rows[ii]];
+      if (ii==0 || acc<min_acc) min_acc = acc;
+      if (ii==0 || acc>max_acc) max_acc = acc;
+      if (ii==0 || jerk<min_jerk) min_jerk = jerk;
+      if (ii==0 || jerk>max_jerk) max_jerk = jerk;
+    }
+  }
 
-      delta_acc = fundi_acc-cands[ii].acc;
-      acc_freq = correct_for_acceleration(fundi_freq,delta_acc);
+  //The largest acceleration and jerk offsets bound the frequency sweep
+  void windows(const CandidateTable& table, int fundi,
+	       std::vector<std::pair<double,double> >& ranges)
+  {
+    double fundi_freq = table.freq[fundi];
+    float fundi_acc = table.acc[fundi];
+    float fundi_jerk = table.jerk[fundi];
+    double max_delta_acc = std::max(fabs(fundi_acc-min_acc),fabs(fundi_acc-max_acc));
+    double max_delta_jerk = std::max(fabs(fundi_jerk-min_jerk),fabs(fundi_jerk-max_jerk));
+    double sweep = fabs(fundi_freq)*tobs_over_c*(max_delta_acc+max_delta_jerk*tobs/8.0);
+    double edge = fundi_freq*tolerance;
+    ranges.push_back(std::make_pair(fundi_freq-edge-sweep,fundi_freq+edge+sweep));
+  }
 
-      if (acc_freq>fundi_freq){
-	if (cands[ii].freq>fundi_freq-edge && cands[ii].freq<acc_freq+edge){
-	  if (keep_related)
-	    cands[idx].append(cands[ii]);
-	  unique[ii]=false;
-	}
-      } else {
-	if (cands[ii].freq<fundi_freq+edge && cands[ii].freq>acc_freq-edge){
-	  if (keep_related)
-	    cands[idx].append(cands[ii]);
-	  unique[ii]=false;
-	}
-      }
-    }
+  int related(const CandidateTable& table, int fundi, int other)
+  {
+    double fundi_freq = table.freq[fundi];
+    double delta_acc = table.acc[fundi]-table.acc[other];
+    double delta_jerk = table.jerk[fundi]-table.jerk[other];
+    double acc_freq = correct_for_acceleration(fundi_freq,delta_acc,delta_jerk);
+    double edge = fundi_freq*tolerance;
+    float freq = table.freq[other];
+    if (acc_freq>fundi_freq)
+      return (freq>fundi_freq-edge && freq<acc_freq+edge);
+    else
+      return (freq<fundi_freq+edge && freq>acc_freq-edge);
   }
   
 public:
   AccelerationDistiller(float tobs, float tolerance, bool keep_related)
-    :BaseDistiller(keep_related),tobs(tobs),tolerance(tolerance){
+    :BaseDistiller(keep_related,tolerance),tobs(tobs),tolerance(tolerance),
+     min_acc(0),max_acc(0),min_jerk(0),max_jerk(0){
     tobs_over_c = tobs/SPEED_OF_LIGHT;
   }
 };
@@ -168,32 +308,503 @@ public:
 class DMDistiller: public BaseDistiller {
 private:
   float tolerance;
-  double ratio;
 
-  void condition(std::vector<Candidate>& cands,int idx)
+  void windows(const CandidateTable& table, int fundi,
+	       std::vector<std::pair<double,double> >& ranges)
+  {
+    double fundi_freq = table.freq[fundi];
+    ranges.push_back(std::make_pair(fundi_freq*(1-tolerance),fundi_freq*(1+tolerance)));
+  }
+
+  int related(const CandidateTable& table, int fundi, int other)
   {
-    int ii;
-    double fundi_freq = cands[idx].freq;
+    double fundi_freq = table.freq[fundi];
     double upper_tol = 1+tolerance;
     double lower_tol = 1-tolerance;
-    for (ii=idx+1;ii<size;ii++){
-      /*
-      if (cands[ii].nh > cands[idx].nh){
-        continue;
-	}*/
-      
-      ratio = cands[ii].freq/fundi_freq;
-      if (ratio>(lower_tol)&&ratio<(upper_tol)){
-	if (keep_related)
-	  cands[idx].append(cands[ii]);
-	unique[ii]=false;
-      }
-    }
+    double ratio = table.freq[other]/fundi_freq;
+    return (ratio>(lower_tol)&&ratio<(upper_tol));
   }
   
 public:
   DMDistiller(float tolerance, bool keep_related)
-    :BaseDistiller(keep_related),tolerance(tolerance){}
+    :BaseDistiller(keep_related,tolerance),tolerance(tolerance){}
+};
+
+/*
+  Distills on several threads with the result of a single distiller.
+
+  Two candidates can only affect each other's fate if one lies in a
+  window of the other, so the rows are first split into groups closed
+  under the distiller's windows: every window, including the harmonic
+  images of the harmonic distiller, joins the candidate to everything
+  inside it. This pass is a window search per candidate and runs on all
+  threads; the groups are then formed with a union-find.
+
+  Groups are dealt, in order of frequency, into bands of similar size
+  that threads take in turn and distill independently. No relation
+  crosses a band, so distilling a band alone removes and associates
+  exactly what distilling everything at once would. The surviving rows
+  are merged back into the single distiller's S/N order and the
+  association edges are added band by band, so the output does not
+  depend on the number of threads.
+
+  Harmonic windows reach across the whole spectrum and chain nearly
+  every candidate into one group, which would leave a single band for
+  one thread. When the largest group is more than a thread's share of
+  the rows, the threads instead find the weaker candidates related to
+  every candidate, unique or not, and one pass in S/N order keeps the
+  candidates no surviving stronger one relates to, adding the edges of
+  the survivors as it goes. This repeats the window searches a single
+  distiller skips for removed candidates, but only the final pass is
+  serial.
+*/
+template <class Distiller>
+class ParallelDistiller {
+private:
+  struct Chunk {
+    Distiller distiller;
+    BaseDistiller* indexed;
+    const CandidateTable* table;
+    size_t start;
+    size_t end;
+    std::vector<int> cover;
+    std::vector<std::pair<int,int> > joins;
+    std::vector<std::pair<double,double> > ranges;
+    std::vector<int> found;
+    std::vector<std::pair<int,int> > relations;
+    std::vector<size_t> relation_start;
+    std::vector<std::vector<int> >* bands;
+    std::vector<std::vector<int> >* survivors;
+    std::vector<std::vector<std::pair<int,int> > >* links;
+    int* next_band;
+    Chunk(const Distiller& distiller):distiller(distiller){}
+  };
+
+  Distiller indexer;
+  std::vector<Chunk> chunks;
+  std::vector<pthread_t> threads;
+  std::vector<int> parent;
+  std::vector<int> band_of;
+  std::vector<std::vector<int> > bands;
+  std::vector<std::vector<int> > survivors;
+  std::vector<std::vector<std::pair<int,int> > > links;
+  size_t min_rows;
+  bool banded;
+
+  /*
+    Window positions of rows [start,end) of the S/N order. A window
+    covering frequency index positions a..b joins a to the row
+    (joins) and each of a..b to the next (cover, as +1 at a and -1 at b).
+  */
+  static void* window_chunk(void* arg)
+  {
+    Chunk& chunk = *(Chunk*) arg;
+    BaseDistiller& indexed = *chunk.indexed;
+    const CandidateIndex& index = indexed.index;
+    for (size_t idx=chunk.start;idx<chunk.end;idx++){
+      chunk.ranges.clear();
+      indexed.windows(*chunk.table,indexed.order[idx],chunk.ranges);
+      for (int ii=0;ii<chunk.ranges.size();ii++){
+	size_t a,end;
+	index.span(BaseDistiller::window_low(chunk.ranges[ii]),
+		   BaseDistiller::window_high(chunk.ranges[ii]),a,end);
+	if (a>=end)
+	  continue;
+	chunk.joins.push_back(std::make_pair((int)index.position(idx),(int)a));
+	chunk.cover[a]++;
+	chunk.cover[end-1]--;
+      }
+    }
+    return NULL;
+  }
+
+  //Related positions of rows [start,end) of the S/N order, for a serial pass
+  static void* relate_chunk(void* arg)
+  {
+    Chunk& chunk = *(Chunk*) arg;
+    BaseDistiller& indexed = *chunk.indexed;
+    chunk.relations.clear();
+    chunk.relation_start.clear();
+    for (size_t idx=chunk.start;idx<chunk.end;idx++){
+      chunk.relation_start.push_back(chunk.relations.size());
+      indexed.find_related(*chunk.table,idx,chunk.ranges,chunk.found,chunk.relations);
+    }
+    chunk.relation_start.push_back(chunk.relations.size());
+    return NULL;
+  }
+
+  //Keep each row no surviving stronger row relates to, in S/N order
+  std::vector<int> resolve(CandidateTable& table, BaseDistiller& indexed)
+  {
+    std::vector<int> new_rows;
+    for (int jj=0;jj<chunks.size();jj++){
+      Chunk& chunk = chunks[jj];
+      for (size_t idx=chunk.start;idx<chunk.end;idx++){
+	if (!indexed.unique[idx])
+	  continue;
+	new_rows.push_back(indexed.order[idx]);
+	for (size_t ii=chunk.relation_start[idx-chunk.start];
+	     ii<chunk.relation_start[idx-chunk.start+1];ii++){
+	  int other = chunk.relations[ii].first;
+	  for (int kk=0;kk<chunk.relations[ii].second;kk++){
+	    if (indexed.keep_related)
+	      table.add_assoc(indexed.order[idx],indexed.order[other]);
+	    indexed.unique[other] = false;
+	  }
+	}
+      }
+      std::vector<std::pair<int,int> >().swap(chunk.relations);
+      std::vector<size_t>().swap(chunk.relation_start);
+    }
+    return new_rows;
+  }
+
+  static void* distill_chunk(void* arg)
+  {
+    Chunk& chunk = *(Chunk*) arg;
+    BaseDistiller& distiller = chunk.distiller;
+    int nbands = chunk.bands->size();
+    int band;
+    while ((band = __sync_fetch_and_add(chunk.next_band,1)) < nbands)
+      distiller.distill_rows(*chunk.table,(*chunk.bands)[band],
+			     (*chunk.survivors)[band],(*chunk.links)[band]);
+    return NULL;
+  }
+
+  //Chunk 0 runs on the calling thread
+  void run(void* (*func)(void*), unsigned int nchunks)
+  {
+    for (int ii=1;ii<nchunks;ii++)
+      if (pthread_create(&threads[ii],NULL,func,(void*)&chunks[ii]))
+	ErrorChecker::throw_error("ParallelDistiller: failed to create thread");
+    func((void*)&chunks[0]);
+    for (int ii=1;ii<nchunks;ii++)
+      pthread_join(threads[ii],NULL);
+  }
+
+  int find(int ii)
+  {
+    while (parent[ii]!=ii){
+      parent[ii] = parent[parent[ii]];
+      ii = parent[ii];
+    }
+    return ii;
+  }
+
+  void join(int ii, int jj)
+  {
+    ii = find(ii);
+    jj = find(jj);
+    if (ii!=jj)
+      parent[std::max(ii,jj)] = std::min(ii,jj);
+  }
+
+public:
+  /*!
+    \param distiller Distiller to run on each thread (copied per thread).
+    \param nthreads Number of threads to use (0 for all online cores).
+    \param min_rows Fewest rows worth partitioning, fewer are distilled in place.
+  */
+  ParallelDistiller(const Distiller& distiller, unsigned int nthreads=0, size_t min_rows=4096)
+    :indexer(distiller),min_rows(min_rows),banded(false)
+  {
+    if (nthreads==0){
+      long ncores = sysconf(_SC_NPROCESSORS_ONLN);
+      nthreads = std::max(1L,ncores);
+    }
+    chunks.resize(nthreads,Chunk(distiller));
+    threads.resize(nthreads);
+  }
+
+  unsigned int get_nthreads(void){return chunks.size();}
+
+  size_t get_nbands(void){return bands.size();}
+
+  //Whether the last distill() split the rows into bands (false if it related all rows)
+  bool is_banded(void){return banded;}
+
+  /*!
+    \brief Distill rows of a candidate table.
+
+    \param table Candidates, gains the association edges.
+    \param rows Rows to distill.
+    \return Surviving rows in order of decreasing S/N, as Distiller::distill.
+  */
+  std::vector<int> distill(CandidateTable& table, const std::vector<int>& rows)
+  {
+    unsigned int nchunks = chunks.size();
+    bands.clear();
+    banded = false;
+    if (nchunks==1 || rows.size()<std::max(min_rows,(size_t)2*nchunks))
+      return chunks[0].distiller.distill(table,rows);
+
+    //window positions on all threads, against one index of every row
+    BaseDistiller& indexed = indexer;
+    indexed.index_rows(table,rows);
+    int size = rows.size();
+    for (int ii=0;ii<nchunks;ii++){
+      Chunk& chunk = chunks[ii];
+      chunk.indexed = &indexed;
+      chunk.table = &table;
+      chunk.start = ii*(size_t)size/nchunks;
+      chunk.end = (ii+1)*(size_t)size/nchunks;
+      chunk.cover.assign(size+1,0);
+      chunk.joins.clear();
+    }
+    run(&ParallelDistiller::window_chunk,nchunks);
+
+    //groups closed under the windows, over frequency index positions
+    parent.resize(size);
+    for (int ii=0;ii<size;ii++)
+      parent[ii] = ii;
+    int covered = 0;
+    for (int ii=0;ii<size-1;ii++){
+      for (int jj=0;jj<nchunks;jj++)
+	covered += chunks[jj].cover[ii];
+      if (covered>0)
+	join(ii,ii+1);
+    }
+    for (int jj=0;jj<nchunks;jj++){
+      for (int ii=0;ii<chunks[jj].joins.size();ii++)
+	join(chunks[jj].joins[ii].first,chunks[jj].joins[ii].second);
+      std::vector<int>().swap(chunks[jj].cover);
+      std::vector<std::pair<int,int> >().swap(chunks[jj].joins);
+    }
+
+    //one group bigger than a thread's share cannot be banded
+    std::vector<int> group_size(size,0);
+    int largest = 0;
+    for (int ii=0;ii<size;ii++)
+      largest = std::max(largest,++group_size[find(ii)]);
+    if (largest>size/nchunks){
+      run(&ParallelDistiller::relate_chunk,nchunks);
+      return resolve(table,indexed);
+    }
+    banded = true;
+
+    //deal groups, lowest frequency first, into bands of about size/(4*nchunks) rows
+    size_t band_rows = std::max((size_t)1,(size_t)size/(4*nchunks));
+    size_t filled = band_rows;
+    int nbands = 0;
+    band_of.assign(size,-1);
+    for (int ii=0;ii<size;ii++){
+      int group = find(ii);
+      if (band_of[group]>=0)
+	continue;
+      if (filled>=band_rows){
+	nbands++;
+	filled = 0;
+      }
+      band_of[group] = nbands-1;
+      filled += group_size[group];
+    }
+    bands.resize(nbands);
+    for (int idx=0;idx<size;idx++)
+      bands[band_of[find(indexed.index.position(idx))]].push_back(indexed.order[idx]);
+
+    //distill the bands on all threads
+    survivors.resize(nbands);
+    links.resize(nbands);
+    int next_band = 0;
+    for (int ii=0;ii<nchunks;ii++){
+      chunks[ii].bands = &bands;
+      chunks[ii].survivors = &survivors;
+      chunks[ii].links = &links;
+      chunks[ii].next_band = &next_band;
+    }
+    run(&ParallelDistiller::distill_chunk,nchunks);
+
+    //merge in the order of a single distiller
+    std::vector<bool> keep(table.size(),false);
+    size_t count = 0;
+    for (int ii=0;ii<nbands;ii++){
+      for (int jj=0;jj<survivors[ii].size();jj++)
+	keep[survivors[ii][jj]] = true;
+      count += survivors[ii].size();
+      for (int jj=0;jj<links[ii].size();jj++)
+	table.add_assoc(links[ii][jj].first,links[ii][jj].second);
+    }
+    std::vector<int> new_rows;
+    new_rows.reserve(count);
+    for (int idx=0;idx<size;idx++)
+      if (keep[indexed.order[idx]])
+	new_rows.push_back(indexed.order[idx]);
+    survivors.clear();
+    links.clear();
+    return new_rows;
+  }
+
+  std::vector<Candidate> distill(const std::vector<Candidate>& cands)
+  {
+    CandidateTable table;
+    std::vector<int> rows = table.append(cands);
+    return table.to_candidates(distill(table,rows));
+  }
+};
+
+//S/N order of table rows, ties in the order the rows were added
+struct row_before {
+  const CandidateTable* table;
+  row_before(const CandidateTable& table):table(&table){}
+  bool operator()(int x, int y) const {
+    float snr_x = table->snr[x];
+    float snr_y = table->snr[y];
+    return (snr_x>snr_y || (snr_x==snr_y && x<y));
+  }
+};
+
+/*
+  DM distilling one candidate at a time, while the search is running.
+
+  Rows added so far are kept in a frequency index together with the
+  unique set that DMDistiller would give for them, distilled in row
+  order. A new row is absorbed if a stronger unique row relates to it;
+  otherwise it is unique, and the weaker rows it relates to are
+  re-examined in S/N order, each one that changes state re-examining
+  those it relates to in turn. Each unique row keeps the S/N ordered
+  list of weaker rows it relates to, so finish() only has to add those
+  association edges: the surviving rows and their associations are
+  exactly those of DMDistiller on the same rows.
+*/
+class IncrementalDMDistiller {
+private:
+  typedef std::set<std::pair<double,int> > FreqIndex;
+  float tolerance;
+  bool keep_related;
+  FreqIndex by_freq;
+  std::vector<char> unique;
+  std::map<int,std::vector<int> > children;
+  size_t nunique;
+  size_t nchanges;
+
+  //As DMDistiller::related
+  bool related(const CandidateTable& table, int fundi, int other)
+  {
+    double fundi_freq = table.freq[fundi];
+    double upper_tol = 1+tolerance;
+    double lower_tol = 1-tolerance;
+    double ratio = table.freq[other]/fundi_freq;
+    return (ratio>(lower_tol)&&ratio<(upper_tol));
+  }
+
+  //Rows in [lo,hi] widened by DISTILL_WINDOW_MARGIN
+  FreqIndex::iterator window_begin(double lo){
+    return by_freq.lower_bound(std::make_pair(lo-fabs(lo)*DISTILL_WINDOW_MARGIN,-1));
+  }
+
+  bool in_window(FreqIndex::iterator it, double hi){
+    return it!=by_freq.end() && it->first<=hi+fabs(hi)*DISTILL_WINDOW_MARGIN;
+  }
+
+  //Weaker rows that row relates to, in S/N order
+  void find_weaker(const CandidateTable& table, int row, std::vector<int>& weaker)
+  {
+    row_before before(table);
+    double freq = table.freq[row];
+    weaker.clear();
+    for (FreqIndex::iterator it=window_begin(freq*(1-tolerance));
+	 in_window(it,freq*(1+tolerance));it++)
+      if (before(row,it->second) && related(table,row,it->second))
+	weaker.push_back(it->second);
+    std::sort(weaker.begin(),weaker.end(),before);
+  }
+
+  //Whether a stronger unique row relates to row
+  bool absorbed(const CandidateTable& table, int row)
+  {
+    row_before before(table);
+    double freq = table.freq[row];
+    for (FreqIndex::iterator it=window_begin(freq/(1+tolerance));
+	 in_window(it,freq/(1-tolerance));it++)
+      if (unique[it->second] && before(it->second,row) && related(table,it->second,row))
+	return true;
+    return false;
+  }
+
+public:
+  IncrementalDMDistiller(float tolerance, bool keep_related)
+    :tolerance(tolerance),keep_related(keep_related),nunique(0),nchanges(0){}
+
+  size_t get_nrows(void){return by_freq.size();}
+
+  size_t get_nunique(void){return nunique;}
+
+  //Number of times a row changed from unique to absorbed or back
+  size_t get_nchanges(void){return nchanges;}
+
+  //Add a row of table, which must have been added to the table after any row added before
+  void add(const CandidateTable& table, int row)
+  {
+    if (unique.size()<table.size())
+      unique.resize(table.size(),0);
+    row_before before(table);
+    by_freq.insert(std::make_pair((double)table.freq[row],row));
+
+    //stronger unique rows also relate to the new row
+    if (keep_related){
+      double freq = table.freq[row];
+      for (FreqIndex::iterator it=window_begin(freq/(1+tolerance));
+	   in_window(it,freq/(1-tolerance));it++)
+	if (unique[it->second] && before(it->second,row) && related(table,it->second,row)){
+	  std::vector<int>& list = children[it->second];
+	  list.insert(std::upper_bound(list.begin(),list.end(),row,before),row);
+	}
+    }
+
+    //re-examine in S/N order, a change only affects weaker rows
+    std::set<int,row_before> pending(before);
+    std::vector<int> weaker;
+    pending.insert(row);
+    while (!pending.empty()){
+      int next = *pending.begin();
+      pending.erase(pending.begin());
+      bool is_unique = !absorbed(table,next);
+      if (is_unique==(bool)unique[next])
+	continue;
+      unique[next] = is_unique;
+      if (next!=row)
+	nchanges++;
+      find_weaker(table,next,weaker);
+      pending.insert(weaker.begin(),weaker.end());
+      if (is_unique){
+	nunique++;
+	if (keep_related)
+	  children[next] = weaker;
+      } else {
+	nunique--;
+	children.erase(next);
+      }
+    }
+  }
+
+  void add(const CandidateTable& table, const std::vector<int>& rows)
+  {
+    for (int ii=0;ii<rows.size();ii++)
+      add(table,rows[ii]);
+  }
+
+  /*!
+    \brief Add the association edges of the unique rows.
+
+    \return Unique rows in order of decreasing S/N, as DMDistiller::distill.
+  */
+  std::vector<int> finish(CandidateTable& table)
+  {
+    std::vector<int> rows;
+    rows.reserve(nunique);
+    for (FreqIndex::iterator it=by_freq.begin();it!=by_freq.end();it++)
+      if (unique[it->second])
+	rows.push_back(it->second);
+    std::sort(rows.begin(),rows.end(),row_before(table));
+    for (int ii=0;ii<rows.size();ii++){
+      std::map<int,std::vector<int> >::iterator list = children.find(rows[ii]);
+      if (list==children.end())
+	continue;
+      for (int jj=0;jj<list->second.size();jj++)
+	table.add_assoc(rows[ii],list->second[jj]);
+    }
+    return rows;
+  }
 };
 
 class CandidateTester {
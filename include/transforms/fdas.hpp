@@ -0,0 +1,202 @@
+#pragma once
+#include "cuda.h"
+#include "cufft.h"
+#include <vector>
+#include <complex>
+#include <cmath>
+#include "data_types/fourierseries.hpp"
+#include "data_types/candidates.hpp"
+#include "transforms/ffter.hpp"
+#include "utils/exceptions.hpp"
+#include "utils/utils.hpp"
+#include <kernels/defaults.h>
+#include <kernels/kernels.h>
+
+#define FDAS_SPEED_OF_LIGHT 299792458.0
+
+/*
+  Fourier domain acceleration search.
+
+  The dereddened Fourier series of a single DM trial is correlated with
+  a bank of templates, one per Fourier frequency derivative z (the number
+  of bins the signal drifts through during the observation). The
+  correlation is done by overlap-save: the series is cut into overlapping
+  segments that are transformed once (batched), then each template is a
+  pointwise multiply and a batched inverse transform of short segments.
+
+  Each call to correlate() produces one row of the f-fdot plane as an
+  interbinned amplitude spectrum with the same noise statistics as the
+  input, so it can be normalised, harmonic summed and peak searched as
+  for a resampled time series. Harmonics are summed within a row, so for
+  large |z| the higher harmonics (which drift by k*z) are only partially
+  recovered.
+*/
+class FourierDomainAccelerator {
+private:
+  unsigned int nbins;
+  unsigned int halfwidth;
+  unsigned int seglen;
+  unsigned int step;
+  unsigned int nsegs;
+  std::vector<float> z_list;
+  cufftComplex* templates;
+  cufftComplex* segments;
+  cufftComplex* work;
+  CuFFTerC2C* segment_fft;
+  unsigned int max_blocks;
+  unsigned int max_threads;
+
+  /*
+    Response of a unit amplitude signal drifting through z bins,
+    evaluated at integer bin offset q from its mean frequency. This is
+    the DFT of the sampled linear chirp, so z=0 gives a delta function.
+  */
+  std::complex<double> response(std::vector< std::complex<double> >& chirp, int q)
+  {
+    unsigned int nsamps = chirp.size();
+    std::complex<double> sum(0.0,0.0);
+    std::complex<double> twiddle = std::polar(1.0,-2.0*M_PI*q/nsamps);
+    std::complex<double> rotation(1.0,0.0);
+    for (unsigned int t=0;t<nsamps;t++){
+      sum += chirp[t] * rotation;
+      rotation *= twiddle;
+    }
+    return sum/(double)nsamps;
+  }
+
+  void generate_templates(void)
+  {
+    unsigned int ntemplates = z_list.size();
+    unsigned int nsamps = 4*(2*halfwidth+1);
+    std::vector<cufftComplex> h_templates(ntemplates*seglen);
+    std::vector< std::complex<double> > resp(2*halfwidth+1);
+    std::vector< std::complex<double> > chirp(nsamps);
+    double u;
+    for (int ii=0;ii<ntemplates;ii++){
+      for (unsigned int t=0;t<nsamps;t++){
+	u = (double) t/nsamps;
+	chirp[t] = std::polar(1.0,M_PI*z_list[ii]*(u*u-u));
+      }
+      double norm = 0.0;
+      for (int q=-(int)halfwidth;q<=(int)halfwidth;q++){
+	resp[q+halfwidth] = response(chirp,q);
+	norm += std::norm(resp[q+halfwidth]);
+      }
+      norm = std::sqrt(norm);
+      cufftComplex* kernel = &h_templates[ii*seglen];
+      for (int jj=0;jj<seglen;jj++){
+	kernel[jj].x = 0.0;
+	kernel[jj].y = 0.0;
+      }
+      //correlation kernel: k[-q] = conj(A(q))/|A|
+      for (int q=-(int)halfwidth;q<=(int)halfwidth;q++){
+	std::complex<double> val = std::conj(resp[q+halfwidth])/norm;
+	cufftComplex& k = kernel[(seglen-q)%seglen];
+	k.x = (float) val.real();
+	k.y = (float) val.imag();
+      }
+    }
+    Utils::device_malloc<cufftComplex>(&templates,ntemplates*seglen);
+    Utils::h2dcpy<cufftComplex>(templates,&h_templates[0],ntemplates*seglen);
+    CuFFTerC2C template_ffter(seglen,ntemplates);
+    template_ffter.execute(templates,templates,CUFFT_FORWARD);
+  }
+
+public:
+  /*!
+    \param nbins Number of bins in the Fourier series to be searched.
+    \param zmax Largest |z| to search (bins).
+    \param zstep Spacing of z trials (bins).
+    \param seglen Overlap-save segment length (0 for automatic).
+  */
+  FourierDomainAccelerator(unsigned int nbins, float zmax, float zstep=2.0,
+			   unsigned int seglen=0,
+			   unsigned int max_blocks=MAX_BLOCKS,
+			   unsigned int max_threads=MAX_THREADS)
+    :nbins(nbins),seglen(seglen),max_blocks(max_blocks),max_threads(max_threads)
+  {
+    if (zstep<=0)
+      ErrorChecker::throw_error("FourierDomainAccelerator: zstep must be positive");
+    zmax = fabs(zmax);
+    int nz = (int) (zmax/zstep);
+    for (int ii=-nz;ii<=nz;ii++)
+      z_list.push_back(ii*zstep);
+
+    //response is negligible beyond |z|/2 plus the sinc sidelobes
+    halfwidth = (unsigned int) ceil(zmax/2.0) + 16;
+    if (this->seglen==0){
+      this->seglen = 2048;
+      while (this->seglen < 8*(2*halfwidth+1))
+	this->seglen *= 2;
+    }
+    if (this->seglen <= 2*halfwidth+1)
+      ErrorChecker::throw_error("FourierDomainAccelerator: segment length too short for zmax");
+    step = this->seglen-2*halfwidth-1;
+    nsegs = (nbins+step-1)/step;
+
+    generate_templates();
+    Utils::device_malloc<cufftComplex>(&segments,nsegs*this->seglen);
+    Utils::device_malloc<cufftComplex>(&work,nsegs*this->seglen);
+    segment_fft = new CuFFTerC2C(this->seglen,nsegs);
+  }
+
+  ~FourierDomainAccelerator()
+  {
+    Utils::device_free(templates);
+    Utils::device_free(segments);
+    Utils::device_free(work);
+    delete segment_fft;
+  }
+
+  std::vector<float>& get_z_list(void){return z_list;}
+
+  unsigned int get_ntemplates(void){return z_list.size();}
+
+  /*!
+    \brief Segment and forward transform a Fourier series.
+
+    Must be called once per DM trial before correlate().
+  */
+  void load(DeviceFourierSeries<cufftComplex>& fseries)
+  {
+    if (fseries.get_nbins()!=nbins)
+      ErrorChecker::throw_error("FourierDomainAccelerator: bad Fourier series length");
+    device_fdas_segment(fseries.get_data(),segments,nbins,seglen,
+			step,halfwidth+1,nsegs,max_blocks,max_threads);
+    segment_fft->execute(segments,segments,CUFFT_FORWARD);
+  }
+
+  /*!
+    \brief Form one row of the f-fdot plane.
+
+    \param idx Index into the z list.
+    \param output Power spectrum to receive the interbinned amplitudes.
+  */
+  void correlate(unsigned int idx, DevicePowerSpectrum<float>& output)
+  {
+    if (output.get_nbins()!=nbins)
+      ErrorChecker::throw_error("FourierDomainAccelerator: bad output length");
+    device_fdas_multiply(segments,templates+idx*seglen,work,
+			 seglen,nsegs,max_blocks,max_threads);
+    segment_fft->execute(work,work,CUFFT_INVERSE);
+    //forward and inverse cuFFT transforms are unnormalised
+    device_fdas_extract(work,output.get_data(),nbins,seglen,step,
+			halfwidth+1,1.0/seglen,max_blocks,max_threads);
+  }
+
+  /*!
+    \brief Convert the z of a row into an acceleration for each candidate.
+
+    A drift of z bins at frequency f corresponds to a line of sight
+    acceleration of -z*c/(f*tobs^2) (+ve acceleration is away from the
+    observer, as in the time domain search). For harmonic sums the drift
+    is that of the highest harmonic summed, f*2^nh.
+  */
+  void set_accelerations(unsigned int idx, float tobs, std::vector<Candidate>& cands)
+  {
+    double z = z_list[idx];
+    for (int ii=0;ii<cands.size();ii++)
+      cands[ii].acc = -z*FDAS_SPEED_OF_LIGHT/
+	(cands[ii].freq*pow(2.0,cands[ii].nh)*tobs*tobs);
+  }
+};
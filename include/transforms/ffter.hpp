@@ -11,6 +11,11 @@ protected:
   CuFFTer(void):fft_plan(0),size(0){}
   unsigned int get_size(void){return size;}
 
+private:
+  //a copy would destroy the plan a second time
+  CuFFTer(const CuFFTer&);
+  CuFFTer& operator=(const CuFFTer&);
+
 public:
   double get_resolution(float tsamp){
     return (double) 1.0/(size * tsamp);
@@ -20,6 +25,10 @@ public:
     return size/2+1;
   }
 
+  virtual ~CuFFTer(){
+    if (fft_plan)
+      cufftDestroy(fft_plan);
+  }
 };
 
 class CuFFTerC2C: public CuFFTer {
@@ -334,6 +334,71 @@ public:
   }  
 };
 
+/*
+  Fold results keyed on what a fold depends on (DM trial, frequency,
+  acceleration and jerk), so candidates folded speculatively during
+  the search need not be folded again when they survive distillation.
+*/
+class FoldCache {
+private:
+  struct Key {
+    int dm_idx;
+    float freq;
+    float acc;
+    float jerk;
+    bool operator<(const Key& other) const {
+      if (dm_idx!=other.dm_idx) return dm_idx<other.dm_idx;
+      if (freq!=other.freq) return freq<other.freq;
+      if (acc!=other.acc) return acc<other.acc;
+      return jerk<other.jerk;
+    }
+  };
+
+  struct Entry {
+    float folded_snr;
+    double opt_period;
+    std::vector<float> fold;
+    int nbins;
+    int nints;
+  };
+
+  std::map<Key,Entry> entries;
+
+  static Key make_key(const Candidate& cand){
+    Key key = {cand.dm_idx,cand.freq,cand.acc,cand.jerk};
+    return key;
+  }
+
+public:
+  void store(const Candidate& cand){
+    Entry& entry = entries[make_key(cand)];
+    entry.folded_snr = cand.folded_snr;
+    entry.opt_period = cand.opt_period;
+    entry.fold = cand.fold;
+    entry.nbins = cand.nbins;
+    entry.nints = cand.nints;
+  }
+
+  //Copy cached fold results into cand, false if it has not been folded
+  bool restore(Candidate& cand){
+    std::map<Key,Entry>::iterator it = entries.find(make_key(cand));
+    if (it==entries.end())
+      return false;
+    cand.folded_snr = it->second.folded_snr;
+    cand.opt_period = it->second.opt_period;
+    cand.fold = it->second.fold;
+    cand.nbins = it->second.nbins;
+    cand.nints = it->second.nints;
+    return true;
+  }
+
+  bool contains(const Candidate& cand){
+    return entries.find(make_key(cand))!=entries.end();
+  }
+
+  size_t size(void){return entries.size();}
+};
+
 class MultiFolder {
 private:
   std::vector<Candidate>& cands;
@@ -348,6 +413,7 @@ private:
   float max_period;
   bool use_progress_bar;
   ProgressBar* progress_bar;
+  FoldCache* cache;
 
   void fold_all_mapped(void){
     std::map<unsigned int, std::vector<unsigned int> >::iterator iter;
@@ -368,6 +434,8 @@ private:
     int cand_idx;
     TimeSeries<unsigned char> h_tim;
     float mean,std,rms;
+    float padding_mean;
+    bool padding = nsamps > dm_trials.get_nsamps();
 
     if (use_progress_bar){
       printf("Folding and optimising candidates...\n");
@@ -381,6 +449,10 @@ private:
 	
 	h_tim = dm_trials[iter->first];
         device_tim.copy_from_host(h_tim);
+	if (padding){
+	  padding_mean = stats::mean<float>(device_tim.get_data(),dm_trials.get_nsamps());
+	  device_tim.fill(dm_trials.get_nsamps(),nsamps,padding_mean);
+	}
 	d_tim_r.set_tsamp(h_tim.get_tsamp());
 	r2cfft.execute(device_tim.get_data(),d_fseries.get_data());
 	former.form(d_fseries,pspec);
@@ -393,7 +465,11 @@ private:
 	    
             cand_idx = iter->second[ii];
             period = 1.0/cands[cand_idx].freq;
-	    resampler.resample(device_tim,d_tim_r,nsamps,cands[cand_idx].acc);
+	    if (cands[cand_idx].jerk!=0)
+	      resampler.resampleIII(device_tim,d_tim_r,nsamps,cands[cand_idx].acc,
+				    cands[cand_idx].jerk);
+	    else
+	      resampler.resample(device_tim,d_tim_r,nsamps,cands[cand_idx].acc);
 	    folder.fold(d_tim_r,*subints,period);
 	    optimiser->optimise(*subints);
 	    cands[cand_idx].folded_snr = subints->get_opt_sn();
@@ -406,9 +482,13 @@ private:
   }
 
 public:
-  MultiFolder(std::vector<Candidate>& cands, DispersionTrials<unsigned char>& dm_trials)
-    :cands(cands),dm_trials(dm_trials),use_progress_bar(false){
-    nsamps = Utils::prev_power_of_two(dm_trials.get_nsamps());
+  MultiFolder(std::vector<Candidate>& cands, DispersionTrials<unsigned char>& dm_trials,
+	      unsigned int size=0)
+    :cands(cands),dm_trials(dm_trials),use_progress_bar(false),cache(NULL){
+    if (size==0)
+      nsamps = Utils::fastest_fft_length(dm_trials.get_nsamps());
+    else
+      nsamps = size;
     tsamp = dm_trials.get_tsamp();
     subints = new FoldedSubints<float>(64,16);
     optimiser = new FoldOptimiser (64,16);
@@ -420,16 +500,32 @@ public:
     progress_bar = new ProgressBar;
     use_progress_bar = true;
   }
+
+  //Reuse folds found in the cache and add new folds to it
+  void set_cache(FoldCache* cache_){
+    cache = cache_;
+  }
   
   void fold_n(unsigned int n_to_fold){
     int count = std::min(n_to_fold,(unsigned int) cands.size());
     float p;
     for (int ii=0;ii<count;ii++){
       p = 1.0/cands[ii].freq;
-      if (p>min_period && p<max_period)
+      if (p>min_period && p<max_period){
+	if (cache!=NULL && cache->restore(cands[ii]))
+	  continue;
 	dm_to_cand_map[cands[ii].dm_idx].push_back(ii);
+      }
+    }
+    if (!dm_to_cand_map.empty())
+      fold_all_mapped();
+    if (cache!=NULL){
+      std::map<unsigned int, std::vector<unsigned int> >::iterator iter;
+      for (iter=dm_to_cand_map.begin();iter!=dm_to_cand_map.end();iter++)
+	for (int ii=0;ii<iter->second.size();ii++)
+	  cache->store(cands[iter->second[ii]]);
     }
-    fold_all_mapped();
+    dm_to_cand_map.clear();
     std::sort(cands.begin(),cands.end(),less_than_key());
   }
   
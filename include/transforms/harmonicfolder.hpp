@@ -24,6 +24,11 @@ public:
   }
   
   void fold(DevicePowerSpectrum<float>& fold0)
+  {
+    fold(fold0.get_data(),fold0.get_nbins());
+  }
+
+  void fold(float* fold0, unsigned int nbins)
   {
     PUSH_NVTX_RANGE("Harmonic summing",2)
     for (int ii=0;ii<sums.size();ii++)
@@ -31,8 +36,8 @@ public:
 	h_data_ptrs[ii] = sums[ii]->get_data();
       }
     Utils::h2dcpy<float*>(d_data_ptrs,h_data_ptrs,sums.size());
-    device_harmonic_sum(fold0.get_data(),d_data_ptrs,
-			fold0.get_nbins(),sums.size(),
+    device_harmonic_sum(fold0,d_data_ptrs,
+			nbins,sums.size(),
 			max_blocks,max_threads);
     POP_NVTX_RANGE
       }
@@ -0,0 +1,91 @@
+#pragma once
+#include <complex>
+#include "fftw3.h"
+#include "pthread.h"
+#include "utils/exceptions.hpp"
+
+/*
+  FFTW counterparts of the CuFFTer classes for searches on the CPU.
+
+  Plans are made with FFTW_UNALIGNED so they can be executed on any
+  buffer of the right length, and plan creation (which is not thread
+  safe in FFTW) is serialised on a process wide mutex. Executing a plan
+  is thread safe, so each worker may hold its own plans or share them.
+  As with cuFFT the transforms are unnormalised, and C2R overwrites
+  its input.
+*/
+class HostFFTer {
+protected:
+  fftwf_plan fft_plan;
+  unsigned int size;
+
+  static pthread_mutex_t* planner_mutex(void){
+    static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    return &mutex;
+  }
+
+  HostFFTer(unsigned int size):fft_plan(NULL),size(size){}
+
+  void check_plan(void){
+    if (fft_plan==NULL)
+      ErrorChecker::throw_error("HostFFTer: FFTW could not create a plan");
+  }
+
+public:
+  double get_resolution(float tsamp){
+    return (double) 1.0/(size * tsamp);
+  }
+
+  unsigned int get_output_size(void){
+    return size/2+1;
+  }
+
+  virtual ~HostFFTer(){
+    pthread_mutex_lock(planner_mutex());
+    if (fft_plan!=NULL)
+      fftwf_destroy_plan(fft_plan);
+    pthread_mutex_unlock(planner_mutex());
+  }
+};
+
+class HostFFTerR2C: public HostFFTer {
+public:
+  HostFFTerR2C(unsigned int size, unsigned int flags=FFTW_ESTIMATE)
+    :HostFFTer(size)
+  {
+    float* in = (float*) fftwf_malloc(sizeof(float)*size);
+    fftwf_complex* out = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex)*(size/2+1));
+    pthread_mutex_lock(planner_mutex());
+    fft_plan = fftwf_plan_dft_r2c_1d(size,in,out,flags|FFTW_UNALIGNED);
+    pthread_mutex_unlock(planner_mutex());
+    fftwf_free(in);
+    fftwf_free(out);
+    check_plan();
+  }
+
+  void execute(float* tim, std::complex<float>* fseries)
+  {
+    fftwf_execute_dft_r2c(fft_plan,tim,reinterpret_cast<fftwf_complex*>(fseries));
+  }
+};
+
+class HostFFTerC2R: public HostFFTer {
+public:
+  HostFFTerC2R(unsigned int size, unsigned int flags=FFTW_ESTIMATE)
+    :HostFFTer(size)
+  {
+    fftwf_complex* in = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex)*(size/2+1));
+    float* out = (float*) fftwf_malloc(sizeof(float)*size);
+    pthread_mutex_lock(planner_mutex());
+    fft_plan = fftwf_plan_dft_c2r_1d(size,in,out,flags|FFTW_UNALIGNED);
+    pthread_mutex_unlock(planner_mutex());
+    fftwf_free(in);
+    fftwf_free(out);
+    check_plan();
+  }
+
+  void execute(std::complex<float>* fseries, float* tim)
+  {
+    fftwf_execute_dft_c2r(fft_plan,reinterpret_cast<fftwf_complex*>(fseries),tim);
+  }
+};
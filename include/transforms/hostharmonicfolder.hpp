@@ -0,0 +1,148 @@
+#pragma once
+#include <data_types/fourierseries.hpp>
+#include <utils/exceptions.hpp>
+#include <vector>
+#include <cmath>
+#include <cstddef>
+
+//Largest number of harmonic folds (2^8 = 256 harmonics)
+#define MAX_HOST_HARMONIC_FOLDS 8
+
+//Fundamental bins per block, must be a multiple of 2^MAX_HOST_HARMONIC_FOLDS
+#define HOST_HARMONIC_BLOCK 8192
+
+/*
+  Harmonic summing on the CPU.
+
+  Produces the same sums as harmonic_sum_kernel: fold n (n=1..nfolds)
+  adds the bins round(idx*k/2^n) for odd k to fold n-1 and is scaled
+  by 1/sqrt(2^n). The fundamental is walked in blocks whose start is a
+  multiple of 2^n, so for fold n and numerator k the source bin of
+  fundamental b0+p*2^n+r is (b0*k>>n) + p*k + offsets[r], where the
+  2^n offsets (r*k+2^(n-1))>>n are precomputed once. Each block reads
+  one short contiguous source range per (n,k) and writes every fold
+  from a single running accumulator.
+
+  Each fold level is a template instance so that the inner loops have
+  compile time trip counts.
+*/
+
+template <int LEVEL, int NFOLDS, bool DONE = (LEVEL>NFOLDS)>
+struct HostHarmonicLevel {
+  static void sum(const float* input, float* acc, float** outputs,
+		  size_t b0, unsigned int block, const int* streams)
+  {
+    const unsigned int period = 1u<<LEVEL;
+    const float norm = 1.0/std::sqrt((float)period);
+    const int* level_streams = streams + stream_offset();
+    for (unsigned int k=1;k<period;k+=2){
+      const int* offsets = level_streams + (k/2)*period;
+      const float* src = input + ((b0*k)>>LEVEL);
+      for (unsigned int p=0;p<block;p+=period){
+	float* dst = acc + p;
+	for (unsigned int r=0;r<period;r++)
+	  dst[r] += src[offsets[r]];
+	src += k;
+      }
+    }
+    float* out = outputs[LEVEL-1] + b0;
+    for (unsigned int jj=0;jj<block;jj++)
+      out[jj] = acc[jj]*norm;
+    HostHarmonicLevel<LEVEL+1,NFOLDS>::sum(input,acc,outputs,b0,block,streams);
+  }
+
+  //Start of this level's streams: sum over lower levels of 2^(l-1)*2^l
+  static size_t stream_offset(void){
+    size_t offset = 0;
+    for (int ll=1;ll<LEVEL;ll++)
+      offset += (size_t)1<<(2*ll-1);
+    return offset;
+  }
+};
+
+template <int LEVEL, int NFOLDS>
+struct HostHarmonicLevel<LEVEL,NFOLDS,true> {
+  static void sum(const float*, float*, float**, size_t, unsigned int, const int*){}
+};
+
+
+class HostHarmonicFolder {
+private:
+  HostHarmonicSums<float>& sums;
+  std::vector<int> streams;
+  std::vector<float*> outputs;
+  std::vector<float> acc;
+
+  template <int NFOLDS>
+  void fold_blocks(const float* input, size_t nblocks)
+  {
+    for (size_t ii=0;ii<nblocks;ii++){
+      size_t b0 = ii*HOST_HARMONIC_BLOCK;
+      for (unsigned int jj=0;jj<HOST_HARMONIC_BLOCK;jj++)
+	acc[jj] = input[b0+jj];
+      HostHarmonicLevel<1,NFOLDS>::sum(input,&acc[0],&outputs[0],b0,
+				       HOST_HARMONIC_BLOCK,&streams[0]);
+    }
+  }
+
+  //Direct evaluation for the partial block at the end of the spectrum
+  void fold_tail(const float* input, size_t start, size_t size)
+  {
+    unsigned int nfolds = outputs.size();
+    for (size_t idx=start;idx<size;idx++){
+      float val = input[idx];
+      for (unsigned int level=1;level<=nfolds;level++){
+	size_t period = (size_t)1<<level;
+	for (size_t k=1;k<period;k+=2)
+	  val += input[(idx*k+period/2)>>level];
+	outputs[level-1][idx] = val/std::sqrt((float)period);
+      }
+    }
+  }
+
+public:
+  HostHarmonicFolder(HostHarmonicSums<float>& sums)
+    :sums(sums),acc(HOST_HARMONIC_BLOCK)
+  {
+    if (sums.size()>MAX_HOST_HARMONIC_FOLDS)
+      ErrorChecker::throw_error("HostHarmonicFolder: too many harmonic folds requested");
+    for (unsigned int level=1;level<=sums.size();level++){
+      int period = 1<<level;
+      for (int k=1;k<period;k+=2)
+	for (int r=0;r<period;r++)
+	  streams.push_back((r*k+period/2)>>level);
+    }
+    if (streams.empty())
+      streams.push_back(0);
+    outputs.resize(sums.size());
+  }
+
+  void fold(HostPowerSpectrum<float>& fold0)
+  {
+    for (int ii=0;ii<sums.size();ii++){
+      if (sums[ii]->get_nbins()!=fold0.get_nbins())
+	ErrorChecker::throw_error("HostHarmonicFolder: harmonic sums have wrong length");
+      outputs[ii] = sums[ii]->get_data();
+    }
+    fold(fold0.get_data(),fold0.get_nbins());
+  }
+
+  //outputs must already point at the sums buffers
+  void fold(const float* input, size_t size)
+  {
+    size_t nblocks = size/HOST_HARMONIC_BLOCK;
+    switch (outputs.size())
+      {
+      case 0: return;
+      case 1: fold_blocks<1>(input,nblocks); break;
+      case 2: fold_blocks<2>(input,nblocks); break;
+      case 3: fold_blocks<3>(input,nblocks); break;
+      case 4: fold_blocks<4>(input,nblocks); break;
+      case 5: fold_blocks<5>(input,nblocks); break;
+      case 6: fold_blocks<6>(input,nblocks); break;
+      case 7: fold_blocks<7>(input,nblocks); break;
+      case 8: fold_blocks<8>(input,nblocks); break;
+      }
+    fold_tail(input,nblocks*HOST_HARMONIC_BLOCK,size);
+  }
+};
@@ -0,0 +1,205 @@
+#pragma once
+#include <data_types/timeseries.hpp>
+#include <utils/exceptions.hpp>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#define HOST_RESAMPLER_SPEED_OF_LIGHT 299792458.0
+
+//Samples between exact re-evaluations of the interpolation position
+#define HOST_RESAMPLER_ANCHOR 4096
+
+/*
+  Time domain resampling on the CPU.
+
+  The default (nearest sample) mode produces exactly the output of
+  device_resampleII/device_resampleIII. Output sample i reads input
+  sample round(i + f(i)) with f(i) = af*i*(i-N) + jf*i*(i-N/2)*(i-N),
+  so the shift round(i + f(i)) - i changes by at most one per sample
+  and is constant over long runs. f is monotone between the turning
+  points of its derivative, so the end of each run is found by an
+  exponential then binary search on the exact index expression, and
+  the mapping is stored as (start, length, shift) runs. Each run is
+  then a single memcpy.
+
+  The interpolating mode reads the input at the unrounded position
+  and linearly interpolates between neighbouring samples. Positions
+  are stepped with forward differences of the cubic and re-evaluated
+  exactly every HOST_RESAMPLER_ANCHOR samples to bound round-off.
+*/
+class HostTimeDomainResampler {
+private:
+  bool interpolate;
+  double accel_fact;
+  double jerk_fact;
+  double size;
+  std::vector<size_t> run_starts;
+  std::vector<size_t> run_lengths;
+  std::vector<long> run_shifts;
+
+  //Same expression (and evaluation order) as the device index functions
+  inline double position(unsigned long id)
+  {
+    if (jerk_fact!=0){
+      double idx = id + id*accel_fact*(id-size) + jerk_fact*id*(id-size/2)*(id-size);
+      return std::min(std::max(idx,0.0),size-1);
+    }
+    return std::max(id + id*accel_fact*(id-size),0.0);
+  }
+
+  inline long shift(unsigned long id)
+  {
+    return (long) rint(position(id)) - (long) id;
+  }
+
+  //Sample indices where f'(i) changes sign, in (0,N)
+  void turning_points(std::vector<size_t>& bounds)
+  {
+    //f'(i) = af*(2i-N) + jf*(3i^2 - 3Ni + N^2/2)
+    double a = 3*jerk_fact;
+    double b = 2*accel_fact - 3*jerk_fact*size;
+    double c = -accel_fact*size + jerk_fact*size*size/2;
+    std::vector<double> roots;
+    if (a==0){
+      if (b!=0)
+	roots.push_back(-c/b);
+    } else {
+      double disc = b*b-4*a*c;
+      if (disc>=0){
+	roots.push_back((-b-sqrt(disc))/(2*a));
+	roots.push_back((-b+sqrt(disc))/(2*a));
+      }
+    }
+    bounds.clear();
+    bounds.push_back(0);
+    for (int ii=0;ii<roots.size();ii++)
+      if (roots[ii]>0 && roots[ii]<size)
+	bounds.push_back((size_t) roots[ii]);
+    bounds.push_back((size_t) size);
+    std::sort(bounds.begin(),bounds.end());
+  }
+
+  void build_runs(void)
+  {
+    run_starts.clear();
+    run_lengths.clear();
+    run_shifts.clear();
+    std::vector<size_t> bounds;
+    turning_points(bounds);
+    for (int seg=0;seg<bounds.size()-1;seg++){
+      size_t ii = bounds[seg];
+      size_t end = bounds[seg+1];
+      while (ii<end){
+	long s = shift(ii);
+	//shift(lo)==s and (hi==end or shift(hi)!=s)
+	size_t lo = ii;
+	size_t step = 1;
+	while (lo+step<end && shift(lo+step)==s){
+	  lo += step;
+	  step *= 2;
+	}
+	size_t hi = std::min(lo+step,end);
+	while (hi-lo>1){
+	  size_t mid = lo+(hi-lo)/2;
+	  if (shift(mid)==s)
+	    lo = mid;
+	  else
+	    hi = mid;
+	}
+	if (!run_shifts.empty() && run_shifts.back()==s &&
+	    run_starts.back()+run_lengths.back()==ii)
+	  run_lengths.back() += hi-ii;
+	else {
+	  run_starts.push_back(ii);
+	  run_lengths.push_back(hi-ii);
+	  run_shifts.push_back(s);
+	}
+	ii = hi;
+      }
+    }
+  }
+
+  void set_trial(unsigned int nsamps, float tsamp, float acc, float jerk)
+  {
+    //same expressions as device_resampleII and device_resampleIII
+    accel_fact = ((acc*tsamp) / (2 * HOST_RESAMPLER_SPEED_OF_LIGHT));
+    jerk_fact = (((double)jerk*tsamp*tsamp) / (6 * HOST_RESAMPLER_SPEED_OF_LIGHT));
+    size = (double) nsamps;
+  }
+
+  void resample_nearest(float* input, float* output)
+  {
+    build_runs();
+    for (int ii=0;ii<run_starts.size();ii++)
+      std::memcpy(output+run_starts[ii],input+run_starts[ii]+run_shifts[ii],
+		  run_lengths[ii]*sizeof(float));
+  }
+
+  void resample_linear(float* input, float* output)
+  {
+    size_t nsamps = (size_t) size;
+    if (nsamps<2){
+      std::copy(input,input+nsamps,output);
+      return;
+    }
+    for (size_t start=0;start<nsamps;start+=HOST_RESAMPLER_ANCHOR){
+      size_t end = std::min(start+HOST_RESAMPLER_ANCHOR,nsamps);
+      //forward differences of the (cubic) unclamped position
+      //x(i) = c3*i^3 + c2*i^2 + c1*i, taken from the coefficients as
+      //differencing large positions would leave round-off in D3
+      double c3 = jerk_fact;
+      double c2 = accel_fact - 1.5*jerk_fact*size;
+      double c1 = 1 - accel_fact*size + 0.5*jerk_fact*size*size;
+      double s = start;
+      double x = start + start*accel_fact*(start-size) +
+	jerk_fact*start*(start-size/2)*(start-size);
+      //x(i+1) = x(i) + D1, D1 += D2, D2 += D3 (D3 is constant)
+      double D1 = c3*(3*s*s+3*s+1) + c2*(2*s+1) + c1;
+      double D2 = c3*(6*s+6) + 2*c2;
+      double D3 = 6*c3;
+      for (size_t ii=start;ii<end;ii++){
+	double pos = std::min(std::max(x,0.0),size-1);
+	size_t idx = std::min((size_t) pos,nsamps-2);
+	float frac = pos-idx;
+	output[ii] = input[idx] + frac*(input[idx+1]-input[idx]);
+	x += D1;
+	D1 += D2;
+	D2 += D3;
+      }
+    }
+  }
+
+public:
+  /*!
+    \param interpolate Linearly interpolate instead of taking the nearest sample.
+  */
+  HostTimeDomainResampler(bool interpolate=false)
+    :interpolate(interpolate),accel_fact(0),jerk_fact(0),size(0){}
+
+  /*!
+    \brief Resample a time series to a constant acceleration and jerk.
+
+    \param input Series to resample.
+    \param output Output series (at least size samples).
+    \param size Number of samples to resample.
+    \param acc Acceleration (m/s/s).
+    \param jerk Jerk (m/s/s/s).
+  */
+  void resample(TimeSeries<float>& input, TimeSeries<float>& output,
+		unsigned int size, float acc, float jerk=0.0)
+  {
+    if (input.get_nsamps()<size || output.get_nsamps()<size)
+      ErrorChecker::throw_error("HostTimeDomainResampler: series shorter than requested size");
+    set_trial(size,input.get_tsamp(),acc,jerk);
+    output.set_tsamp(input.get_tsamp());
+    if (interpolate)
+      resample_linear(input.get_data(),output.get_data());
+    else
+      resample_nearest(input.get_data(),output.get_data());
+  }
+
+  //Number of constant shift runs in the last nearest sample mapping
+  size_t get_nruns(void){return run_starts.size();}
+};
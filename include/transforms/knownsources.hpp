@@ -0,0 +1,194 @@
+#pragma once
+#include "data_types/candidates.hpp"
+#include <utils/exceptions.hpp>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+
+/*
+  A known pulsar or periodic RFI signal.
+  dm_tol of 0 matches at any DM, as RFI entries should.
+*/
+struct KnownSource {
+  std::string name;
+  double period;
+  float dm;
+  float tolerance;
+  float dm_tol;
+
+  KnownSource(std::string name, double period, float dm, float tolerance, float dm_tol)
+    :name(name),period(period),dm(dm),tolerance(tolerance),dm_tol(dm_tol){}
+};
+
+/*
+  Match candidates against a catalogue of known sources.
+
+  Every harmonic f0*h and subharmonic f0/h of every source, with h up
+  to max_harm, becomes one window of the source's fractional tolerance
+  in a table sorted by the window's lower edge. A candidate can only
+  lie in windows whose lower edge is between f/R and f, where R is the
+  widest window's high/low ratio, so each candidate costs two binary
+  searches and a test of the few windows in between.
+
+  A candidate in several windows takes the lowest harmonic order
+  (h, counting subharmonics as h too), then the closest frequency, then
+  the first source in the catalogue.
+*/
+class KnownSourceMatcher {
+private:
+  struct Window {
+    double low;
+    double freq;
+    int source;
+    int order;
+    bool operator<(const Window& other) const {
+      return low<other.low || (low==other.low && (source<other.source ||
+						   (source==other.source && freq<other.freq)));
+    }
+  };
+
+  std::vector<KnownSource> sources;
+  std::vector<Window> windows;
+  std::vector<double> lows;
+  double max_ratio;
+  int max_harm;
+
+  void add_window(int source, double freq, int order){
+    Window window;
+    window.freq = freq;
+    window.low = freq*(1-sources[source].tolerance);
+    window.source = source;
+    window.order = order;
+    windows.push_back(window);
+  }
+
+public:
+  KnownSourceMatcher(int max_harm)
+    :max_ratio(1),max_harm(std::max(1,max_harm)){}
+
+  /*!
+    \brief Read a catalogue of "name period dm tolerance [dm_tol]" lines.
+
+    Period is in seconds and tolerance is fractional (0.0001 = 0.01%).
+    Blank lines and lines starting with # are skipped.
+  */
+  void read_catalogue(std::string filename)
+  {
+    std::ifstream infile(filename.c_str());
+    ErrorChecker::check_file_error(infile,filename);
+    std::string line;
+    while (std::getline(infile,line)){
+      std::stringstream fields(line);
+      std::string name;
+      double period;
+      float dm,tolerance;
+      float dm_tol = 0;
+      if (!(fields >> name) || name[0]=='#')
+	continue;
+      if (!(fields >> period >> dm >> tolerance) || period<=0 || tolerance<=0 || tolerance>=1)
+	ErrorChecker::throw_error("Bad line in "+filename+": "+line);
+      fields >> dm_tol;
+      add_source(KnownSource(name,period,dm,tolerance,dm_tol));
+    }
+  }
+
+  void add_source(const KnownSource& source)
+  {
+    sources.push_back(source);
+    windows.clear();
+  }
+
+  size_t get_nsources(void) const {return sources.size();}
+
+  const std::string& get_name(int source) const {return sources[source].name;}
+
+  std::vector<std::string> get_names(void) const {
+    std::vector<std::string> names;
+    for (int ii=0;ii<sources.size();ii++)
+      names.push_back(sources[ii].name);
+    return names;
+  }
+
+  //Build the sorted harmonic table, done once before matching
+  void prepare(void)
+  {
+    windows.clear();
+    max_ratio = 1;
+    for (int ii=0;ii<sources.size();ii++){
+      double freq = 1.0/sources[ii].period;
+      for (int hh=1;hh<=max_harm;hh++){
+	add_window(ii,freq*hh,hh);
+	if (hh>1)
+	  add_window(ii,freq/hh,hh);
+      }
+      max_ratio = std::max(max_ratio,(1.0+sources[ii].tolerance)/(1.0-sources[ii].tolerance));
+    }
+    std::sort(windows.begin(),windows.end());
+    lows.resize(windows.size());
+    for (int ii=0;ii<windows.size();ii++)
+      lows[ii] = windows[ii].low;
+  }
+
+  size_t get_nwindows(void) const {return windows.size();}
+
+  //The source a candidate matches, or -1
+  int match(const Candidate& cand)
+  {
+    if (windows.empty() && !sources.empty())
+      prepare();
+    double freq = cand.freq;
+    //widened slightly so rounding in max_ratio never drops a window
+    std::vector<double>::iterator first = std::lower_bound(lows.begin(),lows.end(),
+							   freq/max_ratio*(1-1e-9));
+    std::vector<double>::iterator last = std::upper_bound(first,lows.end(),freq);
+    int best = -1;
+    for (size_t ii=first-lows.begin();ii<last-lows.begin();ii++){
+      const Window& window = windows[ii];
+      const KnownSource& source = sources[window.source];
+      double ratio = freq/window.freq;
+      if (!(ratio>1-source.tolerance && ratio<1+source.tolerance))
+	continue;
+      if (source.dm_tol>0 && fabs(cand.dm-source.dm)>source.dm_tol)
+	continue;
+      if (best<0){
+	best = ii;
+	continue;
+      }
+      const Window& other = windows[best];
+      double offset = fabs(ratio-1);
+      double other_offset = fabs(freq/other.freq-1);
+      if (window.order<other.order ||
+	  (window.order==other.order && (offset<other_offset ||
+					 (offset==other_offset && window.source<other.source))))
+	best = ii;
+    }
+    return best<0 ? -1 : windows[best].source;
+  }
+
+  //Set known_source on every candidate, returning the number matched
+  size_t tag(std::vector<Candidate>& cands)
+  {
+    size_t count = 0;
+    for (int ii=0;ii<cands.size();ii++){
+      cands[ii].known_source = match(cands[ii]);
+      count += cands[ii].known_source>=0;
+    }
+    return count;
+  }
+
+  //Tag, then drop matched candidates keeping the order of the rest
+  size_t remove(std::vector<Candidate>& cands)
+  {
+    size_t count = tag(cands);
+    std::vector<Candidate> kept;
+    kept.reserve(cands.size()-count);
+    for (int ii=0;ii<cands.size();ii++)
+      if (cands[ii].known_source<0)
+	kept.push_back(cands[ii]);
+    cands.swap(kept);
+    return count;
+  }
+};
@@ -0,0 +1,229 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <unistd.h>
+#include "pthread.h"
+#include "utils/exceptions.hpp"
+
+/*
+  Cluster threshold crossings (sorted by bin) into peaks. A cluster
+  continues while the next crossing is within min_gap bins of the
+  last crossing that raised the cluster maximum.
+*/
+inline int identify_unique_peaks(const int* idxs, const float* snrs, unsigned int count,
+				 int min_gap, int* peakidxs, float* peaksnrs)
+{
+  int ii;
+  float cpeak;
+  int cpeakidx;
+  int lastidx= -1 * min_gap;
+  int npeaks=0;
+  ii=0;
+
+  while (ii<count){
+    cpeak=snrs[ii];
+    cpeakidx=idxs[ii];
+    lastidx=idxs[ii];
+    ii++;
+
+    while (ii<count && (idxs[ii]-lastidx) < min_gap){
+      if (snrs[ii]>cpeak)
+	{
+	  cpeak=snrs[ii];
+	  cpeakidx=idxs[ii];
+	  lastidx=idxs[ii];
+	}
+      ii++;
+    }
+    peakidxs[npeaks]=cpeakidx;
+    peaksnrs[npeaks]=cpeak;
+    npeaks++;
+  }
+  return npeaks;
+}
+
+/*
+  Threshold and cluster peaks on the host using a pool of threads.
+
+  Work is cut into contiguous chunks, each handled by one thread into
+  its own growable buffers, and the buffers are concatenated in chunk
+  order, so the output is identical to a serial pass and has no fixed
+  size limit.
+
+  Clustering chunks never cut a cluster: a chunk boundary is moved
+  forward to the first pair of crossings that are at least min_gap
+  apart, where the serial algorithm is guaranteed to start a new
+  cluster (the last crossing that raised the current peak can be no
+  later than the previous crossing). A chunk with no such gap is
+  absorbed by the chunk before it.
+
+  Inputs smaller than min_chunk per thread are handled serially on
+  the calling thread.
+*/
+class PeakExtractor {
+private:
+  struct Chunk {
+    const float* data;
+    const int* idxs;
+    const float* snrs;
+    size_t start;
+    size_t end;
+    float threshold;
+    int min_gap;
+    std::vector<int> out_idxs;
+    std::vector<float> out_snrs;
+  };
+
+  int min_gap;
+  unsigned int nthreads;
+  size_t min_chunk;
+  std::vector<Chunk> chunks;
+  std::vector<pthread_t> threads;
+  std::vector<int> idx_arena;
+  std::vector<float> snr_arena;
+
+  static void* threshold_chunk(void* ptr)
+  {
+    Chunk* chunk = (Chunk*) ptr;
+    chunk->out_idxs.clear();
+    chunk->out_snrs.clear();
+    for (size_t ii=chunk->start;ii<chunk->end;ii++)
+      if (chunk->data[ii] > chunk->threshold){
+	chunk->out_idxs.push_back(ii);
+	chunk->out_snrs.push_back(chunk->data[ii]);
+      }
+    return NULL;
+  }
+
+  static void* cluster_chunk(void* ptr)
+  {
+    Chunk* chunk = (Chunk*) ptr;
+    size_t count = chunk->end-chunk->start;
+    chunk->out_idxs.resize(count);
+    chunk->out_snrs.resize(count);
+    if (count==0)
+      return NULL;
+    int npeaks = identify_unique_peaks(chunk->idxs+chunk->start,chunk->snrs+chunk->start,
+				       count,chunk->min_gap,
+				       &chunk->out_idxs[0],&chunk->out_snrs[0]);
+    chunk->out_idxs.resize(npeaks);
+    chunk->out_snrs.resize(npeaks);
+    return NULL;
+  }
+
+  unsigned int get_nchunks(size_t size)
+  {
+    size_t nchunks = size/min_chunk;
+    nchunks = std::min((size_t)nthreads,nchunks);
+    nchunks = std::max((size_t)1,nchunks);
+    if (chunks.size()<nchunks){
+      chunks.resize(nchunks);
+      threads.resize(nchunks);
+    }
+    return nchunks;
+  }
+
+  //Chunk 0 runs on the calling thread
+  void run(void* (*func)(void*), unsigned int nchunks)
+  {
+    for (int ii=1;ii<nchunks;ii++)
+      if (pthread_create(&threads[ii],NULL,func,(void*)&chunks[ii]))
+	ErrorChecker::throw_error("PeakExtractor: failed to create thread");
+    func((void*)&chunks[0]);
+    for (int ii=1;ii<nchunks;ii++)
+      pthread_join(threads[ii],NULL);
+  }
+
+  size_t gather(unsigned int nchunks, std::vector<int>& idxs, std::vector<float>& snrs)
+  {
+    size_t total = 0;
+    for (int ii=0;ii<nchunks;ii++)
+      total += chunks[ii].out_idxs.size();
+    idxs.resize(total);
+    snrs.resize(total);
+    size_t offset = 0;
+    for (int ii=0;ii<nchunks;ii++){
+      std::copy(chunks[ii].out_idxs.begin(),chunks[ii].out_idxs.end(),idxs.begin()+offset);
+      std::copy(chunks[ii].out_snrs.begin(),chunks[ii].out_snrs.end(),snrs.begin()+offset);
+      offset += chunks[ii].out_idxs.size();
+    }
+    return total;
+  }
+
+public:
+  /*!
+    \param min_gap Minimum gap in bins between unique peaks.
+    \param nthreads Number of threads to use (0 for all online cores).
+    \param min_chunk Smallest number of bins worth giving to a thread.
+  */
+  PeakExtractor(int min_gap=30, unsigned int nthreads=0, size_t min_chunk=65536)
+    :min_gap(min_gap),nthreads(nthreads),min_chunk(std::max((size_t)1,min_chunk))
+  {
+    if (this->nthreads==0){
+      long ncores = sysconf(_SC_NPROCESSORS_ONLN);
+      this->nthreads = std::max(1L,ncores);
+    }
+  }
+
+  /*!
+    \brief Cluster a sorted list of threshold crossings into unique peaks.
+
+    \return The number of peaks.
+  */
+  size_t cluster(const int* idxs, const float* snrs, size_t count,
+		 std::vector<int>& peakidxs, std::vector<float>& peaksnrs)
+  {
+    unsigned int nchunks = get_nchunks(count);
+    size_t bound = 0;
+    for (int ii=0;ii<nchunks;ii++){
+      Chunk& chunk = chunks[ii];
+      chunk.idxs = idxs;
+      chunk.snrs = snrs;
+      chunk.min_gap = min_gap;
+      chunk.start = bound;
+      if (ii==nchunks-1)
+	bound = count;
+      else {
+	bound = std::max(bound,(ii+1)*count/nchunks);
+	while (bound>0 && bound<count && idxs[bound]-idxs[bound-1] < min_gap)
+	  bound++;
+      }
+      chunk.end = bound;
+    }
+    run(&PeakExtractor::cluster_chunk,nchunks);
+    return gather(nchunks,peakidxs,peaksnrs);
+  }
+
+  /*!
+    \brief Find and cluster peaks above threshold in bins [start,end) of a spectrum.
+
+    \return The number of peaks.
+  */
+  size_t extract(const float* data, size_t start, size_t end, float threshold,
+		 std::vector<int>& peakidxs, std::vector<float>& peaksnrs)
+  {
+    if (end<=start){
+      peakidxs.clear();
+      peaksnrs.clear();
+      return 0;
+    }
+    size_t size = end-start;
+    unsigned int nchunks = get_nchunks(size);
+    for (int ii=0;ii<nchunks;ii++){
+      Chunk& chunk = chunks[ii];
+      chunk.data = data;
+      chunk.threshold = threshold;
+      chunk.start = start + ii*size/nchunks;
+      chunk.end = start + (ii+1)*size/nchunks;
+    }
+    run(&PeakExtractor::threshold_chunk,nchunks);
+    size_t count = gather(nchunks,idx_arena,snr_arena);
+    if (count==0){
+      peakidxs.clear();
+      peaksnrs.clear();
+      return 0;
+    }
+    return cluster(&idx_arena[0],&snr_arena[0],count,peakidxs,peaksnrs);
+  }
+};
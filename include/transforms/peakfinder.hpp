@@ -3,10 +3,15 @@
 #include "data_types/candidates.hpp"
 #include "data_types/fourierseries.hpp"
 #include "kernels/kernels.h"
+#include "transforms/peakextractor.hpp"
 #include <thrust/device_vector.h>
 #include "utils/utils.hpp"
+#include "utils/exceptions.hpp"
+#include <kernels/defaults.h>
 #include <cmath>
 #include <algorithm>
+#include <vector>
+#include <utility>
 
 class PeakFinder {
 private:
@@ -14,82 +19,283 @@ private:
   float min_freq;
   float max_freq;
   int min_gap; //The minimum gap between adjacent peaks such that the are considered unique
-  unsigned int max_cands; //This value is hardcoded (could cause segfault)
-  std::vector<int> idxs;
-  std::vector<float> snrs;
   std::vector<int> peakidxs;
   std::vector<float> peaksnrs;
   std::vector<float> peakfreqs;
   thrust::device_vector<int> d_idxs;
   thrust::device_vector<float> d_snrs;
+  thrust::device_vector<int> d_peak_idxs;
+  thrust::device_vector<float> d_peak_snrs;
+  thrust::device_vector<int> d_work;
   cached_allocator allocator;
-  
-  int identify_unique_peaks(unsigned int count)
-  {
-    int ii;
-    float cpeak;
-    int cpeakidx;
-    int lastidx= -1 * min_gap;
-    int npeaks=0;
-    ii=0;
-
-    while (ii<count){
-      cpeak=snrs[ii];
-      cpeakidx=idxs[ii];
-      lastidx=idxs[ii];
-      ii++;
-
-      while (ii<count && (idxs[ii]-lastidx) < min_gap){
-        if (snrs[ii]>cpeak)
-	  {                                                                                
-	    cpeak=snrs[ii];
-	    cpeakidx=idxs[ii];
-	    lastidx=idxs[ii];
-	  }
-        ii++;
-      }
-      peakidxs[npeaks]=cpeakidx;
-      peaksnrs[npeaks]=cpeak;
-      npeaks++;
-    }
-    return npeaks;
-  }
 
 public:
   PeakFinder(float threshold, float min_freq, float max_freq, unsigned int size, int min_gap=30)
     :threshold(threshold), min_freq(min_freq), 
-     max_freq(max_freq),min_gap(min_gap),max_cands(100000)
+     max_freq(max_freq),min_gap(min_gap)
   {
-    idxs.resize(max_cands);
-    snrs.resize(max_cands);
-    peakidxs.resize(max_cands);
-    peaksnrs.resize(max_cands);
-    peakfreqs.resize(max_cands);
     d_idxs.resize(size);
     d_snrs.resize(size);
   }
 
+  void set_threshold(float threshold_){threshold = threshold_;}
+
+  float get_threshold(void){return threshold;}
+
   void find_candidates(HarmonicSums<float>& sums, SpectrumCandidates& cands){
     for (int ii=0;ii<sums.size();ii++)
       find_candidates(*sums[ii],cands);
   }
   
   void find_candidates(DevicePowerSpectrum<float>& pspec, SpectrumCandidates& cands){
-    int size = pspec.get_nbins();
-    float nyquist = pspec.get_bin_width()*size;
+    find_candidates(pspec.get_data(),pspec.get_nbins(),pspec.get_bin_width(),
+		    pspec.get_nh(),cands);
+  }
+
+  void find_candidates(float* data, int size, double bin_width, int nh,
+		       SpectrumCandidates& cands){
+    float nyquist = bin_width*size;
     int orig_size = 2.0*(size-1.0);
-    int nh = pspec.get_nh();
-    int max_bin = (int)((max_freq/pspec.get_bin_width())*pow(2.0,nh));
+    int max_bin = (int)((max_freq/bin_width)*pow(2.0,nh));
     int start_idx = (int)(orig_size*(min_freq/nyquist)*pow(2.0,nh));
-    int count = device_find_peaks(std::min(size,max_bin),
-                                  start_idx, pspec.get_data(),
-                                  threshold, &idxs[0], &snrs[0],
-				  d_idxs,d_snrs,allocator);
-    int npeaks = identify_unique_peaks(count);
+    //crossings are clustered on the device, only the peaks come back
+    int npeaks = device_find_unique_peaks(std::min(size,max_bin),
+					  start_idx, data, threshold, min_gap,
+					  d_idxs,d_snrs,d_peak_idxs,d_peak_snrs,
+					  d_work,allocator,MAX_BLOCKS,MAX_THREADS);
+    if (npeaks<=0)
+      return;
+    peakidxs.resize(npeaks);
+    peaksnrs.resize(npeaks);
+    Utils::d2hcpy<int>(&peakidxs[0],thrust::raw_pointer_cast(d_peak_idxs.data()),npeaks);
+    Utils::d2hcpy<float>(&peaksnrs[0],thrust::raw_pointer_cast(d_peak_snrs.data()),npeaks);
     float factor = 1.0/size*nyquist/pow(2.0,(float)nh);
+    peakfreqs.resize(npeaks);
     for (int ii=0;ii<npeaks;ii++){
       peakfreqs[ii] = peakidxs[ii]*factor;
     }
     cands.append(&peaksnrs[0],&peakfreqs[0],nh,npeaks);
   }
 };
+
+/*
+  Harmonic summing and peak finding in a single pass.
+
+  Gives the same candidates as HarmonicFolder::fold followed by
+  PeakFinder::find_candidates on the fundamental and on every fold,
+  but the folds are never written to device memory: only bins above
+  threshold come back, as (bin, fold, power) tuples. Tuples arrive
+  in arbitrary order and are grouped by fold and sorted by bin on the
+  host before clustering. The tuple buffer grows (and the kernel is
+  rerun) if a spectrum has more crossings than it can hold.
+
+  Given lists of bin ranges, only the bins inside them are summed and
+  thresholded, for searches that already know where to look.
+*/
+class HarmonicPeakFinder {
+private:
+  float threshold;
+  float min_freq;
+  float max_freq;
+  int min_gap;
+  unsigned int nfolds;
+  unsigned int max_peaks;
+  unsigned int max_blocks;
+  unsigned int max_threads;
+  int* d_bins;
+  int* d_nh;
+  float* d_powers;
+  unsigned int* d_count;
+  int* d_ranges;
+  unsigned int max_ranges;
+  std::vector<int> range_levels;
+  std::vector<int> range_starts;
+  std::vector<int> range_offsets;
+  std::vector<int> bins;
+  std::vector<int> nhs;
+  std::vector<float> powers;
+  std::vector< std::vector< std::pair<int,float> > > levels;
+  std::vector<int> idxs;
+  std::vector<float> snrs;
+  std::vector<int> peakidxs;
+  std::vector<float> peaksnrs;
+  std::vector<float> peakfreqs;
+  PeakExtractor extractor;
+
+  void allocate(unsigned int npeaks)
+  {
+    max_peaks = npeaks;
+    Utils::device_malloc<int>(&d_bins,max_peaks);
+    Utils::device_malloc<int>(&d_nh,max_peaks);
+    Utils::device_malloc<float>(&d_powers,max_peaks);
+  }
+
+  void release(void)
+  {
+    Utils::device_free(d_bins);
+    Utils::device_free(d_nh);
+    Utils::device_free(d_powers);
+  }
+
+  //Bins of each fold inside [min_freq,max_freq], as PeakFinder
+  void search_window(int size, double bin_width, peasoup_peak_window& window)
+  {
+    float nyquist = bin_width*size;
+    int orig_size = 2.0*(size-1.0);
+    for (int nh=0;nh<=nfolds;nh++){
+      int max_bin = (int)((max_freq/bin_width)*pow(2.0,nh));
+      window.start[nh] = (int)(orig_size*(min_freq/nyquist)*pow(2.0,nh));
+      window.end[nh] = std::min(size,max_bin);
+    }
+  }
+
+  //Copy back count (bin, fold, power) tuples and cluster each fold's peaks
+  void extract(unsigned int count, int size, double bin_width, SpectrumCandidates& cands)
+  {
+    float nyquist = bin_width*size;
+    bins.resize(count);
+    nhs.resize(count);
+    powers.resize(count);
+    if (count>0){
+      Utils::d2hcpy<int>(&bins[0],d_bins,count);
+      Utils::d2hcpy<int>(&nhs[0],d_nh,count);
+      Utils::d2hcpy<float>(&powers[0],d_powers,count);
+    }
+
+    for (int nh=0;nh<=nfolds;nh++)
+      levels[nh].clear();
+    for (int ii=0;ii<count;ii++)
+      levels[nhs[ii]].push_back(std::make_pair(bins[ii],powers[ii]));
+
+    for (int nh=0;nh<=nfolds;nh++){
+      std::vector< std::pair<int,float> >& level = levels[nh];
+      unsigned int npoints = level.size();
+      if (npoints==0)
+	continue;
+      std::sort(level.begin(),level.end());
+      idxs.resize(npoints);
+      snrs.resize(npoints);
+      for (int ii=0;ii<npoints;ii++){
+	idxs[ii] = level[ii].first;
+	snrs[ii] = level[ii].second;
+      }
+      int npeaks = extractor.cluster(&idxs[0],&snrs[0],npoints,peakidxs,peaksnrs);
+      float factor = 1.0/size*nyquist/pow(2.0,(float)nh);
+      peakfreqs.resize(npeaks);
+      for (int ii=0;ii<npeaks;ii++)
+	peakfreqs[ii] = peakidxs[ii]*factor;
+      cands.append(&peaksnrs[0],&peakfreqs[0],nh,npeaks);
+    }
+  }
+
+public:
+  HarmonicPeakFinder(float threshold, float min_freq, float max_freq,
+		     unsigned int nfolds, int min_gap=30,
+		     unsigned int max_peaks=65536,
+		     unsigned int max_blocks=MAX_BLOCKS,
+		     unsigned int max_threads=MAX_THREADS)
+    :threshold(threshold),min_freq(min_freq),max_freq(max_freq),
+     min_gap(min_gap),nfolds(nfolds),max_blocks(max_blocks),
+     max_threads(max_threads),d_ranges(NULL),max_ranges(0),
+     levels(nfolds+1),extractor(min_gap)
+  {
+    if (nfolds>MAX_FUSED_HARMONIC_FOLDS)
+      ErrorChecker::throw_error("HarmonicPeakFinder: too many harmonic folds requested");
+    allocate(max_peaks);
+    Utils::device_malloc<unsigned int>(&d_count,1);
+  }
+
+  ~HarmonicPeakFinder()
+  {
+    release();
+    Utils::device_free(d_count);
+    if (d_ranges!=NULL)
+      Utils::device_free(d_ranges);
+  }
+
+  void find_candidates(DevicePowerSpectrum<float>& pspec, SpectrumCandidates& cands)
+  {
+    find_candidates(pspec.get_data(),pspec.get_nbins(),pspec.get_bin_width(),cands);
+  }
+
+  void find_candidates(float* data, int size, double bin_width, SpectrumCandidates& cands)
+  {
+    peasoup_peak_window window;
+    search_window(size,bin_width,window);
+    unsigned int count = device_harmonic_sum_peaks(data,size,nfolds,
+						   threshold,window,d_bins,d_nh,
+						   d_powers,d_count,max_peaks,
+						   max_blocks,max_threads);
+    if (count>max_peaks){
+      release();
+      allocate(count+count/2);
+      count = device_harmonic_sum_peaks(data,size,nfolds,
+					threshold,window,d_bins,d_nh,
+					d_powers,d_count,max_peaks,
+					max_blocks,max_threads);
+    }
+    extract(count,size,bin_width,cands);
+  }
+
+  /*!
+    \brief Harmonic sum and find peaks only inside some bin ranges.
+
+    \param ranges [start,end) bin ranges of each fold, ranges[nh] for
+    fold nh. Ranges may overlap; they are merged and clipped to the
+    searched frequency band. Peaks are clustered within the ranges only.
+  */
+  void find_candidates(float* data, int size, double bin_width,
+		       std::vector< std::vector< std::pair<int,int> > >& ranges,
+		       SpectrumCandidates& cands)
+  {
+    peasoup_peak_window window;
+    search_window(size,bin_width,window);
+    range_levels.clear();
+    range_starts.clear();
+    range_offsets.assign(1,0);
+    for (int nh=0;nh<=nfolds && nh<ranges.size();nh++){
+      std::vector< std::pair<int,int> >& level = ranges[nh];
+      std::sort(level.begin(),level.end());
+      for (int ii=0;ii<level.size();){
+	int start = std::max(level[ii].first,window.start[nh]);
+	int end = level[ii].second;
+	for (ii++;ii<level.size() && level[ii].first<=end;ii++)
+	  end = std::max(end,level[ii].second);
+	end = std::min(end,window.end[nh]);
+	if (end<=start)
+	  continue;
+	range_levels.push_back(nh);
+	range_starts.push_back(start);
+	range_offsets.push_back(range_offsets.back()+end-start);
+      }
+    }
+    unsigned int nranges = range_levels.size();
+    if (nranges==0)
+      return;
+    //levels, starts and offsets in one upload
+    std::vector<int> packed(range_levels);
+    packed.insert(packed.end(),range_starts.begin(),range_starts.end());
+    packed.insert(packed.end(),range_offsets.begin(),range_offsets.end());
+    if (packed.size()>max_ranges){
+      if (d_ranges!=NULL)
+	Utils::device_free(d_ranges);
+      max_ranges = packed.size()+packed.size()/2;
+      Utils::device_malloc<int>(&d_ranges,max_ranges);
+    }
+    Utils::h2dcpy<int>(d_ranges,&packed[0],packed.size());
+    unsigned int total = range_offsets.back();
+    unsigned int count = device_harmonic_sum_peaks_ranges(data,nranges,d_ranges,total,
+							  threshold,d_bins,d_nh,d_powers,
+							  d_count,max_peaks,
+							  max_blocks,max_threads);
+    if (count>max_peaks){
+      release();
+      allocate(count+count/2);
+      count = device_harmonic_sum_peaks_ranges(data,nranges,d_ranges,total,
+					       threshold,d_bins,d_nh,d_powers,
+					       d_count,max_peaks,
+					       max_blocks,max_threads);
+    }
+    extract(count,size,bin_width,cands);
+  }
+};
@@ -1,19 +1,108 @@
 #pragma once
 #include "stdio.h"
+#include "unistd.h"
+#include <pthread.h>
 #include "data_types/candidates.hpp"
+#include "data_types/candidatetable.hpp"
+#include <utils/exceptions.hpp>
 #include <vector>
+#include <string>
 #include <cmath>
 #include <algorithm>
 
+/*
+  A score computed for every candidate in the scorer's pass. Features
+  must be safe to compute from several threads at once; their values
+  land in Candidate::features in the order they were added to the
+  scorer, and are written to the overview under get_name().
+
+  Candidates are scored as rows of the CandidateTable they were
+  distilled in, so features walk the row's association edges rather
+  than nested assoc vectors.
+*/
+class ScoreFeature {
+public:
+  virtual ~ScoreFeature(){}
+  virtual std::string get_name(void)=0;
+
+  //Score cand, which is row of table and directly associated with the row's edges
+  virtual float compute(const Candidate& cand, const CandidateTable& table, int row)=0;
+};
+
+//S/N weighted RMS DM offset of the associations, in units of the DM smearing width
+class DMCurveWidth: public ScoreFeature {
+private:
+  float tdm_band_partial;
+
+public:
+  DMCurveWidth(float cfreq, float bw)
+  {
+    float ftop = cfreq+bw/2.0;
+    float fbottom = cfreq-bw/2.0;
+    tdm_band_partial = 4150.0*(1.0/std::pow(fbottom,2) - 1.0/std::pow(ftop,2));
+  }
+
+  std::string get_name(void){return "dm_curve_width";}
+
+  float compute(const Candidate& cand, const CandidateTable& table, int row)
+  {
+    double ddm = 1.0/(cand.freq*tdm_band_partial);
+    double weight = cand.snr;
+    double sum = 0;
+    for (int edge=table.first_assoc(row);edge>=0;edge=table.next_assoc(edge)){
+      int child = table.assoc_row(edge);
+      double offset = (table.dm[child]-cand.dm)/ddm;
+      weight += table.snr[child];
+      sum += table.snr[child]*offset*offset;
+    }
+    return weight>0 ? sqrt(sum/weight) : 0;
+  }
+};
+
+//S/N weighted standard deviation of acceleration over a candidate and its associations
+class AccelerationSpread: public ScoreFeature {
+public:
+  std::string get_name(void){return "acc_spread";}
+
+  float compute(const Candidate& cand, const CandidateTable& table, int row)
+  {
+    double weight = cand.snr;
+    double sum = cand.snr*cand.acc;
+    double sum_sq = cand.snr*cand.acc*cand.acc;
+    for (int edge=table.first_assoc(row);edge>=0;edge=table.next_assoc(edge)){
+      int child = table.assoc_row(edge);
+      weight += table.snr[child];
+      sum += table.snr[child]*table.acc[child];
+      sum_sq += table.snr[child]*table.acc[child]*table.acc[child];
+    }
+    if (weight<=0)
+      return 0;
+    double mean = sum/weight;
+    return sqrt(std::max(0.0,sum_sq/weight-mean*mean));
+  }
+};
+
 class CandidateScorer {
 private:
+  struct Chunk {
+    CandidateScorer* scorer;
+    std::vector<Candidate>* cands;
+    const CandidateTable* table;
+    const std::vector<int>* rows;
+    size_t start;
+    size_t end;
+  };
+
   float tsamp;
   float cfreq;
   float foff;
   float tdm_chan_partial;
   float tdm_band_partial;
   int max_dm_gap;
-  
+  unsigned int nthreads;
+  size_t min_chunk;
+  std::vector<ScoreFeature*> features;
+
   inline float tdm_chan(float ddm){
     return ddm*tdm_chan_partial;
   }
@@ -21,67 +110,143 @@ private:
   inline float tdm_band(float ddm){
     return ddm*tdm_band_partial;
   }
-  
+
   inline bool has_physical_period(Candidate& cand){
     return 1.0/cand.freq>tdm_chan(cand.dm);
   }
 
-  inline bool has_adjacency(Candidate& cand){
+  //An association in an adjacent DM trial, or all of them in the same one
+  inline bool has_adjacency(Candidate& cand, const CandidateTable& table, int row){
+    const int* dm_idx = &table.dm_idx[0];
     int idx = cand.dm_idx;
-    bool adjacent = false; 
-    bool unique = true;
-    for (int ii=0;ii<cand.assoc.size();ii++){
-      if (cand.assoc[ii].dm_idx!=idx)
-	unique = false;
-      if (cand.assoc[ii].dm_idx==idx+1 || cand.assoc[ii].dm_idx==idx-1){
-	adjacent = true;
-	break;
-      }
+    int adjacent = 0;
+    int unique = 1;
+    for (int edge=table.first_assoc(row);edge>=0;edge=table.next_assoc(edge)){
+      int step = dm_idx[table.assoc_row(edge)]-idx;
+      adjacent |= (step==1) | (step==-1);
+      unique &= (step==0);
     }
-    if (adjacent || unique)
-      return true;
-    else
-      return false;
+    return adjacent || unique;
   }
-  
-  inline void delta_dm_ratio(Candidate& cand){
+
+  //S/N sums are accumulated in association order, so the ratios are unchanged
+  inline void delta_dm_ratio(Candidate& cand, const CandidateTable& table, int row){
+    const float* dm = &table.dm[0];
+    const float* snr = &table.snr[0];
     int inside_count = 1;
     int total_count = 1;
     float inside_snr = cand.snr;
     float total_snr = cand.snr;
     float ddm = 1.0/(cand.freq*tdm_band_partial);
-    for (int ii=0;ii<cand.assoc.size();ii++){
+    float cand_dm = cand.dm;
+    for (int edge=table.first_assoc(row);edge>=0;edge=table.next_assoc(edge)){
+      int child = table.assoc_row(edge);
+      int inside = fabs(cand_dm-dm[child]) <= ddm;
+      total_snr += snr[child];
       total_count++;
-      total_snr+=cand.assoc[ii].snr;
-      if (fabs(cand.dm-cand.assoc[ii].dm) <= ddm){
-	inside_count++;
-	inside_snr+=cand.assoc[ii].snr;
-      }
+      inside_count += inside;
+      inside_snr += inside ? snr[child] : 0.0f;
     }
-    float count_ratio = (float) inside_count/total_count;
-    float snr_ratio = (float) inside_snr/total_snr;
-    cand.ddm_count_ratio = count_ratio;
-    cand.ddm_snr_ratio = snr_ratio;
-  }
-    
-public:  
-  CandidateScorer(float tsamp, float cfreq, float foff, float bw)
-    :tsamp(tsamp),cfreq(cfreq),foff(foff)
+    cand.ddm_count_ratio = (float) inside_count/total_count;
+    cand.ddm_snr_ratio = (float) inside_snr/total_snr;
+  }
+
+  //Only reads the scorer, so any number of rows can be scored at once
+  void score_row(Candidate& cand, const CandidateTable& table, int row){
+    cand.is_physical = has_physical_period(cand);
+    cand.is_adjacent = has_adjacency(cand,table,row);
+    delta_dm_ratio(cand,table,row);
+    cand.features.resize(features.size());
+    for (int ii=0;ii<features.size();ii++)
+      cand.features[ii] = features[ii]->compute(cand,table,row);
+  }
+
+  static void* score_chunk(void* arg)
+  {
+    Chunk& chunk = *(Chunk*) arg;
+    std::vector<Candidate>& cands = *chunk.cands;
+    const std::vector<int>& rows = *chunk.rows;
+    for (size_t ii=chunk.start;ii<chunk.end;ii++)
+      chunk.scorer->score_row(cands[ii],*chunk.table,rows[ii]);
+    return NULL;
+  }
+
+public:
+  /*!
+    \param nthreads Number of threads to score with (0 for all online cores).
+    \param min_chunk Fewest candidates worth giving to a thread.
+  */
+  CandidateScorer(float tsamp, float cfreq, float foff, float bw,
+		  unsigned int nthreads=0, size_t min_chunk=256)
+    :tsamp(tsamp),cfreq(cfreq),foff(foff),nthreads(nthreads),
+     min_chunk(std::max((size_t)1,min_chunk))
   {
     float ftop = cfreq+bw/2.0;
     float fbottom = cfreq-bw/2.0;
     tdm_chan_partial = 8300.0 * foff / std::pow(cfreq,3.0);
     tdm_band_partial = 4150.0*(1.0/std::pow(fbottom,2) - 1.0/std::pow(ftop,2));
+    if (this->nthreads==0){
+      long ncores = sysconf(_SC_NPROCESSORS_ONLN);
+      this->nthreads = std::max(1L,ncores);
+    }
+  }
+
+  //Compute feature for every candidate scored from now on (not owned)
+  void add_feature(ScoreFeature* feature){
+    features.push_back(feature);
+  }
+
+  std::vector<std::string> get_feature_names(void){
+    std::vector<std::string> names;
+    for (int ii=0;ii<features.size();ii++)
+      names.push_back(features[ii]->get_name());
+    return names;
   }
 
+  //Score one candidate with nested associations; safe to call from several threads
   void score(Candidate& cand){
-    cand.is_physical = has_physical_period(cand);
-    cand.is_adjacent = has_adjacency(cand);
-    delta_dm_ratio(cand);
+    CandidateTable table;
+    int row = table.add(cand);
+    score_row(cand,table,row);
+  }
+
+  /*!
+    \brief Score candidates that are rows of a distilling table.
+
+    \param cands Candidates to score, as table.to_candidates(rows).
+    \param table Table the candidates were distilled in.
+    \param rows Row of each candidate.
+  */
+  void score_all(std::vector<Candidate>& cands, const CandidateTable& table,
+		 const std::vector<int>& rows){
+    if (cands.empty())
+      return;
+    if (rows.size()!=cands.size())
+      ErrorChecker::throw_error("CandidateScorer: one row is needed per candidate");
+    unsigned int nchunks = std::max((size_t)1,std::min((size_t)nthreads,cands.size()/min_chunk));
+    std::vector<Chunk> chunks(nchunks);
+    std::vector<pthread_t> threads(nchunks);
+    for (int ii=0;ii<nchunks;ii++){
+      chunks[ii].scorer = this;
+      chunks[ii].cands = &cands;
+      chunks[ii].table = &table;
+      chunks[ii].rows = &rows;
+      chunks[ii].start = ii*cands.size()/nchunks;
+      chunks[ii].end = (ii+1)*cands.size()/nchunks;
+    }
+    //chunk 0 runs on the calling thread
+    for (int ii=1;ii<nchunks;ii++)
+      if (pthread_create(&threads[ii],NULL,score_chunk,(void*)&chunks[ii]))
+	ErrorChecker::throw_error("CandidateScorer: failed to create thread");
+    score_chunk((void*)&chunks[0]);
+    for (int ii=1;ii<nchunks;ii++)
+      pthread_join(threads[ii],NULL);
   }
 
+  //Score candidates with nested associations
   void score_all(std::vector<Candidate>& cands){
-    for (int ii=0;ii<cands.size();ii++)
-      score(cands[ii]);
+    CandidateTable table;
+    std::vector<int> rows = table.append(cands);
+    score_all(cands,table,rows);
   }
 };
@@ -0,0 +1,153 @@
+#pragma once
+#include "cuda.h"
+#include "cufft.h"
+#include <vector>
+#include <algorithm>
+#include "data_types/timeseries.hpp"
+#include "data_types/fourierseries.hpp"
+#include "data_types/candidates.hpp"
+#include "transforms/ffter.hpp"
+#include "transforms/spectrumformer.hpp"
+#include "transforms/harmonicfolder.hpp"
+#include "transforms/peakfinder.hpp"
+#include "transforms/distiller.hpp"
+#include "utils/exceptions.hpp"
+#include "utils/utils.hpp"
+#include "utils/stats.hpp"
+#include <kernels/defaults.h>
+#include <kernels/kernels.h>
+
+/*
+  Acceleration search of partial observations.
+
+  At level L the dereddened series is cut into segments of about
+  size/2^L samples, rounded down to a 7-smooth length so the short
+  transforms stay fast, overlapping by half a segment. The last segment
+  is placed flush with the end of the series, so every stretch of
+  orbit is seen whole by at least one segment. Each segment
+  is resampled over the acceleration grid its own AccelerationPlan
+  gives for the shorter tobs, transformed with a short FFT, normalised
+  against its own zero acceleration spectrum and searched as usual.
+  Candidates are acceleration distilled per segment (with the segment
+  tobs) and tagged with their level and segment so the DM and harmonic
+  distillers merge them with the full length candidates.
+*/
+class SegmentSearcher {
+private:
+  unsigned int level;
+  unsigned int size;
+  unsigned int step;
+  unsigned int nsegments;
+  unsigned int full_size;
+  AccelerationPlan& plan;
+  double tobs;
+  CuFFTerR2C r2cfft;
+  DeviceTimeSeries<float> d_tim_r;
+  DeviceFourierSeries<cufftComplex> d_fseries;
+  DevicePowerSpectrum<float> pspec;
+  HarmonicSums<float> sums;
+  HarmonicFolder harm_folder;
+  PeakFinder cand_finder;
+  HarmonicDistiller harm_finder;
+  AccelerationDistiller acc_still;
+  SpectrumFormer former;
+  std::vector<float> acc_list;
+  std::vector<float> jerk_list;
+
+  void resample(float* input, float acc, float jerk, float tsamp)
+  {
+    if (jerk!=0)
+      device_resampleIII(input,d_tim_r.get_data(),size,acc,jerk,tsamp,
+			 MAX_THREADS,MAX_BLOCKS);
+    else
+      device_resampleII(input,d_tim_r.get_data(),size,acc,tsamp,
+			MAX_THREADS,MAX_BLOCKS);
+  }
+
+public:
+  /*!
+    \param full_size Transform length of the full series.
+    \param level Segments are about full_size/2^level samples long.
+    \param plan Acceleration plan for the segment length.
+    \param threshold S/N threshold.
+    \param min_freq Lowest frequency to search.
+    \param max_freq Highest frequency to search.
+    \param nharmonics Number of harmonic folds.
+    \param freq_tol Fractional frequency tolerance.
+    \param max_harm Highest harmonic removed by the harmonic distiller.
+    \param tsamp Sampling time (s).
+  */
+  SegmentSearcher(unsigned int full_size, unsigned int level,
+		  AccelerationPlan& plan, float threshold,
+		  float min_freq, float max_freq,
+		  unsigned int nharmonics, float freq_tol,
+		  float max_harm, float tsamp)
+    :level(level),size(segment_size(full_size,level)),step(size/2),
+     nsegments(size<2 ? 0 : (full_size-size+step-1)/step+1),
+     full_size(full_size),plan(plan),
+     tobs(size*(double)tsamp),
+     r2cfft(size),d_tim_r(size),
+     d_fseries(size/2+1,1.0/tobs),pspec(d_fseries),
+     sums(pspec,nharmonics),harm_folder(sums),
+     cand_finder(threshold,min_freq,max_freq,size),
+     harm_finder(freq_tol,max_harm,false),
+     acc_still(tobs,freq_tol,true)
+  {
+    if (level==0 || size<2)
+      ErrorChecker::throw_error("SegmentSearcher: invalid segment level");
+  }
+
+  //Segment length at a level, the largest 7-smooth length <= full_size/2^level
+  static unsigned int segment_size(unsigned int full_size, unsigned int level)
+  {
+    return Utils::prev_smooth_length(full_size>>level);
+  }
+
+  unsigned int get_nsegments(void){return nsegments;}
+  unsigned int get_size(void){return size;}
+
+  /*!
+    \brief Search every segment of a series.
+
+    \param tim Dereddened full length time series.
+    \param dm DM of the series.
+    \param dm_idx Index of the DM trial.
+    \param cands Acceleration distilled candidates are appended here.
+  */
+  void search(DeviceTimeSeries<float>& tim, float dm, int dm_idx,
+	      CandidateCollection& cands)
+  {
+    float tsamp = tim.get_tsamp();
+    float mean,std,rms;
+    plan.generate_accel_list(dm,acc_list);
+    plan.generate_jerk_list(dm,jerk_list);
+    for (int seg=0;seg<nsegments;seg++){
+      float* input = tim.get_data()+std::min((size_t)seg*step,(size_t)(full_size-size));
+      resample(input,0.0,0.0,tsamp);
+      r2cfft.execute(d_tim_r.get_data(),d_fseries.get_data());
+      former.form_interpolated(d_fseries,pspec);
+      stats::stats<float>(pspec.get_data(),size/2+1,&mean,&rms,&std);
+
+      CandidateCollection accel_trial_cands;
+      for (int jj=0;jj<jerk_list.size();jj++){
+	for (int kk=0;kk<acc_list.size();kk++){
+	  resample(input,acc_list[kk],jerk_list[jj],tsamp);
+	  r2cfft.execute(d_tim_r.get_data(),d_fseries.get_data());
+	  former.form_interpolated(d_fseries,pspec);
+	  stats::normalise(pspec.get_data(),mean,std,size/2+1);
+	  SpectrumCandidates trial_cands(dm,dm_idx,acc_list[kk],jerk_list[jj]);
+	  harm_folder.fold(pspec);
+	  cand_finder.find_candidates(pspec,trial_cands);
+	  cand_finder.find_candidates(sums,trial_cands);
+	  accel_trial_cands.append(harm_finder.distill(trial_cands.cands));
+	}
+      }
+      std::vector<Candidate> seg_cands = acc_still.distill(accel_trial_cands.cands);
+      for (int ii=0;ii<seg_cands.size();ii++){
+	seg_cands[ii].segment_level = level;
+	seg_cands[ii].segment = seg;
+      }
+      cands.append(seg_cands);
+    }
+  }
+};
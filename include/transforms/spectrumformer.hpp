@@ -2,6 +2,9 @@
 #include <data_types/fourierseries.hpp>
 #include <kernels/kernels.h>
 #include <kernels/defaults.h>
+#include <complex>
+#include <cmath>
+#include <algorithm>
 
 class SpectrumFormer {
 public:
@@ -22,3 +25,44 @@ public:
   }
 
 };
+
+//CPU counterpart of SpectrumFormer (same expressions as the kernels)
+class HostSpectrumFormer {
+public:
+  void form_interpolated(const std::complex<float>* input, float* output, size_t nbins)
+  {
+    float re_l = 0.0;
+    float im_l = 0.0;
+    for (size_t idx=0;idx<nbins;idx++){
+      float re = input[idx].real();
+      float im = input[idx].imag();
+      float ampsq = re*re+im*im;
+      float ampsq_diff = 0.5*((re-re_l)*(re-re_l) +
+			      (im-im_l)*(im-im_l));
+      output[idx] = sqrtf(std::max(ampsq,ampsq_diff));
+      re_l = re;
+      im_l = im;
+    }
+  }
+
+  void form(const std::complex<float>* input, float* output, size_t nbins)
+  {
+    for (size_t idx=0;idx<nbins;idx++){
+      float re = input[idx].real();
+      float im = input[idx].imag();
+      output[idx] = sqrtf(re*re+im*im);
+    }
+  }
+
+  void form_interpolated(HostFourierSeries< std::complex<float> >& input,
+			 HostPowerSpectrum<float>& output)
+  {
+    form_interpolated(input.get_data(),output.get_data(),input.get_nbins());
+  }
+
+  void form(HostFourierSeries< std::complex<float> >& input,
+	    HostPowerSpectrum<float>& output)
+  {
+    form(input.get_data(),output.get_data(),input.get_nbins());
+  }
+};
@@ -0,0 +1,99 @@
+#pragma once
+#include <deque>
+#include "pthread.h"
+
+/*
+  Fixed capacity FIFO between pipeline stages.
+
+  push() blocks while the queue is full, so a slow consumer holds back
+  its producers (back-pressure); try_push() gives up instead. pop()
+  blocks until an item arrives or the queue is closed and drained.
+*/
+template <class T>
+class BoundedQueue {
+private:
+  std::deque<T> items;
+  size_t capacity;
+  bool closed;
+  pthread_mutex_t mutex;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+
+public:
+  BoundedQueue(size_t capacity)
+    :capacity(capacity>0?capacity:1),closed(false)
+  {
+    pthread_mutex_init(&mutex,NULL);
+    pthread_cond_init(&not_empty,NULL);
+    pthread_cond_init(&not_full,NULL);
+  }
+
+  ~BoundedQueue()
+  {
+    pthread_cond_destroy(&not_full);
+    pthread_cond_destroy(&not_empty);
+    pthread_mutex_destroy(&mutex);
+  }
+
+  //Returns false if the queue was closed
+  bool push(const T& item)
+  {
+    pthread_mutex_lock(&mutex);
+    while (items.size()>=capacity && !closed)
+      pthread_cond_wait(&not_full,&mutex);
+    bool ok = !closed;
+    if (ok){
+      items.push_back(item);
+      pthread_cond_signal(&not_empty);
+    }
+    pthread_mutex_unlock(&mutex);
+    return ok;
+  }
+
+  //Returns false if the queue is full or closed
+  bool try_push(const T& item)
+  {
+    pthread_mutex_lock(&mutex);
+    bool ok = !closed && items.size()<capacity;
+    if (ok){
+      items.push_back(item);
+      pthread_cond_signal(&not_empty);
+    }
+    pthread_mutex_unlock(&mutex);
+    return ok;
+  }
+
+  //Returns false once the queue is closed and empty
+  bool pop(T& item)
+  {
+    pthread_mutex_lock(&mutex);
+    while (items.empty() && !closed)
+      pthread_cond_wait(&not_empty,&mutex);
+    bool ok = !items.empty();
+    if (ok){
+      item = items.front();
+      items.pop_front();
+      pthread_cond_signal(&not_full);
+    }
+    pthread_mutex_unlock(&mutex);
+    return ok;
+  }
+
+  //Wake all waiters; queued items can still be popped
+  void close(void)
+  {
+    pthread_mutex_lock(&mutex);
+    closed = true;
+    pthread_cond_broadcast(&not_empty);
+    pthread_cond_broadcast(&not_full);
+    pthread_mutex_unlock(&mutex);
+  }
+
+  size_t size(void)
+  {
+    pthread_mutex_lock(&mutex);
+    size_t n = items.size();
+    pthread_mutex_unlock(&mutex);
+    return n;
+  }
+};
@@ -10,12 +10,15 @@ struct CmdLineOptions {
   std::string zapfilename;
   int max_num_threads;
   unsigned int size;
+  std::string fft_table;
   float dm_start;
   float dm_end;
   float dm_tol;
   float dm_pulse_width;
   float acc_start;
   float acc_end;
+  float jerk_start;
+  float jerk_end;
   float acc_tol;
   float acc_pulse_width;
   float boundary_5_freq;
@@ -28,6 +31,27 @@ struct CmdLineOptions {
   float max_freq;
   int max_harm;
   float freq_tol;
+  bool fdas;
+  float zmax;
+  float zstep;
+  bool fuse_harmonics;
+  int acc_batch;
+  int coarse_tscrunch;
+  float coarse_miss_prob;
+  float coarse_false_alarms;
+  int segment_levels;
+  int task_trials;
+  int cpu_workers;
+  bool physical_cores;
+  float early_fold_snr;
+  int queue_depth;
+  int distill_threads;
+  std::string known_sources;
+  bool remove_known;
+  bool checkpoint;
+  bool resume;
+  bool spill_trials;
+  std::string shard;
   bool verbose;
   bool progress_bar;
 };
@@ -97,9 +121,13 @@ bool read_cmdline_options(CmdLineOptions& args, int argc, char **argv)
 				     false, 1000, "int", cmd);
 
       TCLAP::ValueArg<size_t> arg_size("", "fft_size",
-                                       "Transform size to use (defaults to lower power of two)",
+                                       "Transform size to use (defaults to fastest 2^a.3^b.5^c.7^d length >= nsamps)",
                                        false, 0, "size_t", cmd);
 
+      TCLAP::ValueArg<std::string> arg_fft_table("", "fft_table",
+						 "Transform length benchmark from fft_benchmark to choose the length from",
+						 false, "", "string", cmd);
+
       TCLAP::ValueArg<float> arg_dm_start("", "dm_start",
                                           "First DM to dedisperse to",
                                           false, 0.0, "float", cmd);
@@ -124,6 +152,14 @@ bool read_cmdline_options(CmdLineOptions& args, int argc, char **argv)
 					 "Last acceleration to resample to",
 					 false, 0.0, "float", cmd);
 
+      TCLAP::ValueArg<float> arg_jerk_start("", "jerk_start",
+                                            "First jerk to resample to (m/s/s/s)",
+                                            false, 0.0, "float",cmd);
+
+      TCLAP::ValueArg<float> arg_jerk_end("", "jerk_end",
+                                          "Last jerk to resample to (m/s/s/s)",
+                                          false, 0.0, "float",cmd);
+
       TCLAP::ValueArg<float> arg_acc_tol("", "acc_tol",
 					 "Acceleration smearing tolerance (1.11=10%)",
 					 false, 1.10, "float",cmd);
@@ -168,6 +204,82 @@ bool read_cmdline_options(CmdLineOptions& args, int argc, char **argv)
                                           "Tolerance for distilling frequencies (0.0001 = 0.01%)",
                                           false, 0.0001, "float",cmd);
 
+      TCLAP::SwitchArg arg_fdas("", "fdas", "Use Fourier domain acceleration search", cmd);
+
+      TCLAP::ValueArg<float> arg_zmax("", "zmax",
+                                      "Largest Fourier drift (bins) for Fourier domain search",
+                                      false, 200.0, "float",cmd);
+
+      TCLAP::ValueArg<float> arg_zstep("", "zstep",
+                                       "Spacing of Fourier drift trials (bins)",
+                                       false, 2.0, "float",cmd);
+
+      TCLAP::SwitchArg arg_fuse_harmonics("", "fuse_harmonics",
+                                          "Harmonic sum and find peaks in one pass without storing the sums", cmd);
+
+      TCLAP::ValueArg<int> arg_acc_batch("", "acc_batch",
+                                         "Acceleration trials to process per batch (0 = fit to GPU memory)",
+                                         false, 1, "int",cmd);
+
+      TCLAP::ValueArg<int> arg_coarse_tscrunch("", "coarse_tscrunch",
+                                               "Decimation of the coarse acceleration pass (0 or 1 = single pass)",
+                                               false, 0, "int",cmd);
+
+      TCLAP::ValueArg<float> arg_coarse_miss_prob("", "coarse_miss_prob",
+                                                  "Allowed probability that the coarse pass misses a min_snr signal",
+                                                  false, 0.01, "float",cmd);
+
+      TCLAP::ValueArg<float> arg_coarse_false_alarms("", "coarse_false_alarms",
+                                                     "Allowed number of coarse pass noise detections per DM",
+                                                     false, 10.0, "float",cmd);
+
+      TCLAP::ValueArg<int> arg_segment_levels("", "segment_levels",
+                                              "Also search half-overlapping segments of tobs/2 ... tobs/2^N",
+                                              false, 0, "int",cmd);
+
+      TCLAP::ValueArg<int> arg_task_trials("", "task_trials",
+                                           "Acceleration trials per scheduled task (0 = auto, -1 = whole DMs)",
+                                           false, 0, "int",cmd);
+
+      TCLAP::ValueArg<int> arg_cpu_workers("", "cpu_workers",
+                                           "CPU search workers alongside the GPUs (-1 = one per free core)",
+                                           false, 0, "int",cmd);
+
+      TCLAP::SwitchArg arg_physical_cores("", "physical_cores",
+                                          "Size the CPU pool to physical cores, ignoring SMT siblings", cmd);
+
+      TCLAP::ValueArg<float> arg_early_fold_snr("", "early_fold_snr",
+                                                "Fold candidates above this S/N while the search runs (0 = off)",
+                                                false, 0.0, "float",cmd);
+
+      TCLAP::ValueArg<int> arg_queue_depth("", "queue_depth",
+                                           "Candidate sets buffered between search, distill and fold stages",
+                                           false, 64, "int",cmd);
+
+      TCLAP::ValueArg<int> arg_distill_threads("", "distill_threads",
+                                               "Threads for distilling and scoring after the search (0 = one per core)",
+                                               false, 0, "int",cmd);
+
+      TCLAP::ValueArg<std::string> arg_known_sources("", "known_sources",
+                                                     "Catalogue of known pulsars and periodic RFI to tag candidates with",
+                                                     false, "", "string",cmd);
+
+      TCLAP::SwitchArg arg_remove_known("", "remove_known",
+                                        "Drop candidates matching --known_sources before folding", cmd);
+
+      TCLAP::SwitchArg arg_checkpoint("", "checkpoint",
+                                      "Journal the candidates of each finished DM trial to the output directory", cmd);
+
+      TCLAP::SwitchArg arg_resume("", "resume",
+                                  "Resume an interrupted search from its journal (implies --checkpoint)", cmd);
+
+      TCLAP::SwitchArg arg_spill_trials("", "spill_trials",
+                                        "Spill the dedispersed trials to the output directory for --resume", cmd);
+
+      TCLAP::ValueArg<std::string> arg_shard("", "shard",
+                                             "Search DM trials i, i+N, ... only and write them for peasoup_merge",
+                                             false, "", "i/N",cmd);
+
       TCLAP::SwitchArg arg_verbose("v", "verbose", "verbose mode", cmd);
 
       TCLAP::SwitchArg arg_progress_bar("p", "progress_bar", "Enable progress bar for DM search", cmd);
@@ -180,12 +292,15 @@ bool read_cmdline_options(CmdLineOptions& args, int argc, char **argv)
       args.max_num_threads   = arg_max_num_threads.getValue();
       args.limit             = arg_limit.getValue();
       args.size              = arg_size.getValue();
+      args.fft_table         = arg_fft_table.getValue();
       args.dm_start          = arg_dm_start.getValue();
       args.dm_end            = arg_dm_end.getValue();
       args.dm_tol            = arg_dm_tol.getValue();
       args.dm_pulse_width    = arg_dm_pulse_width.getValue();
       args.acc_start         = arg_acc_start.getValue();
       args.acc_end           = arg_acc_end.getValue();
+      args.jerk_start        = arg_jerk_start.getValue();
+      args.jerk_end          = arg_jerk_end.getValue();
       args.acc_tol           = arg_acc_tol.getValue();
       args.acc_pulse_width   = arg_acc_pulse_width.getValue();
       args.boundary_5_freq   = arg_boundary_5_freq.getValue();
@@ -197,6 +312,27 @@ bool read_cmdline_options(CmdLineOptions& args, int argc, char **argv)
       args.max_freq          = arg_max_freq.getValue();
       args.max_harm          = arg_max_harm.getValue();
       args.freq_tol          = arg_freq_tol.getValue();
+      args.fdas              = arg_fdas.getValue();
+      args.zmax              = arg_zmax.getValue();
+      args.zstep             = arg_zstep.getValue();
+      args.fuse_harmonics    = arg_fuse_harmonics.getValue();
+      args.acc_batch         = arg_acc_batch.getValue();
+      args.coarse_tscrunch   = arg_coarse_tscrunch.getValue();
+      args.coarse_miss_prob  = arg_coarse_miss_prob.getValue();
+      args.coarse_false_alarms = arg_coarse_false_alarms.getValue();
+      args.segment_levels    = arg_segment_levels.getValue();
+      args.task_trials       = arg_task_trials.getValue();
+      args.cpu_workers       = arg_cpu_workers.getValue();
+      args.physical_cores    = arg_physical_cores.getValue();
+      args.early_fold_snr    = arg_early_fold_snr.getValue();
+      args.queue_depth       = arg_queue_depth.getValue();
+      args.distill_threads   = arg_distill_threads.getValue();
+      args.known_sources     = arg_known_sources.getValue();
+      args.remove_known      = arg_remove_known.getValue();
+      args.checkpoint        = arg_checkpoint.getValue();
+      args.resume            = arg_resume.getValue();
+      args.spill_trials      = arg_spill_trials.getValue();
+      args.shard             = arg_shard.getValue();
       args.verbose           = arg_verbose.getValue();
       args.progress_bar      = arg_progress_bar.getValue();
 
@@ -0,0 +1,405 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include "stdio.h"
+#include "unistd.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <data_types/candidates.hpp>
+#include <utils/exceptions.hpp>
+
+#define COLUMNAR_MAGIC "PSCANCOL"
+#define COLUMNAR_VERSION 1
+#define COLUMNAR_ALIGN 64
+
+/*
+  Columnar candidate file (candidates.pcol).
+
+  Every section starts on a 64 byte boundary, so a mapped file can be
+  used in place:
+
+    header     ColumnarHeader
+    directory  ncolumns ColumnarColumn entries
+    columns    one array of ncands values per column, in directory order
+    index      ncands ColumnarIndexEntry entries
+    folds      the fold of each folded candidate (nints x nbins floats),
+               each starting on a 64 byte boundary
+    detections CandidatePOD records, the candidate and its associations
+               as written by write_binary
+
+  Column names match the overview.xml elements, except that
+  known_source holds the catalogue index (-1 for none) rather than the
+  name; the scorer's features follow the fixed columns. Readers must
+  reject a newer version.
+*/
+struct ColumnarHeader {
+  char magic[8];
+  unsigned int version;
+  unsigned int ncolumns;
+  unsigned long long ncands;
+  unsigned long long index_offset;
+  unsigned long long fold_offset;
+  unsigned long long fold_bytes;
+  unsigned long long detections_offset;
+  unsigned long long ndetections;
+};
+
+enum ColumnarType {
+  COLUMNAR_FLOAT32 = 0,
+  COLUMNAR_FLOAT64 = 1,
+  COLUMNAR_INT32 = 2,
+  COLUMNAR_UINT8 = 3
+};
+
+struct ColumnarColumn {
+  char name[20];
+  unsigned int type;
+  unsigned long long offset;
+};
+
+//Fold offset is relative to the fold section, detections index the detection section
+struct ColumnarIndexEntry {
+  unsigned long long fold_offset;
+  unsigned int nbins;
+  unsigned int nints;
+  unsigned long long first_detection;
+  unsigned long long ndetections;
+};
+
+//The layout is part of the format
+typedef char columnar_header_is_64_bytes[sizeof(ColumnarHeader)==64 ? 1 : -1];
+typedef char columnar_column_is_32_bytes[sizeof(ColumnarColumn)==32 ? 1 : -1];
+typedef char columnar_index_is_32_bytes[sizeof(ColumnarIndexEntry)==32 ? 1 : -1];
+typedef char columnar_detection_is_24_bytes[sizeof(CandidatePOD)==24 ? 1 : -1];
+
+template <class T> struct ColumnarTypeOf {};
+template <> struct ColumnarTypeOf<float> {static const unsigned int type = COLUMNAR_FLOAT32;};
+template <> struct ColumnarTypeOf<double> {static const unsigned int type = COLUMNAR_FLOAT64;};
+template <> struct ColumnarTypeOf<int> {static const unsigned int type = COLUMNAR_INT32;};
+template <> struct ColumnarTypeOf<unsigned char> {static const unsigned int type = COLUMNAR_UINT8;};
+
+class ColumnarCandidateWriter {
+private:
+  FILE* fo;
+  size_t pos;
+  bool ok;
+  std::vector<ColumnarColumn> columns;
+  std::vector<std::vector<char> > column_data;
+
+  void write(const void* ptr, size_t nbytes){
+    if (nbytes>0 && fwrite(ptr,1,nbytes,fo)!=nbytes)
+      ok = false;
+    pos += nbytes;
+  }
+
+  void pad(void){
+    static const char zeros[COLUMNAR_ALIGN] = {0};
+    write(zeros,(COLUMNAR_ALIGN-pos%COLUMNAR_ALIGN)%COLUMNAR_ALIGN);
+  }
+
+  //Names must fit the directory with their terminating zero
+  static bool fits(const std::string& name){
+    return name.size()<sizeof(((ColumnarColumn*)0)->name);
+  }
+
+  //Add a column to the directory; its offset is set when the data is written
+  template <class T>
+  void add_column(const std::string& name, const std::vector<T>& values){
+    ColumnarColumn column;
+    memset(&column,0,sizeof(column));
+    memcpy(column.name,name.data(),name.size());
+    column.type = ColumnarTypeOf<T>::type;
+    columns.push_back(column);
+    const char* ptr = values.empty() ? NULL : (const char*) &values[0];
+    column_data.push_back(std::vector<char>(ptr,ptr+values.size()*sizeof(T)));
+  }
+
+  template <class T>
+  void add_field(const std::string& name, const std::vector<Candidate>& cands, T Candidate::*field){
+    std::vector<T> values(cands.size());
+    for (int ii=0;ii<cands.size();ii++)
+      values[ii] = cands[ii].*field;
+    add_column(name,values);
+  }
+
+  void add_flag(const std::string& name, const std::vector<Candidate>& cands, bool Candidate::*field){
+    std::vector<unsigned char> values(cands.size());
+    for (int ii=0;ii<cands.size();ii++)
+      values[ii] = cands[ii].*field;
+    add_column(name,values);
+  }
+
+  void collect_columns(std::vector<Candidate>& cands, const std::vector<std::string>& feature_names){
+    add_field("freq",cands,&Candidate::freq);
+    add_field("opt_period",cands,&Candidate::opt_period);
+    add_field("dm",cands,&Candidate::dm);
+    add_field("dm_idx",cands,&Candidate::dm_idx);
+    add_field("acc",cands,&Candidate::acc);
+    add_field("jerk",cands,&Candidate::jerk);
+    add_field("segment_level",cands,&Candidate::segment_level);
+    add_field("segment",cands,&Candidate::segment);
+    add_field("nh",cands,&Candidate::nh);
+    add_field("snr",cands,&Candidate::snr);
+    add_field("folded_snr",cands,&Candidate::folded_snr);
+    add_flag("is_adjacent",cands,&Candidate::is_adjacent);
+    add_flag("is_physical",cands,&Candidate::is_physical);
+    add_field("ddm_count_ratio",cands,&Candidate::ddm_count_ratio);
+    add_field("ddm_snr_ratio",cands,&Candidate::ddm_snr_ratio);
+    std::vector<int> nassoc(cands.size());
+    for (int ii=0;ii<cands.size();ii++)
+      nassoc[ii] = cands[ii].count_assoc();
+    add_column("nassoc",nassoc);
+    add_field("known_source",cands,&Candidate::known_source);
+    for (int jj=0;jj<feature_names.size();jj++){
+      std::vector<float> values(cands.size(),0);
+      for (int ii=0;ii<cands.size();ii++)
+	if (jj<cands[ii].features.size())
+	  values[ii] = cands[ii].features[jj];
+      add_column(feature_names[jj],values);
+    }
+  }
+
+public:
+  ColumnarCandidateWriter():fo(NULL),pos(0),ok(true){}
+
+  /*!
+    \brief Write candidates, with their folds and detections, as a columnar file.
+
+    Feature names longer than 19 characters do not fit the directory
+    and are an error, thrown before the file is created.
+
+    \param feature_names Names of the scorer features held in Candidate::features.
+    \return false if the file could not be written.
+  */
+  bool write_file(std::string path, std::vector<Candidate>& cands,
+		  const std::vector<std::string>& feature_names)
+  {
+    for (int ii=0;ii<feature_names.size();ii++)
+      if (!fits(feature_names[ii]))
+	ErrorChecker::throw_error("ColumnarCandidateWriter: feature name "+feature_names[ii]+
+				  " is longer than 19 characters");
+    fo = fopen(path.c_str(),"wb");
+    if (fo == NULL){
+      perror(path.c_str());
+      return false;
+    }
+    pos = 0;
+    ok = true;
+    columns.clear();
+    column_data.clear();
+    collect_columns(cands,feature_names);
+
+    //header and directory are written again once the offsets are known
+    ColumnarHeader header;
+    memset(&header,0,sizeof(header));
+    write(&header,sizeof(header));
+    write(&columns[0],columns.size()*sizeof(ColumnarColumn));
+    pad();
+    for (int ii=0;ii<columns.size();ii++){
+      columns[ii].offset = pos;
+      if (!column_data[ii].empty())
+	write(&column_data[ii][0],column_data[ii].size());
+      pad();
+      std::vector<char>().swap(column_data[ii]);
+    }
+
+    //index, then the folds and detections it points into
+    std::vector<ColumnarIndexEntry> index(cands.size());
+    std::vector<std::vector<CandidatePOD> > detections(cands.size());
+    unsigned long long fold_bytes = 0;
+    unsigned long long ndetections = 0;
+    for (int ii=0;ii<cands.size();ii++){
+      ColumnarIndexEntry& entry = index[ii];
+      memset(&entry,0,sizeof(entry));
+      if (cands[ii].fold.size()>0){
+	entry.fold_offset = fold_bytes;
+	entry.nbins = cands[ii].nbins;
+	entry.nints = cands[ii].nints;
+	size_t nbytes = cands[ii].fold.size()*sizeof(float);
+	fold_bytes += (nbytes+COLUMNAR_ALIGN-1)/COLUMNAR_ALIGN*COLUMNAR_ALIGN;
+      }
+      cands[ii].collect_candidates(detections[ii]);
+      entry.first_detection = ndetections;
+      entry.ndetections = detections[ii].size();
+      ndetections += detections[ii].size();
+    }
+    header.index_offset = pos;
+    if (!index.empty())
+      write(&index[0],index.size()*sizeof(ColumnarIndexEntry));
+    pad();
+    header.fold_offset = pos;
+    header.fold_bytes = fold_bytes;
+    for (int ii=0;ii<cands.size();ii++)
+      if (cands[ii].fold.size()>0){
+	write(&cands[ii].fold[0],cands[ii].fold.size()*sizeof(float));
+	pad();
+      }
+    header.detections_offset = pos;
+    header.ndetections = ndetections;
+    for (int ii=0;ii<cands.size();ii++)
+      if (!detections[ii].empty())
+	write(&detections[ii][0],detections[ii].size()*sizeof(CandidatePOD));
+    pad();
+
+    memcpy(header.magic,COLUMNAR_MAGIC,8);
+    header.version = COLUMNAR_VERSION;
+    header.ncolumns = columns.size();
+    header.ncands = cands.size();
+    if (fseek(fo,0,SEEK_SET)!=0)
+      ok = false;
+    pos = 0;
+    write(&header,sizeof(header));
+    write(&columns[0],columns.size()*sizeof(ColumnarColumn));
+    if (fclose(fo)!=0)
+      ok = false;
+    fo = NULL;
+    if (!ok)
+      perror(path.c_str());
+    return ok;
+  }
+};
+
+/*
+  Read-only view of a columnar candidate file, mapped into memory.
+  Pointers returned stay valid for the life of the object.
+*/
+class ColumnarCandidateFile {
+private:
+  int fd;
+  const char* base;
+  size_t nbytes;
+  const ColumnarHeader* header;
+  const ColumnarColumn* columns;
+  const ColumnarIndexEntry* index;
+  std::string path;
+
+  ColumnarCandidateFile(const ColumnarCandidateFile&);
+  ColumnarCandidateFile& operator=(const ColumnarCandidateFile&);
+
+  bool in_file(unsigned long long offset, unsigned long long size){
+    return offset%COLUMNAR_ALIGN==0 && offset<=nbytes && size<=nbytes-offset;
+  }
+
+  void fail(std::string reason){
+    if (base!=NULL)
+      munmap((void*)base,nbytes);
+    if (fd>=0)
+      close(fd);
+    ErrorChecker::throw_error("ColumnarCandidateFile: "+path+" "+reason);
+  }
+
+  static size_t type_size(unsigned int type){
+    switch (type){
+    case COLUMNAR_FLOAT32: return sizeof(float);
+    case COLUMNAR_FLOAT64: return sizeof(double);
+    case COLUMNAR_INT32: return sizeof(int);
+    case COLUMNAR_UINT8: return sizeof(unsigned char);
+    }
+    return 0;
+  }
+
+public:
+  ColumnarCandidateFile(std::string path)
+    :fd(-1),base(NULL),nbytes(0),path(path)
+  {
+    fd = open(path.c_str(),O_RDONLY);
+    if (fd<0)
+      fail("could not be opened");
+    struct stat st;
+    if (fstat(fd,&st)!=0)
+      fail("could not be read");
+    nbytes = st.st_size;
+    if (nbytes<sizeof(ColumnarHeader))
+      fail("is not a columnar candidate file");
+    void* ptr = mmap(NULL,nbytes,PROT_READ,MAP_SHARED,fd,0);
+    if (ptr==MAP_FAILED)
+      fail("could not be mapped");
+    base = (const char*) ptr;
+    header = (const ColumnarHeader*) base;
+    if (memcmp(header->magic,COLUMNAR_MAGIC,8)!=0)
+      fail("is not a columnar candidate file");
+    if (header->version>COLUMNAR_VERSION)
+      fail("has a newer format version than this reader");
+    unsigned long long ncands = header->ncands;
+    if (!in_file(sizeof(ColumnarHeader),header->ncolumns*(unsigned long long)sizeof(ColumnarColumn)) ||
+	!in_file(header->index_offset,ncands*sizeof(ColumnarIndexEntry)) ||
+	!in_file(header->fold_offset,header->fold_bytes) ||
+	!in_file(header->detections_offset,header->ndetections*sizeof(CandidatePOD)))
+      fail("is truncated or corrupt");
+    columns = (const ColumnarColumn*) (base+sizeof(ColumnarHeader));
+    index = (const ColumnarIndexEntry*) (base+header->index_offset);
+    for (unsigned int ii=0;ii<header->ncolumns;ii++)
+      if (type_size(columns[ii].type)==0 ||
+	  !in_file(columns[ii].offset,ncands*type_size(columns[ii].type)))
+	fail("is truncated or corrupt");
+    for (unsigned long long ii=0;ii<ncands;ii++)
+      if (index[ii].fold_offset>header->fold_bytes ||
+	  index[ii].nbins*(unsigned long long)index[ii].nints*sizeof(float) >
+	  header->fold_bytes-index[ii].fold_offset ||
+	  index[ii].first_detection>header->ndetections ||
+	  index[ii].ndetections>header->ndetections-index[ii].first_detection)
+	fail("has a corrupt index");
+  }
+
+  ~ColumnarCandidateFile()
+  {
+    munmap((void*)base,nbytes);
+    close(fd);
+  }
+
+  size_t size(void) const {return header->ncands;}
+
+  unsigned int get_version(void) const {return header->version;}
+
+  std::vector<std::string> get_column_names(void) const
+  {
+    std::vector<std::string> names;
+    for (unsigned int ii=0;ii<header->ncolumns;ii++)
+      names.push_back(std::string(columns[ii].name,strnlen(columns[ii].name,sizeof(columns[ii].name))));
+    return names;
+  }
+
+  bool has_column(const std::string& name) const
+  {
+    std::vector<std::string> names = get_column_names();
+    return std::find(names.begin(),names.end(),name)!=names.end();
+  }
+
+  /*!
+    \brief A column as an array of size() values.
+
+    \tparam T float, double, int or unsigned char, matching the stored type.
+  */
+  template <class T>
+  const T* get_column(const std::string& name) const
+  {
+    for (unsigned int ii=0;ii<header->ncolumns;ii++)
+      if (name==std::string(columns[ii].name,strnlen(columns[ii].name,sizeof(columns[ii].name)))){
+	if (columns[ii].type!=ColumnarTypeOf<T>::type)
+	  ErrorChecker::throw_error("ColumnarCandidateFile: column "+name+" has another type");
+	return (const T*) (base+columns[ii].offset);
+      }
+    ErrorChecker::throw_error("ColumnarCandidateFile: no column "+name);
+    return NULL;
+  }
+
+  //Fold of candidate idx as nints x nbins floats, NULL if it was not folded
+  const float* get_fold(size_t idx, int& nbins, int& nints) const
+  {
+    nbins = index[idx].nbins;
+    nints = index[idx].nints;
+    if (nbins==0 || nints==0)
+      return NULL;
+    return (const float*) (base+header->fold_offset+index[idx].fold_offset);
+  }
+
+  //The candidate and its associations, as in the binary candidate file
+  const CandidatePOD* get_detections(size_t idx, size_t& count) const
+  {
+    count = index[idx].ndetections;
+    return (const CandidatePOD*) (base+header->detections_offset) + index[idx].first_detection;
+  }
+};
@@ -0,0 +1,371 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include "stdio.h"
+#include "unistd.h"
+#include <sys/stat.h>
+#include <data_types/candidates.hpp>
+#include <data_types/timeseries.hpp>
+#include <utils/exceptions.hpp>
+
+#define JOURNAL_MAGIC "PSJOURN1"
+#define SPILL_MAGIC "PSSPILL1"
+
+//64 bit FNV-1a, used to tie checkpoint files to the search they came from
+inline unsigned long long fnv1a_hash(const void* data, size_t nbytes,
+				     unsigned long long hash=14695981039346656037ULL)
+{
+  const unsigned char* ptr = (const unsigned char*) data;
+  for (size_t ii=0;ii<nbytes;ii++){
+    hash ^= ptr[ii];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+inline unsigned long long fnv1a_hash(const std::string& str)
+{
+  return fnv1a_hash(str.data(),str.size());
+}
+
+//Create the directory a checkpoint or shard file goes into
+inline void ensure_parent_directory(const std::string& path)
+{
+  size_t slash = path.rfind('/');
+  if (slash==std::string::npos || slash==0)
+    return;
+  std::string dir = path.substr(0,slash);
+  struct stat st = {0};
+  if (stat(dir.c_str(), &st) == -1 && mkdir(dir.c_str(), 0777) != 0)
+    perror(dir.c_str());
+}
+
+/*
+  Binary records of CandidateSets, shared by the search journal and
+  the shard files. A record is its payload length, the payload (DM
+  index, final flag, candidate count and the candidates with their
+  associations) and an FNV-1a checksum of the payload.
+*/
+class CandidateSetIO {
+private:
+  static char* ptr_of(std::vector<char>& buf){
+    return buf.empty() ? NULL : &buf[0];
+  }
+
+  template <class T>
+  static void put(std::vector<char>& buf, T value){
+    const char* ptr = (const char*) &value;
+    buf.insert(buf.end(),ptr,ptr+sizeof(T));
+  }
+
+  template <class T>
+  static bool get(const std::vector<char>& buf, size_t& pos, T& value){
+    if (pos+sizeof(T)>buf.size())
+      return false;
+    memcpy(&value,&buf[pos],sizeof(T));
+    pos += sizeof(T);
+    return true;
+  }
+
+  static void put_candidate(std::vector<char>& buf, const Candidate& cand){
+    put(buf,cand.dm);
+    put(buf,cand.dm_idx);
+    put(buf,cand.acc);
+    put(buf,cand.jerk);
+    put(buf,cand.segment_level);
+    put(buf,cand.segment);
+    put(buf,cand.nh);
+    put(buf,cand.snr);
+    put(buf,cand.freq);
+    put(buf,(unsigned int) cand.assoc.size());
+    for (int ii=0;ii<cand.assoc.size();ii++)
+      put_candidate(buf,cand.assoc[ii]);
+  }
+
+  static bool get_candidate(const std::vector<char>& buf, size_t& pos, Candidate& cand){
+    unsigned int nassoc;
+    if (!(get(buf,pos,cand.dm) && get(buf,pos,cand.dm_idx) &&
+	  get(buf,pos,cand.acc) && get(buf,pos,cand.jerk) &&
+	  get(buf,pos,cand.segment_level) && get(buf,pos,cand.segment) &&
+	  get(buf,pos,cand.nh) && get(buf,pos,cand.snr) &&
+	  get(buf,pos,cand.freq) && get(buf,pos,nassoc)))
+      return false;
+    //each association takes at least this many bytes
+    if (nassoc > (buf.size()-pos)/(9*4+sizeof(unsigned int)))
+      return false;
+    cand.assoc.resize(nassoc);
+    for (unsigned int ii=0;ii<nassoc;ii++)
+      if (!get_candidate(buf,pos,cand.assoc[ii]))
+	return false;
+    return true;
+  }
+
+public:
+  //Write a candidate set as a length prefixed, checksummed record
+  static void write_record(FILE* fp, const CandidateSet& set){
+    std::vector<char> buf;
+    put(buf,set.dm_idx);
+    put(buf,(int) set.final);
+    put(buf,(unsigned int) set.cands.size());
+    for (int ii=0;ii<set.cands.size();ii++)
+      put_candidate(buf,set.cands[ii]);
+    unsigned long long nbytes = buf.size();
+    unsigned long long checksum = fnv1a_hash(ptr_of(buf),buf.size());
+    fwrite(&nbytes,sizeof(nbytes),1,fp);
+    fwrite(ptr_of(buf),1,buf.size(),fp);
+    fwrite(&checksum,sizeof(checksum),1,fp);
+  }
+
+  //Read the next intact record, false at the end of the file or at a torn record
+  static bool read_record(FILE* fp, CandidateSet& set){
+    unsigned long long nbytes, checksum;
+    if (fread(&nbytes,sizeof(nbytes),1,fp)!=1 || nbytes>(1ULL<<40))
+      return false;
+    std::vector<char> buf(nbytes);
+    if (nbytes>0 && fread(ptr_of(buf),1,nbytes,fp)!=nbytes)
+      return false;
+    if (fread(&checksum,sizeof(checksum),1,fp)!=1 ||
+	checksum!=fnv1a_hash(ptr_of(buf),buf.size()))
+      return false;
+    size_t pos = 0;
+    int final;
+    unsigned int ncands;
+    if (!(get(buf,pos,set.dm_idx) && get(buf,pos,final) && get(buf,pos,ncands)))
+      return false;
+    set.final = final!=0;
+    set.cands.clear();
+    set.cands.resize(ncands);
+    for (unsigned int ii=0;ii<ncands;ii++)
+      if (!get_candidate(buf,pos,set.cands[ii]))
+	return false;
+    return true;
+  }
+};
+
+/*
+  Append-only binary journal of the candidate sets of finished DM
+  trials, written by the distill stage so that an interrupted search
+  can be resumed with --resume.
+
+  The file starts with a magic string and a hash of the search
+  configuration; a journal written by a different search is refused.
+  Each record holds one CandidateSet of acceleration distilled
+  candidates and is flushed to disk before the next one is written.
+  A DM counts as finished once its final set is in the journal; sets of
+  unfinished DMs and any torn record at the end are discarded when the
+  journal is reopened. An existing journal is only reopened after
+  load(); starting a new journal over an old one is refused.
+*/
+class SearchJournal {
+private:
+  std::string path;
+  unsigned long long config_hash;
+  FILE* fo;
+  bool loaded;
+  std::vector<CandidateSet> finished;
+  std::vector<int> done_dms;
+
+  void write_header(FILE* fp){
+    fwrite(JOURNAL_MAGIC,1,8,fp);
+    fwrite(&config_hash,sizeof(config_hash),1,fp);
+  }
+
+public:
+  /*!
+    \param path Journal file.
+    \param config_hash Hash of everything that determines the search results.
+  */
+  SearchJournal(std::string path, unsigned long long config_hash)
+    :path(path),config_hash(config_hash),fo(NULL),loaded(false){}
+
+  ~SearchJournal(){
+    close();
+  }
+
+  /*!
+    \brief Read the finished DMs of an existing journal.
+
+    \return Number of finished DMs (0 if there is no journal).
+  */
+  size_t load(void)
+  {
+    finished.clear();
+    done_dms.clear();
+    loaded = true;
+    FILE* fp = fopen(path.c_str(),"rb");
+    if (fp==NULL)
+      return 0;
+    char magic[8];
+    unsigned long long hash;
+    if (fread(magic,1,8,fp)!=8 || memcmp(magic,JOURNAL_MAGIC,8)!=0 ||
+	fread(&hash,sizeof(hash),1,fp)!=1){
+      fclose(fp);
+      ErrorChecker::throw_error("SearchJournal: "+path+" is not a search journal");
+    }
+    if (hash!=config_hash){
+      fclose(fp);
+      ErrorChecker::throw_error("SearchJournal: "+path+" was written by a different search configuration");
+    }
+    std::vector<CandidateSet> sets;
+    CandidateSet set;
+    while (CandidateSetIO::read_record(fp,set))
+      sets.push_back(set);
+    fclose(fp);
+
+    for (int ii=0;ii<sets.size();ii++)
+      if (sets[ii].final)
+	done_dms.push_back(sets[ii].dm_idx);
+    std::sort(done_dms.begin(),done_dms.end());
+    done_dms.erase(std::unique(done_dms.begin(),done_dms.end()),done_dms.end());
+    for (int ii=0;ii<sets.size();ii++)
+      if (is_done(sets[ii].dm_idx))
+	finished.push_back(sets[ii]);
+    return done_dms.size();
+  }
+
+  /*!
+    \brief Start journalling, keeping only the finished DMs read by load().
+
+    The journal is rewritten to a temporary file and renamed into place,
+    so an interruption here leaves the old journal intact. Without a
+    load() first, an existing journal is an error rather than being
+    silently replaced.
+  */
+  void open(void)
+  {
+    struct stat st;
+    if (!loaded && stat(path.c_str(),&st)==0)
+      ErrorChecker::throw_error("SearchJournal: "+path+" already exists, use --resume to continue"
+				" that search or remove it to start again");
+    ensure_parent_directory(path);
+    std::string tmp_path = path+".tmp";
+    FILE* fp = fopen(tmp_path.c_str(),"wb");
+    if (fp==NULL)
+      ErrorChecker::throw_error("SearchJournal: could not create "+tmp_path);
+    write_header(fp);
+    for (int ii=0;ii<finished.size();ii++)
+      CandidateSetIO::write_record(fp,finished[ii]);
+    fflush(fp);
+    fsync(fileno(fp));
+    fclose(fp);
+    if (rename(tmp_path.c_str(),path.c_str())!=0)
+      ErrorChecker::throw_error("SearchJournal: could not replace "+path);
+    fo = fopen(path.c_str(),"ab");
+    if (fo==NULL)
+      ErrorChecker::throw_error("SearchJournal: could not open "+path);
+  }
+
+  //Append a candidate set and flush it to disk (not thread safe)
+  void record(const CandidateSet& set)
+  {
+    if (fo==NULL)
+      return;
+    CandidateSetIO::write_record(fo,set);
+    fflush(fo);
+    fsync(fileno(fo));
+  }
+
+  void close(void)
+  {
+    if (fo!=NULL)
+      fclose(fo);
+    fo = NULL;
+  }
+
+  bool is_done(int dm_idx)
+  {
+    return std::binary_search(done_dms.begin(),done_dms.end(),dm_idx);
+  }
+
+  //Flags of the finished DMs, for the scheduler
+  std::vector<bool> get_done(size_t ndms)
+  {
+    std::vector<bool> done(ndms,false);
+    for (int ii=0;ii<done_dms.size();ii++)
+      if (done_dms[ii]>=0 && done_dms[ii]<ndms)
+	done[done_dms[ii]] = true;
+    return done;
+  }
+
+  //Append the candidates of all finished DMs
+  void restore(std::vector<Candidate>& cands)
+  {
+    for (int ii=0;ii<finished.size();ii++)
+      cands.insert(cands.end(),finished[ii].cands.begin(),finished[ii].cands.end());
+  }
+};
+
+/*
+  Spill file of the dedispersed trials, so a resumed search can skip
+  dedispersion. Holds a magic string, a hash of the dedispersion
+  configuration, the trial shape and the raw 8 bit trials.
+*/
+class TrialsSpill {
+private:
+  std::string path;
+  unsigned long long config_hash;
+
+public:
+  TrialsSpill(std::string path, unsigned long long config_hash)
+    :path(path),config_hash(config_hash){}
+
+  void write(DispersionTrials<unsigned char>& trials)
+  {
+    std::string tmp_path = path+".tmp";
+    FILE* fp = fopen(tmp_path.c_str(),"wb");
+    if (fp==NULL){
+      perror(tmp_path.c_str());
+      return;
+    }
+    unsigned int nsamps = trials.get_nsamps();
+    unsigned int count = trials.get_count();
+    size_t nbytes = (size_t) nsamps*count;
+    fwrite(SPILL_MAGIC,1,8,fp);
+    fwrite(&config_hash,sizeof(config_hash),1,fp);
+    fwrite(&nsamps,sizeof(nsamps),1,fp);
+    fwrite(&count,sizeof(count),1,fp);
+    bool ok = fwrite(trials.get_data(),1,nbytes,fp)==nbytes;
+    ok = fflush(fp)==0 && ok;
+    fsync(fileno(fp));
+    fclose(fp);
+    if (!ok || rename(tmp_path.c_str(),path.c_str())!=0){
+      std::cerr << "WARNING: could not write trials spill file " << path << std::endl;
+      unlink(tmp_path.c_str());
+    }
+  }
+
+  /*!
+    \brief Read spilled trials back.
+
+    \return Trial data allocated with new[] (NULL if there is no matching spill file).
+  */
+  unsigned char* read(unsigned int& nsamps, unsigned int count)
+  {
+    FILE* fp = fopen(path.c_str(),"rb");
+    if (fp==NULL)
+      return NULL;
+    char magic[8];
+    unsigned long long hash;
+    unsigned int spill_count;
+    if (fread(magic,1,8,fp)!=8 || memcmp(magic,SPILL_MAGIC,8)!=0 ||
+	fread(&hash,sizeof(hash),1,fp)!=1 || hash!=config_hash ||
+	fread(&nsamps,sizeof(nsamps),1,fp)!=1 ||
+	fread(&spill_count,sizeof(spill_count),1,fp)!=1 || spill_count!=count){
+      fclose(fp);
+      std::cerr << "WARNING: ignoring mismatched trials spill file " << path << std::endl;
+      return NULL;
+    }
+    size_t nbytes = (size_t) nsamps*count;
+    unsigned char* data = new unsigned char [nbytes];
+    if (fread(data,1,nbytes,fp)!=nbytes){
+      delete [] data;
+      data = NULL;
+      std::cerr << "WARNING: trials spill file " << path << " is truncated" << std::endl;
+    }
+    fclose(fp);
+    return data;
+  }
+};
@@ -11,27 +11,33 @@
 #include <utils/xml_util.hpp>
 #include <utils/cmdline.hpp>
 #include <utils/stopwatch.hpp>
+#include <utils/columnar.hpp>
 #include <data_types/header.hpp>
 #include "cuda.h"
 
 class OutputFileWriter {
-  XML::Element root;
+  XML::Writer xml;
+  std::string filename;
 
 public:
-  OutputFileWriter()
-    :root("peasoup_search"){}
+  /*!
+    \brief Stream the overview to filename.
 
-  std::string to_string(void){
-    return root.to_string(true);
+    Sections are written as they are added; the file is written as
+    filename.tmp and renamed into place by close().
+  */
+  OutputFileWriter(std::string filename)
+    :filename(filename)
+  {
+    if (!xml.open(filename+".tmp"))
+      ErrorChecker::throw_error("File "+filename+".tmp could not be opened");
+    xml.start("peasoup_search");
   }
 
-  void to_file(std::string filename){
-    std::ofstream outfile;
-    outfile.open(filename.c_str(),std::ifstream::out | std::ifstream::binary);
-    ErrorChecker::check_file_error(outfile, filename);
-    outfile << root.to_string(true);
-    ErrorChecker::check_file_error(outfile, filename);
-    outfile.close();
+  void close(void){
+    std::string tmp_filename = filename+".tmp";
+    if (!xml.close() || rename(tmp_filename.c_str(),filename.c_str())!=0)
+      ErrorChecker::throw_error("File "+filename+" could not be written");
   }
   
   void add_header(std::string filename){
@@ -40,179 +46,228 @@ public:
     infile.open(filename.c_str(),std::ifstream::in | std::ifstream::binary);
     ErrorChecker::check_file_error(infile, filename);
     read_header(infile,hdr);
-    XML::Element header("header_parameters");
-    header.append(XML::Element("source_name",hdr.source_name));
-    header.append(XML::Element("rawdatafile",hdr.rawdatafile));
-    header.append(XML::Element("az_start",hdr.az_start));
-    header.append(XML::Element("za_start",hdr.za_start));
-    header.append(XML::Element("src_raj",hdr.src_raj));
-    header.append(XML::Element("src_dej",hdr.src_dej));
-    header.append(XML::Element("tstart",hdr.tstart));
-    header.append(XML::Element("tsamp",hdr.tsamp));
-    header.append(XML::Element("period",hdr.period));
-    header.append(XML::Element("fch1",hdr.fch1));
-    header.append(XML::Element("foff",hdr.foff));
-    header.append(XML::Element("nchans",hdr.nchans));
-    header.append(XML::Element("telescope_id",hdr.telescope_id));
-    header.append(XML::Element("machine_id",hdr.machine_id));
-    header.append(XML::Element("data_type",hdr.data_type));
-    header.append(XML::Element("ibeam",hdr.ibeam));
-    header.append(XML::Element("nbeams",hdr.nbeams));
-    header.append(XML::Element("nbits",hdr.nbits));
-    header.append(XML::Element("barycentric",hdr.barycentric));
-    header.append(XML::Element("pulsarcentric",hdr.pulsarcentric));
-    header.append(XML::Element("nbins",hdr.nbins));
-    header.append(XML::Element("nsamples",hdr.nsamples));
-    header.append(XML::Element("nifs",hdr.nifs));
-    header.append(XML::Element("npuls",hdr.npuls));
-    header.append(XML::Element("refdm",hdr.refdm));
-    header.append(XML::Element("signed",(int)hdr.signed_data));
-    root.append(header);
+    xml.start("header_parameters");
+    xml.element("source_name",hdr.source_name);
+    xml.element("rawdatafile",hdr.rawdatafile);
+    xml.element("az_start",hdr.az_start);
+    xml.element("za_start",hdr.za_start);
+    xml.element("src_raj",hdr.src_raj);
+    xml.element("src_dej",hdr.src_dej);
+    xml.element("tstart",hdr.tstart);
+    xml.element("tsamp",hdr.tsamp);
+    xml.element("period",hdr.period);
+    xml.element("fch1",hdr.fch1);
+    xml.element("foff",hdr.foff);
+    xml.element("nchans",hdr.nchans);
+    xml.element("telescope_id",hdr.telescope_id);
+    xml.element("machine_id",hdr.machine_id);
+    xml.element("data_type",hdr.data_type);
+    xml.element("ibeam",hdr.ibeam);
+    xml.element("nbeams",hdr.nbeams);
+    xml.element("nbits",hdr.nbits);
+    xml.element("barycentric",hdr.barycentric);
+    xml.element("pulsarcentric",hdr.pulsarcentric);
+    xml.element("nbins",hdr.nbins);
+    xml.element("nsamples",hdr.nsamples);
+    xml.element("nifs",hdr.nifs);
+    xml.element("npuls",hdr.npuls);
+    xml.element("refdm",hdr.refdm);
+    xml.element("signed",(int)hdr.signed_data);
+    xml.end();
   }
 
   void add_search_parameters(CmdLineOptions& args){
-    XML::Element search_options("search_parameters");
-    search_options.append(XML::Element("infilename",args.infilename));
-    search_options.append(XML::Element("outdir",args.outdir));
-    search_options.append(XML::Element("killfilename",args.killfilename));
-    search_options.append(XML::Element("zapfilename",args.zapfilename));
-    search_options.append(XML::Element("max_num_threads",args.max_num_threads));
-    search_options.append(XML::Element("size",args.size));
-    search_options.append(XML::Element("dm_start",args.dm_start));
-    search_options.append(XML::Element("dm_end",args.dm_end));
-    search_options.append(XML::Element("dm_tol",args.dm_tol));
-    search_options.append(XML::Element("dm_pulse_width",args.dm_pulse_width));
-    search_options.append(XML::Element("acc_start",args.acc_start));
-    search_options.append(XML::Element("acc_end",args.acc_end));
-    search_options.append(XML::Element("acc_tol",args.acc_tol));
-    search_options.append(XML::Element("acc_pulse_width",args.acc_pulse_width));
-    search_options.append(XML::Element("boundary_5_freq",args.boundary_5_freq));
-    search_options.append(XML::Element("boundary_25_freq",args.boundary_25_freq));
-    search_options.append(XML::Element("nharmonics",args.nharmonics));
-    search_options.append(XML::Element("npdmp",args.npdmp));
-    search_options.append(XML::Element("min_snr",args.min_snr));
-    search_options.append(XML::Element("min_freq",args.min_freq));
-    search_options.append(XML::Element("max_freq",args.max_freq));
-    search_options.append(XML::Element("max_harm",args.max_harm));
-    search_options.append(XML::Element("freq_tol",args.freq_tol));
-    search_options.append(XML::Element("verbose",args.verbose));
-    search_options.append(XML::Element("progress_bar",args.progress_bar));
-    root.append(search_options);
+    xml.start("search_parameters");
+    xml.element("infilename",args.infilename);
+    xml.element("outdir",args.outdir);
+    xml.element("killfilename",args.killfilename);
+    xml.element("zapfilename",args.zapfilename);
+    xml.element("max_num_threads",args.max_num_threads);
+    xml.element("size",args.size);
+    xml.element("fft_table",args.fft_table);
+    xml.element("dm_start",args.dm_start);
+    xml.element("dm_end",args.dm_end);
+    xml.element("dm_tol",args.dm_tol);
+    xml.element("dm_pulse_width",args.dm_pulse_width);
+    xml.element("acc_start",args.acc_start);
+    xml.element("acc_end",args.acc_end);
+    xml.element("acc_tol",args.acc_tol);
+    xml.element("acc_pulse_width",args.acc_pulse_width);
+    xml.element("jerk_start",args.jerk_start);
+    xml.element("jerk_end",args.jerk_end);
+    xml.element("boundary_5_freq",args.boundary_5_freq);
+    xml.element("boundary_25_freq",args.boundary_25_freq);
+    xml.element("nharmonics",args.nharmonics);
+    xml.element("npdmp",args.npdmp);
+    xml.element("min_snr",args.min_snr);
+    xml.element("min_freq",args.min_freq);
+    xml.element("max_freq",args.max_freq);
+    xml.element("max_harm",args.max_harm);
+    xml.element("freq_tol",args.freq_tol);
+    xml.element("fdas",args.fdas);
+    xml.element("zmax",args.zmax);
+    xml.element("zstep",args.zstep);
+    xml.element("fuse_harmonics",args.fuse_harmonics);
+    xml.element("acc_batch",args.acc_batch);
+    xml.element("coarse_tscrunch",args.coarse_tscrunch);
+    xml.element("coarse_miss_prob",args.coarse_miss_prob);
+    xml.element("coarse_false_alarms",args.coarse_false_alarms);
+    xml.element("segment_levels",args.segment_levels);
+    xml.element("task_trials",args.task_trials);
+    xml.element("cpu_workers",args.cpu_workers);
+    xml.element("physical_cores",args.physical_cores);
+    xml.element("early_fold_snr",args.early_fold_snr);
+    xml.element("queue_depth",args.queue_depth);
+    xml.element("distill_threads",args.distill_threads);
+    xml.element("known_sources",args.known_sources);
+    xml.element("remove_known",args.remove_known);
+    xml.element("checkpoint",args.checkpoint);
+    xml.element("resume",args.resume);
+    xml.element("spill_trials",args.spill_trials);
+    xml.element("shard",args.shard);
+    xml.element("verbose",args.verbose);
+    xml.element("progress_bar",args.progress_bar);
+    xml.end();
   }
 
   void add_misc_info(void){
-    XML::Element info("misc_info");
+    xml.start("misc_info");
     char buf[128];
     getlogin_r(buf,128);
-    info.append(XML::Element("username",buf));
+    xml.element("username",buf);
     std::time_t t = std::time(NULL);
     std::strftime(buf, 128, "%Y-%m-%d-%H:%M", std::localtime(&t));
-    info.append(XML::Element("local_datetime",buf));
+    xml.element("local_datetime",buf);
     std::strftime(buf, 128, "%Y-%m-%d-%H:%M", std::gmtime(&t));
-    info.append(XML::Element("utc_datetime",buf));
-    root.append(info);
+    xml.element("utc_datetime",buf);
+    xml.end();
   }
   
   void add_timing_info(std::map<std::string,Stopwatch>& elapsed_times){
-    XML::Element times("execution_times");
+    xml.start("execution_times");
     typedef std::map<std::string,Stopwatch>::iterator it_type;
     for (it_type it=elapsed_times.begin(); it!=elapsed_times.end(); it++)
-      times.append(XML::Element(it->first,it->second.getTime()));
-    root.append(times);
+      xml.element(it->first,it->second.getTime());
+    xml.end();
   }
   
   void add_gpu_info(std::vector<int>& device_idxs){
-    XML::Element gpu_info("cuda_device_parameters");
+    xml.start("cuda_device_parameters");
     int runtime_version,driver_version;
     cudaRuntimeGetVersion(&runtime_version);
     cudaDriverGetVersion(&driver_version);
-    gpu_info.append(XML::Element("runtime",runtime_version));
-    gpu_info.append(XML::Element("driver",driver_version));
+    xml.element("runtime",runtime_version);
+    xml.element("driver",driver_version);
     cudaDeviceProp properties;
     for (int ii=0;ii<device_idxs.size();ii++){
-      XML::Element device("cuda_device");
-      device.add_attribute("id",device_idxs[ii]);
+      xml.start("cuda_device");
+      xml.attribute("id",device_idxs[ii]);
       cudaGetDeviceProperties(&properties,device_idxs[ii]);
-      device.append(XML::Element("name",properties.name));
-      device.append(XML::Element("major_cc",properties.major));
-      device.append(XML::Element("minor_cc",properties.minor));
-      gpu_info.append(device);
+      xml.element("name",properties.name);
+      xml.element("major_cc",properties.major);
+      xml.element("minor_cc",properties.minor);
+      xml.end();
     }
-    root.append(gpu_info);
+    xml.end();
   }
   
   void add_dm_list(std::vector<float>& dms){
-    XML::Element dm_trials("dedispersion_trials");
-    dm_trials.add_attribute("count",dms.size());
+    xml.start("dedispersion_trials");
+    xml.attribute("count",dms.size());
     for (int ii=0;ii<dms.size();ii++){
-      XML::Element trial("trial");
-      trial.add_attribute("id",ii);
-      trial.set_text(dms[ii]);
-      dm_trials.append(trial);
+      xml.start("trial");
+      xml.attribute("id",ii);
+      xml.text(dms[ii]);
+      xml.end();
     }
-    root.append(dm_trials);
+    xml.end();
   }
   
   void add_acc_list(std::vector<float>& accs){
-    XML::Element acc_trials("acceleration_trials");
-    acc_trials.add_attribute("count",accs.size());
-    acc_trials.add_attribute("DM",0);
+    xml.start("acceleration_trials");
+    xml.attribute("DM",0);
+    xml.attribute("count",accs.size());
     for(int ii=0;ii<accs.size();ii++){
-      XML::Element trial("trial");
-      trial.add_attribute("id",ii);
-      trial.set_text(accs[ii]);
-      acc_trials.append(trial);
+      xml.start("trial");
+      xml.attribute("id",ii);
+      xml.text(accs[ii]);
+      xml.end();
     }
-    root.append(acc_trials);
+    xml.end();
+  }
+
+  void add_jerk_list(std::vector<float>& jerks){
+    xml.start("jerk_trials");
+    xml.attribute("DM",0);
+    xml.attribute("count",jerks.size());
+    for(int ii=0;ii<jerks.size();ii++){
+      xml.start("trial");
+      xml.attribute("id",ii);
+      xml.text(jerks[ii]);
+      xml.end();
+    }
+    xml.end();
   }
 
   void add_candidates(std::vector<Candidate>& candidates, 
-		      std::map<unsigned,long int> byte_map)
+		      std::map<unsigned,long int> byte_map,
+		      std::vector<std::string> feature_names=std::vector<std::string>(),
+		      std::vector<std::string> known_names=std::vector<std::string>())
   {
-    XML::Element cands("candidates");
+    xml.start("candidates");
     for (int ii=0;ii<candidates.size();ii++){
-      XML::Element cand("candidate");
-      cand.add_attribute("id",ii);
-      cand.append(XML::Element("period",1.0/candidates[ii].freq));
-      cand.append(XML::Element("opt_period",candidates[ii].opt_period));
-      cand.append(XML::Element("dm",candidates[ii].dm));
-      cand.append(XML::Element("acc",candidates[ii].acc));
-      cand.append(XML::Element("nh",candidates[ii].nh));
-      cand.append(XML::Element("snr",candidates[ii].snr));
-      cand.append(XML::Element("folded_snr",candidates[ii].folded_snr));
-      cand.append(XML::Element("is_adjacent",candidates[ii].is_adjacent));
-      cand.append(XML::Element("is_physical",candidates[ii].is_physical));
-      cand.append(XML::Element("ddm_count_ratio",candidates[ii].ddm_count_ratio));
-      cand.append(XML::Element("ddm_snr_ratio",candidates[ii].ddm_snr_ratio));
-      cand.append(XML::Element("nassoc",candidates[ii].count_assoc()));
-      cand.append(XML::Element("byte_offset",byte_map[ii]));
-      cands.append(cand);
+      xml.start("candidate");
+      xml.attribute("id",ii);
+      xml.element("period",1.0/candidates[ii].freq);
+      xml.element("opt_period",candidates[ii].opt_period);
+      xml.element("dm",candidates[ii].dm);
+      xml.element("acc",candidates[ii].acc);
+      xml.element("jerk",candidates[ii].jerk);
+      xml.element("segment_level",candidates[ii].segment_level);
+      xml.element("segment",candidates[ii].segment);
+      xml.element("nh",candidates[ii].nh);
+      xml.element("snr",candidates[ii].snr);
+      xml.element("folded_snr",candidates[ii].folded_snr);
+      xml.element("is_adjacent",candidates[ii].is_adjacent);
+      xml.element("is_physical",candidates[ii].is_physical);
+      xml.element("ddm_count_ratio",candidates[ii].ddm_count_ratio);
+      xml.element("ddm_snr_ratio",candidates[ii].ddm_snr_ratio);
+      for (int jj=0;jj<feature_names.size() && jj<candidates[ii].features.size();jj++)
+	xml.element(feature_names[jj],candidates[ii].features[jj]);
+      if (candidates[ii].known_source>=0 && candidates[ii].known_source<known_names.size())
+	xml.element("known_source",known_names[candidates[ii].known_source]);
+      xml.element("nassoc",candidates[ii].count_assoc());
+      xml.element("byte_offset",byte_map[ii]);
+      xml.end();
     }
-    root.append(cands);
+    xml.end();
   }
 
   void add_candidates(std::vector<Candidate>& candidates,
 		      std::map<int,std::string>& filenames){
-    XML::Element cands("candidates");
+    xml.start("candidates");
     for (int ii=0;ii<candidates.size();ii++){
-      XML::Element cand("candidate");
-      cand.add_attribute("id",ii);
-      cand.append(XML::Element("period",1.0/candidates[ii].freq));
-      cand.append(XML::Element("opt_period",candidates[ii].opt_period));
-      cand.append(XML::Element("dm",candidates[ii].dm));
-      cand.append(XML::Element("acc",candidates[ii].acc));
-      cand.append(XML::Element("nh",candidates[ii].nh));
-      cand.append(XML::Element("snr",candidates[ii].snr));
-      cand.append(XML::Element("folded_snr",candidates[ii].folded_snr));
-      cand.append(XML::Element("is_adjacent",candidates[ii].is_adjacent));
-      cand.append(XML::Element("is_physical",candidates[ii].is_physical));
-      cand.append(XML::Element("ddm_count_ratio",candidates[ii].ddm_count_ratio));
-      cand.append(XML::Element("ddm_snr_ratio",candidates[ii].ddm_snr_ratio));
-      cand.append(XML::Element("nassoc",candidates[ii].count_assoc()));
-      cand.append(XML::Element("results_file",filenames[ii]));
-      cands.append(cand);
+      xml.start("candidate");
+      xml.attribute("id",ii);
+      xml.element("period",1.0/candidates[ii].freq);
+      xml.element("opt_period",candidates[ii].opt_period);
+      xml.element("dm",candidates[ii].dm);
+      xml.element("acc",candidates[ii].acc);
+      xml.element("jerk",candidates[ii].jerk);
+      xml.element("segment_level",candidates[ii].segment_level);
+      xml.element("segment",candidates[ii].segment);
+      xml.element("nh",candidates[ii].nh);
+      xml.element("snr",candidates[ii].snr);
+      xml.element("folded_snr",candidates[ii].folded_snr);
+      xml.element("is_adjacent",candidates[ii].is_adjacent);
+      xml.element("is_physical",candidates[ii].is_physical);
+      xml.element("ddm_count_ratio",candidates[ii].ddm_count_ratio);
+      xml.element("ddm_snr_ratio",candidates[ii].ddm_snr_ratio);
+      xml.element("nassoc",candidates[ii].count_assoc());
+      xml.element("results_file",filenames[ii]);
+      xml.end();
     }    
-    root.append(cands);
+    xml.end();
   }
  
 };
@@ -269,6 +324,16 @@ public:
     fclose(fo);
   }
   
+  //Columnar, mmap-able version of write_binary (see utils/columnar.hpp)
+  void write_columnar(std::vector<Candidate>& candidates, std::string filename,
+		      std::vector<std::string> feature_names=std::vector<std::string>())
+  {
+    std::stringstream filepath;
+    filepath << output_dir << "/" << filename;
+    ColumnarCandidateWriter writer;
+    writer.write_file(filepath.str(),candidates,feature_names);
+  }
+
   void write_binaries(std::vector<Candidate>& candidates)
   {
     char actualpath [PATH_MAX];
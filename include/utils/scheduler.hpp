@@ -0,0 +1,283 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include "pthread.h"
+#include "stdio.h"
+#include <data_types/candidates.hpp>
+#include <utils/utils.hpp>
+#include <utils/progress_bar.hpp>
+#include <utils/exceptions.hpp>
+
+//Smallest number of acceleration trials in an automatically sized task
+#define MIN_TASK_TRIALS 32
+//Tasks per worker aimed for when sizing tasks automatically
+#define TASKS_PER_WORKER 16
+//Cost of the per-DM transforms, in acceleration trials
+#define SEARCH_TASK_OVERHEAD 2
+
+#define DEQUE_EMPTY -1
+#define DEQUE_ABORT -2
+
+/*
+  A range of flattened (jerk, acceleration) trials of one DM trial.
+  Chunk 0 of a DM also carries that DM's per-DM extras (segments).
+*/
+struct SearchTask {
+  int dm_idx;
+  float dm;
+  int chunk;
+  int nchunks;
+  size_t start;
+  size_t end;
+  size_t cost;
+};
+
+struct task_cost_greater_than {
+  bool operator()(const SearchTask& x, const SearchTask& y){
+    return (x.cost>y.cost);
+  }
+};
+
+/*
+  Chase-Lev work-stealing deque of task ids. All tasks are added before
+  the workers start, so the buffer never grows: the owner pops from the
+  bottom and thieves take from the top, with a compare-and-swap on top
+  deciding the race for the last task.
+*/
+class WorkStealingDeque {
+private:
+  std::vector<int> tasks;
+  volatile long top;
+  volatile long bottom;
+
+public:
+  WorkStealingDeque():top(0),bottom(0){}
+
+  //Not thread safe, only used before the workers start
+  void push(int task){
+    tasks.push_back(task);
+    bottom = tasks.size();
+  }
+
+  int pop(void){
+    long b = bottom-1;
+    bottom = b;
+    __sync_synchronize();
+    long t = top;
+    if (t>b){
+      bottom = t;
+      return DEQUE_EMPTY;
+    }
+    int task = tasks[b];
+    if (t<b)
+      return task;
+    //last task, race any thief for it
+    bool won = __sync_bool_compare_and_swap(&top,t,t+1);
+    bottom = t+1;
+    return won ? task : DEQUE_EMPTY;
+  }
+
+  int steal(void){
+    long t = top;
+    __sync_synchronize();
+    long b = bottom;
+    if (t>=b)
+      return DEQUE_EMPTY;
+    int task = tasks[t];
+    if (!__sync_bool_compare_and_swap(&top,t,t+1))
+      return DEQUE_ABORT;
+    return task;
+  }
+};
+
+/*
+  Hands out (DM, acceleration chunk) tasks to workers.
+
+  Tasks are costed from the trial counts of the AccelerationPlan,
+  sorted largest first and dealt round-robin onto one deque per
+  worker, so each worker starts on its largest task and idle workers
+  steal the smallest remaining tasks of the others. Workers file the
+  candidates of each finished task; the worker that finishes the last
+  chunk of a DM receives all of that DM's candidates, in chunk order,
+  to acceleration distill.
+*/
+class SearchScheduler {
+private:
+  std::vector<SearchTask> tasks;
+  std::vector<WorkStealingDeque> deques;
+  std::vector<std::vector<Candidate> > results;
+  std::vector<std::vector<int> > dm_tasks;
+  std::vector<int> remaining;
+  size_t total_cost;
+  volatile size_t done_cost;
+  volatile int started;
+  ProgressBar* progress;
+  bool use_progress_bar;
+  //progress updates and stop() are serialised, so a late update never follows the stop
+  pthread_mutex_t progress_lock;
+  size_t progress_done;
+  bool progress_stopped;
+
+public:
+  /*!
+    \param dm_list DMs of the dispersion trials.
+    \param plan Acceleration plan used to count the trials at each DM.
+    \param nworkers Number of worker threads.
+    \param chunk_trials Trials per task (0 for one task per DM).
+    \param skip Flags of DMs to leave out, e.g. finished in a resumed search.
+  */
+  SearchScheduler(std::vector<float>& dm_list, AccelerationPlan& plan,
+		  unsigned int nworkers, size_t chunk_trials,
+		  const std::vector<bool>* skip=NULL)
+    :deques(std::max(1u,nworkers)),dm_tasks(dm_list.size()),
+     remaining(dm_list.size()),total_cost(0),done_cost(0),started(0),
+     progress(NULL),use_progress_bar(false),progress_done(0),progress_stopped(false)
+  {
+    pthread_mutex_init(&progress_lock,NULL);
+    for (int ii=0;ii<dm_list.size();ii++){
+      if (skip!=NULL && ii<skip->size() && (*skip)[ii]){
+	remaining[ii] = 0;
+	continue;
+      }
+      size_t ntrials = plan.get_ntrials(dm_list[ii]);
+      size_t chunk = (chunk_trials==0) ? ntrials : chunk_trials;
+      int nchunks = (ntrials+chunk-1)/chunk;
+      for (int jj=0;jj<nchunks;jj++){
+	SearchTask task;
+	task.dm_idx = ii;
+	task.dm = dm_list[ii];
+	task.chunk = jj;
+	task.nchunks = nchunks;
+	task.start = jj*chunk;
+	task.end = (jj==nchunks-1) ? ntrials : (jj+1)*chunk;
+	task.cost = task.end-task.start+SEARCH_TASK_OVERHEAD;
+	total_cost += task.cost;
+	tasks.push_back(task);
+      }
+      remaining[ii] = nchunks;
+    }
+    std::stable_sort(tasks.begin(),tasks.end(),task_cost_greater_than());
+    results.resize(tasks.size());
+    for (int ii=0;ii<tasks.size();ii++)
+      dm_tasks[tasks[ii].dm_idx].push_back(ii);
+    //owners pop from the bottom, so push the smallest tasks first
+    for (int ii=tasks.size()-1;ii>=0;ii--)
+      deques[ii%deques.size()].push(ii);
+  }
+
+  ~SearchScheduler(){
+    if (use_progress_bar)
+      delete progress;
+    pthread_mutex_destroy(&progress_lock);
+  }
+
+  /*!
+    \brief Trials per task giving about TASKS_PER_WORKER tasks per worker.
+
+    \param dm_list DMs of the dispersion trials.
+    \param plan Acceleration plan used to count the trials at each DM.
+    \param nworkers Number of worker threads.
+    \param skip Flags of DMs to leave out.
+  */
+  static size_t choose_chunk(std::vector<float>& dm_list, AccelerationPlan& plan,
+			     unsigned int nworkers, const std::vector<bool>* skip=NULL)
+  {
+    size_t total = 0;
+    for (int ii=0;ii<dm_list.size();ii++)
+      if (skip==NULL || ii>=skip->size() || !(*skip)[ii])
+	total += plan.get_ntrials(dm_list[ii]);
+    size_t chunk = total/(std::max(1u,nworkers)*TASKS_PER_WORKER);
+    return std::max((size_t)MIN_TASK_TRIALS,chunk);
+  }
+
+  void enable_progress_bar(){
+    progress = new ProgressBar();
+    use_progress_bar = true;
+  }
+
+  size_t get_ntasks(void){return tasks.size();}
+
+  /*!
+    \brief Get the next task for a worker, stealing when its own deque is empty.
+
+    \param worker Index of the calling worker.
+    \param task The task to run.
+    \return false once every task has been handed out.
+  */
+  bool next_task(unsigned int worker, SearchTask& task)
+  {
+    if (use_progress_bar && !tasks.empty() && __sync_bool_compare_and_swap(&started,0,1)){
+      printf("Releasing DMs to workers...\n");
+      progress->start();
+    }
+    int nworkers = deques.size();
+    int id = deques[worker%nworkers].pop();
+    bool contended = true;
+    while (id<0 && contended){
+      contended = false;
+      for (int ii=1;ii<nworkers;ii++){
+	int victim = (worker+ii)%nworkers;
+	int stolen = deques[victim].steal();
+	if (stolen==DEQUE_ABORT)
+	  contended = true;
+	else if (stolen>=0){
+	  id = stolen;
+	  break;
+	}
+      }
+    }
+    if (id<0)
+      return false;
+    task = tasks[id];
+    return true;
+  }
+
+  /*!
+    \brief File the candidates of a finished task.
+
+    \param task The finished task.
+    \param cands Candidates of the task (swapped out).
+    \param dm_cands Set to all candidates of the DM if this was its last task.
+    \return true if this was the last task of its DM.
+  */
+  bool complete(SearchTask& task, std::vector<Candidate>& cands,
+		std::vector<Candidate>& dm_cands)
+  {
+    std::vector<int>& ids = dm_tasks[task.dm_idx];
+    int id = -1;
+    for (int ii=0;ii<ids.size();ii++)
+      if (tasks[ids[ii]].chunk==task.chunk)
+	id = ids[ii];
+    if (id<0)
+      ErrorChecker::throw_error("SearchScheduler: unknown task");
+    results[id].swap(cands);
+
+    size_t done = __sync_add_and_fetch(&done_cost,task.cost);
+    if (use_progress_bar){
+      pthread_mutex_lock(&progress_lock);
+      if (!progress_stopped && done>progress_done){
+	progress_done = done;
+	if (done==total_cost){
+	  progress->stop();
+	  progress_stopped = true;
+	}
+	else
+	  progress->set_progress((float)done/total_cost);
+      }
+      pthread_mutex_unlock(&progress_lock);
+    }
+
+    //full barrier, every other chunk's results are visible after this
+    if (__sync_sub_and_fetch(&remaining[task.dm_idx],1)!=0)
+      return false;
+    dm_cands.clear();
+    for (int chunk=0;chunk<task.nchunks;chunk++)
+      for (int ii=0;ii<ids.size();ii++)
+	if (tasks[ids[ii]].chunk==chunk){
+	  std::vector<Candidate>& part = results[ids[ii]];
+	  dm_cands.insert(dm_cands.end(),part.begin(),part.end());
+	  std::vector<Candidate>().swap(part);
+	}
+    return true;
+  }
+};
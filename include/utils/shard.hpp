@@ -0,0 +1,239 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <map>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include "stdio.h"
+#include "unistd.h"
+#include <data_types/candidates.hpp>
+#include <data_types/candidatetable.hpp>
+#include <utils/journal.hpp>
+#include <utils/exceptions.hpp>
+
+#define SHARD_MAGIC "PSSHARD2"
+
+/*
+  A slice of the DM list searched by one process (--shard i/N).
+
+  DM trials are dealt out round-robin, so shard i searches trials
+  i, i+N, i+2N, ... and every shard gets a similar mix of cheap high
+  DM trials and expensive low DM ones.
+*/
+struct ShardSpec {
+  int index;
+  int count;
+
+  ShardSpec():index(0),count(1){}
+
+  bool is_sharded(void){return count>1;}
+
+  bool owns(int dm_idx){return dm_idx%count==index;}
+
+  //Parse "i/N", with 0 <= i < N
+  static ShardSpec parse(std::string spec)
+  {
+    ShardSpec shard;
+    if (spec=="")
+      return shard;
+    size_t slash = spec.find('/');
+    char* end;
+    if (slash==std::string::npos)
+      ErrorChecker::throw_error("Shard must be given as i/N");
+    shard.index = strtol(spec.substr(0,slash).c_str(),&end,10);
+    if (*end!='\0')
+      ErrorChecker::throw_error("Shard must be given as i/N");
+    shard.count = strtol(spec.substr(slash+1).c_str(),&end,10);
+    if (*end!='\0' || shard.count<1 || shard.index<0 || shard.index>=shard.count)
+      ErrorChecker::throw_error("Shard must be given as i/N with 0 <= i < N");
+    return shard;
+  }
+
+  //Name of this shard's file with the given extension
+  std::string filename(std::string ext)
+  {
+    std::stringstream name;
+    name << "shard_" << index << "_of_" << count << "." << ext;
+    return name.str();
+  }
+};
+
+//Map shard-local DM trial indices (including associations) to global ones
+inline void remap_dm_indices(std::vector<Candidate>& cands, const std::vector<int>& global_idx)
+{
+  for (int ii=0;ii<cands.size();ii++){
+    if (cands[ii].dm_idx>=0 && cands[ii].dm_idx<global_idx.size())
+      cands[ii].dm_idx = global_idx[cands[ii].dm_idx];
+    remap_dm_indices(cands[ii].assoc,global_idx);
+  }
+}
+
+/*
+  Candidates of one shard, in global DM indices.
+
+  The file holds a magic string, the hash of the search configuration,
+  the shard index and count, the transform length, the distilling
+  tolerances (freq_tol and max_harm), the full DM list and one
+  CandidateSet record per DM trial of the shard. The merge step takes
+  the tolerances from here so that it distills exactly as the search
+  would have. It is written to a
+  temporary file and renamed into place once complete, so the merge
+  step only ever sees finished shards.
+*/
+class ShardFile {
+public:
+  unsigned long long config_hash;
+  ShardSpec shard;
+  unsigned int size;
+  float freq_tol;
+  int max_harm;
+  std::vector<float> dm_list;
+  std::vector<CandidateSet> sets;
+
+  ShardFile():config_hash(0),size(0),freq_tol(0),max_harm(0){}
+
+  /*!
+    \brief Group candidates into one set per owned DM trial.
+
+    \param cands Candidates with global DM indices.
+  */
+  void set_candidates(std::vector<Candidate>& cands)
+  {
+    std::map<int,int> set_idx;
+    sets.clear();
+    for (int ii=0;ii<dm_list.size();ii++)
+      if (shard.owns(ii)){
+	set_idx[ii] = sets.size();
+	sets.push_back(CandidateSet(ii,true,std::vector<Candidate>()));
+      }
+    for (int ii=0;ii<cands.size();ii++){
+      std::map<int,int>::iterator it = set_idx.find(cands[ii].dm_idx);
+      if (it==set_idx.end())
+	ErrorChecker::throw_error("ShardFile: candidate outside of shard");
+      sets[it->second].cands.push_back(cands[ii]);
+    }
+  }
+
+  void write(std::string path)
+  {
+    ensure_parent_directory(path);
+    std::string tmp_path = path+".tmp";
+    FILE* fp = fopen(tmp_path.c_str(),"wb");
+    if (fp==NULL)
+      ErrorChecker::throw_error("ShardFile: could not create "+tmp_path);
+    unsigned int ndms = dm_list.size();
+    fwrite(SHARD_MAGIC,1,8,fp);
+    fwrite(&config_hash,sizeof(config_hash),1,fp);
+    fwrite(&shard.index,sizeof(int),1,fp);
+    fwrite(&shard.count,sizeof(int),1,fp);
+    fwrite(&size,sizeof(size),1,fp);
+    fwrite(&freq_tol,sizeof(freq_tol),1,fp);
+    fwrite(&max_harm,sizeof(max_harm),1,fp);
+    fwrite(&ndms,sizeof(ndms),1,fp);
+    if (ndms>0)
+      fwrite(&dm_list[0],sizeof(float),ndms,fp);
+    for (int ii=0;ii<sets.size();ii++)
+      CandidateSetIO::write_record(fp,sets[ii]);
+    bool ok = fflush(fp)==0 && !ferror(fp);
+    fsync(fileno(fp));
+    fclose(fp);
+    if (!ok || rename(tmp_path.c_str(),path.c_str())!=0){
+      unlink(tmp_path.c_str());
+      ErrorChecker::throw_error("ShardFile: could not write "+path);
+    }
+  }
+
+  void read(std::string path)
+  {
+    FILE* fp = fopen(path.c_str(),"rb");
+    if (fp==NULL)
+      ErrorChecker::throw_error("ShardFile: could not open "+path);
+    char magic[8];
+    unsigned int ndms;
+    if (fread(magic,1,8,fp)!=8 || memcmp(magic,SHARD_MAGIC,8)!=0 ||
+	fread(&config_hash,sizeof(config_hash),1,fp)!=1 ||
+	fread(&shard.index,sizeof(int),1,fp)!=1 ||
+	fread(&shard.count,sizeof(int),1,fp)!=1 ||
+	fread(&size,sizeof(size),1,fp)!=1 ||
+	fread(&freq_tol,sizeof(freq_tol),1,fp)!=1 ||
+	fread(&max_harm,sizeof(max_harm),1,fp)!=1 ||
+	fread(&ndms,sizeof(ndms),1,fp)!=1){
+      fclose(fp);
+      ErrorChecker::throw_error("ShardFile: "+path+" is not a shard file");
+    }
+    dm_list.resize(ndms);
+    if (ndms>0 && fread(&dm_list[0],sizeof(float),ndms,fp)!=ndms){
+      fclose(fp);
+      ErrorChecker::throw_error("ShardFile: "+path+" is truncated");
+    }
+    sets.clear();
+    CandidateSet set;
+    while (CandidateSetIO::read_record(fp,set))
+      sets.push_back(set);
+    bool at_end = fgetc(fp)==EOF;
+    fclose(fp);
+    if (!at_end)
+      ErrorChecker::throw_error("ShardFile: "+path+" is corrupt");
+  }
+};
+
+/*!
+  \brief Check that shards are all N shards of one search and gather their candidates.
+
+  Every shard must come from the same search, with the same tolerances,
+  and together they must hold every DM trial exactly once. The sets of
+  each shard are released once gathered.
+
+  \param shards Shards as read, in any order.
+  \param names File of each shard, for the error messages.
+  \param table Table the candidates are added to.
+  \return Rows of the candidates, shard by shard.
+*/
+inline std::vector<int> merge_shards(std::vector<ShardFile>& shards,
+				     const std::vector<std::string>& names,
+				     CandidateTable& table)
+{
+  if (shards.empty())
+    ErrorChecker::throw_error("No shards to merge");
+  for (int ii=0;ii<shards.size();ii++)
+    if (shards[ii].config_hash!=shards[0].config_hash ||
+	shards[ii].shard.count!=shards[0].shard.count ||
+	shards[ii].size!=shards[0].size ||
+	shards[ii].freq_tol!=shards[0].freq_tol ||
+	shards[ii].max_harm!=shards[0].max_harm ||
+	shards[ii].dm_list!=shards[0].dm_list)
+      ErrorChecker::throw_error(names[ii]+" is from a different search than "+names[0]);
+
+  //every shard exactly once, and every DM trial searched
+  int nshards = shards[0].shard.count;
+  size_t ndms = shards[0].dm_list.size();
+  std::vector<int> shard_seen(nshards,0);
+  std::vector<int> dm_seen(ndms,0);
+  std::vector<int> rows;
+  for (int ii=0;ii<shards.size();ii++){
+    if (shards[ii].shard.index<0 || shards[ii].shard.index>=nshards)
+      ErrorChecker::throw_error("Bad shard index in "+names[ii]);
+    if (shard_seen[shards[ii].shard.index]++)
+      ErrorChecker::throw_error("Shard given more than once: "+names[ii]);
+    for (int jj=0;jj<shards[ii].sets.size();jj++){
+      CandidateSet& set = shards[ii].sets[jj];
+      if (set.dm_idx<0 || set.dm_idx>=ndms || !shards[ii].shard.owns(set.dm_idx))
+	ErrorChecker::throw_error("Shard holds a DM trial it does not own: "+names[ii]);
+      dm_seen[set.dm_idx]++;
+      std::vector<int> set_rows = table.append(set.cands);
+      rows.insert(rows.end(),set_rows.begin(),set_rows.end());
+    }
+    std::vector<CandidateSet>().swap(shards[ii].sets);
+  }
+  for (int ii=0;ii<nshards;ii++)
+    if (!shard_seen[ii]){
+      ShardSpec missing = shards[0].shard;
+      missing.index = ii;
+      ErrorChecker::throw_error("Missing shard: "+missing.filename("cands"));
+    }
+  for (int ii=0;ii<ndms;ii++)
+    if (dm_seen[ii]!=1)
+      ErrorChecker::throw_error("Shards do not cover the DM list exactly once");
+  return rows;
+}
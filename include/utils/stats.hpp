@@ -32,6 +32,25 @@ namespace stats {
     return;
   } 
 
+  //Gaussian sigma with upper tail probability p, found by bisection on erfc
+  inline double gaussian_isf(double p)
+  {
+    if (p>=1)
+      return -40.0;
+    if (p<=0)
+      return 40.0;
+    double lo = -40.0;
+    double hi = 40.0;
+    for (int ii=0;ii<100;ii++){
+      double mid = (lo+hi)/2;
+      if (0.5*erfc(mid/sqrt(2.0))>p)
+	lo = mid;
+      else
+	hi = mid;
+    }
+    return (lo+hi)/2;
+  }
+
   void normalise(float* ptr, float mean, float std, 
 		 unsigned int size, unsigned int max_blocks=MAX_BLOCKS,
 		 unsigned int max_threads=MAX_THREADS){
@@ -39,5 +58,28 @@ namespace stats {
     return;
   }
 
+  //Host memory counterparts of stats() and normalise()
+  template <class T>
+  void host_stats(const T* ptr, unsigned int nsamps, float* mean_, float* rms_,
+		  float* std_, unsigned int first_samp=0)
+  {
+    double sum = 0;
+    double sumsq = 0;
+    for (unsigned int ii=first_samp;ii<nsamps;ii++){
+      double val = ptr[ii];
+      sum += val;
+      sumsq += val*val;
+    }
+    *rms_  = sqrt(sumsq/(nsamps-first_samp));
+    *mean_ = sum/(nsamps-first_samp);
+    *std_  = std(*mean_,*rms_);
+  }
+
+  void host_normalise(float* ptr, float mean, float std, unsigned int size)
+  {
+    for (unsigned int ii=0;ii<size;ii++)
+      ptr[ii] = (ptr[ii]-mean)/std;
+  }
+
   
 }
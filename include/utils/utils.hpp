@@ -6,6 +6,11 @@
 #include <fstream>
 #include <vector>
 #include <iostream>
+#include <algorithm>
+#include <set>
+#include <map>
+#include <sstream>
+#include <unistd.h>
 
 class Utils {
 public:
@@ -16,7 +21,117 @@ public:
     }
     return n;
   }
-  
+
+  //True if val has no prime factors other than 2, 3, 5 and 7
+  static bool is_smooth(unsigned int val){
+    if (val==0)
+      return false;
+    unsigned int radices[4] = {2,3,5,7};
+    for (int ii=0;ii<4;ii++)
+      while (val%radices[ii]==0)
+	val/=radices[ii];
+    return val==1;
+  }
+
+  /*
+    Relative cost per point of a single radix-p pass of a cuFFT
+    transform, normalised to radix-2. The cost of a transform of
+    length n = 2^a.3^b.5^c.7^d is modelled as n*(a*w2+b*w3+c*w5+d*w7).
+    Odd radices run at lower throughput than the power-of-two
+    kernels, so are penalised beyond their log2(p) work.
+  */
+  static double fft_length_cost(unsigned int val){
+    unsigned int radices[4] = {2,3,5,7};
+    double weights[4] = {1.0,1.85,2.90,3.90};
+    double passes = 0.0;
+    unsigned int n = val;
+    for (int ii=0;ii<4;ii++)
+      while (n%radices[ii]==0){
+	n/=radices[ii];
+	passes += weights[ii];
+      }
+    return (double) val * passes;
+  }
+
+  /*
+    Return the even 7-smooth length >= val with the lowest modelled
+    transform cost. The next power of two is always a candidate, so the
+    result is never more expensive than padding to a power of two.
+  */
+  static unsigned int fastest_fft_length(unsigned int val){
+    unsigned int pow2 = 1;
+    while (pow2<val)
+      pow2*=2;
+    unsigned int best = pow2;
+    double best_cost = fft_length_cost(pow2);
+    //enumerate 2^a.3^b.5^c.7^d in [val,pow2) with a>=1
+    for (unsigned long n7=2; n7<pow2; n7*=7)
+      for (unsigned long n5=n7; n5<pow2; n5*=5)
+	for (unsigned long n3=n5; n3<pow2; n3*=3)
+	  for (unsigned long n=n3; n<pow2; n*=2){
+	    if (n<val)
+	      continue;
+	    double cost = fft_length_cost(n);
+	    if (cost<best_cost || (cost==best_cost && n<best)){
+	      best = n;
+	      best_cost = cost;
+	    }
+	  }
+    return best;
+  }
+
+  //Largest even 7-smooth length <= val (0 if val<2)
+  static unsigned int prev_smooth_length(unsigned int val){
+    unsigned int best = 0;
+    for (unsigned long n7=2; n7<=val; n7*=7)
+      for (unsigned long n5=n7; n5<=val; n5*=5)
+	for (unsigned long n3=n5; n3<=val; n3*=3)
+	  for (unsigned long n=n3; n<=val; n*=2)
+	    best = std::max(best,(unsigned int)n);
+    return best;
+  }
+
+  /*
+    Read a transform length benchmark of "length seconds" lines, as
+    written by fft_benchmark on the GPU the search will run on.
+  */
+  static std::map<unsigned int,double> read_fft_table(std::string filename){
+    std::ifstream infile(filename.c_str());
+    ErrorChecker::check_file_error(infile,filename);
+    std::map<unsigned int,double> table;
+    std::string line;
+    while (std::getline(infile,line)){
+      if (line.empty() || line[0]=='#')
+	continue;
+      std::stringstream fields(line);
+      unsigned int length;
+      double seconds;
+      if (!(fields >> length >> seconds) || length%2!=0 || seconds<=0)
+	ErrorChecker::throw_error("Bad line in "+filename+": "+line);
+      table[length] = seconds;
+    }
+    return table;
+  }
+
+  /*
+    Return the length >= val with the lowest measured time in a
+    benchmark table. Lengths the table does not reach fall back to
+    the modelled choice above.
+  */
+  static unsigned int fastest_fft_length(unsigned int val, const std::map<unsigned int,double>& table){
+    std::map<unsigned int,double>::const_iterator it = table.lower_bound(val);
+    if (it==table.end())
+      return fastest_fft_length(val);
+    unsigned int best = it->first;
+    double best_time = it->second;
+    for (;it!=table.end();++it)
+      if (it->second<best_time){
+	best = it->first;
+	best_time = it->second;
+      }
+    return best;
+  }
+
   template <class T>
   static void device_malloc(T** ptr,unsigned int units){
     cudaMalloc((void**)ptr, sizeof(T)*units);
@@ -79,12 +194,37 @@ public:
     infile.close();
   }
 
+  //Zero when there is no usable CUDA device (or driver)
   static int gpu_count(){
-    int count;
-    cudaGetDeviceCount(&count);
+    int count = 0;
+    if (cudaGetDeviceCount(&count)!=cudaSuccess){
+      cudaGetLastError();
+      return 0;
+    }
     return count;
   }
 
+  /*!
+    \brief Number of online CPUs.
+
+    \param physical_only Count SMT siblings sharing a core once.
+  */
+  static int cpu_count(bool physical_only=false){
+    long ncpus = std::max(1L,sysconf(_SC_NPROCESSORS_ONLN));
+    if (!physical_only)
+      return ncpus;
+    std::set<std::string> cores;
+    for (long ii=0;ii<ncpus;ii++){
+      std::stringstream path;
+      path << "/sys/devices/system/cpu/cpu" << ii << "/topology/thread_siblings_list";
+      std::ifstream infile(path.str().c_str());
+      std::string siblings;
+      if (infile.good() && std::getline(infile,siblings))
+	cores.insert(siblings);
+    }
+    return cores.empty() ? ncpus : cores.size();
+  }
+
 };
 
 class Block {
@@ -150,14 +290,28 @@ private:
   float bw;
   float tsamp_us;
   float tobs;
+  float jerk_lo;
+  float jerk_hi;
+  float max_freq;
+
+  //Effective pulse width (us) at a given DM
+  float effective_width(float dm){
+    float tdm = pow(8.3*bw/pow(cfreq,3.0)*dm,2.0);
+    float tpulse = pulse_width * pulse_width;
+    float ttsamp = tsamp * tsamp;
+    return sqrt(tdm+tpulse+ttsamp);
+  }
 
 public:
   AccelerationPlan(float acc_lo, float acc_hi, float tol,
 		   float pulse_width, unsigned int nsamps,
-		   float tsamp, float cfreq, float bw)
+		   float tsamp, float cfreq, float bw,
+		   float jerk_lo=0.0, float jerk_hi=0.0,
+		   float max_freq=0.0)
     :acc_lo(acc_lo),acc_hi(acc_hi),tol(tol),
      pulse_width(pulse_width),nsamps(nsamps),
-     tsamp(tsamp),cfreq(cfreq),bw(fabs(bw))
+     tsamp(tsamp),cfreq(cfreq),bw(fabs(bw)),
+     jerk_lo(jerk_lo),jerk_hi(jerk_hi),max_freq(max_freq)
   {
     tsamp_us = 1.0e6 * tsamp;
     tobs = nsamps*tsamp;
@@ -172,10 +326,7 @@ public:
       return;
     }
 
-    float tdm = pow(8.3*bw/pow(cfreq,3.0)*dm,2.0);
-    float tpulse = pulse_width * pulse_width;
-    float ttsamp = tsamp * tsamp;
-    float w_us = sqrt(tdm+tpulse+ttsamp);
+    float w_us = effective_width(dm);
     float alt_a = 2.0 * w_us * 1.0e-6 * 24.0 * 299792458.0/tobs/tobs * sqrt((tol*tol)-1.0);
     unsigned int naccels = (unsigned int)((float)(acc_hi-acc_lo))/alt_a;
     acc_list.clear();
@@ -190,6 +341,59 @@ public:
     acc_list.push_back(acc_hi);
     return;
   }
+
+  /*
+    Jerk trials to search at each acceleration. The residual time
+    shift of the cubic resampling term (zero at the start, middle and
+    end of the observation) peaks at j*tobs^3/(72*sqrt(3)*c), against
+    a*tobs^2/(8*c) for acceleration, so the step follows from the
+    acceleration step at the same smearing tolerance. A jerk j sweeps
+    the frequency of a signal at f through f*j*tobs^3/(8*c) Fourier
+    bins, so the step is never finer than one bin of sweep at
+    max_freq, and if the whole jerk range sweeps less than one bin
+    only zero jerk is searched. As for acceleration, the smearing
+    step widens with DM through the effective pulse width.
+  */
+  void generate_jerk_list(float dm,std::vector<float>& jerk_list){
+    jerk_list.clear();
+    if (jerk_hi==jerk_lo){
+      jerk_list.push_back(0.0);
+      return;
+    }
+
+    float w_us = effective_width(dm);
+    float alt_a = 2.0 * w_us * 1.0e-6 * 24.0 * 299792458.0/tobs/tobs * sqrt((tol*tol)-1.0);
+    float alt_j = alt_a * 9.0 * sqrt(3.0) / tobs;
+    if (max_freq>0){
+      float min_step = 8.0*299792458.0/(max_freq*tobs*tobs*tobs);
+      float max_jerk = std::max(fabs(jerk_lo),fabs(jerk_hi));
+      if (max_jerk < min_step){
+	jerk_list.push_back(0.0);
+	return;
+      }
+      alt_j = std::max(alt_j,min_step);
+    }
+    unsigned int njerks = (unsigned int)((float)(jerk_hi-jerk_lo))/alt_j;
+    jerk_list.reserve(njerks+3);
+    if (jerk_hi!=0 && jerk_lo!=0)
+      jerk_list.push_back(0.0); //explicitly force zero jerk.
+    float jerk = jerk_lo;
+    while (jerk<jerk_hi){
+      jerk_list.push_back(jerk);
+      jerk+=alt_j;
+    }
+    jerk_list.push_back(jerk_hi);
+    return;
+  }
+
+  //Number of (acceleration, jerk) trials searched at a DM
+  size_t get_ntrials(float dm){
+    std::vector<float> acc_list;
+    std::vector<float> jerk_list;
+    generate_accel_list(dm,acc_list);
+    generate_jerk_list(dm,jerk_list);
+    return acc_list.size()*jerk_list.size();
+  }
 };
 
 
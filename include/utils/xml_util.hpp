@@ -5,6 +5,11 @@
 #include <iomanip>
 #include <map>
 #include <vector>
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+#include "stdio.h"
+#include "stdlib.h"
 
 namespace XML {
 
@@ -89,4 +94,251 @@ namespace XML {
       return xml.str();
     }
   };
+
+  /*
+    Writes elements straight to a buffered file as they are produced,
+    in the layout of Element::to_string, instead of building a tree.
+
+      writer.start("trial");
+      writer.attribute("id",ii);
+      writer.text(dm);
+      writer.end();
+
+    Floating point values are written with the fewest digits that read
+    back to the same float or double.
+  */
+  class Writer {
+  private:
+    enum State {OPEN_TAG, HAS_TEXT, HAS_CHILDREN};
+    FILE* fo;
+    std::vector<char> buffer;
+    std::vector<std::string> names;
+    std::vector<State> states;
+    char number[64];
+
+    void put(const char* str, size_t len){
+      fwrite(str,1,len,fo);
+    }
+
+    void put(const char* str){
+      put(str,strlen(str));
+    }
+
+    void put(const std::string& str){
+      put(str.data(),str.size());
+    }
+
+    void indent(size_t level){
+      for (size_t ii=0;ii<level;ii++)
+	put("  ",2);
+    }
+
+    //Finish the parent's start tag before a child
+    void open_parent(void){
+      if (states.empty())
+	return;
+      if (states.back()==OPEN_TAG)
+	put(">\n",2);
+      states.back() = HAS_CHILDREN;
+    }
+
+    void escape(const char* str, size_t len){
+      size_t from = 0;
+      for (size_t ii=0;ii<len;ii++){
+	const char* entity = NULL;
+	switch (str[ii]){
+	case '&': entity = "&amp;"; break;
+	case '<': entity = "&lt;"; break;
+	case '>': entity = "&gt;"; break;
+	case '\'': entity = "&apos;"; break;
+	}
+	if (entity!=NULL){
+	  put(str+from,ii-from);
+	  put(entity);
+	  from = ii+1;
+	}
+      }
+      put(str+from,len-from);
+    }
+
+    static bool reads_back(const char* buf, float value){return strtof(buf,NULL)==value;}
+    static bool reads_back(const char* buf, double value){return strtod(buf,NULL)==value;}
+
+    //ndigits significant digits with the first at 10^exp10, fixed point for moderate exponents
+    static int format_digits(char* buf, bool negative, unsigned long long digits, int ndigits, int exp10){
+      while (ndigits>1 && digits%10==0){
+	digits /= 10;
+	ndigits--;
+      }
+      char digit[24];
+      for (int ii=ndigits-1;ii>=0;ii--){
+	digit[ii] = '0'+digits%10;
+	digits /= 10;
+      }
+      char* ptr = buf;
+      if (negative)
+	*ptr++ = '-';
+      if (exp10<-5 || exp10>=15){
+	*ptr++ = digit[0];
+	if (ndigits>1){
+	  *ptr++ = '.';
+	  for (int ii=1;ii<ndigits;ii++)
+	    *ptr++ = digit[ii];
+	}
+	ptr += sprintf(ptr,"e%+03d",exp10);
+      } else if (exp10<0){
+	*ptr++ = '0';
+	*ptr++ = '.';
+	for (int ii=0;ii<-exp10-1;ii++)
+	  *ptr++ = '0';
+	for (int ii=0;ii<ndigits;ii++)
+	  *ptr++ = digit[ii];
+      } else {
+	for (int ii=0;ii<=exp10;ii++)
+	  *ptr++ = ii<ndigits ? digit[ii] : '0';
+	if (ndigits>exp10+1){
+	  *ptr++ = '.';
+	  for (int ii=exp10+1;ii<ndigits;ii++)
+	    *ptr++ = digit[ii];
+	}
+      }
+      *ptr = '\0';
+      return ptr-buf;
+    }
+
+    /*
+      Fewest significant digits that read back as the same value. The
+      digits for each length are rounded in double arithmetic and only a
+      length that passes that test is formatted and read back. Beyond 14
+      digits double arithmetic is not exact, so those lengths (and values
+      it cannot scale) are tried with printf.
+    */
+    template <class X>
+    static int shortest(char* buf, size_t size, X value, int max_digits){
+      double x = value;
+      //zero, inf and nan
+      if (x==0 || !(x-x==0))
+	return snprintf(buf,size,"%g",x);
+      bool negative = x<0;
+      x = fabs(x);
+      int exp10 = (int)floor(log10(x));
+      int lo = 1;
+      if (exp10>-290 && exp10<290){
+	for (;lo<=std::min(max_digits,14);lo++){
+	  int ndigits = lo;
+	  int exponent = exp10;
+	  int scale = ndigits-1-exponent;
+	  double digits = floor((scale>=0 ? x*pow(10.0,scale) : x/pow(10.0,-scale))+0.5);
+	  if (digits>=pow(10.0,ndigits)){
+	    digits = floor(digits/10+0.5);
+	    exponent++;
+	    scale--;
+	  }
+	  double approx = scale>=0 ? digits/pow(10.0,scale) : digits*pow(10.0,-scale);
+	  if ((X)approx!=(X)x)
+	    continue;
+	  int len = format_digits(buf,negative,(unsigned long long)digits,ndigits,exponent);
+	  if (reads_back(buf,value))
+	    return len;
+	}
+      }
+      int hi = max_digits;
+      while (lo<hi){
+	int mid = (lo+hi)/2;
+	snprintf(buf,size,"%.*g",mid,(double)value);
+	if (reads_back(buf,value))
+	  hi = mid;
+	else
+	  lo = mid+1;
+      }
+      return snprintf(buf,size,"%.*g",lo,(double)value);
+    }
+
+    void value(const std::string& x){escape(x.data(),x.size());}
+    void value(const char* x){escape(x,strlen(x));}
+    void value(bool x){put(x?"1":"0",1);}
+    void value(int x){put(number,snprintf(number,sizeof(number),"%d",x));}
+    void value(unsigned int x){put(number,snprintf(number,sizeof(number),"%u",x));}
+    void value(long x){put(number,snprintf(number,sizeof(number),"%ld",x));}
+    void value(unsigned long x){put(number,snprintf(number,sizeof(number),"%lu",x));}
+    void value(long long x){put(number,snprintf(number,sizeof(number),"%lld",x));}
+    void value(unsigned long long x){put(number,snprintf(number,sizeof(number),"%llu",x));}
+    void value(float x){put(number,shortest(number,sizeof(number),x,9));}
+    void value(double x){put(number,shortest(number,sizeof(number),x,17));}
+
+  public:
+    Writer():fo(NULL),buffer(1<<20){}
+
+    ~Writer(){
+      if (fo!=NULL)
+	fclose(fo);
+    }
+
+    //Open path and write the XML declaration
+    bool open(std::string path){
+      fo = fopen(path.c_str(),"wb");
+      if (fo==NULL)
+	return false;
+      setvbuf(fo,&buffer[0],_IOFBF,buffer.size());
+      put("<?xml version='1.0' encoding='ISO-8859-1'?>\n");
+      return true;
+    }
+
+    void start(const std::string& name){
+      open_parent();
+      indent(names.size());
+      put("<",1);
+      put(name);
+      names.push_back(name);
+      states.push_back(OPEN_TAG);
+    }
+
+    //Only between start() and any text or children
+    template <class X>
+    void attribute(const std::string& key, X x){
+      put(" ",1);
+      put(key);
+      put("='",2);
+      value(x);
+      put("'",1);
+    }
+
+    template <class X>
+    void text(X x){
+      if (states.back()==OPEN_TAG)
+	put(">",1);
+      states.back() = HAS_TEXT;
+      value(x);
+    }
+
+    void end(void){
+      if (states.back()==OPEN_TAG)
+	put(">",1);
+      else if (states.back()==HAS_CHILDREN)
+	indent(names.size()-1);
+      put("</",2);
+      put(names.back());
+      put(">\n",2);
+      names.pop_back();
+      states.pop_back();
+    }
+
+    //An element holding only text
+    template <class X>
+    void element(const std::string& name, X x){
+      start(name);
+      text(x);
+      end();
+    }
+
+    //Close any open elements and the file, false on a write error
+    bool close(void){
+      while (!names.empty())
+	end();
+      bool ok = !ferror(fo);
+      ok = (fclose(fo)==0) && ok;
+      fo = NULL;
+      return ok;
+    }
+  };
 }
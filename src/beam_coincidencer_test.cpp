@@ -0,0 +1,159 @@
+#include <transforms/beamcoincidencer.hpp>
+#include <utils/stopwatch.hpp>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+
+#define NBEAMS 20
+#define NCANDS_PER_BEAM 100
+#define FREQ_TOL 0.0001
+#define MAX_HARM 16
+#define MAX_DENOM 2
+#define BEAM_THRESHOLD 4
+#define DM_TOL 40.0
+
+/*
+  All-pairs reference for BeamCoincidencer: every candidate is tested
+  against every candidate of every other beam at every harmonic ratio.
+  Beam counts, RFI flags, groups and group beam counts must be the same
+  for any number of threads.
+*/
+class ReferenceCoincidencer {
+private:
+  std::vector<double> ratios;
+  std::vector<int> parent;
+
+  int find(int row){
+    while (parent[row]!=row)
+      row = parent[row];
+    return row;
+  }
+
+public:
+  std::vector<int> nbeams_matched;
+  std::vector<char> is_rfi;
+  std::vector<int> group;
+  std::vector<int> group_nbeams;
+
+  ReferenceCoincidencer()
+  {
+    for (int jj=1;jj<=MAX_HARM;jj++)
+      for (int kk=1;kk<=MAX_DENOM;kk++){
+	ratios.push_back(jj/(double)kk);
+	ratios.push_back(kk/(double)jj);
+      }
+  }
+
+  bool matches(const BeamCandidateTable& t, int row, int other){
+    if (t.beam[row]==t.beam[other])
+      return false;
+    for (int ii=0;ii<ratios.size();ii++){
+      double ratio = t.freq[other]/(t.freq[row]*ratios[ii]);
+      if (ratio>1-FREQ_TOL && ratio<1+FREQ_TOL)
+	return true;
+    }
+    return false;
+  }
+
+  void match(const BeamCandidateTable& t, const std::vector<char>& adjacent)
+  {
+    int size = t.size();
+    nbeams_matched.assign(size,1);
+    std::vector<std::vector<char> > matched(size,std::vector<char>(NBEAMS,0));
+    for (int ii=0;ii<size;ii++)
+      for (int jj=0;jj<size;jj++)
+	if (matches(t,ii,jj) && !matched[ii][t.beam[jj]]){
+	  matched[ii][t.beam[jj]] = 1;
+	  nbeams_matched[ii]++;
+	}
+    is_rfi.resize(size);
+    for (int ii=0;ii<size;ii++)
+      is_rfi[ii] = nbeams_matched[ii]>=BEAM_THRESHOLD;
+
+    parent.resize(size);
+    for (int ii=0;ii<size;ii++)
+      parent[ii] = ii;
+    std::vector<char> linked(size,0);
+    for (int ii=0;ii<size;ii++)
+      for (int jj=0;jj<size;jj++)
+	if (!is_rfi[ii] && !is_rfi[jj] && adjacent[t.beam[ii]*NBEAMS+t.beam[jj]] &&
+	    fabs(t.dm[ii]-t.dm[jj])<=DM_TOL && matches(t,ii,jj)){
+	  linked[ii] = linked[jj] = 1;
+	  int a = find(ii);
+	  int b = find(jj);
+	  parent[std::max(a,b)] = std::min(a,b);
+	}
+    group.assign(size,-1);
+    group_nbeams.clear();
+    std::vector<std::vector<char> > group_beams;
+    for (int ii=0;ii<size;ii++){
+      if (!linked[ii])
+	continue;
+      int root = find(ii);
+      if (root==ii){
+	group[ii] = group_nbeams.size();
+	group_nbeams.push_back(0);
+	group_beams.push_back(std::vector<char>(NBEAMS,0));
+      } else {
+	group[ii] = group[root];
+      }
+      if (!group_beams[group[ii]][t.beam[ii]]++)
+	group_nbeams[group[ii]]++;
+    }
+  }
+};
+
+int main()
+{
+  srand(3);
+  //beams on a 5 x 4 grid 0.05 degrees apart, adjacent up to 0.06 degrees
+  std::vector<double> ra, dec;
+  for (int ii=0;ii<NBEAMS;ii++){
+    ra.push_back((ii%5)*0.05);
+    dec.push_back((ii/5)*0.05);
+  }
+  std::vector<char> adjacent(NBEAMS*NBEAMS);
+  for (int ii=0;ii<NBEAMS;ii++)
+    for (int jj=0;jj<NBEAMS;jj++)
+      adjacent[ii*NBEAMS+jj] = fabs(ra[ii]-ra[jj])+fabs(dec[ii]-dec[jj])<0.06;
+
+  //noise, RFI at harmonics of 50 Hz in every beam and a source seen in a few
+  BeamCandidateTable table;
+  for (int beam=0;beam<NBEAMS;beam++)
+    for (int ii=0;ii<NCANDS_PER_BEAM;ii++){
+      double jitter = 1+FREQ_TOL*0.6*(rand()/(double)RAND_MAX-0.5);
+      double freq = 0.1+1000*pow(rand()/(double)RAND_MAX,3);
+      if (rand()%15==0)
+	freq = 50.0*(1+rand()%4)*jitter;
+      else if (beam<7 && rand()%10==0)
+	freq = 7.3*(1+rand()%2)*jitter;
+      table.add(beam,ii,freq,6+rand()%10,rand()%100,0);
+    }
+
+  Stopwatch ref_timer;
+  ref_timer.start();
+  ReferenceCoincidencer reference;
+  reference.match(table,adjacent);
+  ref_timer.stop();
+
+  bool ok = true;
+  unsigned int nthreads[] = {1,2,3,8};
+  for (int ii=0;ii<4;ii++){
+    BeamCoincidencer coincidencer(FREQ_TOL,MAX_HARM,MAX_DENOM,BEAM_THRESHOLD,DM_TOL,nthreads[ii],1);
+    coincidencer.set_positions(ra,dec,0.06);
+    Stopwatch timer;
+    timer.start();
+    coincidencer.match(table,NBEAMS);
+    timer.stop();
+    bool match_ok = coincidencer.nbeams_matched==reference.nbeams_matched &&
+      coincidencer.is_rfi==reference.is_rfi && coincidencer.group==reference.group &&
+      coincidencer.group_nbeams==reference.group_nbeams;
+    printf("BeamCoincidencer (%u threads) %d candidates, %d RFI, %d groups, indexed %.3f s, "
+	   "all pairs %.3f s: %s\n",nthreads[ii],(int)table.size(),(int)coincidencer.get_nrfi(),
+	   (int)coincidencer.get_ngroups(),timer.getTime(),ref_timer.getTime(),
+	   match_ok?"identical":"DIFFERENT");
+    ok &= match_ok;
+  }
+  return ok?0:1;
+}
@@ -0,0 +1,177 @@
+#include <utils/columnar.hpp>
+#include <data_types/candidates.hpp>
+#include <iostream>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define PCOL_PATH "columnar_test.pcol"
+#define NCANDS 500
+
+/*
+  ColumnarCandidateWriter against ColumnarCandidateFile: every column,
+  fold and detection written must read back unchanged, with the
+  directory sized by the columns actually written, and feature names
+  too long for the directory must be refused rather than truncated.
+*/
+
+std::vector<Candidate> make_candidates(int nfeatures)
+{
+  std::vector<Candidate> cands;
+  for (int ii=0;ii<NCANDS;ii++){
+    Candidate cand(rand()%1000/10.0,rand()%100,rand()%200-100,rand()%5,6+rand()%1000/10.0,
+		   rand()%100000/100.0+0.01);
+    cand.jerk = rand()%5-2;
+    cand.segment_level = rand()%3;
+    cand.segment = rand()%4;
+    cand.folded_snr = rand()%500/10.0;
+    cand.opt_period = 1.0/cand.freq*(1+rand()%100*1e-9);
+    cand.is_adjacent = rand()%2;
+    cand.is_physical = rand()%2;
+    cand.ddm_count_ratio = rand()%100/100.0;
+    cand.ddm_snr_ratio = rand()%100/100.0;
+    cand.known_source = rand()%4-1;
+    //some candidates carry fewer features than named, the rest read as 0
+    for (int jj=rand()%(nfeatures+1);jj>0;jj--)
+      cand.features.push_back(rand()%1000/7.0);
+    for (int jj=rand()%4;jj>0;jj--){
+      Candidate assoc(rand()%1000/10.0,rand()%100,rand()%200,1,7,cand.freq*2);
+      if (rand()%2)
+	assoc.append(Candidate(1,2,3,1,6.5,cand.freq/2));
+      cand.append(assoc);
+    }
+    if (rand()%3==0){
+      int nbins = 16*(1+rand()%4);
+      int nints = 1+rand()%3;
+      std::vector<float> fold(nbins*nints);
+      for (int jj=0;jj<fold.size();jj++)
+	fold[jj] = rand()%1000/10.0;
+      cand.set_fold(&fold[0],nbins,nints);
+    }
+    cands.push_back(cand);
+  }
+  return cands;
+}
+
+template <class T>
+int count_wrong(const ColumnarCandidateFile& file, const std::string& name,
+		const std::vector<Candidate>& cands, T Candidate::*field)
+{
+  const T* values = file.get_column<T>(name);
+  int nwrong = 0;
+  for (int ii=0;ii<cands.size();ii++)
+    nwrong += values[ii]!=cands[ii].*field;
+  return nwrong;
+}
+
+int count_wrong_flag(const ColumnarCandidateFile& file, const std::string& name,
+		     const std::vector<Candidate>& cands, bool Candidate::*field)
+{
+  const unsigned char* values = file.get_column<unsigned char>(name);
+  int nwrong = 0;
+  for (int ii=0;ii<cands.size();ii++)
+    nwrong += values[ii]!=cands[ii].*field;
+  return nwrong;
+}
+
+bool check_round_trip(std::vector<Candidate>& cands, const std::vector<std::string>& feature_names)
+{
+  ColumnarCandidateWriter writer;
+  if (!writer.write_file(PCOL_PATH,cands,feature_names))
+    return false;
+  ColumnarCandidateFile file(PCOL_PATH);
+  std::vector<std::string> names = file.get_column_names();
+  bool ok = file.size()==cands.size() && names.size()==17+feature_names.size();
+  for (int ii=0;ii<feature_names.size() && ok;ii++)
+    ok &= names[17+ii]==feature_names[ii];
+  if (!ok)
+    return false;
+
+  int nwrong = 0;
+  nwrong += count_wrong(file,"freq",cands,&Candidate::freq);
+  nwrong += count_wrong(file,"opt_period",cands,&Candidate::opt_period);
+  nwrong += count_wrong(file,"dm",cands,&Candidate::dm);
+  nwrong += count_wrong(file,"dm_idx",cands,&Candidate::dm_idx);
+  nwrong += count_wrong(file,"acc",cands,&Candidate::acc);
+  nwrong += count_wrong(file,"jerk",cands,&Candidate::jerk);
+  nwrong += count_wrong(file,"segment_level",cands,&Candidate::segment_level);
+  nwrong += count_wrong(file,"segment",cands,&Candidate::segment);
+  nwrong += count_wrong(file,"nh",cands,&Candidate::nh);
+  nwrong += count_wrong(file,"snr",cands,&Candidate::snr);
+  nwrong += count_wrong(file,"folded_snr",cands,&Candidate::folded_snr);
+  nwrong += count_wrong_flag(file,"is_adjacent",cands,&Candidate::is_adjacent);
+  nwrong += count_wrong_flag(file,"is_physical",cands,&Candidate::is_physical);
+  nwrong += count_wrong(file,"ddm_count_ratio",cands,&Candidate::ddm_count_ratio);
+  nwrong += count_wrong(file,"ddm_snr_ratio",cands,&Candidate::ddm_snr_ratio);
+  nwrong += count_wrong(file,"known_source",cands,&Candidate::known_source);
+  const int* nassoc = file.get_column<int>("nassoc");
+  for (int ii=0;ii<cands.size();ii++)
+    nwrong += nassoc[ii]!=cands[ii].count_assoc();
+  for (int jj=0;jj<feature_names.size();jj++){
+    const float* values = file.get_column<float>(feature_names[jj]);
+    for (int ii=0;ii<cands.size();ii++)
+      nwrong += values[ii]!=(jj<cands[ii].features.size() ? cands[ii].features[jj] : 0);
+  }
+
+  for (int ii=0;ii<cands.size();ii++){
+    int nbins,nints;
+    const float* fold = file.get_fold(ii,nbins,nints);
+    if (cands[ii].fold.empty())
+      nwrong += fold!=NULL;
+    else if (fold==NULL || nbins!=cands[ii].nbins || nints!=cands[ii].nints ||
+	     (size_t)fold%COLUMNAR_ALIGN!=0)
+      nwrong++;
+    else
+      for (int jj=0;jj<cands[ii].fold.size();jj++)
+	nwrong += fold[jj]!=cands[ii].fold[jj];
+
+    std::vector<CandidatePOD> expected;
+    cands[ii].collect_candidates(expected);
+    size_t count;
+    const CandidatePOD* detections = file.get_detections(ii,count);
+    if (count!=expected.size())
+      nwrong++;
+    else
+      for (int jj=0;jj<count;jj++)
+	nwrong += memcmp(&detections[jj],&expected[jj],sizeof(CandidatePOD))!=0;
+  }
+  return nwrong==0;
+}
+
+int main()
+{
+  srand(7);
+  bool ok = true;
+
+  const char* feature_list[] = {"dm_curve_width","acc_spread","a_19_character_name"};
+  for (int nfeatures=0;nfeatures<=3;nfeatures++){
+    std::vector<std::string> feature_names(feature_list,feature_list+nfeatures);
+    std::vector<Candidate> cands = make_candidates(nfeatures);
+    bool trip_ok = check_round_trip(cands,feature_names);
+    printf("Round trip, %d features     %s\n",nfeatures,trip_ok?"ok":"FAILED");
+    ok &= trip_ok;
+  }
+
+  std::vector<Candidate> none;
+  bool empty_ok = check_round_trip(none,std::vector<std::string>(1,"acc_spread"));
+  printf("Round trip, no candidates   %s\n",empty_ok?"ok":"FAILED");
+  ok &= empty_ok;
+
+  //a 20 character name would lose its last character in the directory
+  unlink(PCOL_PATH);
+  std::vector<Candidate> cands = make_candidates(1);
+  std::vector<std::string> long_name(1,"a_20_character_name_");
+  bool refused = false;
+  try {
+    ColumnarCandidateWriter writer;
+    writer.write_file(PCOL_PATH,cands,long_name);
+  } catch (std::runtime_error& e) {
+    refused = access(PCOL_PATH,F_OK)!=0;
+  }
+  printf("Long feature name refused   %s\n",refused?"ok":"FAILED");
+  ok &= refused;
+
+  unlink(PCOL_PATH);
+  return ok?0:1;
+}
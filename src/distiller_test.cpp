@@ -0,0 +1,349 @@
+#include <transforms/distiller.hpp>
+#include <data_types/candidateindex.hpp>
+#include <data_types/candidates.hpp>
+#include <utils/stopwatch.hpp>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+
+#define NCANDS 20000
+#define TOBS 600.0
+#define FREQ_TOL 0.0001
+#define MAX_HARM 16
+
+/*
+  All-pairs reference distillers: the windowed distillers in
+  transforms/distiller.hpp must give exactly the same candidates, in
+  the same order and with the same associations.
+*/
+class ReferenceDistiller {
+protected:
+  std::vector<bool> unique;
+  int size;
+  bool keep_related;
+  virtual void condition(std::vector<Candidate>& cands, int idx)=0;
+  ReferenceDistiller(bool keep_related):keep_related(keep_related){}
+
+  void relate(std::vector<Candidate>& cands, int idx, int ii){
+    if (keep_related)
+      cands[idx].append(cands[ii]);
+    unique[ii]=false;
+  }
+
+public:
+  virtual ~ReferenceDistiller(){}
+
+  std::vector<Candidate> distill(std::vector<Candidate>& cands)
+  {
+    size = cands.size();
+    unique.assign(size,true);
+    std::stable_sort(cands.begin(),cands.end(),snr_less_than());
+    for (int ii=0;ii<size;ii++)
+      if (unique[ii])
+	condition(cands,ii);
+    std::vector<Candidate> new_cands;
+    for (int ii=0;ii<size;ii++)
+      if (unique[ii])
+	new_cands.push_back(cands[ii]);
+    return new_cands;
+  }
+};
+
+class ReferenceHarmonicDistiller: public ReferenceDistiller {
+  float tolerance;
+  float max_harm;
+  bool fractional_harms;
+
+  void condition(std::vector<Candidate>& cands, int idx){
+    double upper_tol = 1+tolerance;
+    double lower_tol = 1-tolerance;
+    double fundi_freq = cands[idx].freq;
+    for (int ii=idx+1;ii<size;ii++){
+      double freq = cands[ii].freq;
+      float max_denominator = fractional_harms ? pow(2.0,cands[ii].nh) : 1;
+      for (int jj=1;jj<=max_harm;jj++)
+	for (int kk=1;kk<=max_denominator;kk++){
+	  double ratio = kk*freq/(jj*fundi_freq);
+	  if (ratio>(lower_tol)&&ratio<(upper_tol))
+	    relate(cands,idx,ii);
+	}
+    }
+  }
+public:
+  ReferenceHarmonicDistiller(float tol, float max_harm, bool keep_related, bool fractional_harms)
+    :ReferenceDistiller(keep_related),tolerance(tol),max_harm(max_harm),
+     fractional_harms(fractional_harms){}
+};
+
+class ReferenceAccelerationDistiller: public ReferenceDistiller {
+  float tobs;
+  double tobs_over_c;
+  float tolerance;
+
+  float correct_for_acceleration(double freq, double delta_acc, double delta_jerk){
+    return freq+delta_acc*freq*tobs_over_c+delta_jerk*freq*tobs_over_c*tobs/8.0;
+  }
+
+  void condition(std::vector<Candidate>& cands, int idx){
+    double fundi_freq = cands[idx].freq;
+    double edge = fundi_freq*tolerance;
+    for (int ii=idx+1;ii<size;ii++){
+      double acc_freq = correct_for_acceleration(fundi_freq,cands[idx].acc-cands[ii].acc,
+						 cands[idx].jerk-cands[ii].jerk);
+      if (acc_freq>fundi_freq){
+	if (cands[ii].freq>fundi_freq-edge && cands[ii].freq<acc_freq+edge)
+	  relate(cands,idx,ii);
+      } else {
+	if (cands[ii].freq<fundi_freq+edge && cands[ii].freq>acc_freq-edge)
+	  relate(cands,idx,ii);
+      }
+    }
+  }
+public:
+  ReferenceAccelerationDistiller(float tobs, float tolerance, bool keep_related)
+    :ReferenceDistiller(keep_related),tobs(tobs),tolerance(tolerance){
+    tobs_over_c = tobs/SPEED_OF_LIGHT;
+  }
+};
+
+class ReferenceDMDistiller: public ReferenceDistiller {
+  float tolerance;
+
+  void condition(std::vector<Candidate>& cands, int idx){
+    double fundi_freq = cands[idx].freq;
+    double upper_tol = 1+tolerance;
+    double lower_tol = 1-tolerance;
+    for (int ii=idx+1;ii<size;ii++){
+      double ratio = cands[ii].freq/fundi_freq;
+      if (ratio>(lower_tol)&&ratio<(upper_tol))
+	relate(cands,idx,ii);
+    }
+  }
+public:
+  ReferenceDMDistiller(float tolerance, bool keep_related)
+    :ReferenceDistiller(keep_related),tolerance(tolerance){}
+};
+
+bool same(const Candidate& x, const Candidate& y)
+{
+  if (x.freq!=y.freq || x.snr!=y.snr || x.dm_idx!=y.dm_idx || x.acc!=y.acc ||
+      x.jerk!=y.jerk || x.nh!=y.nh || x.assoc.size()!=y.assoc.size())
+    return false;
+  for (int ii=0;ii<x.assoc.size();ii++)
+    if (!same(x.assoc[ii],y.assoc[ii]))
+      return false;
+  return true;
+}
+
+bool same(const std::vector<Candidate>& x, const std::vector<Candidate>& y)
+{
+  if (x.size()!=y.size())
+    return false;
+  for (int ii=0;ii<x.size();ii++)
+    if (!same(x[ii],y[ii]))
+      return false;
+  return true;
+}
+
+//Pulsar-like families (harmonics, DM and acceleration neighbours) in noise
+std::vector<Candidate> make_candidates(void)
+{
+  std::vector<Candidate> cands;
+  while (cands.size()<NCANDS){
+    double freq = 0.1+1000.0*pow(rand()/(double)RAND_MAX,3.0);
+    int dm_idx = rand()%500;
+    float acc = -250+(rand()%101)*5;
+    float snr = 6+20*rand()/(float)RAND_MAX;
+    int family = 1+rand()%8;
+    for (int ii=0;ii<family;ii++){
+      int harm = 1+rand()%4;
+      double drift = 1+FREQ_TOL*(rand()/(double)RAND_MAX-0.5);
+      Candidate cand(dm_idx+rand()%5,dm_idx+rand()%5,acc+5*(rand()%5),
+		     rand()%5,snr/harm,freq*harm*drift);
+      cand.jerk = (rand()%3-1)*2.0;
+      //exact S/N ties exercise the sort order
+      if (rand()%10==0)
+	cand.snr = 10;
+      cands.push_back(cand);
+    }
+  }
+  return cands;
+}
+
+//Box and harmonic queries of CandidateIndex against a scan of every candidate
+bool check_index(const std::vector<Candidate>& cands)
+{
+  CandidateIndex index(FREQ_TOL);
+  index.build(cands);
+  std::vector<CandidateQuery> queries;
+  std::vector<std::vector<int> > expected;
+  int nharm_found = 0;
+  bool ok = true;
+  for (int ii=0;ii<1000;ii++){
+    const Candidate& centre = cands[rand()%cands.size()];
+    CandidateQuery query(centre.freq*(1-FREQ_TOL),centre.freq*(1+FREQ_TOL));
+    if (ii%2)
+      query.dm_range(centre.dm-2,centre.dm+2);
+    if (ii%3)
+      query.acc_range(centre.acc-10,centre.acc+10);
+    queries.push_back(query);
+    expected.push_back(std::vector<int>());
+    for (int jj=0;jj<cands.size();jj++)
+      if (cands[jj].freq>=query.freq_low && cands[jj].freq<=query.freq_high &&
+	  cands[jj].dm>=query.dm_low && cands[jj].dm<=query.dm_high &&
+	  cands[jj].acc>=query.acc_low && cands[jj].acc<=query.acc_high)
+	expected.back().push_back(jj);
+
+    std::vector<int> harm_found, harm_expected;
+    index.query_harmonics(centre.freq,FREQ_TOL,MAX_HARM,2,query,harm_found);
+    for (int jj=0;jj<cands.size();jj++){
+      bool in_box = cands[jj].dm>=query.dm_low && cands[jj].dm<=query.dm_high &&
+	cands[jj].acc>=query.acc_low && cands[jj].acc<=query.acc_high;
+      bool harmonic = false;
+      for (int hh=1;hh<=MAX_HARM;hh++)
+	for (int kk=1;kk<=2;kk++){
+	  double up = centre.freq*hh/kk, down = centre.freq*kk/hh;
+	  harmonic |= cands[jj].freq>=up*(1-FREQ_TOL) && cands[jj].freq<=up*(1+FREQ_TOL);
+	  harmonic |= cands[jj].freq>=down*(1-FREQ_TOL) && cands[jj].freq<=down*(1+FREQ_TOL);
+	}
+      if (in_box && harmonic)
+	harm_expected.push_back(jj);
+    }
+    std::sort(harm_found.begin(),harm_found.end());
+    ok &= harm_found==harm_expected;
+    nharm_found += harm_found.size();
+  }
+  std::vector<size_t> offsets;
+  std::vector<int> found;
+  index.query_batch(queries,offsets,found,3,1);
+  int nfound = 0;
+  for (int ii=0;ii<queries.size();ii++){
+    std::vector<int> batch(found.begin()+offsets[ii],found.begin()+offsets[ii+1]);
+    std::vector<int> single;
+    index.query(queries[ii],single);
+    std::sort(batch.begin(),batch.end());
+    ok &= batch==expected[ii] && single==std::vector<int>(found.begin()+offsets[ii],found.begin()+offsets[ii+1]);
+    nfound += batch.size();
+  }
+  printf("%-24s %6d candidates, %d buckets, %d box and %d harmonic matches: %s\n",
+	 "CandidateIndex",(int)cands.size(),(int)index.get_nbuckets(),nfound,nharm_found,
+	 ok?"identical":"DIFFERENT");
+  return ok;
+}
+
+template <class Fast, class Reference>
+bool check(const char* name, Fast& fast, Reference& reference, std::vector<Candidate> cands)
+{
+  std::vector<Candidate> ref_cands(cands);
+  Stopwatch fast_timer, ref_timer;
+  fast_timer.start();
+  std::vector<Candidate> fast_out = fast.distill(cands);
+  fast_timer.stop();
+  ref_timer.start();
+  std::vector<Candidate> ref_out = reference.distill(ref_cands);
+  ref_timer.stop();
+  bool ok = same(fast_out,ref_out);
+  printf("%-24s %6d -> %6d candidates, windowed %.3f s, all pairs %.3f s: %s\n",
+	 name,(int)cands.size(),(int)fast_out.size(),
+	 fast_timer.getTime(),ref_timer.getTime(),ok?"identical":"DIFFERENT");
+  return ok;
+}
+
+int main()
+{
+  srand(1);
+  std::vector<Candidate> cands = make_candidates();
+  bool ok = true;
+
+  ok &= check_index(cands);
+
+  DMDistiller dm_still(FREQ_TOL,true);
+  ReferenceDMDistiller ref_dm_still(FREQ_TOL,true);
+  ok &= check("DMDistiller",dm_still,ref_dm_still,cands);
+
+  AccelerationDistiller acc_still(TOBS,FREQ_TOL,true);
+  ReferenceAccelerationDistiller ref_acc_still(TOBS,FREQ_TOL,true);
+  ok &= check("AccelerationDistiller",acc_still,ref_acc_still,cands);
+
+  HarmonicDistiller harm_still(FREQ_TOL,MAX_HARM,true,false);
+  ReferenceHarmonicDistiller ref_harm_still(FREQ_TOL,MAX_HARM,true,false);
+  ok &= check("HarmonicDistiller",harm_still,ref_harm_still,cands);
+
+  HarmonicDistiller frac_still(FREQ_TOL,MAX_HARM,false,true);
+  ReferenceHarmonicDistiller ref_frac_still(FREQ_TOL,MAX_HARM,false,true);
+  ok &= check("HarmonicDistiller (frac)",frac_still,ref_frac_still,cands);
+
+  //all three stages on one table against nested copies between stages
+  std::vector<Candidate> ref_cands(cands);
+  Stopwatch table_timer, nested_timer;
+  table_timer.start();
+  CandidateTable table;
+  std::vector<int> rows = table.append(cands);
+  rows = acc_still.distill(table,rows);
+  rows = dm_still.distill(table,rows);
+  rows = harm_still.distill(table,rows);
+  std::vector<Candidate> table_out = table.to_candidates(rows);
+  table_timer.stop();
+  nested_timer.start();
+  std::vector<Candidate> nested_out = ref_acc_still.distill(ref_cands);
+  nested_out = ref_dm_still.distill(nested_out);
+  nested_out = ref_harm_still.distill(nested_out);
+  nested_timer.stop();
+  bool chain_ok = same(table_out,nested_out);
+  printf("%-24s %6d -> %6d candidates, table %.3f s, nested %.3f s: %s\n",
+	 "Chained",(int)cands.size(),(int)table_out.size(),
+	 table_timer.getTime(),nested_timer.getTime(),chain_ok?"identical":"DIFFERENT");
+  ok &= chain_ok;
+
+  //one row at a time, as the search finds them, against one batch
+  CandidateTable inc_table, batch_table;
+  std::vector<int> inc_rows = inc_table.append(cands);
+  std::vector<int> batch_rows = batch_table.append(cands);
+  Stopwatch inc_timer, batch_timer;
+  inc_timer.start();
+  IncrementalDMDistiller inc_still(FREQ_TOL,true);
+  for (int ii=0;ii<inc_rows.size();ii++)
+    inc_still.add(inc_table,inc_rows[ii]);
+  inc_rows = inc_still.finish(inc_table);
+  inc_timer.stop();
+  batch_timer.start();
+  batch_rows = dm_still.distill(batch_table,batch_rows);
+  batch_timer.stop();
+  bool inc_ok = same(inc_table.to_candidates(inc_rows),batch_table.to_candidates(batch_rows));
+  printf("%-24s %6d -> %6d candidates, incremental %.3f s (%d changes), batch %.3f s: %s\n",
+	 "IncrementalDMDistiller",(int)cands.size(),(int)inc_rows.size(),inc_timer.getTime(),
+	 (int)inc_still.get_nchanges(),batch_timer.getTime(),inc_ok?"identical":"DIFFERENT");
+  ok &= inc_ok;
+
+  //threaded distilling must not depend on the number of threads
+  unsigned int nthreads[] = {1,2,3,8};
+  for (int ii=0;ii<4;ii++){
+    ParallelDistiller<DMDistiller> par_dm_still(dm_still,nthreads[ii],1);
+    ParallelDistiller<AccelerationDistiller> par_acc_still(acc_still,nthreads[ii],1);
+    ParallelDistiller<HarmonicDistiller> par_harm_still(harm_still,nthreads[ii],1);
+    ParallelDistiller<HarmonicDistiller> par_frac_still(frac_still,nthreads[ii],1);
+    Stopwatch par_timer;
+    par_timer.start();
+    CandidateTable par_table;
+    std::vector<int> par_rows = par_table.append(cands);
+    par_rows = par_acc_still.distill(par_table,par_rows);
+    par_rows = par_dm_still.distill(par_table,par_rows);
+    par_rows = par_harm_still.distill(par_table,par_rows);
+    std::vector<Candidate> par_out = par_table.to_candidates(par_rows);
+    par_timer.stop();
+    bool par_ok = same(par_out,table_out) &&
+      same(par_frac_still.distill(cands),frac_still.distill(cands));
+    //harmonic windows chain the spectrum into one group, which must not become one band
+    bool split_ok = nthreads[ii]==1 ||
+      (par_dm_still.is_banded() && par_dm_still.get_nbands()>=nthreads[ii] &&
+       !par_harm_still.is_banded() && !par_frac_still.is_banded());
+    printf("Parallel (%u threads)      %6d -> %6d candidates, %d DM bands, harmonics %s, %.3f s: %s\n",
+	   nthreads[ii],(int)cands.size(),(int)par_out.size(),(int)par_dm_still.get_nbands(),
+	   par_harm_still.is_banded()?"banded":(nthreads[ii]==1?"unsplit":"related"),par_timer.getTime(),
+	   par_ok?(split_ok?"identical":"identical, SPLIT WRONG"):"DIFFERENT");
+    ok &= par_ok && split_ok;
+  }
+
+  return ok?0:1;
+}
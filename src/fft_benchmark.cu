@@ -0,0 +1,104 @@
+#include <utils/exceptions.hpp>
+#include <utils/utils.hpp>
+#include <utils/stopwatch.hpp>
+#include <transforms/ffter.hpp>
+#include <tclap/CmdLine.h>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <stdio.h>
+#include "cuda.h"
+#include "cufft.h"
+
+/*
+  Time cuFFT R2C transforms of every even 2^a.3^b.5^c.7^d length in
+  [min_size,max_size] on this GPU and write a "length seconds" table
+  for peasoup --fft_table. Each length is run once untimed so plan
+  creation and warm-up are not counted.
+*/
+int main(int argc, char **argv)
+{
+  unsigned int min_size,max_size;
+  int nloop,device;
+  std::string outfilename;
+  try
+    {
+      TCLAP::CmdLine cmd("Peasoup - benchmark transform lengths", ' ', "1.0");
+
+      TCLAP::ValueArg<unsigned int> arg_min_size("", "min_size",
+						 "Shortest transform length to time",
+						 false, 1<<20, "unsigned int", cmd);
+
+      TCLAP::ValueArg<unsigned int> arg_max_size("", "max_size",
+						 "Longest transform length to time",
+						 false, 1<<24, "unsigned int", cmd);
+
+      TCLAP::ValueArg<int> arg_nloop("n", "nloop",
+				     "Transforms to average over per length",
+				     false, 20, "int", cmd);
+
+      TCLAP::ValueArg<int> arg_device("d", "device",
+				      "GPU to benchmark",
+				      false, 0, "int", cmd);
+
+      TCLAP::ValueArg<std::string> arg_outfilename("o", "outfile",
+						   "Benchmark table output filename",
+						   false, "fft_table.txt", "string", cmd);
+
+      cmd.parse(argc, argv);
+      min_size    = arg_min_size.getValue();
+      max_size    = arg_max_size.getValue();
+      nloop       = std::max(1,arg_nloop.getValue());
+      device      = arg_device.getValue();
+      outfilename = arg_outfilename.getValue();
+
+    }catch (TCLAP::ArgException &e) {
+    std::cerr << "Error: " << e.error() << " for arg " << e.argId()
+	      << std::endl;
+    return 1;
+  }
+
+  std::vector<unsigned int> lengths;
+  for (unsigned long n7=2; n7<=max_size; n7*=7)
+    for (unsigned long n5=n7; n5<=max_size; n5*=5)
+      for (unsigned long n3=n5; n3<=max_size; n3*=3)
+	for (unsigned long n=n3; n<=max_size; n*=2)
+	  if (n>=min_size)
+	    lengths.push_back(n);
+  std::sort(lengths.begin(),lengths.end());
+  if (lengths.empty())
+    ErrorChecker::throw_error("No 7-smooth lengths between min_size and max_size");
+
+  cudaSetDevice(device);
+  ErrorChecker::check_cuda_error("Error from cudaSetDevice");
+  unsigned int largest = lengths.back();
+  float* d_tim;
+  cufftComplex* d_spec;
+  Utils::device_malloc<float>(&d_tim,largest);
+  Utils::device_malloc<cufftComplex>(&d_spec,largest/2+1);
+  cudaMemset(d_tim,0,sizeof(float)*largest);
+
+  FILE* fo = fopen(outfilename.c_str(),"w");
+  if (fo==NULL)
+    ErrorChecker::throw_error("Could not open "+outfilename);
+  fprintf(fo,"#length\tseconds (cuFFT R2C, device %d, mean of %d)\n",device,nloop);
+  for (int ii=0;ii<lengths.size();ii++){
+    CuFFTerR2C fft(lengths[ii]);
+    fft.execute(d_tim,d_spec);
+    cudaDeviceSynchronize();
+    Stopwatch timer;
+    timer.start();
+    for (int jj=0;jj<nloop;jj++)
+      fft.execute(d_tim,d_spec);
+    cudaDeviceSynchronize();
+    timer.stop();
+    ErrorChecker::check_cuda_error("Error from benchmark transform");
+    fprintf(fo,"%u\t%.9e\n",lengths[ii],timer.getTime()/nloop);
+    fflush(fo);
+  }
+  fclose(fo);
+  Utils::device_free(d_tim);
+  Utils::device_free(d_spec);
+  return 0;
+}
@@ -0,0 +1,46 @@
+#include <transforms/hostharmonicfolder.hpp>
+#include <data_types/fourierseries.hpp>
+#include <utils/stopwatch.hpp>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+
+#define NBINS 10000000
+#define BINWIDTH 0.003725290
+#define NFOLDS 8
+
+//Compare the blocked CPU harmonic sums with the direct
+//evaluation used by harmonic_sum_kernel
+int main()
+{
+  HostPowerSpectrum<float> pspec(NBINS,BINWIDTH);
+  float* input = pspec.get_data();
+  for (int ii=0;ii<NBINS;ii++)
+    input[ii] = rand()/(float)RAND_MAX;
+
+  HostHarmonicSums<float> sums(pspec,NFOLDS);
+  HostHarmonicFolder folder(sums);
+
+  Stopwatch timer;
+  timer.start();
+  for (int jj=0;jj<10;jj++)
+    folder.fold(pspec);
+  timer.stop();
+  printf("Mean fold time: %f s\n",timer.getTime()/10);
+
+  double max_error = 0;
+  for (int ii=0;ii<NBINS;ii++){
+    float val = input[ii];
+    for (int jj=1;jj<=NFOLDS;jj++){
+      int period = 1<<jj;
+      for (int k=1;k<period;k+=2)
+	val += input[(int) (ii*((double)k/period) + 0.5)];
+      double error = fabs(val/sqrt((float)period) - sums[jj-1]->get_data()[ii]);
+      if (error>max_error)
+	max_error = error;
+    }
+  }
+  printf("Max absolute error: %g\n",max_error);
+  return (max_error<1e-4)?0:1;
+}
@@ -0,0 +1,92 @@
+#include <transforms/hostresampler.hpp>
+#include <transforms/resampler.hpp>
+#include <data_types/timeseries.hpp>
+#include <utils/exceptions.hpp>
+#include <utils/utils.hpp>
+#include <utils/stopwatch.hpp>
+#include <iostream>
+#include <stdio.h>
+#include <cmath>
+#include "cuda.h"
+
+#define NBINS 4194304
+#define TSAMP 0.000064
+#define NTRIALS 7
+
+/*
+  HostTimeDomainResampler against the device resampler it replaces.
+  The nearest sample mode must match device_resampleII (no jerk) and
+  device_resampleIII sample for sample. The interpolating mode is
+  checked against a direct per-sample evaluation of the position.
+*/
+
+//Linear interpolation at the exact (clamped) position of every sample
+void reference_linear(float* input, float* output, unsigned int size,
+		      float tsamp, float acc, float jerk)
+{
+  double accel_fact = ((acc*tsamp) / (2 * HOST_RESAMPLER_SPEED_OF_LIGHT));
+  double jerk_fact = (((double)jerk*tsamp*tsamp) / (6 * HOST_RESAMPLER_SPEED_OF_LIGHT));
+  double dsize = size;
+  for (unsigned long id=0;id<size;id++){
+    double pos = id + id*accel_fact*(id-dsize) + jerk_fact*id*(id-dsize/2)*(id-dsize);
+    pos = std::min(std::max(pos,0.0),dsize-1);
+    size_t idx = std::min((size_t) pos,(size_t) size-2);
+    float frac = pos-idx;
+    output[id] = input[idx] + frac*(input[idx+1]-input[idx]);
+  }
+}
+
+int main()
+{
+  float accs[NTRIALS] = {0.0,125.5,-125.5,500.0,-500.0,37.3,-250.0};
+  float jerks[NTRIALS] = {0.0,0.0,0.0,0.0,0.5,-0.5,0.25};
+
+  HostTimeSeries<float> tim(NBINS,TSAMP);
+  for (int ii=0;ii<NBINS;ii++)
+    tim.get_data()[ii] = ii%451 + 0.001*(ii%7);
+  DeviceTimeSeries<float> d_tim(NBINS);
+  Utils::h2dcpy<float>(d_tim.get_data(),tim.get_data(),NBINS);
+  d_tim.set_tsamp(TSAMP);
+  DeviceTimeSeries<float> d_tim_r(NBINS);
+  d_tim_r.set_tsamp(TSAMP);
+
+  HostTimeSeries<float> host_out(NBINS);
+  HostTimeSeries<float> device_out(NBINS);
+  HostTimeSeries<float> ref_out(NBINS);
+  HostTimeDomainResampler host_resampler;
+  HostTimeDomainResampler linear_resampler(true);
+  TimeDomainResampler resampler;
+  bool ok = true;
+
+  for (int ii=0;ii<NTRIALS;ii++){
+    Stopwatch host_timer;
+    host_timer.start();
+    host_resampler.resample(tim,host_out,NBINS,accs[ii],jerks[ii]);
+    host_timer.stop();
+    if (jerks[ii]==0)
+      resampler.resampleII(d_tim,d_tim_r,NBINS,accs[ii]);
+    else
+      resampler.resampleIII(d_tim,d_tim_r,NBINS,accs[ii],jerks[ii]);
+    Utils::d2hcpy(device_out.get_data(),d_tim_r.get_data(),NBINS);
+    int nwrong = 0;
+    for (int jj=0;jj<NBINS;jj++)
+      if (host_out[jj]!=device_out[jj]){
+	if (nwrong<5)
+	  printf("[WRONG (%d)] %f != %f\n",jj,host_out[jj],device_out[jj]);
+	nwrong++;
+      }
+    printf("nearest acc %8.2f jerk %5.2f: %6d runs, %.4f s, %d wrong\n",
+	   accs[ii],jerks[ii],(int)host_resampler.get_nruns(),host_timer.getTime(),nwrong);
+    ok &= nwrong==0;
+
+    linear_resampler.resample(tim,host_out,NBINS,accs[ii],jerks[ii]);
+    reference_linear(tim.get_data(),ref_out.get_data(),NBINS,TSAMP,accs[ii],jerks[ii]);
+    double max_err = 0;
+    for (int jj=0;jj<NBINS;jj++)
+      max_err = std::max(max_err,(double)fabs(host_out[jj]-ref_out[jj]));
+    printf("linear  acc %8.2f jerk %5.2f: max error %g\n",accs[ii],jerks[ii],max_err);
+    ok &= max_err<0.01;
+  }
+  printf("%s\n",ok?"PASS":"FAIL");
+  return ok?0:1;
+}
@@ -0,0 +1,216 @@
+#include <utils/journal.hpp>
+#include <data_types/candidates.hpp>
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define JOURNAL_PATH "journal_test_dir/search.journal"
+#define CONFIG_HASH 12345ULL
+#define NDMS 40
+
+/*
+  SearchJournal round trips, torn tail recovery at every truncation
+  point of the last two records, checksum failures, refusal of a journal
+  from another configuration and refusal to overwrite a journal
+  without --resume.
+*/
+
+bool same(const Candidate& x, const Candidate& y)
+{
+  if (x.dm!=y.dm || x.dm_idx!=y.dm_idx || x.acc!=y.acc || x.jerk!=y.jerk ||
+      x.segment_level!=y.segment_level || x.segment!=y.segment ||
+      x.nh!=y.nh || x.snr!=y.snr || x.freq!=y.freq || x.assoc.size()!=y.assoc.size())
+    return false;
+  for (int ii=0;ii<x.assoc.size();ii++)
+    if (!same(x.assoc[ii],y.assoc[ii]))
+      return false;
+  return true;
+}
+
+bool same(const std::vector<Candidate>& x, const std::vector<Candidate>& y)
+{
+  if (x.size()!=y.size())
+    return false;
+  for (int ii=0;ii<x.size();ii++)
+    if (!same(x[ii],y[ii]))
+      return false;
+  return true;
+}
+
+std::vector<Candidate> make_candidates(int dm_idx)
+{
+  std::vector<Candidate> cands;
+  int ncands = rand()%6;
+  for (int ii=0;ii<ncands;ii++){
+    Candidate cand(dm_idx*0.5,dm_idx,rand()%100-50,rand()%5,6+rand()%20,1+rand()%1000/7.0);
+    cand.jerk = rand()%3-1;
+    cand.segment_level = rand()%2;
+    cand.segment = rand()%3;
+    for (int jj=rand()%3;jj>0;jj--)
+      cand.append(Candidate(dm_idx*0.5,dm_idx,rand()%100,1,7,cand.freq*2));
+    cands.push_back(cand);
+  }
+  return cands;
+}
+
+//Sets of a search of NDMS DMs; DMs divisible by 4 are never finished
+std::vector<CandidateSet> make_sets(void)
+{
+  std::vector<CandidateSet> sets;
+  for (int ii=0;ii<NDMS;ii++){
+    int dm_idx = (ii*7)%NDMS;
+    if (dm_idx%3==0)
+      sets.push_back(CandidateSet(dm_idx,false,make_candidates(dm_idx)));
+    if (dm_idx%4!=0)
+      sets.push_back(CandidateSet(dm_idx,true,make_candidates(dm_idx)));
+  }
+  return sets;
+}
+
+//DMs whose final set is among the first nsets sets
+std::vector<bool> finished(const std::vector<CandidateSet>& sets, size_t nsets)
+{
+  std::vector<bool> done(NDMS,false);
+  for (size_t ii=0;ii<nsets;ii++)
+    if (sets[ii].final)
+      done[sets[ii].dm_idx] = true;
+  return done;
+}
+
+//Load the journal and compare it with the first nsets sets journalled
+bool check_restore(const std::vector<CandidateSet>& sets, size_t nsets)
+{
+  SearchJournal journal(JOURNAL_PATH,CONFIG_HASH);
+  size_t ndone = journal.load();
+  std::vector<bool> done = finished(sets,nsets);
+  std::vector<Candidate> cands, expected_cands;
+  journal.restore(cands);
+  for (size_t ii=0;ii<nsets;ii++)
+    if (done[sets[ii].dm_idx])
+      expected_cands.insert(expected_cands.end(),sets[ii].cands.begin(),sets[ii].cands.end());
+  bool ok = ndone==std::count(done.begin(),done.end(),true) && same(cands,expected_cands);
+  ok &= journal.get_done(NDMS)==done;
+  return ok;
+}
+
+long file_size(const char* path)
+{
+  FILE* fp = fopen(path,"rb");
+  if (fp==NULL)
+    return -1;
+  fseek(fp,0,SEEK_END);
+  long size = ftell(fp);
+  fclose(fp);
+  return size;
+}
+
+bool throws_error(SearchJournal& journal, bool load)
+{
+  try {
+    if (load)
+      journal.load();
+    else
+      journal.open();
+  } catch (std::runtime_error& e) {
+    return true;
+  }
+  return false;
+}
+
+int main()
+{
+  srand(1);
+  std::vector<CandidateSet> sets = make_sets();
+  unlink(JOURNAL_PATH);
+  bool ok = true;
+
+  //record every set, remembering where each record ends
+  std::vector<long> ends;
+  {
+    SearchJournal journal(JOURNAL_PATH,CONFIG_HASH);
+    journal.open();
+    for (int ii=0;ii<sets.size();ii++){
+      journal.record(sets[ii]);
+      ends.push_back(file_size(JOURNAL_PATH));
+    }
+  }
+  bool round_trip = check_restore(sets,sets.size());
+  printf("%-28s %d sets, %ld bytes: %s\n","Round trip",(int)sets.size(),
+	 ends.back(),round_trip?"ok":"FAILED");
+  ok &= round_trip;
+
+  std::vector<char> full(ends.back());
+  FILE* fp = fopen(JOURNAL_PATH,"rb");
+  fread(&full[0],1,full.size(),fp);
+  fclose(fp);
+
+  //cut the journal at every byte of the last two records
+  int ncuts = 0, nbad = 0;
+  for (long cut=ends[ends.size()-3];cut<ends.back();cut++){
+    fp = fopen(JOURNAL_PATH,"wb");
+    fwrite(&full[0],1,cut,fp);
+    fclose(fp);
+    size_t nintact = 0;
+    while (nintact<ends.size() && ends[nintact]<=cut)
+      nintact++;
+    bool cut_ok = check_restore(sets,nintact);
+    //resuming drops the torn tail and the unfinished DMs, which are
+    //searched again and must append cleanly after the kept records
+    std::vector<bool> done = finished(sets,nintact);
+    std::vector<CandidateSet> resumed, rerun;
+    for (size_t ii=0;ii<sets.size();ii++)
+      if (ii<nintact && done[sets[ii].dm_idx])
+	resumed.push_back(sets[ii]);
+      else if (ii>=nintact)
+	rerun.push_back(sets[ii]);
+    for (size_t ii=0;ii<nintact;ii++)
+      if (!done[sets[ii].dm_idx])
+	rerun.push_back(sets[ii]);
+    SearchJournal journal(JOURNAL_PATH,CONFIG_HASH);
+    journal.load();
+    journal.open();
+    for (size_t ii=0;ii<rerun.size();ii++){
+      journal.record(rerun[ii]);
+      resumed.push_back(rerun[ii]);
+    }
+    journal.close();
+    cut_ok &= check_restore(resumed,resumed.size());
+    ncuts++;
+    nbad += !cut_ok;
+  }
+  printf("%-28s %d truncation points: %s\n","Torn tail recovery",ncuts,nbad==0?"ok":"FAILED");
+  ok &= nbad==0;
+
+  //a flipped byte in the last record's payload fails its checksum
+  fp = fopen(JOURNAL_PATH,"wb");
+  fwrite(&full[0],1,full.size(),fp);
+  fclose(fp);
+  fp = fopen(JOURNAL_PATH,"r+b");
+  fseek(fp,ends[ends.size()-2]+8+4,SEEK_SET);
+  int byte = fgetc(fp);
+  fseek(fp,ends[ends.size()-2]+8+4,SEEK_SET);
+  fputc(byte^0x40,fp);
+  fclose(fp);
+  bool checksum_ok = check_restore(sets,sets.size()-1);
+  printf("%-28s %s\n","Corrupt last record",checksum_ok?"ok":"FAILED");
+  ok &= checksum_ok;
+
+  //a journal from another configuration is refused
+  SearchJournal other(JOURNAL_PATH,CONFIG_HASH+1);
+  bool mismatch_ok = throws_error(other,true);
+  printf("%-28s %s\n","Config hash mismatch",mismatch_ok?"ok":"FAILED");
+  ok &= mismatch_ok;
+
+  //--checkpoint without --resume must not replace an existing journal
+  SearchJournal fresh(JOURNAL_PATH,CONFIG_HASH);
+  bool overwrite_ok = throws_error(fresh,false) && file_size(JOURNAL_PATH)==full.size();
+  printf("%-28s %s\n","Existing journal kept",overwrite_ok?"ok":"FAILED");
+  ok &= overwrite_ok;
+
+  unlink(JOURNAL_PATH);
+  rmdir("journal_test_dir");
+  return ok?0:1;
+}
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <algorithm>
 #include "cuda.h"
 #include "cufft.h"
 #include <thrust/transform.h>
@@ -15,6 +16,7 @@
 #include <thrust/copy.h>
 #include <thrust/tuple.h>
 #include <thrust/fill.h>
+#include <thrust/functional.h>
 #include <kernels/defaults.h>
 #include <kernels/kernels.h>
 #include <utils/exceptions.hpp>
@@ -207,6 +209,143 @@ void device_harmonic_sum(float* d_input_array, float** d_output_array,
   ErrorChecker::check_cuda_error("Error from device_harmonic_sum");
 }
 
+/*
+  Harmonic sum and threshold in one pass. Each fold is formed exactly
+  as in harmonic_sum_kernel ((idx*k+2^(n-1))>>n is the same bin as
+  (int)(idx*k/2^n+0.5)) but is never written out; only bins above
+  threshold inside the fold's search window are appended to a compact
+  (bin, fold, power) list. The counter keeps incrementing past
+  max_peaks so that the caller can detect overflow.
+*/
+__global__
+void harmonic_sum_peaks_kernel(float *d_idata, size_t size, unsigned nharms,
+			       float thresh, peasoup_peak_window window,
+			       int* d_bins, int* d_nh, float* d_powers,
+			       unsigned int* d_count, unsigned int max_peaks)
+{
+  for( int idx = blockIdx.x*blockDim.x + threadIdx.x ; idx < size ; idx += blockDim.x*gridDim.x )
+    {
+      float val = d_idata[idx];
+      float power = val;
+      for (unsigned level=0; level<=nharms; level++)
+	{
+	  if (level>0)
+	    {
+	      unsigned period = 1<<level;
+	      for (unsigned k=1; k<period; k+=2)
+		val += d_idata[((unsigned long long) idx*k + period/2) >> level];
+	      power = val*rsqrt((double) period);
+	    }
+	  if (power > thresh && idx >= window.start[level] && idx < window.end[level])
+	    {
+	      unsigned int pos = atomicAdd(d_count,1);
+	      if (pos < max_peaks)
+		{
+		  d_bins[pos] = idx;
+		  d_nh[pos] = level;
+		  d_powers[pos] = power;
+		}
+	    }
+	}
+    }
+}
+
+unsigned int device_harmonic_sum_peaks(float* d_input_array, size_t size,
+				       unsigned nharms, float thresh,
+				       peasoup_peak_window window,
+				       int* d_bins, int* d_nh, float* d_powers,
+				       unsigned int* d_count, unsigned int max_peaks,
+				       unsigned int max_blocks, unsigned int max_threads)
+{
+  unsigned int count;
+  unsigned blocks = size/max_threads + 1;
+  if (blocks > max_blocks)
+    blocks = max_blocks;
+  cudaMemset(d_count,0,sizeof(unsigned int));
+  harmonic_sum_peaks_kernel<<<blocks,max_threads>>>(d_input_array,size,nharms,thresh,
+						     window,d_bins,d_nh,d_powers,
+						     d_count,max_peaks);
+  ErrorChecker::check_cuda_error("Error from device_harmonic_sum_peaks");
+  cudaMemcpy(&count,d_count,sizeof(unsigned int),cudaMemcpyDeviceToHost);
+  ErrorChecker::check_cuda_error("Error from device_harmonic_sum_peaks");
+  return count;
+}
+
+/*
+  As harmonic_sum_peaks_kernel, but only at the bins of a list of
+  [start,end) ranges, each in one fold. d_ranges holds the folds of
+  the nranges ranges, then their start bins, then the nranges+1
+  running totals of their lengths; thread t works on the range r with
+  offsets[r] <= t < offsets[r+1]. Ranges of one fold must not overlap.
+*/
+__global__
+void harmonic_sum_peaks_ranges_kernel(float *d_idata, unsigned nranges,
+				      const int* d_ranges, unsigned int total,
+				      float thresh, int* d_bins, int* d_nh,
+				      float* d_powers, unsigned int* d_count,
+				      unsigned int max_peaks)
+{
+  const int* levels = d_ranges;
+  const int* starts = d_ranges + nranges;
+  const int* offsets = d_ranges + 2*nranges;
+  for( unsigned int tid = blockIdx.x*blockDim.x + threadIdx.x ; tid < total ; tid += blockDim.x*gridDim.x )
+    {
+      unsigned lo = 0;
+      unsigned hi = nranges;
+      while (hi-lo>1)
+	{
+	  unsigned mid = (lo+hi)/2;
+	  if (offsets[mid] <= tid)
+	    lo = mid;
+	  else
+	    hi = mid;
+	}
+      int idx = starts[lo] + (tid-offsets[lo]);
+      unsigned nharms = levels[lo];
+      float val = d_idata[idx];
+      for (unsigned level=1; level<=nharms; level++)
+	{
+	  unsigned period = 1<<level;
+	  for (unsigned k=1; k<period; k+=2)
+	    val += d_idata[((unsigned long long) idx*k + period/2) >> level];
+	}
+      float power = nharms>0 ? val*rsqrt((double) (1<<nharms)) : val;
+      if (power > thresh)
+	{
+	  unsigned int pos = atomicAdd(d_count,1);
+	  if (pos < max_peaks)
+	    {
+	      d_bins[pos] = idx;
+	      d_nh[pos] = nharms;
+	      d_powers[pos] = power;
+	    }
+	}
+    }
+}
+
+unsigned int device_harmonic_sum_peaks_ranges(float* d_input_array, unsigned nranges,
+					      const int* d_ranges, unsigned int total,
+					      float thresh, int* d_bins, int* d_nh,
+					      float* d_powers, unsigned int* d_count,
+					      unsigned int max_peaks,
+					      unsigned int max_blocks, unsigned int max_threads)
+{
+  unsigned int count = 0;
+  cudaMemset(d_count,0,sizeof(unsigned int));
+  if (nranges==0 || total==0)
+    return 0;
+  unsigned blocks = total/max_threads + 1;
+  if (blocks > max_blocks)
+    blocks = max_blocks;
+  harmonic_sum_peaks_ranges_kernel<<<blocks,max_threads>>>(d_input_array,nranges,d_ranges,total,
+							    thresh,d_bins,d_nh,d_powers,
+							    d_count,max_peaks);
+  ErrorChecker::check_cuda_error("Error from device_harmonic_sum_peaks_ranges");
+  cudaMemcpy(&count,d_count,sizeof(unsigned int),cudaMemcpyDeviceToHost);
+  ErrorChecker::check_cuda_error("Error from device_harmonic_sum_peaks_ranges");
+  return count;
+}
+
 //------------spectrum forming--------------//
 
 
@@ -303,6 +442,42 @@ void device_form_power_series(cufftComplex* d_array_in,
   return;
 }
 
+//As bin_interbin_series_kernel for nbatch contiguous series of nbins
+__global__ void bin_interbin_series_batch_kernel(cufftComplex *d_idata,float* d_odata, 
+						 size_t nbins, size_t size, size_t gulp_index)
+{
+  float* d_idata_float = (float*)d_idata;
+  size_t idx = blockIdx.x * blockDim.x + threadIdx.x + gulp_index;
+  float re_l =0.0;
+  float im_l =0.0;
+  if (idx>=size)
+    return;
+  if (idx%nbins != 0) {
+    re_l = d_idata_float[2*idx-2];
+    im_l = d_idata_float[2*idx-1];
+  }
+  float re = d_idata_float[2*idx];
+  float im = d_idata_float[2*idx+1];
+  float ampsq = re*re+im*im;
+  float ampsq_diff = 0.5*((re-re_l)*(re-re_l) +
+			  (im-im_l)*(im-im_l));
+  d_odata[idx] = sqrtf(fmaxf(ampsq,ampsq_diff));
+}
+
+void device_form_interbinned_batch(cufftComplex* d_array_in,
+				   float* d_array_out,
+				   size_t nbins, unsigned int nbatch,
+				   unsigned int max_blocks,
+				   unsigned int max_threads)
+{
+  size_t size = nbins*nbatch;
+  BlockCalculator calc(size,max_blocks,max_threads);
+  for (int ii=0;ii<calc.size();ii++)
+    bin_interbin_series_batch_kernel<<<calc[ii].blocks,max_threads>>>
+      (d_array_in, d_array_out, nbins, size, calc[ii].data_idx);
+  ErrorChecker::check_cuda_error("Error from device_form_interbinned_batch");
+}
+
 //-----------------time domain resampling---------------//
 
 inline __device__ unsigned long getAcceleratedIndex(double accel_fact, double size_by_2,
@@ -317,6 +492,18 @@ inline __device__ unsigned long getAcceleratedIndexII(double accel_fact, double
 }
 
 
+/*
+  As getAcceleratedIndexII plus a cubic term for a constant jerk. The
+  cubic is zero at the start, middle and end of the series, so it
+  adds no mean acceleration or frequency offset. The index is clamped
+  as the cubic term can push it past either end.
+*/
+inline __device__ unsigned long getAcceleratedIndexIII(double accel_fact, double jerk_fact,
+						       double size, unsigned long id){
+  double idx = id + id*accel_fact*(id-size) + jerk_fact*id*(id-size/2)*(id-size);
+  return __double2ull_rn(fmin(fmax(idx,0.0),size-1));
+}
+
 __global__ void resample_kernel(float* input_d,
 				float* output_d,
 				double accel_fact,
@@ -361,6 +548,105 @@ void device_resampleII(float * d_idata, float * d_odata,
   ErrorChecker::check_cuda_error("Error from device_resampleII");
 }
 
+/*
+  Resample one time series for a batch of accelerations. Each thread
+  produces the same output sample for every trial, so the reads for
+  all trials fall close together in the input series. Output row kk
+  starts at d_odata + kk*size.
+*/
+__global__ void resample_batch_kernelII(float* input_d,
+					float* output_d,
+					double* accel_facts,
+					double* jerk_facts,
+					unsigned int nbatch,
+					double size,
+					size_t stride)
+{
+  for( unsigned long idx = blockIdx.x*blockDim.x + threadIdx.x ; idx < size ; idx += blockDim.x*gridDim.x )
+    {
+      for (unsigned int kk=0; kk<nbatch; kk++)
+	{
+	  unsigned long out_idx;
+	  if (jerk_facts!=NULL && jerk_facts[kk]!=0)
+	    out_idx = getAcceleratedIndexIII(accel_facts[kk],jerk_facts[kk],size,idx);
+	  else
+	    out_idx = getAcceleratedIndexII(accel_facts[kk],size,idx);
+	  output_d[kk*stride+idx] = input_d[out_idx];
+	}
+    }
+}
+
+void device_resampleII_batch(float * d_idata, float * d_odata,
+			     size_t size, double* d_accel_facts,
+			     double* d_jerk_facts, unsigned int nbatch,
+			     unsigned int max_threads,
+			     unsigned int max_blocks)
+{
+  unsigned blocks = size/max_threads + 1;
+  if (blocks > max_blocks)
+    blocks = max_blocks;
+  resample_batch_kernelII<<< blocks,max_threads >>>(d_idata, d_odata,
+						    d_accel_facts, d_jerk_facts, nbatch,
+						    (double) size, size);
+  ErrorChecker::check_cuda_error("Error from device_resampleII_batch");
+}
+
+__global__ void resample_kernelIII(float* input_d,
+				   float* output_d,
+				   double accel_fact,
+				   double jerk_fact,
+				   double size)
+{
+  for( unsigned long idx = blockIdx.x*blockDim.x + threadIdx.x ; idx < size ; idx += blockDim.x*gridDim.x )
+  {
+    unsigned long out_idx = getAcceleratedIndexIII(accel_fact,jerk_fact,size,idx);
+    output_d[idx] = input_d[out_idx];
+  }
+}
+
+void device_resampleIII(float * d_idata, float * d_odata,
+			size_t size, float a, float j,
+			float tsamp, unsigned int max_threads,
+			unsigned int max_blocks)
+{
+  double accel_fact = ((a*tsamp) / (2 * 299792458.0));
+  double jerk_fact = (((double)j*tsamp*tsamp) / (6 * 299792458.0));
+  unsigned blocks = size/max_threads + 1;
+  if (blocks > max_blocks)
+    blocks = max_blocks;
+  resample_kernelIII<<< blocks,max_threads >>>(d_idata, d_odata,
+					       accel_fact, jerk_fact,
+					       (double) size);
+  ErrorChecker::check_cuda_error("Error from device_resampleIII");
+}
+
+//Sum each run of factor input samples into one output sample
+__global__ void tscrunch_kernel(float* input_d,
+				float* output_d,
+				unsigned int factor,
+				size_t out_size)
+{
+  for( size_t idx = blockIdx.x*blockDim.x + threadIdx.x ; idx < out_size ; idx += blockDim.x*gridDim.x )
+  {
+    float sum = 0;
+    size_t in_idx = idx*factor;
+    for (unsigned int ii=0; ii<factor; ii++)
+      sum += input_d[in_idx+ii];
+    output_d[idx] = sum;
+  }
+}
+
+void device_tscrunch(float * d_idata, float * d_odata,
+		     size_t out_size, unsigned int factor,
+		     unsigned int max_threads, unsigned int max_blocks)
+{
+  unsigned blocks = out_size/max_threads + 1;
+  if (blocks > max_blocks)
+    blocks = max_blocks;
+  tscrunch_kernel<<< blocks,max_threads >>>(d_idata, d_odata, factor, out_size);
+  ErrorChecker::check_cuda_error("Error from device_tscrunch");
+}
+
 void device_resample(float * d_idata, float * d_odata,
 		     size_t size, float a, 
 		     float tsamp, unsigned int max_threads,
@@ -389,8 +675,7 @@ struct greater_than_threshold : thrust::unary_function<thrust::tuple<int,float>,
 };
 
 int device_find_peaks(int n, int start_index, float * d_dat,
-		      float thresh, int * indexes, float * snrs,
-		      thrust::device_vector<int>& d_index, 
+		      float thresh, thrust::device_vector<int>& d_index, 
 		      thrust::device_vector<float>& d_snrs,
 		      cached_allocator& policy)
 {
@@ -398,6 +683,8 @@ int device_find_peaks(int n, int start_index, float * d_dat,
   using thrust::tuple;
   using thrust::counting_iterator;
   using thrust::zip_iterator;
+  if (n<=start_index)
+    return 0;
   // Wrap the device pointer to let Thrust know                              
   thrust::device_ptr<float> dptr_dat(d_dat + start_index);
   typedef thrust::device_vector<float>::iterator snr_iterator;
@@ -409,12 +696,171 @@ int device_find_peaks(int n, int start_index, float * d_dat,
   //apply execution policy to get some speed up
   int num_copied = thrust::copy_if(thrust::cuda::par(policy), zipped_iter, zipped_iter+n-start_index,
 				   zipped_out_iter,greater_than_threshold(thresh)) - zipped_out_iter;
+  ErrorChecker::check_cuda_error("Error from device_find_peaks;");
+  return(num_copied);
+}
+
+int device_find_peaks(int n, int start_index, float * d_dat,
+		      float thresh, int * indexes, float * snrs,
+		      thrust::device_vector<int>& d_index, 
+		      thrust::device_vector<float>& d_snrs,
+		      cached_allocator& policy)
+{
+  int num_copied = device_find_peaks(n,start_index,d_dat,thresh,d_index,d_snrs,policy);
   thrust::copy(d_index.begin(),d_index.begin()+num_copied,indexes);
   thrust::copy(d_snrs.begin(),d_snrs.begin()+num_copied,snrs);
   ErrorChecker::check_cuda_error("Error from device_find_peaks;");
   return(num_copied);
 }
 
+//Crossings per clustering chunk (raised to min_gap if that is larger)
+#define CLUSTER_CHUNK 1024
+
+/*
+  Clustering as identify_unique_peaks does, without a serial walk.
+
+  The serial walk resets its state (current maximum and its bin) at a
+  crossing that either starts a new cluster or raises the maximum, and
+  what follows a reset at crossing r depends only on r. So the walk is
+  a chain of resets, r -> next[r], where next[r] is the first later
+  crossing that is min_gap or more bins past r or brighter than r. As
+  bins are distinct, next[r] is at most min_gap crossings past r.
+
+  The crossings are cut into fixed-size chunks. The chain enters each
+  chunk at one of its first min_gap crossings, so for every chunk and
+  every possible entry the exit into the next chunk is found in
+  parallel, the true entries are then chained across the chunks, and
+  finally each chunk walks its own part of the chain in parallel.
+  A reset is a peak if the reset after it starts a new cluster.
+*/
+__global__
+void cluster_next_kernel(const int* idxs, const float* snrs, int count,
+			 int min_gap, int* next, unsigned int gulp_idx)
+{
+  int r = blockIdx.x * blockDim.x + threadIdx.x + gulp_idx;
+  if (r>=count)
+    return;
+  int ii = r+1;
+  while (ii<count && idxs[ii]-idxs[r]<min_gap && snrs[ii]<=snrs[r])
+    ii++;
+  next[r] = ii;
+}
+
+//One thread per chunk and entry, exits are stored as crossing numbers
+__global__
+void cluster_exit_kernel(const int* next, int count, int chunk, int nentries,
+			 int nexits, int* exits, unsigned int gulp_idx)
+{
+  int idx = blockIdx.x * blockDim.x + threadIdx.x + gulp_idx;
+  if (idx>=nexits)
+    return;
+  int start = (idx/nentries)*chunk;
+  int r = start + idx%nentries;
+  int end = min(start+chunk,count);
+  while (r<end)
+    r = next[r];
+  exits[idx] = min(r,count);
+}
+
+//Chains the entries across chunks, one step per chunk
+__global__
+void cluster_entry_kernel(const int* exits, int count, int chunk, int nentries,
+			  int nchunks, int* entries)
+{
+  int r = 0;
+  entries[0] = r;
+  for (int ii=1;ii<nchunks;ii++){
+    if (r<count)
+      r = exits[(ii-1)*nentries + r-(ii-1)*chunk];
+    entries[ii] = r;
+  }
+}
+
+//One thread per chunk, marks the peaks on its part of the chain
+__global__
+void cluster_mark_kernel(const int* idxs, const int* next, const int* entries,
+			 int count, int chunk, int nchunks, int min_gap,
+			 int* keep, unsigned int gulp_idx)
+{
+  int idx = blockIdx.x * blockDim.x + threadIdx.x + gulp_idx;
+  if (idx>=nchunks)
+    return;
+  int end = min((idx+1)*chunk,count);
+  int r = entries[idx];
+  while (r<end){
+    int n = next[r];
+    keep[r] = n>=count || idxs[n]-idxs[r]>=min_gap;
+    r = n;
+  }
+}
+
+int device_find_unique_peaks(int n, int start_index, float * d_dat,
+			     float thresh, int min_gap,
+			     thrust::device_vector<int>& d_index,
+			     thrust::device_vector<float>& d_snrs,
+			     thrust::device_vector<int>& d_peak_index,
+			     thrust::device_vector<float>& d_peak_snrs,
+			     thrust::device_vector<int>& d_work,
+			     cached_allocator& policy,
+			     unsigned int max_blocks,
+			     unsigned int max_threads)
+{
+  using thrust::tuple;
+  using thrust::zip_iterator;
+  int count = device_find_peaks(n,start_index,d_dat,thresh,d_index,d_snrs,policy);
+  if (count<=0)
+    return 0;
+  min_gap = std::max(min_gap,1);
+  int chunk = std::max(CLUSTER_CHUNK,min_gap);
+  int nchunks = (count-1)/chunk+1;
+  int nentries = std::min(min_gap,count);
+  int nexits = nchunks*nentries;
+  //work buffers only grow to the largest count seen
+  size_t nwork = 2*(size_t)count + nexits + nchunks;
+  if (d_peak_index.size()<count){
+    d_peak_index.resize(count);
+    d_peak_snrs.resize(count);
+  }
+  if (d_work.size()<nwork)
+    d_work.resize(nwork);
+  const int* idxs = thrust::raw_pointer_cast(d_index.data());
+  const float* snrs = thrust::raw_pointer_cast(d_snrs.data());
+  int* next = thrust::raw_pointer_cast(d_work.data());
+  int* keep = next + count;
+  int* exits = keep + count;
+  int* entries = exits + nexits;
+
+  BlockCalculator next_calc(count, max_blocks, max_threads);
+  for (int ii=0;ii<next_calc.size();ii++)
+    cluster_next_kernel<<<next_calc[ii].blocks,max_threads>>>
+      (idxs,snrs,count,min_gap,next,next_calc[ii].data_idx);
+  ErrorChecker::check_cuda_error("Error from cluster_next_kernel");
+  if (nchunks>1){
+    BlockCalculator exit_calc(nexits, max_blocks, max_threads);
+    for (int ii=0;ii<exit_calc.size();ii++)
+      cluster_exit_kernel<<<exit_calc[ii].blocks,max_threads>>>
+	(next,count,chunk,nentries,nexits,exits,exit_calc[ii].data_idx);
+    ErrorChecker::check_cuda_error("Error from cluster_exit_kernel");
+  }
+  cluster_entry_kernel<<<1,1>>>(exits,count,chunk,nentries,nchunks,entries);
+  ErrorChecker::check_cuda_error("Error from cluster_entry_kernel");
+  thrust::fill(thrust::cuda::par(policy),d_work.begin()+count,d_work.begin()+2*count,0);
+  BlockCalculator mark_calc(nchunks, max_blocks, max_threads);
+  for (int ii=0;ii<mark_calc.size();ii++)
+    cluster_mark_kernel<<<mark_calc[ii].blocks,max_threads>>>
+      (idxs,next,entries,count,chunk,nchunks,min_gap,keep,mark_calc[ii].data_idx);
+  ErrorChecker::check_cuda_error("Error from cluster_mark_kernel");
+
+  typedef thrust::device_vector<float>::iterator snr_iterator;
+  typedef thrust::device_vector<int>::iterator indices_iterator;
+  zip_iterator<tuple<indices_iterator,snr_iterator> > zipped_iter = make_zip_iterator(make_tuple(d_index.begin(),d_snrs.begin()));
+  zip_iterator<tuple<indices_iterator,snr_iterator> > peaks_iter = make_zip_iterator(make_tuple(d_peak_index.begin(),d_peak_snrs.begin()));
+  int npeaks = thrust::copy_if(thrust::cuda::par(policy), zipped_iter, zipped_iter+count,
+			       d_work.begin()+count, peaks_iter, thrust::identity<int>()) - peaks_iter;
+  ErrorChecker::check_cuda_error("Error from device_find_unique_peaks");
+  return npeaks;
+}
+
 //------------------rednoise----------------//
 
 template<typename T>
@@ -1138,6 +1584,99 @@ void device_cuCmulf_inplace(cufftComplex* x, cufftComplex* y,
   return;
 }
 
+//--------Fourier domain acceleration search--------//
+
+__global__ void fdas_segment_kernel(cufftComplex* fseries, cufftComplex* segments,
+				    unsigned int nbins, unsigned int seglen,
+				    unsigned int step, unsigned int offset,
+				    unsigned int size, unsigned int gulp_idx)
+{
+  int idx = blockIdx.x * blockDim.x + threadIdx.x + gulp_idx;
+  if (idx>=size)
+    return;
+  int src = (idx/seglen)*step + idx%seglen - offset;
+  if (src>=0 && src<nbins)
+    segments[idx] = fseries[src];
+  else
+    segments[idx] = make_cuComplex(0.0,0.0);
+}
+
+void device_fdas_segment(cufftComplex* fseries, cufftComplex* segments,
+			 unsigned int nbins, unsigned int seglen,
+			 unsigned int step, unsigned int offset,
+			 unsigned int nsegs, unsigned int max_blocks,
+			 unsigned int max_threads)
+{
+  unsigned int size = nsegs*seglen;
+  BlockCalculator calc(size, max_blocks, max_threads);
+  for (int ii=0;ii<calc.size();ii++)
+    fdas_segment_kernel<<<calc[ii].blocks,max_threads>>>
+      (fseries,segments,nbins,seglen,step,offset,size,calc[ii].data_idx);
+  ErrorChecker::check_cuda_error("Error from device_fdas_segment");
+}
+
+__global__ void fdas_multiply_kernel(cufftComplex* segments, cufftComplex* kernel,
+				     cufftComplex* output, unsigned int seglen,
+				     unsigned int size, unsigned int gulp_idx)
+{
+  int idx = blockIdx.x * blockDim.x + threadIdx.x + gulp_idx;
+  if (idx<size)
+    output[idx] = cuCmulf(segments[idx],kernel[idx%seglen]);
+}
+
+void device_fdas_multiply(cufftComplex* segments, cufftComplex* kernel,
+			  cufftComplex* output, unsigned int seglen,
+			  unsigned int nsegs, unsigned int max_blocks,
+			  unsigned int max_threads)
+{
+  unsigned int size = nsegs*seglen;
+  BlockCalculator calc(size, max_blocks, max_threads);
+  for (int ii=0;ii<calc.size();ii++)
+    fdas_multiply_kernel<<<calc[ii].blocks,max_threads>>>
+      (segments,kernel,output,seglen,size,calc[ii].data_idx);
+  ErrorChecker::check_cuda_error("Error from device_fdas_multiply");
+}
+
+//Discards the wrapped edges of each segment and forms the
+//interbinned amplitude spectrum (as bin_interbin_series_kernel)
+__global__ void fdas_extract_kernel(cufftComplex* segments, float* output,
+				    unsigned int nbins, unsigned int seglen,
+				    unsigned int step, unsigned int offset,
+				    float scale, unsigned int gulp_idx)
+{
+  int idx = blockIdx.x * blockDim.x + threadIdx.x + gulp_idx;
+  if (idx>=nbins)
+    return;
+  int in_idx = (idx/step)*seglen + idx%step + offset;
+  cufftComplex x = segments[in_idx];
+  float re = x.x*scale;
+  float im = x.y*scale;
+  float re_l = 0.0;
+  float im_l = 0.0;
+  if (idx>0){
+    cufftComplex y = segments[in_idx-1];
+    re_l = y.x*scale;
+    im_l = y.y*scale;
+  }
+  float ampsq = re*re+im*im;
+  float ampsq_diff = 0.5*((re-re_l)*(re-re_l) +
+			  (im-im_l)*(im-im_l));
+  output[idx] = sqrtf(fmaxf(ampsq,ampsq_diff));
+}
+
+void device_fdas_extract(cufftComplex* segments, float* output,
+			 unsigned int nbins, unsigned int seglen,
+			 unsigned int step, unsigned int offset,
+			 float scale, unsigned int max_blocks,
+			 unsigned int max_threads)
+{
+  BlockCalculator calc(nbins, max_blocks, max_threads);
+  for (int ii=0;ii<calc.size();ii++)
+    fdas_extract_kernel<<<calc[ii].blocks,max_threads>>>
+      (segments,output,nbins,seglen,step,offset,scale,calc[ii].data_idx);
+  ErrorChecker::check_cuda_error("Error from device_fdas_extract");
+}
+
 //--------type converter--------//
 //This is to get around the stupid thrust copy issue
 
@@ -0,0 +1,123 @@
+#include <transforms/knownsources.hpp>
+#include <data_types/candidates.hpp>
+#include <utils/stopwatch.hpp>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <cmath>
+
+#define NSOURCES 3000
+#define NCANDS 6000
+#define MAX_HARM 16
+#define CATALOGUE_PATH "known_sources_test.cat"
+
+/*
+  KnownSourceMatcher against a scan of every harmonic and subharmonic
+  of every source, with the same preference: lowest harmonic order,
+  then closest frequency, then first source in the catalogue.
+*/
+int reference_match(const std::vector<KnownSource>& sources, const Candidate& cand)
+{
+  int best = -1;
+  int best_order = 0;
+  double best_offset = 0;
+  for (int ii=0;ii<sources.size();ii++){
+    const KnownSource& source = sources[ii];
+    double freq = 1.0/source.period;
+    for (int hh=1;hh<=MAX_HARM;hh++)
+      for (int sub=0;sub<2;sub++){
+	if (sub && hh==1)
+	  continue;
+	double ratio = cand.freq/(sub ? freq/hh : freq*hh);
+	if (!(ratio>1-source.tolerance && ratio<1+source.tolerance))
+	  continue;
+	if (source.dm_tol>0 && fabs(cand.dm-source.dm)>source.dm_tol)
+	  continue;
+	double offset = fabs(ratio-1);
+	if (best<0 || hh<best_order ||
+	    (hh==best_order && (offset<best_offset || (offset==best_offset && ii<best)))){
+	  best = ii;
+	  best_order = hh;
+	  best_offset = offset;
+	}
+      }
+  }
+  return best;
+}
+
+int main()
+{
+  srand(5);
+  bool ok = true;
+
+  //sources of mixed tolerance, every fifth matching at any DM as RFI would
+  std::vector<KnownSource> sources;
+  FILE* fo = fopen(CATALOGUE_PATH,"w");
+  fprintf(fo,"# name period dm tolerance [dm_tol]\n\n");
+  for (int ii=0;ii<NSOURCES;ii++){
+    char name[16],period[32];
+    sprintf(name,"SRC%d",ii);
+    sprintf(period,"%.12f",0.0015+5*pow(rand()/(double)RAND_MAX,2));
+    sources.push_back(KnownSource(name,atof(period),rand()%500,ii%7==0 ? 2e-4 : 1e-4,
+				  ii%5==0 ? 0 : 20));
+    fprintf(fo,"%s %s %g %g",name,period,sources[ii].dm,sources[ii].tolerance);
+    if (sources[ii].dm_tol>0)
+      fprintf(fo," %g",sources[ii].dm_tol);
+    fprintf(fo,"\n");
+  }
+  fclose(fo);
+  KnownSourceMatcher matcher(MAX_HARM);
+  matcher.read_catalogue(CATALOGUE_PATH);
+  unlink(CATALOGUE_PATH);
+  matcher.prepare();
+  bool read_ok = matcher.get_nsources()==NSOURCES &&
+    matcher.get_nwindows()==NSOURCES*(2*MAX_HARM-1) && matcher.get_names()[NSOURCES-1]=="SRC2999";
+  printf("%-28s %d sources, %d windows: %s\n","Catalogue",(int)matcher.get_nsources(),
+	 (int)matcher.get_nwindows(),read_ok?"ok":"FAILED");
+  ok &= read_ok;
+
+  //a third of the candidates near a harmonic or subharmonic of a source
+  std::vector<Candidate> cands;
+  for (int ii=0;ii<NCANDS;ii++){
+    double freq = 0.2+1000*rand()/(double)RAND_MAX;
+    if (ii%3==0){
+      const KnownSource& source = sources[rand()%NSOURCES];
+      int hh = 1+rand()%MAX_HARM;
+      freq = (rand()%2 ? hh/source.period : 1/(hh*source.period))*
+	(1+1.5e-4*(rand()/(double)RAND_MAX-0.5));
+    }
+    cands.push_back(Candidate(rand()%500,0,0,0,10+ii*0.001,freq));
+  }
+
+  Stopwatch timer, ref_timer;
+  timer.start();
+  std::vector<Candidate> tagged(cands);
+  size_t ntagged = matcher.tag(tagged);
+  timer.stop();
+  ref_timer.start();
+  int nwrong = 0;
+  size_t nexpected = 0;
+  for (int ii=0;ii<cands.size();ii++){
+    int expected = reference_match(sources,cands[ii]);
+    nwrong += tagged[ii].known_source!=expected;
+    nexpected += expected>=0;
+  }
+  ref_timer.stop();
+  bool tag_ok = nwrong==0 && ntagged==nexpected;
+  printf("%-28s %d candidates, %d matched, sorted %.3f s, scan %.3f s, %d wrong: %s\n","Matching",
+	 (int)cands.size(),(int)ntagged,timer.getTime(),ref_timer.getTime(),nwrong,tag_ok?"ok":"FAILED");
+  ok &= tag_ok;
+
+  //remove() keeps the unmatched candidates in order
+  std::vector<Candidate> kept(cands);
+  size_t nremoved = matcher.remove(kept);
+  bool remove_ok = nremoved==ntagged && kept.size()==cands.size()-ntagged;
+  for (int ii=0,jj=0;ii<tagged.size() && remove_ok;ii++)
+    if (tagged[ii].known_source<0)
+      remove_ok &= jj<kept.size() && kept[jj++].snr==tagged[ii].snr;
+  printf("%-28s %d removed: %s\n","Removal",(int)nremoved,remove_ok?"ok":"FAILED");
+  ok &= remove_ok;
+
+  return ok?0:1;
+}
@@ -0,0 +1,99 @@
+#include <transforms/peakextractor.hpp>
+#include <utils/exceptions.hpp>
+#include <utils/utils.hpp>
+#include <utils/stopwatch.hpp>
+#include <thrust/device_vector.h>
+#include <kernels/kernels.h>
+#include <kernels/defaults.h>
+#include <vector>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include "cuda.h"
+
+#define NBINS 1048576
+#define START_BIN 100
+#define THRESHOLD 6.0f
+
+/*
+  device_find_unique_peaks against identify_unique_peaks on a spectrum
+  dominated by one long run of crossings, as a band of RFI gives: a
+  noisy stretch, a falling and a rising ramp (whose clusters depend on
+  where the run began) and stretches of equal S/N, followed by
+  isolated peaks.
+*/
+std::vector<float> make_spectrum(void)
+{
+  std::vector<float> spectrum(NBINS);
+  for (int ii=0;ii<NBINS;ii++)
+    spectrum[ii] = rand()%500/100.0;
+  int bin = 1000;
+  for (int ii=0;ii<60000;ii++,bin++)
+    spectrum[bin] = THRESHOLD+0.5+rand()%1000/10.0;
+  for (int ii=0;ii<20000;ii++,bin++)
+    spectrum[bin] = THRESHOLD+0.5+(20000-ii)*0.01;
+  for (int ii=0;ii<20000;ii++,bin++)
+    spectrum[bin] = THRESHOLD+0.5+ii*0.01;
+  for (int ii=0;ii<20000;ii++,bin++)
+    spectrum[bin] = THRESHOLD+1+(ii/37)%3;
+  for (bin+=50;bin<NBINS;bin+=1+rand()%200)
+    spectrum[bin] = THRESHOLD+0.5+rand()%1000/10.0;
+  return spectrum;
+}
+
+int main()
+{
+  srand(9);
+  std::vector<float> spectrum = make_spectrum();
+  float* d_spectrum;
+  Utils::device_malloc<float>(&d_spectrum,NBINS);
+  Utils::h2dcpy<float>(d_spectrum,&spectrum[0],NBINS);
+
+  std::vector<int> idxs;
+  std::vector<float> snrs;
+  for (int ii=START_BIN;ii<NBINS;ii++)
+    if (spectrum[ii]>THRESHOLD){
+      idxs.push_back(ii);
+      snrs.push_back(spectrum[ii]);
+    }
+
+  thrust::device_vector<int> d_idxs;
+  thrust::device_vector<float> d_snrs;
+  d_idxs.resize(NBINS);
+  d_snrs.resize(NBINS);
+  thrust::device_vector<int> d_peak_idxs;
+  thrust::device_vector<float> d_peak_snrs;
+  thrust::device_vector<int> d_work;
+  cached_allocator allocator;
+  bool ok = true;
+  int min_gaps[] = {1,30,700,5000};
+  for (int ii=0;ii<4;ii++){
+    std::vector<int> expected_idxs(idxs.size());
+    std::vector<float> expected_snrs(idxs.size());
+    int nexpected = identify_unique_peaks(&idxs[0],&snrs[0],idxs.size(),min_gaps[ii],
+					  &expected_idxs[0],&expected_snrs[0]);
+    Stopwatch timer;
+    timer.start();
+    int npeaks = device_find_unique_peaks(NBINS,START_BIN,d_spectrum,THRESHOLD,min_gaps[ii],
+					  d_idxs,d_snrs,d_peak_idxs,d_peak_snrs,d_work,
+					  allocator,MAX_BLOCKS,MAX_THREADS);
+    cudaDeviceSynchronize();
+    timer.stop();
+    int nwrong = 0;
+    if (npeaks==nexpected && npeaks>0){
+      std::vector<int> peak_idxs(npeaks);
+      std::vector<float> peak_snrs(npeaks);
+      Utils::d2hcpy<int>(&peak_idxs[0],thrust::raw_pointer_cast(d_peak_idxs.data()),npeaks);
+      Utils::d2hcpy<float>(&peak_snrs[0],thrust::raw_pointer_cast(d_peak_snrs.data()),npeaks);
+      for (int jj=0;jj<npeaks;jj++)
+	nwrong += peak_idxs[jj]!=expected_idxs[jj] || peak_snrs[jj]!=expected_snrs[jj];
+    }
+    bool gap_ok = npeaks==nexpected && nwrong==0;
+    printf("min_gap %-5d %d crossings, %d peaks (%d expected), %d wrong, %.4f s: %s\n",
+	   min_gaps[ii],(int)idxs.size(),npeaks,nexpected,nwrong,timer.getTime(),
+	   gap_ok?"ok":"FAILED");
+    ok &= gap_ok;
+  }
+  Utils::device_free(d_spectrum);
+  return ok?0:1;
+}
@@ -0,0 +1,209 @@
+#include <transforms/beamcoincidencer.hpp>
+#include <utils/columnar.hpp>
+#include <utils/exceptions.hpp>
+#include <utils/stopwatch.hpp>
+#include <tclap/CmdLine.h>
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <cmath>
+
+struct CoincideCmdLineOptions {
+  std::vector<std::string> beams;
+  std::string outfilename;
+  std::string birdiefilename;
+  std::string positionsfilename;
+  float beam_sep;
+  int beam_threshold;
+  float min_snr;
+  int max_harm;
+  int max_denom;
+  float freq_tol;
+  float dm_tol;
+  int num_threads;
+  bool verbose;
+};
+
+//Beam outputs are given as search output directories or candidates.pcol files
+std::string columnar_path(std::string beam)
+{
+  std::string ext = ".pcol";
+  if (beam.size()>=ext.size() && beam.compare(beam.size()-ext.size(),ext.size(),ext)==0)
+    return beam;
+  return beam+"/candidates.pcol";
+}
+
+//One "ra dec" line in degrees per beam, in the order the beams are given
+void read_positions(std::string filename, std::vector<double>& ra, std::vector<double>& dec)
+{
+  std::ifstream infile(filename.c_str());
+  ErrorChecker::check_file_error(infile,filename);
+  std::string line;
+  while (std::getline(infile,line)){
+    if (line.empty() || line[0]=='#')
+      continue;
+    std::stringstream fields(line);
+    double beam_ra,beam_dec;
+    if (!(fields >> beam_ra >> beam_dec))
+      ErrorChecker::throw_error("Bad line in "+filename+": "+line);
+    ra.push_back(beam_ra);
+    dec.push_back(beam_dec);
+  }
+}
+
+/*
+  Coincidence the candidates of many beams after the search.
+
+  Candidates seen in beam_thresh or more beams, at any harmonic
+  ratio, are flagged as multi-beam RFI and their frequencies written
+  as a birdie list that can be given to peasoup with --zapfile. The
+  rest are grouped with matching detections in adjacent beams.
+*/
+int main(int argc, char **argv)
+{
+  CoincideCmdLineOptions args;
+  try
+    {
+      TCLAP::CmdLine cmd("Peasoup - coincidence candidates across beams", ' ', "1.0");
+
+      TCLAP::UnlabeledMultiArg<std::string> arg_beams("beams","Search output directories or candidates.pcol files",
+						      true, "string", cmd);
+
+      TCLAP::ValueArg<std::string> arg_outfilename("o", "outfile",
+						   "Candidate coincidence output filename",
+						   false, "coincidences.txt", "string", cmd);
+
+      TCLAP::ValueArg<std::string> arg_birdiefilename("", "birdie_file",
+						      "Multi-beam birdie list output filename",
+						      false, "multibeam_birdies.txt", "string", cmd);
+
+      TCLAP::ValueArg<std::string> arg_positionsfilename("", "positions",
+							 "Beam positions, one 'ra dec' line in degrees per beam",
+							 false, "", "string", cmd);
+
+      TCLAP::ValueArg<float> arg_beam_sep("", "beam_sep",
+					  "Largest separation of adjacent beams in degrees",
+					  false, 0.1, "float", cmd);
+
+      TCLAP::ValueArg<int> arg_beam_threshold("", "beam_thresh",
+					      "The number of beams a candidate must appear in to be considered multibeam",
+					      false, 4, "int", cmd);
+
+      TCLAP::ValueArg<float> arg_min_snr("m", "min_snr",
+					 "Lowest S/N of candidates to coincidence",
+					 false, 0.0, "float", cmd);
+
+      TCLAP::ValueArg<int> arg_max_harm("b", "max_harm",
+					"Maximum harmonic for related candidates",
+					false, 16, "int", cmd);
+
+      TCLAP::ValueArg<int> arg_max_denom("", "max_denom",
+					 "Maximum harmonic denominator (1 for integer harmonics only)",
+					 false, 1, "int", cmd);
+
+      TCLAP::ValueArg<float> arg_freq_tol("f", "freq_tol",
+                                          "Tolerance for matching frequencies (0.0001 = 0.01%)",
+                                          false, 0.0001, "float", cmd);
+
+      TCLAP::ValueArg<float> arg_dm_tol("", "dm_tol",
+					"Largest DM difference for grouping detections (0 = any)",
+					false, 0.0, "float", cmd);
+
+      TCLAP::ValueArg<int> arg_num_threads("t", "num_threads",
+					   "Threads for matching (0 = one per core)",
+					   false, 0, "int", cmd);
+
+      TCLAP::SwitchArg arg_verbose("v", "verbose", "verbose mode", cmd);
+
+      cmd.parse(argc, argv);
+      args.beams             = arg_beams.getValue();
+      args.outfilename       = arg_outfilename.getValue();
+      args.birdiefilename    = arg_birdiefilename.getValue();
+      args.positionsfilename = arg_positionsfilename.getValue();
+      args.beam_sep          = arg_beam_sep.getValue();
+      args.beam_threshold    = arg_beam_threshold.getValue();
+      args.min_snr           = arg_min_snr.getValue();
+      args.max_harm          = arg_max_harm.getValue();
+      args.max_denom         = arg_max_denom.getValue();
+      args.freq_tol          = arg_freq_tol.getValue();
+      args.dm_tol            = arg_dm_tol.getValue();
+      args.num_threads       = arg_num_threads.getValue();
+      args.verbose           = arg_verbose.getValue();
+
+    }catch (TCLAP::ArgException &e) {
+    std::cerr << "Error: " << e.error() << " for arg " << e.argId()
+	      << std::endl;
+    return 1;
+  }
+
+  Stopwatch timer;
+  timer.start();
+  int nbeams = args.beams.size();
+  BeamCandidateTable table;
+  for (int ii=0;ii<nbeams;ii++){
+    ColumnarCandidateFile beam(columnar_path(args.beams[ii]));
+    const float* freq = beam.get_column<float>("freq");
+    const float* snr = beam.get_column<float>("snr");
+    const float* dm = beam.get_column<float>("dm");
+    const float* acc = beam.get_column<float>("acc");
+    for (int jj=0;jj<beam.size();jj++)
+      if (snr[jj]>=args.min_snr)
+	table.add(ii,jj,freq[jj],snr[jj],dm[jj],acc[jj]);
+  }
+  if (args.verbose)
+    std::cout << "Read " << table.size() << " candidates from " << nbeams << " beams" << std::endl;
+
+  BeamCoincidencer coincidencer(args.freq_tol,args.max_harm,args.max_denom,args.beam_threshold,
+				args.dm_tol,std::max(0,args.num_threads));
+  if (args.positionsfilename!=""){
+    std::vector<double> ra,dec;
+    read_positions(args.positionsfilename,ra,dec);
+    if (ra.size()!=nbeams)
+      ErrorChecker::throw_error("Need one position per beam in "+args.positionsfilename);
+    coincidencer.set_positions(ra,dec,args.beam_sep);
+  }
+  if (args.verbose)
+    std::cout << "Matching at " << coincidencer.get_nratios() << " harmonic ratios on "
+	      << coincidencer.get_nthreads() << " threads" << std::endl;
+  coincidencer.match(table,nbeams);
+  timer.stop();
+  if (args.verbose)
+    std::cout << "Flagged " << coincidencer.get_nrfi() << " multi-beam candidates and found "
+	      << coincidencer.get_ngroups() << " groups in " << timer.getTime() << " s" << std::endl;
+
+  FILE* fo = fopen(args.outfilename.c_str(),"w");
+  if (fo==NULL)
+    ErrorChecker::throw_error("Could not open "+args.outfilename);
+  for (int ii=0;ii<nbeams;ii++)
+    fprintf(fo,"#beam %d: %s\n",ii,args.beams[ii].c_str());
+  fprintf(fo,"#beam\tcand\tfreq\tdm\tacc\tsnr\tnbeams\trfi\tgroup\tgroup_nbeams\n");
+  for (int ii=0;ii<table.size();ii++){
+    int group = coincidencer.group[ii];
+    fprintf(fo,"%d\t%d\t%.9f\t%.3f\t%.3f\t%.2f\t%d\t%d\t%d\t%d\n",
+	    table.beam[ii],table.idx[ii],table.freq[ii],table.dm[ii],table.acc[ii],table.snr[ii],
+	    coincidencer.nbeams_matched[ii],(int)coincidencer.is_rfi[ii],group,
+	    group<0 ? 1 : coincidencer.group_nbeams[group]);
+  }
+  fclose(fo);
+
+  //merge overlapping tolerance windows of the RFI frequencies into birdies
+  std::vector<double> rfi_freqs;
+  for (int ii=0;ii<table.size();ii++)
+    if (coincidencer.is_rfi[ii] && table.freq[ii]>0)
+      rfi_freqs.push_back(table.freq[ii]);
+  std::sort(rfi_freqs.begin(),rfi_freqs.end());
+  fo = fopen(args.birdiefilename.c_str(),"w");
+  if (fo==NULL)
+    ErrorChecker::throw_error("Could not open "+args.birdiefilename);
+  for (int ii=0;ii<rfi_freqs.size();){
+    double low = rfi_freqs[ii]*(1-args.freq_tol);
+    double high = rfi_freqs[ii]*(1+args.freq_tol);
+    for (ii++;ii<rfi_freqs.size() && rfi_freqs[ii]*(1-args.freq_tol)<=high;ii++)
+      high = rfi_freqs[ii]*(1+args.freq_tol);
+    fprintf(fo,"%.9f\t%.6f\n",(low+high)/2,(high-low)/2);
+  }
+  fclose(fo);
+  return 0;
+}
@@ -0,0 +1,241 @@
+#include <data_types/candidates.hpp>
+#include <data_types/candidatetable.hpp>
+#include <data_types/filterbank.hpp>
+#include <transforms/dedisperser.hpp>
+#include <transforms/folder.hpp>
+#include <transforms/distiller.hpp>
+#include <transforms/scorer.hpp>
+#include <transforms/knownsources.hpp>
+#include <utils/exceptions.hpp>
+#include <utils/utils.hpp>
+#include <utils/stopwatch.hpp>
+#include <utils/output_stats.hpp>
+#include <utils/shard.hpp>
+#include <tclap/CmdLine.h>
+#include <string>
+#include <iostream>
+#include <stdio.h>
+#include <cmath>
+#include <map>
+
+struct MergeCmdLineOptions {
+  std::vector<std::string> shard_files;
+  std::string infilename;
+  std::string outdir;
+  std::string killfilename;
+  std::string known_sources;
+  int max_num_threads;
+  int distill_threads;
+  int npdmp;
+  int limit;
+  bool remove_known;
+  bool verbose;
+  bool progress_bar;
+};
+
+/*
+  Merge the shard files of a search run with --shard i/N.
+
+  All N shards must be present and come from the same search. The
+  distilling tolerances are those recorded in the shards. The
+  candidates of every shard are DM distilled, harmonic distilled and
+  scored together exactly as a single peasoup process would, and the
+  top candidates are folded after re-dedispersing only the DM trials
+  they were found at.
+*/
+int main(int argc, char **argv)
+{
+  std::map<std::string,Stopwatch> timers;
+  timers["merging"]      = Stopwatch();
+  timers["dedispersion"] = Stopwatch();
+  timers["folding"]      = Stopwatch();
+  timers["total"]        = Stopwatch();
+  timers["total"].start();
+
+  MergeCmdLineOptions args;
+  try
+    {
+      TCLAP::CmdLine cmd("Peasoup - merge the shards of a DM sharded search", ' ', "1.0");
+
+      TCLAP::UnlabeledMultiArg<std::string> arg_shard_files("shards","Shard files (shard_i_of_N.cands)",
+							    true, "string", cmd);
+
+      TCLAP::ValueArg<std::string> arg_infilename("i", "inputfile",
+                                                  "File that was searched (.fil)",
+                                                  true, "", "string", cmd);
+
+      TCLAP::ValueArg<std::string> arg_outdir("o", "outdir",
+                                              "The output directory",
+                                              false, "./", "string",cmd);
+
+      TCLAP::ValueArg<std::string> arg_killfilename("k", "killfile",
+                                                    "Channel mask file used by the search",
+                                                    false, "", "string",cmd);
+
+      TCLAP::ValueArg<int> arg_max_num_threads("t", "num_threads",
+                                               "The number of GPUs to dedisperse with",
+                                               false, 14, "int", cmd);
+
+      TCLAP::ValueArg<int> arg_distill_threads("", "distill_threads",
+                                               "Threads for distilling and scoring (0 = one per core)",
+                                               false, 0, "int", cmd);
+
+      TCLAP::ValueArg<int> arg_npdmp("n", "npdmp",
+                                     "Number of candidates to fold and pdmp",
+                                     false, 0, "int", cmd);
+
+      TCLAP::ValueArg<int> arg_limit("l", "limit",
+                                     "upper limit on number of candidates to write out",
+                                     false, 1000, "int", cmd);
+
+      TCLAP::ValueArg<std::string> arg_known_sources("", "known_sources",
+                                                     "Catalogue of known pulsars and periodic RFI to tag candidates with",
+                                                     false, "", "string", cmd);
+
+      TCLAP::SwitchArg arg_remove_known("", "remove_known",
+                                        "Drop candidates matching --known_sources before folding", cmd);
+
+      TCLAP::SwitchArg arg_verbose("v", "verbose", "verbose mode", cmd);
+
+      TCLAP::SwitchArg arg_progress_bar("p", "progress_bar", "Enable progress bar for folding", cmd);
+
+      cmd.parse(argc, argv);
+      args.shard_files       = arg_shard_files.getValue();
+      args.infilename        = arg_infilename.getValue();
+      args.outdir            = arg_outdir.getValue();
+      args.killfilename      = arg_killfilename.getValue();
+      args.max_num_threads   = arg_max_num_threads.getValue();
+      args.distill_threads   = arg_distill_threads.getValue();
+      args.npdmp             = arg_npdmp.getValue();
+      args.limit             = arg_limit.getValue();
+      args.known_sources     = arg_known_sources.getValue();
+      args.remove_known      = arg_remove_known.getValue();
+      args.verbose           = arg_verbose.getValue();
+      args.progress_bar      = arg_progress_bar.getValue();
+
+    }catch (TCLAP::ArgException &e) {
+    std::cerr << "Error: " << e.error() << " for arg " << e.argId()
+              << std::endl;
+    return 1;
+  }
+
+  timers["merging"].start();
+  std::vector<ShardFile> shards(args.shard_files.size());
+  for (int ii=0;ii<shards.size();ii++){
+    if (args.verbose)
+      std::cout << "Reading " << args.shard_files[ii] << std::endl;
+    shards[ii].read(args.shard_files[ii]);
+  }
+  CandidateTable cand_table;
+  std::vector<int> cand_rows = merge_shards(shards,args.shard_files,cand_table);
+  int nshards = shards[0].shard.count;
+  std::vector<float>& dm_list = shards[0].dm_list;
+  if (args.verbose)
+    std::cout << "Merged " << cand_rows.size() << " candidates from "
+	      << nshards << " shards" << std::endl;
+
+  SigprocFilterbank filobj(args.infilename);
+
+  //distill with the tolerances the shards were searched with
+  float freq_tol = shards[0].freq_tol;
+  int max_harm = shards[0].max_harm;
+  unsigned int distill_threads = std::max(0,args.distill_threads);
+  ParallelDistiller<DMDistiller> dm_still(DMDistiller(freq_tol,true),distill_threads);
+  ParallelDistiller<HarmonicDistiller> harm_still(HarmonicDistiller(freq_tol,max_harm,true,false),
+						  distill_threads);
+  if (args.verbose)
+    std::cout << "Distilling DMs on " << dm_still.get_nthreads() << " threads" << std::endl;
+  cand_rows = dm_still.distill(cand_table,cand_rows);
+  cand_rows = harm_still.distill(cand_table,cand_rows);
+  CandidateCollection dm_cands;
+  dm_cands.cands = cand_table.to_candidates(cand_rows);
+
+  float bw = fabs(filobj.get_foff())*filobj.get_nchans();
+  CandidateScorer cand_scorer(filobj.get_tsamp(),filobj.get_cfreq(), filobj.get_foff(),
+			      bw,distill_threads);
+  DMCurveWidth dm_curve_width(filobj.get_cfreq(),bw);
+  AccelerationSpread acc_spread;
+  cand_scorer.add_feature(&dm_curve_width);
+  cand_scorer.add_feature(&acc_spread);
+  cand_scorer.score_all(dm_cands.cands,cand_table,cand_rows);
+
+  KnownSourceMatcher known_sources(max_harm);
+  if (args.known_sources!=""){
+    known_sources.read_catalogue(args.known_sources);
+    known_sources.prepare();
+    size_t nknown = args.remove_known ? known_sources.remove(dm_cands.cands)
+      : known_sources.tag(dm_cands.cands);
+    if (args.verbose)
+      std::cout << (args.remove_known ? "Removed " : "Tagged ") << nknown
+		<< " candidates matching " << known_sources.get_nsources() << " known sources" << std::endl;
+  }
+  timers["merging"].stop();
+
+  std::vector<int> device_idxs;
+  int npdmp = std::min(args.npdmp,(int) dm_cands.cands.size());
+  if (npdmp>0){
+    //dedisperse just the DM trials of the candidates to fold
+    int ngpus = std::max(1,std::min(Utils::gpu_count(),args.max_num_threads));
+    for (int ii=0;ii<ngpus;ii++)
+      device_idxs.push_back(ii);
+    std::map<int,int> local_idx;
+    std::vector<float> fold_dms;
+    for (int ii=0;ii<npdmp;ii++)
+      if (local_idx.find(dm_cands.cands[ii].dm_idx)==local_idx.end()){
+	local_idx[dm_cands.cands[ii].dm_idx] = fold_dms.size();
+	fold_dms.push_back(dm_list[dm_cands.cands[ii].dm_idx]);
+      }
+    if (args.verbose)
+      std::cout << "Dedispersing " << fold_dms.size() << " DM trials for folding" << std::endl;
+    timers["dedispersion"].start();
+    Dedisperser dedisperser(filobj,ngpus);
+    if (args.killfilename!="")
+      dedisperser.set_killmask(args.killfilename);
+    dedisperser.set_dm_list(fold_dms);
+    DispersionTrials<unsigned char> trials = dedisperser.dedisperse();
+    timers["dedispersion"].stop();
+
+    //fold against the local trials, then restore the global DM indices
+    std::vector<int> global_idx(fold_dms.size());
+    for (std::map<int,int>::iterator it=local_idx.begin();it!=local_idx.end();it++)
+      global_idx[it->second] = it->first;
+    for (int ii=0;ii<npdmp;ii++)
+      dm_cands.cands[ii].dm_idx = local_idx[dm_cands.cands[ii].dm_idx];
+    std::vector<Candidate> to_fold(dm_cands.cands.begin(),dm_cands.cands.begin()+npdmp);
+    timers["folding"].start();
+    MultiFolder folder(to_fold,trials,shards[0].size);
+    if (args.progress_bar)
+      folder.enable_progress_bar();
+    if (args.verbose)
+      std::cout << "Folding top "<< npdmp <<" cands" << std::endl;
+    folder.fold_n(npdmp);
+    timers["folding"].stop();
+    for (int ii=0;ii<to_fold.size();ii++)
+      to_fold[ii].dm_idx = global_idx[to_fold[ii].dm_idx];
+    std::copy(to_fold.begin(),to_fold.end(),dm_cands.cands.begin());
+  }
+
+  if (args.verbose)
+    std::cout << "Writing output files" << std::endl;
+  int new_size = std::min(args.limit,(int) dm_cands.cands.size());
+  dm_cands.cands.resize(new_size);
+
+  CandidateFileWriter cand_files(args.outdir);
+  cand_files.write_binary(dm_cands.cands,"candidates.peasoup");
+  cand_files.write_columnar(dm_cands.cands,"candidates.pcol",cand_scorer.get_feature_names());
+
+  std::stringstream xml_filepath;
+  xml_filepath << args.outdir << "/" << "overview.xml";
+  OutputFileWriter stats(xml_filepath.str());
+  stats.add_misc_info();
+  stats.add_header(args.infilename);
+  stats.add_dm_list(dm_list);
+  if (!device_idxs.empty())
+    stats.add_gpu_info(device_idxs);
+  stats.add_candidates(dm_cands.cands,cand_files.byte_mapping,cand_scorer.get_feature_names(),
+		       known_sources.get_names());
+  timers["total"].stop();
+  stats.add_timing_info(timers);
+  stats.close();
+  return 0;
+}
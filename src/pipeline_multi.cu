@@ -1,6 +1,7 @@
 #include <data_types/timeseries.hpp>
 #include <data_types/fourierseries.hpp>
 #include <data_types/candidates.hpp>
+#include <data_types/candidatetable.hpp>
 #include <data_types/filterbank.hpp>
 #include <transforms/dedisperser.hpp>
 #include <transforms/resampler.hpp>
@@ -13,6 +14,16 @@
 #include <transforms/distiller.hpp>
 #include <transforms/harmonicfolder.hpp>
 #include <transforms/scorer.hpp>
+#include <transforms/knownsources.hpp>
+#include <transforms/fdas.hpp>
+#include <transforms/accelbatcher.hpp>
+#include <transforms/coarsesearch.hpp>
+#include <transforms/segmentsearch.hpp>
+#include <transforms/hostffter.hpp>
+#include <transforms/hostresampler.hpp>
+#include <transforms/hostharmonicfolder.hpp>
+#include <transforms/peakextractor.hpp>
+#include <data_types/hostarena.hpp>
 #include <utils/exceptions.hpp>
 #include <utils/utils.hpp>
 #include <utils/stats.hpp>
@@ -20,8 +31,13 @@
 #include <utils/progress_bar.hpp>
 #include <utils/cmdline.hpp>
 #include <utils/output_stats.hpp>
+#include <utils/scheduler.hpp>
+#include <utils/bounded_queue.hpp>
+#include <utils/journal.hpp>
+#include <utils/shard.hpp>
 #include <string>
 #include <iostream>
+#include <sstream>
 #include <stdio.h>
 #include <unistd.h>
 #include "cuda.h"
@@ -30,72 +46,79 @@
 #include <cmath>
 #include <map>
 
-class DMDispenser {
-private:
-  DispersionTrials<unsigned char>& trials;
-  pthread_mutex_t mutex;
-  int dm_idx;
-  int count;
-  ProgressBar* progress;
-  bool use_progress_bar;
+typedef BoundedQueue<CandidateSet> CandidateQueue;
+typedef BoundedQueue<std::vector<Candidate> > FoldQueue;
 
-public:
-  DMDispenser(DispersionTrials<unsigned char>& trials)
-    :trials(trials),dm_idx(0),use_progress_bar(false){
-    count = trials.get_count();
-    pthread_mutex_init(&mutex, NULL);
-  }
-  
-  void enable_progress_bar(){
-    progress = new ProgressBar();
-    use_progress_bar = true;
-  }
+//A search thread pulling tasks from the scheduler
+class SearchWorker {
+protected:
+  CandidateQueue* output;
 
-  int get_dm_trial_idx(void){
-    pthread_mutex_lock(&mutex);
-    int retval;
-    if (dm_idx==0)
-      if (use_progress_bar){
-	printf("Releasing DMs to workers...\n");
-	progress->start();
-      }
-    if (dm_idx >= trials.get_count()){
-      retval =  -1;
-      if (use_progress_bar)
-	progress->stop();
-    } else {
-      if (use_progress_bar)
-	progress->set_progress((float)dm_idx/count);
-      retval = dm_idx;
-      dm_idx++;
-    }
-    pthread_mutex_unlock(&mutex);
-    return retval;
-  }
-  
-  ~DMDispenser(){
-    if (use_progress_bar)
-      delete progress;
-    pthread_mutex_destroy(&mutex);
+  //Hand on candidates of a DM, final once the DM is fully searched
+  void emit(int dm_idx, bool final, const std::vector<Candidate>& cands){
+    if (cands.empty() && !final)
+      return;
+    if (output!=NULL)
+      output->push(CandidateSet(dm_idx,final,cands));
+    else
+      dm_trial_cands.append(cands);
   }
+
+public:
+  CandidateCollection dm_trial_cands;
+  SearchWorker():output(NULL){}
+  void set_output(CandidateQueue* queue){output = queue;}
+  virtual void start(void)=0;
+  virtual ~SearchWorker(){}
 };
 
-class Worker {
+class Worker: public SearchWorker {
 private:
   DispersionTrials<unsigned char>& trials;
-  DMDispenser& manager;
+  SearchScheduler& manager;
   CmdLineOptions& args;
   AccelerationPlan& acc_plan;
+  AccelerationPlan* coarse_plan;
+  std::vector<AccelerationPlan*> segment_plans;
   unsigned int size;
   int device;
   std::map<std::string,Stopwatch> timers;
+  PeakFinder* cand_finder;
+  HarmonicSums<float>* sums;
+  HarmonicFolder* harm_folder;
+  HarmonicPeakFinder* fused_finder;
+
+  //Harmonic sum a spectrum and append peaks in the fundamental and all folds
+  void find_peaks(float* data, unsigned int nbins, double bin_width,
+		  SpectrumCandidates& trial_cands)
+  {
+    if (args.fuse_harmonics){
+      if (args.verbose)
+	std::cout << "Harmonic summing and finding peaks" << std::endl;
+      fused_finder->find_candidates(data,nbins,bin_width,trial_cands);
+      return;
+    }
+    if (args.verbose)
+      std::cout << "Harmonic summing" << std::endl;
+    harm_folder->fold(data,nbins);
+    if (args.verbose)
+      std::cout << "Finding peaks" << std::endl;
+    cand_finder->find_candidates(data,nbins,bin_width,0,trial_cands);
+    cand_finder->find_candidates(*sums,trial_cands);
+  }
+
+  void find_peaks(DevicePowerSpectrum<float>& pspec, SpectrumCandidates& trial_cands)
+  {
+    find_peaks(pspec.get_data(),pspec.get_nbins(),pspec.get_bin_width(),trial_cands);
+  }
   
 public:
-  CandidateCollection dm_trial_cands;
-
-  Worker(DispersionTrials<unsigned char>& trials, DMDispenser& manager, 
-	 AccelerationPlan& acc_plan, CmdLineOptions& args, unsigned int size, int device)
-    :trials(trials),manager(manager),acc_plan(acc_plan),args(args),size(size),device(device){}
+  Worker(DispersionTrials<unsigned char>& trials, SearchScheduler& manager, 
+	 AccelerationPlan& acc_plan, CmdLineOptions& args, unsigned int size, int device,
+	 AccelerationPlan* coarse_plan=NULL,
+	 std::vector<AccelerationPlan*> segment_plans=std::vector<AccelerationPlan*>())
+    :trials(trials),manager(manager),acc_plan(acc_plan),args(args),size(size),device(device),
+     coarse_plan(coarse_plan),segment_plans(segment_plans){}
   
   void start(void)
   {
@@ -131,24 +154,65 @@ public:
     }
     Dereddener rednoise(size/2+1);
     SpectrumFormer former;
-    PeakFinder cand_finder(args.min_snr,args.min_freq,args.max_freq,size);
-    HarmonicSums<float> sums(pspec,args.nharmonics);
-    HarmonicFolder harm_folder(sums);
+    cand_finder = NULL;
+    sums = NULL;
+    harm_folder = NULL;
+    fused_finder = NULL;
+    if (args.fuse_harmonics)
+      fused_finder = new HarmonicPeakFinder(args.min_snr,args.min_freq,
+					    args.max_freq,args.nharmonics);
+    else {
+      cand_finder = new PeakFinder(args.min_snr,args.min_freq,args.max_freq,size);
+      sums = new HarmonicSums<float>(pspec,args.nharmonics);
+      harm_folder = new HarmonicFolder(*sums);
+    }
     std::vector<float> acc_list;
+    std::vector<float> jerk_list;
+    std::vector<float> trial_accs;
+    std::vector<float> trial_jerks;
     HarmonicDistiller harm_finder(args.freq_tol,args.max_harm,false);
     AccelerationDistiller acc_still(tobs,args.freq_tol,true);
+    FourierDomainAccelerator* fdas = NULL;
+    if (args.fdas)
+      fdas = new FourierDomainAccelerator(size/2+1,args.zmax,args.zstep);
+    AccelerationBatcher* batcher = NULL;
+    if (args.acc_batch!=1 && !args.fdas){
+      unsigned int nbatch = AccelerationBatcher::choose_batch(size,std::max(0,args.acc_batch));
+      if (args.verbose)
+	std::cout << "Processing up to " << nbatch << " acceleration trials per batch" << std::endl;
+      if (nbatch>1)
+	batcher = new AccelerationBatcher(size,nbatch);
+    }
+    CoarseAccelerationSearch* coarse = NULL;
+    HarmonicPeakFinder* hood_finder = NULL;
+    std::vector< std::vector< std::pair<int,int> > > hood_ranges;
+    if (coarse_plan!=NULL && !args.fdas){
+      coarse = new CoarseAccelerationSearch(size,args.coarse_tscrunch,*coarse_plan,
+					    args.min_snr,args.coarse_miss_prob,
+					    args.coarse_false_alarms,
+					    args.min_freq,args.max_freq,args.nharmonics,
+					    args.freq_tol,args.max_harm,trials.get_tsamp());
+      //the fine pass only sums and thresholds the coarse neighbourhoods
+      hood_finder = new HarmonicPeakFinder(args.min_snr,args.min_freq,
+					   args.max_freq,args.nharmonics);
+    }
+    //segment_plans[ii] is the plan for level ii+1
+    std::vector<SegmentSearcher*> segmenters;
+    if (!args.fdas)
+      for (int jj=0;jj<segment_plans.size();jj++)
+	segmenters.push_back(new SegmentSearcher(size,jj+1,*segment_plans[jj],args.min_snr,
+						 args.min_freq,args.max_freq,args.nharmonics,
+						 args.freq_tol,args.max_harm,trials.get_tsamp()));
     float mean,std,rms;
     float padding_mean;
     int ii;
+    SearchTask task;
+    std::vector<Candidate> dm_cands;
 
 	PUSH_NVTX_RANGE("DM-Loop",0)
-    while (true){
-      //timers["get_trial_dm"].start();
-      ii = manager.get_dm_trial_idx();
-      //timers["get_trial_dm"].stop();
-
-      if (ii==-1)
-        break;
+    //every task repeats the per-DM transforms, the scheduler costs them in
+    while (manager.next_task(device,task)){
+      ii = task.dm_idx;
       trials.get_idx(ii,tim);
       
       if (args.verbose)
@@ -165,9 +229,21 @@ public:
       if (args.verbose)
 	    std::cout << "Generating accelration list" << std::endl;
       acc_plan.generate_accel_list(tim.get_dm(),acc_list);
+      acc_plan.generate_jerk_list(tim.get_dm(),jerk_list);
+
+      //one trial per (jerk, acceleration) pair, jerk outermost
+      trial_accs.clear();
+      trial_jerks.clear();
+      for (int jj=0;jj<jerk_list.size();jj++)
+	for (int kk=0;kk<acc_list.size();kk++){
+	  trial_accs.push_back(acc_list[kk]);
+	  trial_jerks.push_back(jerk_list[jj]);
+	}
+      bool searching_jerk = jerk_list.size()>1 || jerk_list[0]!=0;
       
       if (args.verbose)
-	    std::cout << "Searching "<< acc_list.size()<< " acceleration trials for DM "<< tim.get_dm() << std::endl;
+	    std::cout << "Searching "<< acc_list.size()<< " acceleration trials and "
+		      << jerk_list.size() << " jerk trials for DM "<< tim.get_dm() << std::endl;
 
       if (args.verbose)
 	    std::cout << "Executing forward FFT" << std::endl;
@@ -199,17 +275,98 @@ public:
 	    std::cout << "Finding statistics" << std::endl;
       stats::stats<float>(pspec.get_data(),size/2+1,&mean,&rms,&std);
 
+      CandidateCollection accel_trial_cands;
+
+      if (args.fdas){
+	if (args.verbose)
+	  std::cout << "Correlating with " << fdas->get_ntemplates()
+		    << " Fourier domain acceleration templates" << std::endl;
+	fdas->load(d_fseries);
+	PUSH_NVTX_RANGE("FDAS-Loop",1)
+	for (int jj=0;jj<fdas->get_ntemplates();jj++){
+	  fdas->correlate(jj,pspec);
+	  stats::normalise(pspec.get_data(),mean,std,size/2+1);
+	  SpectrumCandidates trial_cands(tim.get_dm(),ii,0.0);
+	  find_peaks(pspec,trial_cands);
+	  fdas->set_accelerations(jj,tobs,trial_cands.cands);
+	  accel_trial_cands.append(harm_finder.distill(trial_cands.cands));
+	}
+	POP_NVTX_RANGE
+	if (manager.complete(task,accel_trial_cands.cands,dm_cands)){
+	  if (args.verbose)
+	    std::cout << "Distilling accelerations" << std::endl;
+	  emit(task.dm_idx,true,acc_still.distill(dm_cands));
+	}
+	continue;
+      }
+
       if (args.verbose)
 	    std::cout << "Executing inverse FFT" << std::endl;
       c2rfft.execute(d_fseries.get_data(),d_tim.get_data());
 
-      CandidateCollection accel_trial_cands;    
+      for (int jj=0;task.chunk==0 && jj<segmenters.size();jj++){
+	if (args.verbose)
+	  std::cout << "Searching " << segmenters[jj]->get_nsegments()
+		    << " segments of " << segmenters[jj]->get_size() << " samples" << std::endl;
+	CandidateCollection segment_cands;
+	segmenters[jj]->search(d_tim,tim.get_dm(),ii,segment_cands);
+	emit(task.dm_idx,false,segment_cands.cands);
+      }
+
+      if (coarse!=NULL){
+	if (args.verbose)
+	  std::cout << "Searching " << args.coarse_tscrunch
+		    << "x decimated time series" << std::endl;
+	coarse->search(d_tim,tim.get_dm(),ii);
+	coarse->select_trials(trial_accs,trial_jerks);
+	if (args.verbose)
+	  std::cout << "Coarse threshold " << coarse->get_threshold() << " (expecting "
+		    << coarse->get_expected_false_alarms() << " false alarms), "
+		    << coarse->get_nhits() << " coarse detections, re-searching "
+		    << trial_accs.size() << " trials at full resolution" << std::endl;
+      }
+
+      //this task's share of the trials
+      size_t trial_end = std::min(task.end,trial_accs.size());
+      size_t trial_start = std::min(task.start,trial_end);
+      if (args.verbose && task.nchunks>1)
+	std::cout << "Searching trials " << trial_start << " to " << trial_end
+		  << " (task " << task.chunk+1 << " of " << task.nchunks << ")" << std::endl;
+
       PUSH_NVTX_RANGE("Acceleration-Loop",1)
 
-      for (int jj=0;jj<acc_list.size();jj++){
+      if (batcher!=NULL){
+	unsigned int nbatch;
+	for (int jj=trial_start;jj<trial_end;jj+=nbatch){
+	  nbatch = std::min((size_t)batcher->get_max_batch(),trial_end-jj);
+	  if (args.verbose)
+	    std::cout << "Resampling, transforming and normalising "
+		      << nbatch << " acceleration trials" << std::endl;
+	  batcher->process(d_tim,&trial_accs[jj],nbatch,mean*size,std*size,
+			   searching_jerk?&trial_jerks[jj]:NULL);
+	  for (int kk=0;kk<nbatch;kk++){
+	    SpectrumCandidates trial_cands(tim.get_dm(),ii,trial_accs[jj+kk],trial_jerks[jj+kk]);
+	    if (coarse!=NULL){
+	      coarse->neighbourhood_bins(trial_accs[jj+kk],trial_jerks[jj+kk],bin_width,hood_ranges);
+	      hood_finder->find_candidates(batcher->get_spectrum(kk),size/2+1,bin_width,
+					   hood_ranges,trial_cands);
+	    }
+	    else
+	      find_peaks(batcher->get_spectrum(kk),size/2+1,bin_width,trial_cands);
+	    if (args.verbose)
+	      std::cout << "Distilling harmonics" << std::endl;
+	    accel_trial_cands.append(harm_finder.distill(trial_cands.cands));
+	  }
+	}
+      }
+      else for (int jj=trial_start;jj<trial_end;jj++){
 	    if (args.verbose)
-	      std::cout << "Resampling to "<< acc_list[jj] << " m/s/s" << std::endl;
-	    resampler.resampleII(d_tim,d_tim_r,size,acc_list[jj]);
+	      std::cout << "Resampling to "<< trial_accs[jj] << " m/s/s, "
+			<< trial_jerks[jj] << " m/s/s/s" << std::endl;
+	    if (trial_jerks[jj]!=0)
+	      resampler.resampleIII(d_tim,d_tim_r,size,trial_accs[jj],trial_jerks[jj]);
+	    else
+	      resampler.resampleII(d_tim,d_tim_r,size,trial_accs[jj]);
 
 	    if (args.verbose)
 	      std::cout << "Execute forward FFT" << std::endl;
@@ -223,29 +380,52 @@ public:
 	      std::cout << "Normalise power spectrum" << std::endl;
 	    stats::normalise(pspec.get_data(),mean*size,std*size,size/2+1);
 
-	    if (args.verbose)
-	      std::cout << "Harmonic summing" << std::endl;
-	    harm_folder.fold(pspec);
-		
-	    if (args.verbose)
-	      std::cout << "Finding peaks" << std::endl;
-	    SpectrumCandidates trial_cands(tim.get_dm(),ii,acc_list[jj]);
-	    cand_finder.find_candidates(pspec,trial_cands);
-	    cand_finder.find_candidates(sums,trial_cands);
+	    SpectrumCandidates trial_cands(tim.get_dm(),ii,trial_accs[jj],trial_jerks[jj]);
+	    if (coarse!=NULL){
+	      coarse->neighbourhood_bins(trial_accs[jj],trial_jerks[jj],bin_width,hood_ranges);
+	      hood_finder->find_candidates(pspec.get_data(),size/2+1,bin_width,
+					   hood_ranges,trial_cands);
+	    }
+	    else
+	      find_peaks(pspec,trial_cands);
 	
 	    if (args.verbose)
 	      std::cout << "Distilling harmonics" << std::endl;
 	      accel_trial_cands.append(harm_finder.distill(trial_cands.cands));
       }
 	  POP_NVTX_RANGE
-      if (args.verbose)
-	    std::cout << "Distilling accelerations" << std::endl;
-      dm_trial_cands.append(acc_still.distill(accel_trial_cands.cands));
+      if (manager.complete(task,accel_trial_cands.cands,dm_cands)){
+	if (args.verbose)
+	  std::cout << "Distilling accelerations" << std::endl;
+	emit(task.dm_idx,true,acc_still.distill(dm_cands));
+      }
     }
 	POP_NVTX_RANGE
 	
     if (args.zapfilename!="")
       delete bzap;
+
+    if (args.fdas)
+      delete fdas;
+
+    if (batcher!=NULL)
+      delete batcher;
+
+    if (coarse!=NULL){
+      delete coarse;
+      delete hood_finder;
+    }
+
+    for (int jj=0;jj<segmenters.size();jj++)
+      delete segmenters[jj];
+
+    if (args.fuse_harmonics)
+      delete fused_finder;
+    else {
+      delete harm_folder;
+      delete sums;
+      delete cand_finder;
+    }
     
     if (args.verbose)
       std::cout << "DM processing took " << pass_timer.getTime() << " seconds"<< std::endl;
@@ -253,8 +433,260 @@ public:
   
 };
 
+/*
+  Runs the same per-DM search loop as Worker in host memory, on the
+  cores left over by the GPU workers (or instead of them with -t 0).
+  Dedispersion and folding still run on a GPU, so a node needs at
+  least one device. All scratch memory comes from a HostSearchArena
+  allocated once per worker. Supports the time
+  domain acceleration and jerk search; FDAS, the coarse pass and
+  segmented searches are GPU only.
+*/
+class CpuWorker: public SearchWorker {
+private:
+  DispersionTrials<unsigned char>& trials;
+  SearchScheduler& manager;
+  CmdLineOptions& args;
+  AccelerationPlan& acc_plan;
+  unsigned int size;
+  int worker_idx;
+  HostSearchArena* arena;
+  PeakExtractor extractor;
+
+  //Same bin limits and frequency conversion as PeakFinder
+  void find_peaks(const float* data, unsigned int nbins, double bin_width, int nh,
+		  SpectrumCandidates& cands)
+  {
+    float nyquist = bin_width*nbins;
+    int orig_size = 2.0*(nbins-1.0);
+    int max_bin = (int)((args.max_freq/bin_width)*pow(2.0,nh));
+    int start_idx = (int)(orig_size*(args.min_freq/nyquist)*pow(2.0,nh));
+    size_t end_idx = std::min((int)nbins,max_bin);
+    size_t npeaks = extractor.extract(data,std::max(0,start_idx),end_idx,args.min_snr,
+				      arena->peakidxs,arena->peaksnrs);
+    if (npeaks==0)
+      return;
+    float factor = 1.0/nbins*nyquist/pow(2.0,(float)nh);
+    arena->peakfreqs.resize(npeaks);
+    for (int ii=0;ii<npeaks;ii++)
+      arena->peakfreqs[ii] = arena->peakidxs[ii]*factor;
+    cands.append(&arena->peaksnrs[0],&arena->peakfreqs[0],nh,npeaks);
+  }
+
+public:
+  CpuWorker(DispersionTrials<unsigned char>& trials, SearchScheduler& manager,
+	    AccelerationPlan& acc_plan, CmdLineOptions& args, unsigned int size,
+	    int worker_idx)
+    :trials(trials),manager(manager),args(args),acc_plan(acc_plan),size(size),
+     worker_idx(worker_idx),arena(NULL),extractor(30,1){}
+
+  void start(void)
+  {
+    Stopwatch pass_timer;
+    pass_timer.start();
+
+    bool padding = false;
+    if (size > trials.get_nsamps())
+      padding = true;
+
+    float tobs = size*trials.get_tsamp();
+    float bin_width = 1.0/tobs;
+    unsigned int nbins = size/2+1;
+    arena = new HostSearchArena(size,bin_width,args.nharmonics);
+    if (args.verbose)
+      std::cout << "CPU worker " << worker_idx << " using "
+		<< arena->get_bytes()/(1<<20) << " MB of scratch memory" << std::endl;
+    HostFFTerR2C r2cfft(size);
+    HostFFTerC2R c2rfft(size);
+    DedispersedTimeSeries<unsigned char> tim;
+    HostTimeDomainResampler resampler;
+    HostSpectrumFormer former;
+    HostDereddener rednoise(nbins);
+    HostHarmonicFolder harm_folder(arena->sums);
+    Zapper* bzap = NULL;
+    if (args.zapfilename!="")
+      bzap = new Zapper(args.zapfilename);
+    std::vector<float> acc_list;
+    std::vector<float> jerk_list;
+    std::vector<float> trial_accs;
+    std::vector<float> trial_jerks;
+    HarmonicDistiller harm_finder(args.freq_tol,args.max_harm,false);
+    AccelerationDistiller acc_still(tobs,args.freq_tol,true);
+    float mean,std,rms;
+    SearchTask task;
+    std::vector<Candidate> dm_cands;
+    float* pspec = arena->pspec.get_data();
+
+    while (manager.next_task(worker_idx,task)){
+      int ii = task.dm_idx;
+      trials.get_idx(ii,tim);
+      arena->tim.copy_from_host(tim);
+      if (padding){
+	float padding_mean = 0;
+	stats::host_stats<float>(arena->tim.get_data(),trials.get_nsamps(),
+				 &padding_mean,&rms,&std);
+	arena->tim.fill(trials.get_nsamps(),size,padding_mean);
+      }
+
+      acc_plan.generate_accel_list(tim.get_dm(),acc_list);
+      acc_plan.generate_jerk_list(tim.get_dm(),jerk_list);
+      trial_accs.clear();
+      trial_jerks.clear();
+      for (int jj=0;jj<jerk_list.size();jj++)
+	for (int kk=0;kk<acc_list.size();kk++){
+	  trial_accs.push_back(acc_list[kk]);
+	  trial_jerks.push_back(jerk_list[jj]);
+	}
+      size_t trial_end = std::min(task.end,trial_accs.size());
+      size_t trial_start = std::min(task.start,trial_end);
+
+      if (args.verbose)
+	std::cout << "CPU worker " << worker_idx << " searching trials " << trial_start
+		  << " to " << trial_end << " for DM " << tim.get_dm() << std::endl;
+
+      r2cfft.execute(arena->tim.get_data(),arena->fseries.get_data());
+      former.form(arena->fseries,arena->pspec);
+      rednoise.calculate_median(arena->pspec);
+      rednoise.deredden(arena->fseries);
+      if (bzap!=NULL)
+	bzap->zap(arena->fseries);
+      former.form_interpolated(arena->fseries,arena->pspec);
+      stats::host_stats<float>(pspec,nbins,&mean,&rms,&std);
+      c2rfft.execute(arena->fseries.get_data(),arena->tim.get_data());
+
+      CandidateCollection accel_trial_cands;
+      for (int jj=trial_start;jj<trial_end;jj++){
+	resampler.resample(arena->tim,arena->tim_r,size,trial_accs[jj],trial_jerks[jj]);
+	r2cfft.execute(arena->tim_r.get_data(),arena->fseries.get_data());
+	former.form_interpolated(arena->fseries,arena->pspec);
+	stats::host_normalise(pspec,mean*size,std*size,nbins);
+	SpectrumCandidates trial_cands(tim.get_dm(),ii,trial_accs[jj],trial_jerks[jj]);
+	harm_folder.fold(arena->pspec);
+	find_peaks(pspec,nbins,bin_width,0,trial_cands);
+	for (int kk=0;kk<arena->sums.size();kk++)
+	  find_peaks(arena->sums[kk]->get_data(),nbins,bin_width,kk+1,trial_cands);
+	accel_trial_cands.append(harm_finder.distill(trial_cands.cands));
+      }
+      if (manager.complete(task,accel_trial_cands.cands,dm_cands))
+	emit(task.dm_idx,true,acc_still.distill(dm_cands));
+    }
+
+    if (bzap!=NULL)
+      delete bzap;
+    delete arena;
+    arena = NULL;
+
+    if (args.verbose)
+      std::cout << "CPU worker " << worker_idx << " took "
+		<< pass_timer.getTime() << " seconds"<< std::endl;
+  }
+};
+
 void* launch_worker_thread(void* ptr){
-  reinterpret_cast<Worker*>(ptr)->start();
+  reinterpret_cast<SearchWorker*>(ptr)->start();
+  return NULL;
+}
+
+/*
+  Collects the per-DM candidate sets as the search workers finish them,
+  journalling each one when checkpointing and, when given a distiller,
+  DM distilling them against everything found so far. Candidates above the early
+  fold threshold are offered to the fold stage straight away; if its
+  queue is full they are dropped rather than holding up the search, and
+  get folded after distillation. Given a known source matcher (with
+  --remove_known), candidates of known sources are never offered, as
+  they will not be folded at all.
+*/
+class DistillStage {
+private:
+  CandidateQueue& input;
+  FoldQueue* fold_queue;
+  float early_fold_snr;
+  SearchJournal* journal;
+  IncrementalDMDistiller* dm_still;
+  KnownSourceMatcher* known_sources;
+
+public:
+  CandidateTable table;
+  std::vector<int> rows;
+  size_t nsets;
+  size_t nspeculative;
+  size_t ndropped;
+  size_t nknown;
+
+  DistillStage(CandidateQueue& input, FoldQueue* fold_queue, float early_fold_snr,
+	       SearchJournal* journal=NULL, IncrementalDMDistiller* dm_still=NULL,
+	       KnownSourceMatcher* known_sources=NULL)
+    :input(input),fold_queue(fold_queue),early_fold_snr(early_fold_snr),
+     journal(journal),dm_still(dm_still),known_sources(known_sources),
+     nsets(0),nspeculative(0),ndropped(0),nknown(0){}
+
+  void start(void)
+  {
+    CandidateSet cand_set;
+    while (input.pop(cand_set)){
+      nsets++;
+      if (journal!=NULL)
+	journal->record(cand_set);
+      std::vector<Candidate>& set = cand_set.cands;
+      if (fold_queue!=NULL){
+	std::vector<Candidate> strong;
+	for (int ii=0;ii<set.size();ii++){
+	  if (set[ii].snr<early_fold_snr)
+	    continue;
+	  if (known_sources!=NULL && known_sources->match(set[ii])>=0){
+	    nknown++;
+	    continue;
+	  }
+	  strong.push_back(set[ii]);
+	  strong.back().assoc.clear();
+	}
+	if (!strong.empty()){
+	  if (fold_queue->try_push(strong))
+	    nspeculative += strong.size();
+	  else
+	    ndropped += strong.size();
+	}
+      }
+      std::vector<int> set_rows = table.append(set);
+      rows.insert(rows.end(),set_rows.begin(),set_rows.end());
+      if (dm_still!=NULL)
+	dm_still->add(table,set_rows);
+    }
+    if (fold_queue!=NULL)
+      fold_queue->close();
+  }
+};
+
+//Folds speculative candidates into the fold cache on one device
+class FoldStage {
+private:
+  FoldQueue& input;
+  DispersionTrials<unsigned char>& trials;
+  unsigned int size;
+  int device;
+  FoldCache& cache;
+
+public:
+  FoldStage(FoldQueue& input, DispersionTrials<unsigned char>& trials,
+	    unsigned int size, int device, FoldCache& cache)
+    :input(input),trials(trials),size(size),device(device),cache(cache){}
+
+  void start(void)
+  {
+    cudaSetDevice(device);
+    std::vector<Candidate> batch;
+    while (input.pop(batch)){
+      MultiFolder folder(batch,trials,size);
+      folder.set_cache(&cache);
+      folder.fold_n(batch.size());
+    }
+  }
+};
+
+template <class T>
+void* launch_stage(void* ptr){
+  reinterpret_cast<T*>(ptr)->start();
   return NULL;
 }
 
@@ -273,8 +705,24 @@ int main(int argc, char **argv)
   if (!read_cmdline_options(args,argc,argv))
     ErrorChecker::throw_error("Failed to parse command line arguments.");
 
+  //dedispersion and folding have no host implementation
+  if (Utils::gpu_count()==0)
+    ErrorChecker::throw_error("No CUDA device found: dedispersion and folding require a GPU.");
+
+  //one GPU worker per device, plus CPU workers on request or with no GPU workers
   int nthreads = std::min(Utils::gpu_count(),args.max_num_threads);
-  nthreads = std::max(1,nthreads);
+  int ncpu_workers = args.cpu_workers;
+  if (ncpu_workers<0 || (ncpu_workers==0 && nthreads==0))
+    ncpu_workers = std::max(1,Utils::cpu_count(args.physical_cores)-nthreads);
+  if (ncpu_workers>0 && (args.fdas || args.coarse_tscrunch>1 || args.segment_levels>0)){
+    if (nthreads==0)
+      ErrorChecker::throw_error("FDAS, coarse and segmented searches require GPU workers.");
+    std::cerr << "WARNING: CPU workers disabled, search mode is GPU only" << std::endl;
+    ncpu_workers = 0;
+  }
+  if (args.verbose)
+    std::cout << "Using " << nthreads << " GPU workers and "
+	      << ncpu_workers << " CPU workers" << std::endl;
 
   if (args.verbose)
     std::cout << "Using file: " << args.infilename << std::endl;
@@ -292,7 +740,8 @@ int main(int argc, char **argv)
     printf("Complete (execution time %.2f s)\n",timers["reading"].getTime());
   }
 
-  Dedisperser dedisperser(filobj,nthreads);
+  //dedisp always needs a device
+  Dedisperser dedisperser(filobj,std::max(1,nthreads));
   if (args.killfilename!=""){
     if (args.verbose)
       std::cout << "Using killfile: " << args.killfilename << std::endl;
@@ -302,6 +751,28 @@ int main(int argc, char **argv)
   if (args.verbose)
     std::cout << "Generating DM list" << std::endl;
   dedisperser.generate_dm_list(args.dm_start,args.dm_end,args.dm_pulse_width,args.dm_tol);
+  std::vector<float> full_dm_list = dedisperser.get_dm_list();
+  //every shard uses the transform length of the full DM range
+  unsigned int full_nsamps = filobj.get_nsamps()-dedisperser.get_max_delay();
+
+  //in shard mode only this process's slice of the DM list is dedispersed
+  ShardSpec shard = ShardSpec::parse(args.shard);
+  std::vector<int> global_dm_idx;
+  std::vector<float> shard_dm_list;
+  for (int ii=0;ii<full_dm_list.size();ii++)
+    if (shard.owns(ii)){
+      global_dm_idx.push_back(ii);
+      shard_dm_list.push_back(full_dm_list[ii]);
+    }
+  if (shard.is_sharded()){
+    if (shard_dm_list.empty())
+      ErrorChecker::throw_error("Shard has no DM trials.");
+    if (args.verbose)
+      std::cout << "Searching shard " << shard.index << " of " << shard.count
+		<< " (" << shard_dm_list.size() << " of " << full_dm_list.size()
+		<< " DM trials)" << std::endl;
+    dedisperser.set_dm_list(shard_dm_list);
+  }
   std::vector<float> dm_list = dedisperser.get_dm_list();
   
   if (args.verbose){
@@ -314,65 +785,269 @@ int main(int argc, char **argv)
   if (args.progress_bar)
     printf("Starting dedispersion...\n");
 
+  //checkpoint files are tied to the configuration that wrote them
+  std::stringstream dedisp_config;
+  dedisp_config << args.infilename << " " << args.killfilename << " " << filobj.get_nsamps();
+  for (int ii=0;ii<dm_list.size();ii++)
+    dedisp_config << " " << dm_list[ii];
+  std::string spill_name = shard.is_sharded() ? shard.filename("spill") : "trials.spill";
+  TrialsSpill spill(args.outdir+"/"+spill_name,fnv1a_hash(dedisp_config.str()));
+
   timers["dedispersion"].start();
+  unsigned char* spilled = NULL;
+  unsigned int spilled_nsamps = 0;
+  if (args.resume && args.spill_trials)
+    spilled = spill.read(spilled_nsamps,dm_list.size());
+  if (spilled!=NULL && args.verbose)
+    std::cout << "Read dedispersed trials from spill file" << std::endl;
   PUSH_NVTX_RANGE("Dedisperse",3)
-  DispersionTrials<unsigned char> trials = dedisperser.dedisperse();
+  DispersionTrials<unsigned char> trials = (spilled!=NULL) ?
+    DispersionTrials<unsigned char>(spilled,spilled_nsamps,filobj.get_tsamp(),dm_list) :
+    dedisperser.dedisperse();
   POP_NVTX_RANGE
+  if (args.spill_trials && spilled==NULL){
+    if (args.verbose)
+      std::cout << "Spilling dedispersed trials" << std::endl;
+    spill.write(trials);
+  }
   timers["dedispersion"].stop();
 
   if (args.progress_bar)
     printf("Complete (execution time %.2f s)\n",timers["dedispersion"].getTime());
 
   unsigned int size;
-  if (args.size==0)
-    size = Utils::prev_power_of_two(filobj.get_nsamps());
+  if (args.size==0 && args.fft_table!="")
+    size = Utils::fastest_fft_length(full_nsamps,Utils::read_fft_table(args.fft_table));
+  else if (args.size==0)
+    size = Utils::fastest_fft_length(full_nsamps);
   else
     //size = std::min(args.size,filobj.get_nsamps());
     size = args.size;
+  if (size%2!=0)
+    ErrorChecker::throw_error("Transform length must be even.");
+  if (!Utils::is_smooth(size))
+    std::cerr << "WARNING: transform length " << size
+	      << " has prime factors larger than 7" << std::endl;
   if (args.verbose)
     std::cout << "Setting transform length to " << size << " points" << std::endl;
   
   AccelerationPlan acc_plan(args.acc_start, args.acc_end, args.acc_tol,
 			    args.acc_pulse_width, size, filobj.get_tsamp(),
-			    filobj.get_cfreq(), filobj.get_foff()); 
+			    filobj.get_cfreq(), filobj.get_foff(),
+			    args.jerk_start, args.jerk_end, args.max_freq); 
+
+  //Coarse pass plan: same span, summed samples and a wider pulse
+  AccelerationPlan* coarse_plan = NULL;
+  if (args.coarse_tscrunch>1){
+    unsigned int coarse_size = (size/args.coarse_tscrunch)&~1u;
+    float coarse_tsamp = args.coarse_tscrunch*filobj.get_tsamp();
+    coarse_plan = new AccelerationPlan(args.acc_start, args.acc_end, args.acc_tol,
+				       args.acc_pulse_width*args.coarse_tscrunch,
+				       coarse_size, coarse_tsamp,
+				       filobj.get_cfreq(), filobj.get_foff(),
+				       args.jerk_start, args.jerk_end,
+				       std::min(args.max_freq,0.5f/coarse_tsamp));
+  }
+  
   
+  //One plan per segment level, with the segment length as tobs
+  std::vector<AccelerationPlan*> segment_plans;
+  for (int level=1;level<=args.segment_levels;level++){
+    unsigned int segment_size = SegmentSearcher::segment_size(size,level);
+    if (segment_size<2)
+      ErrorChecker::throw_error("Too many segment levels for transform length.");
+    segment_plans.push_back(new AccelerationPlan(args.acc_start, args.acc_end, args.acc_tol,
+						 args.acc_pulse_width, segment_size,
+						 filobj.get_tsamp(), filobj.get_cfreq(),
+						 filobj.get_foff(), args.jerk_start,
+						 args.jerk_end, args.max_freq));
+  }
   
+  //Everything the candidates depend on, shared by all shards of a search
+  std::stringstream search_config;
+  search_config << args.infilename << " " << args.killfilename << " " << filobj.get_nsamps();
+  for (int ii=0;ii<full_dm_list.size();ii++)
+    search_config << " " << full_dm_list[ii];
+  search_config << " " << args.zapfilename << " " << size
+		<< " " << args.acc_start << " " << args.acc_end << " " << args.acc_tol
+		<< " " << args.acc_pulse_width << " " << args.jerk_start << " " << args.jerk_end
+		<< " " << args.boundary_5_freq << " " << args.boundary_25_freq
+		<< " " << args.nharmonics << " " << args.min_snr << " " << args.min_freq
+		<< " " << args.max_freq << " " << args.max_harm << " " << args.freq_tol
+		<< " " << args.fdas << " " << args.zmax << " " << args.zstep
+		<< " " << args.coarse_tscrunch << " " << args.coarse_miss_prob
+		<< " " << args.coarse_false_alarms
+		<< " " << args.segment_levels;
+
+  //Journal of finished DMs, read back to skip them when resuming
+  SearchJournal* journal = NULL;
+  std::vector<bool> finished_dms;
+  if (args.checkpoint || args.resume){
+    std::string journal_name = shard.is_sharded() ? shard.filename("journal") : "search.journal";
+    journal = new SearchJournal(args.outdir+"/"+journal_name,
+				fnv1a_hash(search_config.str()+" "+args.shard));
+    if (args.resume){
+      size_t ndone = journal->load();
+      finished_dms = journal->get_done(dm_list.size());
+      if (args.verbose || args.progress_bar)
+	std::cout << "Resuming search, " << ndone << " of " << dm_list.size()
+		  << " DM trials already searched" << std::endl;
+    }
+    journal->open();
+  }
+  std::vector<bool>* skip_dms = (journal!=NULL) ? &finished_dms : NULL;
+
   //Multithreading commands
   timers["searching"].start();
-  std::vector<Worker*> workers(nthreads);
-  std::vector<pthread_t> threads(nthreads);
-  DMDispenser dispenser(trials);
+  int nworkers = nthreads+ncpu_workers;
+  std::vector<SearchWorker*> workers(nworkers);
+  std::vector<pthread_t> threads(nworkers);
+  //FDAS and the coarse pass work on whole DMs
+  size_t task_trials = 0;
+  if (!args.fdas && coarse_plan==NULL && args.task_trials>=0){
+    if (args.task_trials==0)
+      task_trials = SearchScheduler::choose_chunk(dm_list,acc_plan,nworkers,skip_dms);
+    else
+      task_trials = args.task_trials;
+  }
+  SearchScheduler dispenser(dm_list,acc_plan,nworkers,task_trials,skip_dms);
+  if (args.verbose)
+    std::cout << "Searching in " << dispenser.get_ntasks() << " tasks" << std::endl;
   if (args.progress_bar)
     dispenser.enable_progress_bar();
+
+  //search -> distill -> fold, the search blocks if distilling falls behind
+  CandidateQueue cand_queue(args.queue_depth);
+  FoldQueue fold_queue(args.queue_depth);
+  FoldCache fold_cache;
+  bool early_fold = args.early_fold_snr>0 && args.npdmp>0 && nthreads>0 && !shard.is_sharded();
+  //DM distilling during the search only pays while early folds overlap
+  //it; otherwise the batch distiller after the search is cheaper
+  IncrementalDMDistiller inc_dm_still(args.freq_tol,true);
+  IncrementalDMDistiller* stage_dm_still = early_fold?&inc_dm_still:NULL;
+  //prepared here so known sources can be kept out of the early folds
+  KnownSourceMatcher known_sources(args.max_harm);
+  if (args.known_sources!=""){
+    known_sources.read_catalogue(args.known_sources);
+    known_sources.prepare();
+  }
+  KnownSourceMatcher* stage_known_sources =
+    (args.known_sources!="" && args.remove_known)?&known_sources:NULL;
+  DistillStage distill_stage(cand_queue,early_fold?&fold_queue:NULL,args.early_fold_snr,
+			     journal,stage_dm_still,stage_known_sources);
+  FoldStage fold_stage(fold_queue,trials,size,0,fold_cache);
+  pthread_t distill_thread;
+  pthread_t fold_thread;
+  pthread_create(&distill_thread, NULL, launch_stage<DistillStage>, (void*) &distill_stage);
+  if (early_fold)
+    pthread_create(&fold_thread, NULL, launch_stage<FoldStage>, (void*) &fold_stage);
   
   for (int ii=0;ii<nthreads;ii++){
-    workers[ii] = (new Worker(trials,dispenser,acc_plan,args,size,ii));
+    workers[ii] = (new Worker(trials,dispenser,acc_plan,args,size,ii,
+			      coarse_plan,segment_plans));
+    workers[ii]->set_output(&cand_queue);
+    pthread_create(&threads[ii], NULL, launch_worker_thread, (void*) workers[ii]);
+  }
+  for (int ii=nthreads;ii<nworkers;ii++){
+    workers[ii] = (new CpuWorker(trials,dispenser,acc_plan,args,size,ii));
+    workers[ii]->set_output(&cand_queue);
     pthread_create(&threads[ii], NULL, launch_worker_thread, (void*) workers[ii]);
   }
   
-  DMDistiller dm_still(args.freq_tol,true);
-  HarmonicDistiller harm_still(args.freq_tol,args.max_harm,true,false);
   CandidateCollection dm_cands;
-  for (int ii=0; ii<nthreads; ii++){
+  for (int ii=0; ii<nworkers; ii++){
     pthread_join(threads[ii],NULL);
     dm_cands.append(workers[ii]->dm_trial_cands.cands);
   }
+  cand_queue.close();
+  pthread_join(distill_thread,NULL);
+  if (journal!=NULL){
+    journal->restore(dm_cands.cands);
+    delete journal;
+  }
+  //DM and harmonic distilling relate rows of one table instead of copying
+  CandidateTable& cand_table = distill_stage.table;
+  std::vector<int> late_rows = cand_table.append(dm_cands.cands);
+  std::vector<int> cand_rows(distill_stage.rows);
+  cand_rows.insert(cand_rows.end(),late_rows.begin(),late_rows.end());
+  std::vector<Candidate>().swap(dm_cands.cands);
   timers["searching"].stop();
+
+  //shards stop here, peasoup_merge distills, scores and folds across shards
+  if (shard.is_sharded()){
+    dm_cands.cands = cand_table.to_candidates(cand_rows);
+    remap_dm_indices(dm_cands.cands,global_dm_idx);
+    ShardFile shard_file;
+    shard_file.config_hash = fnv1a_hash(search_config.str());
+    shard_file.shard = shard;
+    shard_file.size = size;
+    shard_file.freq_tol = args.freq_tol;
+    shard_file.max_harm = args.max_harm;
+    shard_file.dm_list = full_dm_list;
+    shard_file.set_candidates(dm_cands.cands);
+    std::string shard_path = args.outdir+"/"+shard.filename("cands");
+    shard_file.write(shard_path);
+    if (args.verbose || args.progress_bar)
+      std::cout << "Wrote " << dm_cands.cands.size() << " candidates to "
+		<< shard_path << std::endl;
+    return 0;
+  }
+  if (args.verbose && early_fold)
+    std::cout << distill_stage.nspeculative << " candidates queued for early folding, "
+	      << distill_stage.ndropped << " dropped, " << distill_stage.nknown
+	      << " known sources skipped" << std::endl;
   
+  //the workers are done, distill on every core
+  unsigned int distill_threads = std::max(0,args.distill_threads);
+  if (stage_dm_still!=NULL){
+    //DMs were distilled as the sets arrived, journalled candidates come last
+    inc_dm_still.add(cand_table,late_rows);
+    cand_rows = inc_dm_still.finish(cand_table);
+    if (args.verbose)
+      std::cout << "DM distilled to " << cand_rows.size() << " candidates during the search ("
+		<< inc_dm_still.get_nchanges() << " revised)" << std::endl;
+  } else {
+    ParallelDistiller<DMDistiller> dm_still(DMDistiller(args.freq_tol,true),distill_threads);
+    if (args.verbose)
+      std::cout << "Distilling DMs on " << dm_still.get_nthreads() << " threads" << std::endl;
+    cand_rows = dm_still.distill(cand_table,cand_rows);
+  }
+  ParallelDistiller<HarmonicDistiller> harm_still(HarmonicDistiller(args.freq_tol,args.max_harm,true,false),
+						  distill_threads);
   if (args.verbose)
-    std::cout << "Distilling DMs" << std::endl;
-  dm_cands.cands = dm_still.distill(dm_cands.cands);
-  dm_cands.cands = harm_still.distill(dm_cands.cands);
+    std::cout << "Distilling harmonics on " << harm_still.get_nthreads() << " threads" << std::endl;
+  cand_rows = harm_still.distill(cand_table,cand_rows);
+  if (args.verbose)
+    std::cout << cand_rows.size() << " candidates from " << cand_table.size()
+	      << " detections (" << cand_table.get_bytes() << " bytes)" << std::endl;
+  dm_cands.cands = cand_table.to_candidates(cand_rows);
   
+  float bw = fabs(filobj.get_foff())*filobj.get_nchans();
   CandidateScorer cand_scorer(filobj.get_tsamp(),filobj.get_cfreq(), filobj.get_foff(),
-			      fabs(filobj.get_foff())*filobj.get_nchans());
-  cand_scorer.score_all(dm_cands.cands);
+			      bw,distill_threads);
+  DMCurveWidth dm_curve_width(filobj.get_cfreq(),bw);
+  AccelerationSpread acc_spread;
+  cand_scorer.add_feature(&dm_curve_width);
+  cand_scorer.add_feature(&acc_spread);
+  cand_scorer.score_all(dm_cands.cands,cand_table,cand_rows);
+
+  //known sources are tagged, or dropped, before they cost any folding
+  if (args.known_sources!=""){
+    size_t nknown = args.remove_known ? known_sources.remove(dm_cands.cands)
+      : known_sources.tag(dm_cands.cands);
+    if (args.verbose)
+      std::cout << (args.remove_known ? "Removed " : "Tagged ") << nknown
+		<< " candidates matching " << known_sources.get_nsources() << " known sources" << std::endl;
+  }
 
   if (args.verbose)
     std::cout << "Setting up time series folder" << std::endl;
   
-  MultiFolder folder(dm_cands.cands,trials);
   timers["folding"].start();
+  if (early_fold)
+    pthread_join(fold_thread,NULL);
+  MultiFolder folder(dm_cands.cands,trials,size);
+  folder.set_cache(&fold_cache);
   if (args.progress_bar)
     folder.enable_progress_bar();
 
@@ -392,8 +1067,11 @@ int main(int argc, char **argv)
 
   CandidateFileWriter cand_files(args.outdir);
   cand_files.write_binary(dm_cands.cands,"candidates.peasoup");
+  cand_files.write_columnar(dm_cands.cands,"candidates.pcol",cand_scorer.get_feature_names());
   
-  OutputFileWriter stats;
+  std::stringstream xml_filepath;
+  xml_filepath << args.outdir << "/" << "overview.xml";
+  OutputFileWriter stats(xml_filepath.str());
   stats.add_misc_info();
   stats.add_header(filename);
   stats.add_search_parameters(args);
@@ -402,18 +1080,20 @@ int main(int argc, char **argv)
   std::vector<float> acc_list;
   acc_plan.generate_accel_list(0.0,acc_list);
   stats.add_acc_list(acc_list);
+
+  std::vector<float> jerk_list;
+  acc_plan.generate_jerk_list(0.0,jerk_list);
+  stats.add_jerk_list(jerk_list);
   
   std::vector<int> device_idxs;
   for (int device_idx=0;device_idx<nthreads;device_idx++)
     device_idxs.push_back(device_idx);
   stats.add_gpu_info(device_idxs);
-  stats.add_candidates(dm_cands.cands,cand_files.byte_mapping);
+  stats.add_candidates(dm_cands.cands,cand_files.byte_mapping,cand_scorer.get_feature_names(),
+		       known_sources.get_names());
   timers["total"].stop();
   stats.add_timing_info(timers);
-  
-  std::stringstream xml_filepath;
-  xml_filepath << args.outdir << "/" << "overview.xml";
-  stats.to_file(xml_filepath.str());
+  stats.close();
   
   return 0;
 }
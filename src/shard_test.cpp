@@ -0,0 +1,137 @@
+#include <utils/shard.hpp>
+#include <data_types/candidates.hpp>
+#include <data_types/candidatetable.hpp>
+#include <transforms/distiller.hpp>
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define SHARD_DIR "shard_test_dir"
+#define NDMS 30
+#define NSHARDS 4
+#define NCANDS 3000
+#define FREQ_TOL 0.0003
+#define MAX_HARM 8
+
+/*
+  Shards written by peasoup --shard i/N and merged by peasoup_merge
+  must give the candidates a single process distills, with the
+  tolerances taken from the shard files rather than the merge command
+  line. Shards from a different search, missing shards and repeated
+  shards are refused.
+*/
+
+bool same(const Candidate& x, const Candidate& y)
+{
+  if (x.dm!=y.dm || x.dm_idx!=y.dm_idx || x.acc!=y.acc || x.jerk!=y.jerk ||
+      x.nh!=y.nh || x.snr!=y.snr || x.freq!=y.freq || x.assoc.size()!=y.assoc.size())
+    return false;
+  for (int ii=0;ii<x.assoc.size();ii++)
+    if (!same(x.assoc[ii],y.assoc[ii]))
+      return false;
+  return true;
+}
+
+//Distill as the unsharded search does
+std::vector<Candidate> distill(CandidateTable& table, std::vector<int> rows,
+			       float freq_tol, int max_harm)
+{
+  ParallelDistiller<DMDistiller> dm_still(DMDistiller(freq_tol,true),2,64);
+  ParallelDistiller<HarmonicDistiller> harm_still(HarmonicDistiller(freq_tol,max_harm,true,false),2,64);
+  rows = dm_still.distill(table,rows);
+  rows = harm_still.distill(table,rows);
+  return table.to_candidates(rows);
+}
+
+bool merge_throws(std::vector<ShardFile> shards, const std::vector<std::string>& names)
+{
+  CandidateTable table;
+  try {
+    merge_shards(shards,names,table);
+  } catch (std::runtime_error& e) {
+    return true;
+  }
+  return false;
+}
+
+int main()
+{
+  srand(3);
+  std::vector<float> dm_list;
+  for (int ii=0;ii<NDMS;ii++)
+    dm_list.push_back(ii*1.5);
+
+  //signals seen at several DMs and harmonics, each candidate with a distinct S/N
+  std::vector<Candidate> cands;
+  for (int ii=0;ii<NCANDS;ii++){
+    int dm_idx = rand()%NDMS;
+    double freq = (1+rand()%40)*0.731*(1+rand()%4)/(1+rand()%3)*(1+(rand()%5-2)*FREQ_TOL/4);
+    Candidate cand(dm_list[dm_idx],dm_idx,rand()%20-10,1<<(rand()%5),6+ii*0.001,freq);
+    cands.push_back(cand);
+  }
+  std::random_shuffle(cands.begin(),cands.end());
+
+  CandidateTable table;
+  std::vector<Candidate> expected = distill(table,table.append(cands),FREQ_TOL,MAX_HARM);
+
+  std::vector<std::string> names;
+  for (int ii=NSHARDS-1;ii>=0;ii--){
+    ShardFile shard_file;
+    shard_file.config_hash = 77;
+    shard_file.shard.index = ii;
+    shard_file.shard.count = NSHARDS;
+    shard_file.size = 1<<20;
+    shard_file.freq_tol = FREQ_TOL;
+    shard_file.max_harm = MAX_HARM;
+    shard_file.dm_list = dm_list;
+    std::vector<Candidate> owned;
+    for (int jj=0;jj<cands.size();jj++)
+      if (shard_file.shard.owns(cands[jj].dm_idx))
+	owned.push_back(cands[jj]);
+    shard_file.set_candidates(owned);
+    names.push_back(std::string(SHARD_DIR)+"/"+shard_file.shard.filename("cands"));
+    shard_file.write(names.back());
+  }
+
+  std::vector<ShardFile> shards(NSHARDS);
+  bool header_ok = true;
+  for (int ii=0;ii<NSHARDS;ii++){
+    shards[ii].read(names[ii]);
+    header_ok &= shards[ii].freq_tol==(float) FREQ_TOL && shards[ii].max_harm==MAX_HARM &&
+      shards[ii].size==1<<20 && shards[ii].dm_list==dm_list;
+  }
+  printf("%-28s %s\n","Shard header",header_ok?"ok":"FAILED");
+  bool ok = header_ok;
+
+  std::vector<ShardFile> missing(shards.begin(),shards.end()-1);
+  bool missing_ok = merge_throws(missing,names);
+  std::vector<ShardFile> repeated(shards);
+  repeated.back() = shards[0];
+  bool repeated_ok = merge_throws(repeated,names);
+  std::vector<ShardFile> other(shards);
+  other[1].freq_tol *= 2;
+  bool other_ok = merge_throws(other,names);
+  printf("%-28s %s\n","Missing shard refused",missing_ok?"ok":"FAILED");
+  printf("%-28s %s\n","Repeated shard refused",repeated_ok?"ok":"FAILED");
+  printf("%-28s %s\n","Other tolerance refused",other_ok?"ok":"FAILED");
+  ok &= missing_ok && repeated_ok && other_ok;
+
+  CandidateTable merged_table;
+  std::vector<int> rows = merge_shards(shards,names,merged_table);
+  std::vector<Candidate> merged = distill(merged_table,rows,shards[0].freq_tol,shards[0].max_harm);
+  int nwrong = 0;
+  for (int ii=0;ii<std::min(expected.size(),merged.size());ii++)
+    nwrong += !same(expected[ii],merged[ii]);
+  bool merge_ok = rows.size()==cands.size() && expected.size()==merged.size() && nwrong==0;
+  printf("%-28s %d candidates, %d distilled (%d expected), %d wrong: %s\n","Merge",
+	 (int)rows.size(),(int)merged.size(),(int)expected.size(),nwrong,merge_ok?"ok":"FAILED");
+  ok &= merge_ok;
+
+  for (int ii=0;ii<names.size();ii++)
+    unlink(names[ii].c_str());
+  rmdir(SHARD_DIR);
+  return ok?0:1;
+}
@@ -80,6 +80,53 @@ class CandidateFileParser(object):
         self._f.close()
     
 
+class ColumnarCandidateFile(object):
+    """Memory mapped reader for candidates.pcol (see include/utils/columnar.hpp)"""
+    _version = 1
+    _types = {0:"float32", 1:"float64", 2:"int32", 3:"uint8"}
+    _header_dtype = [("magic","S8"),("version","uint32"),("ncolumns","uint32"),
+                     ("ncands","uint64"),("index_offset","uint64"),
+                     ("fold_offset","uint64"),("fold_bytes","uint64"),
+                     ("detections_offset","uint64"),("ndetections","uint64")]
+    _column_dtype = [("name","S20"),("type","uint32"),("offset","uint64")]
+    _index_dtype = [("fold_offset","uint64"),("nbins","uint32"),("nints","uint32"),
+                    ("first_detection","uint64"),("ndetections","uint64")]
+
+    def __init__(self, filename):
+        self._map = np.memmap(filename,dtype="uint8",mode="r")
+        self.header = self._map[:64].view(self._header_dtype)[0]
+        if self.header["magic"] != "PSCANCOL":
+            raise IOError("%s is not a columnar candidate file"%filename)
+        if self.header["version"] > self._version:
+            raise IOError("%s has a newer format version than this reader"%filename)
+        ncols = int(self.header["ncolumns"])
+        self.ncands = int(self.header["ncands"])
+        directory = self._map[64:64+32*ncols].view(self._column_dtype)
+        self.columns = {}
+        for name,ctype,offset in directory:
+            dtype = np.dtype(self._types[int(ctype)])
+            start = int(offset)
+            self.columns[name.rstrip("\0")] = self._map[start:start+dtype.itemsize*self.ncands].view(dtype)
+        start = int(self.header["index_offset"])
+        self.index = self._map[start:start+32*self.ncands].view(self._index_dtype)
+
+    def __getitem__(self, name):
+        return self.columns[name]
+
+    def get_fold(self, idx):
+        entry = self.index[idx]
+        if entry["nbins"] == 0:
+            return None
+        start = int(self.header["fold_offset"]+entry["fold_offset"])
+        size = int(entry["nbins"]*entry["nints"])
+        return self._map[start:start+4*size].view("float32").reshape(entry["nints"],entry["nbins"])
+
+    def get_hits(self, idx):
+        entry = self.index[idx]
+        start = int(self.header["detections_offset"]+24*entry["first_detection"])
+        return self._map[start:start+24*int(entry["ndetections"])].view(CandidateFileParser._dtype)
+
+
 class OverviewFile(object):
     _ar_dtype = [('period','float32'),
                  ('dm','float32'),